@@ -45,6 +45,27 @@
  */
 #define COMMIT_SHA_LENGTH 5
 
+/**
+ * Maximum number of commands the host may send without waiting for replies.
+ *
+ * The device buffers this many replies.  Commands may be packed back to back
+ * in the host's writes; once the device's reply buffer is full it stops
+ * accepting data until the host has read some replies.  Replies are sent in
+ * the order the commands were received.
+ *
+ * This only applies to devices which report \ref BL_MSG_CAP_PIPELINE in
+ * their \ref BL_MSG_VERSION message.  Older firmware decodes one message
+ * per USB packet, so the host must wait for each reply before sending the
+ * next command.
+ */
+#define BL_MSG_PIPELINE_MAX 16
+
+/** Device capability flags, reported in \ref BL_MSG_VERSION. */
+enum bl_msg_capability {
+	/** Device accepts pipelined commands.  See \ref BL_MSG_PIPELINE_MAX. */
+	BL_MSG_CAP_PIPELINE = (1 << 0),
+};
+
 /** Message type. */
 enum bl_msg_type {
 	BL_MSG_RESPONSE,       /**< Response message. */
@@ -173,6 +194,8 @@ typedef struct {
 typedef struct {
 	uint8_t type;                           /**< Must be \ref BL_MSG_VERSION */
 	uint8_t revision;                       /**< The REVISION bloodlight was built with */
+	uint8_t capabilities;                   /**< See \ref bl_msg_capability; zero from older firmware */
+	uint8_t reserved;
 	uint32_t commit_sha[COMMIT_SHA_LENGTH]; /**< The sha of the commit the device was built with */
 } bl_msg_version_t;
 
@@ -111,6 +111,8 @@ static enum bl_error bl_msg_version(
 
 	response->version.type = BL_MSG_VERSION;
 	response->version.revision = BL_REVISION;
+	response->version.capabilities = BL_MSG_CAP_PIPELINE;
+	response->version.reserved = 0;
 	for (unsigned i = 0; i < COMMIT_SHA_LENGTH; i++) {
 		response->version.commit_sha[i] = 0;
 		/* Convert 8-character hex string into uint32 */
@@ -221,37 +221,107 @@ static enum usbd_request_return_codes bl_usb__cdcacm_control_request(
 	return USBD_REQ_NOTSUPP;
 }
 
-static bool usb_response_used;
-static union bl_msg_data usb_response;
+/** Replies awaiting transmission to the host, oldest first. */
+static struct {
+	union bl_msg_data msg[BL_MSG_PIPELINE_MAX];
+	unsigned next;  /**< Index of the oldest reply. */
+	unsigned count; /**< Number of replies queued. */
+} usb_response;
+
+/** Data received from the host which has not been handled yet. */
+static struct {
+	uint8_t buf[BL_USB_BUF_LEN * 2];
+	uint16_t len;   /**< Number of bytes in buf. */
+	bool nak;       /**< Whether the host is being held off. */
+} usb_rx;
 
-static void bl_usb__cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep)
+/**
+ * Handle as many complete received messages as there is reply space for.
+ *
+ * Any partial message at the end of the buffer is kept for the next packet.
+ */
+static void bl_usb__rx_process(void)
 {
-	static uint8_t buf[BL_USB_BUF_LEN];
-	union bl_msg_data *msg;
-	enum bl_error error;
-	uint16_t len;
+	uint16_t pos = 0;
+
+	while (pos < usb_rx.len && usb_response.count < BL_MSG_PIPELINE_MAX) {
+		union bl_msg_data *response;
+		union bl_msg_data msg;
+		uint8_t len;
+
+		response = &usb_response.msg[(usb_response.next +
+				usb_response.count) % BL_MSG_PIPELINE_MAX];
+
+		len = bl_msg_type_to_len(usb_rx.buf[pos]);
+		if (len == 0) {
+			/* Can't find the next message boundary; drop it all. */
+			response->response.type        = BL_MSG_RESPONSE;
+			response->response.response_to = usb_rx.buf[pos];
+			response->response.error_code  = BL_ERROR_BAD_MESSAGE_LENGTH;
+			usb_response.count++;
+			pos = usb_rx.len;
+			break;
+		}
+
+		if (usb_rx.len - pos < len) {
+			break;
+		}
+
+		/* Messages in the buffer may be unaligned. */
+		for (unsigned i = 0; i < len; i++) {
+			((uint8_t *)&msg)[i] = usb_rx.buf[pos + i];
+		}
+		pos += len;
 
-	len = usbd_ep_read_packet(usbd_dev, ep, buf, sizeof(buf));
-	if (len == 0) {
-		return;
+		if (bl_msg_handle(&msg, response)) {
+			usb_response.count++;
+		}
 	}
 
-	msg = bl_msg_decode(buf, len);
-	if (msg == NULL) {
-		usb_response.response.type        = BL_MSG_RESPONSE;
-		usb_response.response.response_to = bl_msg_get_type(buf);
-		usb_response.response.error_code  = BL_ERROR_BAD_MESSAGE_LENGTH;
-		usb_response_used = true;
-		return;
+	usb_rx.len -= pos;
+	for (unsigned i = 0; i < usb_rx.len; i++) {
+		usb_rx.buf[i] = usb_rx.buf[pos + i];
 	}
+}
 
-	usb_response_used = bl_msg_handle(msg, &usb_response);
+/**
+ * Only let the host send another packet if there is space to receive it.
+ *
+ * \param[in]  usbd_dev  The USB device.
+ */
+static void bl_usb__rx_flow_control(usbd_device *usbd_dev)
+{
+	bool nak = (sizeof(usb_rx.buf) - usb_rx.len) < BL_USB_BUF_LEN;
+
+	if (nak != usb_rx.nak) {
+		usbd_ep_nak_set(usbd_dev, 0x01, nak);
+		usb_rx.nak = nak;
+	}
+}
+
+static void bl_usb__cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep)
+{
+	uint16_t len;
+
+	/* Hold off the host until we know there's space for another packet. */
+	usbd_ep_nak_set(usbd_dev, ep, 1);
+	usb_rx.nak = true;
+
+	len = usbd_ep_read_packet(usbd_dev, ep,
+			usb_rx.buf + usb_rx.len, BL_USB_BUF_LEN);
+	usb_rx.len += len;
+
+	bl_usb__rx_process();
+	bl_usb__rx_flow_control(usbd_dev);
 }
 
 static void bl_usb__cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue)
 {
 	BL_UNUSED(wValue);
 
+	usb_rx.len = 0;
+	usb_rx.nak = false;
+
 	usbd_ep_setup(usbd_dev, 0x01, USB_ENDPOINT_ATTR_BULK,
 			BL_USB_BUF_LEN, bl_usb__cdcacm_data_rx_cb);
 	usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK,
@@ -342,9 +412,16 @@ void bl_usb_poll(void)
 		if (msg && bl_usb__send_message(msg)) {
 			bl_mq_release(channel);
 		}
-	} else if (usb_response_used) {
-		if (bl_usb__send_message((union bl_msg_data *)&usb_response)) {
-			usb_response_used = false;
+	} else if (usb_response.count != 0) {
+		union bl_msg_data *msg = &usb_response.msg[usb_response.next];
+		if (bl_usb__send_message(msg)) {
+			usb_response.next = (usb_response.next + 1) %
+					BL_MSG_PIPELINE_MAX;
+			usb_response.count--;
+
+			/* Handle anything held back by a full reply queue. */
+			bl_usb__rx_process();
+			bl_usb__rx_flow_control(usb_g.handle);
 		}
 	}
 
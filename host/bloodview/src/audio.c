@@ -0,0 +1,442 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the audio monitoring module.
+ *
+ * The device thread is the only producer, and the SDL audio callback is
+ * the only consumer, so the ring buffer needs no lock; each side owns one
+ * index and only reads the other's.
+ *
+ * DC removal and gain are applied by the producer.  The consumer does the
+ * resampling, with linear interpolation, and owns all the state for the
+ * latency control.  Latency is bounded: if the ring buffer fills beyond
+ * twice the target latency, the consumer skips back to the target.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include <SDL2/SDL.h>
+
+#include "util.h"
+#include "audio.h"
+#include "main-menu.h"
+
+/** Sound card rate to use when the sampling rate isn't playable. */
+#define AUDIO_RATE_DEFAULT 48000
+
+/** Lowest sampling rate that is played at the sampling rate. */
+#define AUDIO_RATE_MIN 8000
+
+/** Highest sampling rate that is played at the sampling rate. */
+#define AUDIO_RATE_MAX 96000
+
+/** Cut-off frequency of the DC removal filter, in Hz. */
+#define AUDIO_DC_CUTOFF 10.0
+
+/** Largest resampling ratio trim, as a fraction of the nominal ratio. */
+#define AUDIO_TRIM_MAX 0.005
+
+/**
+ * Bandwidth of the resampling ratio trim control loop, in rad/s.
+ *
+ * The clock mismatch barely changes, so this is slow, to keep the trim
+ * steady against the burstiness of sample arrival.
+ */
+#define AUDIO_TRIM_BANDWIDTH 0.1
+
+/** Time constant of the ring buffer fill smoothing, in seconds. */
+#define AUDIO_FILL_SMOOTH 1.0
+
+/** Audio monitoring module global context. */
+static struct audio_ctx {
+	bool enabled;          /**< Whether monitoring is running. */
+	unsigned idx;          /**< Index of graph being monitored. */
+	SDL_AudioDeviceID dev; /**< SDL audio device, or 0. */
+
+	unsigned rate_in;  /**< Acquisition sampling rate in Hz. */
+	unsigned rate_out; /**< Sound card sampling rate in Hz. */
+	unsigned period;   /**< Sound card buffer length in samples. */
+	uint64_t target;   /**< Target ring buffer fill in samples. */
+
+	float *ring;            /**< Ring buffer of samples to play. */
+	uint64_t mask;          /**< Ring buffer index mask. */
+	_Atomic uint64_t head;  /**< Producer's write index. */
+	_Atomic uint64_t tail;  /**< Consumer's read index. */
+
+	/** Producer state, only touched by the device thread. */
+	struct {
+		float gain;     /**< Linear gain. */
+		float dc_coeff; /**< DC removal filter pole. */
+		float dc_in;    /**< Previous DC removal filter input. */
+		float dc_out;   /**< Previous DC removal filter output. */
+		uint64_t overruns; /**< Samples dropped for a full buffer. */
+	} prod;
+
+	/** Consumer state, only touched by the audio callback. */
+	struct {
+		bool primed;     /**< Whether the target fill was reached. */
+		double frac;     /**< Interpolation position after tail. */
+		double ratio;    /**< Nominal resampling step. */
+		double dt;       /**< Time between callbacks, in seconds. */
+		double fill;     /**< Smoothed ring buffer fill. */
+		double integral; /**< Integral term of ratio trim. */
+		double trim;     /**< Current ratio trim. */
+		uint64_t underruns; /**< Number of underruns. */
+		uint64_t skips;     /**< Number of latency limit skips. */
+
+		double lat_min;   /**< Minimum latency in seconds. */
+		double lat_max;   /**< Maximum latency in seconds. */
+		double lat_sum;   /**< Sum of latencies in seconds. */
+		uint64_t lat_count; /**< Number of latency measurements. */
+	} cons;
+} audio_g;
+
+/**
+ * Record a latency measurement.
+ *
+ * The latency of the next sample to be played is the time to play
+ * the ring buffer contents, plus the time to play the sound card's buffer.
+ *
+ * \param[in]  fill  Current ring buffer fill, in samples.
+ */
+static void audio__latency_update(uint64_t fill)
+{
+	double latency = (double) fill / audio_g.rate_in +
+			(double) audio_g.period / audio_g.rate_out;
+
+	if (audio_g.cons.lat_count == 0 || latency < audio_g.cons.lat_min) {
+		audio_g.cons.lat_min = latency;
+	}
+	if (audio_g.cons.lat_count == 0 || latency > audio_g.cons.lat_max) {
+		audio_g.cons.lat_max = latency;
+	}
+	audio_g.cons.lat_sum += latency;
+	audio_g.cons.lat_count++;
+}
+
+/**
+ * Update the resampling ratio trim from the ring buffer fill.
+ *
+ * Samples arrive in bursts, one message at a time, so the fill is
+ * smoothed before it is compared with the target.  A fill above target
+ * means the device clock is fast relative to the sound card, so samples
+ * are consumed slightly faster, and vice versa.
+ *
+ * With the error in seconds of latency, the loop is a critically damped
+ * second order system, with the same response at any sampling rate.
+ *
+ * \param[in]  fill  Current ring buffer fill, in samples.
+ */
+static void audio__trim_update(uint64_t fill)
+{
+	const double w = AUDIO_TRIM_BANDWIDTH;
+	double alpha = audio_g.cons.dt / AUDIO_FILL_SMOOTH;
+	double error;
+	double trim;
+
+	if (alpha > 1) {
+		alpha = 1;
+	}
+
+	audio_g.cons.fill += (fill - audio_g.cons.fill) * alpha;
+	error = (audio_g.cons.fill - audio_g.target) / audio_g.rate_in;
+
+	audio_g.cons.integral += error * w * w * audio_g.cons.dt;
+	if (audio_g.cons.integral > AUDIO_TRIM_MAX) {
+		audio_g.cons.integral = AUDIO_TRIM_MAX;
+	} else if (audio_g.cons.integral < -AUDIO_TRIM_MAX) {
+		audio_g.cons.integral = -AUDIO_TRIM_MAX;
+	}
+
+	trim = error * 2 * w + audio_g.cons.integral;
+	if (trim > AUDIO_TRIM_MAX) {
+		trim = AUDIO_TRIM_MAX;
+	} else if (trim < -AUDIO_TRIM_MAX) {
+		trim = -AUDIO_TRIM_MAX;
+	}
+
+	audio_g.cons.trim = trim;
+}
+
+/**
+ * SDL audio callback.
+ *
+ * Called on SDL's audio thread when the sound card needs more data.
+ *
+ * \param[in]  pw      Client private data.
+ * \param[in]  stream  Buffer to fill with float samples.
+ * \param[in]  len     Length of stream in bytes.
+ */
+static void audio__callback(void *pw, Uint8 *stream, int len)
+{
+	float *out = (float *) stream;
+	unsigned count = len / sizeof(*out);
+	uint64_t tail = atomic_load_explicit(&audio_g.tail,
+			memory_order_relaxed);
+	uint64_t head = atomic_load_explicit(&audio_g.head,
+			memory_order_acquire);
+	unsigned i = 0;
+	double step;
+
+	BV_UNUSED(pw);
+
+	if (!audio_g.cons.primed) {
+		if (head - tail < audio_g.target) {
+			goto silence;
+		}
+		/* Start from the target, rather than whatever arrived
+		 * since the last callback. */
+		tail = head - audio_g.target;
+		audio_g.cons.primed = true;
+		audio_g.cons.fill = audio_g.target;
+		audio_g.cons.frac = 0;
+	}
+
+	if (head - tail > audio_g.target * 2) {
+		tail = head - audio_g.target;
+		audio_g.cons.fill = audio_g.target;
+		audio_g.cons.skips++;
+	}
+
+	audio__latency_update(head - tail);
+	audio__trim_update(head - tail);
+	step = audio_g.cons.ratio * (1 + audio_g.cons.trim);
+
+	for (; i < count; i++) {
+		float a, b;
+
+		if (tail + 1 >= head) {
+			if (tail > head) {
+				tail = head;
+			}
+			audio_g.cons.primed = false;
+			audio_g.cons.underruns++;
+			break;
+		}
+
+		a = audio_g.ring[tail & audio_g.mask];
+		b = audio_g.ring[(tail + 1) & audio_g.mask];
+		out[i] = a + (b - a) * (float) audio_g.cons.frac;
+
+		audio_g.cons.frac += step;
+		while (audio_g.cons.frac >= 1) {
+			audio_g.cons.frac -= 1;
+			tail++;
+		}
+	}
+
+	atomic_store_explicit(&audio_g.tail, tail, memory_order_release);
+
+silence:
+	for (; i < count; i++) {
+		out[i] = 0;
+	}
+}
+
+/**
+ * Get the smallest power of two that is at least a given value.
+ *
+ * \param[in]  value  The value to round up.
+ * \return the rounded up value.
+ */
+static uint64_t audio__pow2(uint64_t value)
+{
+	uint64_t ret = 1;
+
+	while (ret < value) {
+		ret <<= 1;
+	}
+
+	return ret;
+}
+
+/* Exported interface, documented in audio.h */
+bool audio_start(unsigned frequency)
+{
+	SDL_AudioSpec want = { 0 };
+	SDL_AudioSpec have;
+	unsigned latency;
+	uint64_t size;
+
+	if (!main_menu_config_get_audio_enabled()) {
+		return true;
+	}
+
+	latency = main_menu_config_get_audio_latency();
+	if (latency == 0 || frequency == 0) {
+		fprintf(stderr, "Error: Audio: Bad latency\n");
+		return false;
+	}
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		fprintf(stderr, "Error: Audio: SDL_InitSubSystem: %s\n",
+				SDL_GetError());
+		return false;
+	}
+
+	want.freq = (frequency >= AUDIO_RATE_MIN &&
+	             frequency <= AUDIO_RATE_MAX) ?
+			(int) frequency : AUDIO_RATE_DEFAULT;
+	want.format = AUDIO_F32SYS;
+	want.channels = 1;
+	want.callback = audio__callback;
+
+	/* Keep the sound card's buffer well inside the latency. */
+	want.samples = audio__pow2((uint64_t) want.freq *
+			latency / 4000 + 1) / 2;
+	if (want.samples < 64) {
+		want.samples = 64;
+	} else if (want.samples > 4096) {
+		want.samples = 4096;
+	}
+
+	memset(&audio_g, 0, sizeof(audio_g));
+	audio_g.idx = main_menu_config_get_audio_graph();
+	audio_g.rate_in = frequency;
+
+	audio_g.dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+			SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+			SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+	if (audio_g.dev == 0) {
+		fprintf(stderr, "Error: Audio: SDL_OpenAudioDevice: %s\n",
+				SDL_GetError());
+		goto error;
+	}
+
+	audio_g.rate_out = have.freq;
+	audio_g.period = have.samples;
+	audio_g.cons.ratio = (double) audio_g.rate_in / audio_g.rate_out;
+	audio_g.cons.dt = (double) audio_g.period / audio_g.rate_out;
+
+	/* The sound card's buffer is part of the latency, so the ring
+	 * buffer is held at what remains. */
+	audio_g.target = (uint64_t) frequency * latency / 1000;
+	if (audio_g.target > audio_g.period * audio_g.cons.ratio * 3) {
+		audio_g.target -= audio_g.period * audio_g.cons.ratio;
+	} else {
+		audio_g.target = audio_g.period * audio_g.cons.ratio * 2;
+	}
+	if (audio_g.target < 2) {
+		audio_g.target = 2;
+	}
+
+	/* Room for the latency limit, plus a burst of samples. */
+	size = audio__pow2(audio_g.target * 4);
+	audio_g.mask = size - 1;
+	audio_g.ring = calloc(size, sizeof(*audio_g.ring));
+	if (audio_g.ring == NULL) {
+		fprintf(stderr, "Error: Audio: Failed to allocate buffer\n");
+		goto error;
+	}
+
+	audio_g.prod.gain = pow(10, main_menu_config_get_audio_gain() / 20);
+	audio_g.prod.dc_coeff = exp(-2 * M_PI * AUDIO_DC_CUTOFF / frequency);
+	audio_g.enabled = true;
+
+	SDL_PauseAudioDevice(audio_g.dev, 0);
+	return true;
+
+error:
+	if (audio_g.dev != 0) {
+		SDL_CloseAudioDevice(audio_g.dev);
+		audio_g.dev = 0;
+	}
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	return false;
+}
+
+/* Exported interface, documented in audio.h */
+void audio_finish(void)
+{
+	if (audio_g.dev == 0) {
+		return;
+	}
+
+	audio_g.enabled = false;
+
+	/* Once closed, the callback is no longer running, so its state
+	 * can be read here. */
+	SDL_CloseAudioDevice(audio_g.dev);
+	audio_g.dev = 0;
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+
+	if (audio_g.cons.lat_count != 0) {
+		fprintf(stderr, "Audio: Latency: "
+				"min: %.1f ms, mean: %.1f ms, max: %.1f ms\n",
+				audio_g.cons.lat_min * 1000,
+				audio_g.cons.lat_sum * 1000 /
+						audio_g.cons.lat_count,
+				audio_g.cons.lat_max * 1000);
+	}
+	fprintf(stderr, "Audio: Underruns: %"PRIu64", "
+			"Overruns: %"PRIu64", Skips: %"PRIu64", "
+			"Clock trim: %+.0f ppm\n",
+			audio_g.cons.underruns,
+			audio_g.prod.overruns,
+			audio_g.cons.skips,
+			audio_g.cons.trim * 1000000);
+
+	free(audio_g.ring);
+	audio_g.ring = NULL;
+}
+
+/* Exported interface, documented in audio.h */
+bool audio_is_monitored(unsigned idx)
+{
+	return audio_g.enabled && idx == audio_g.idx;
+}
+
+/* Exported interface, documented in audio.h */
+void audio_data_add(unsigned idx, int32_t value)
+{
+	uint64_t head, tail;
+	float x, y;
+
+	if (!audio_g.enabled || idx != audio_g.idx) {
+		return;
+	}
+
+	/* One pole DC removal filter, then gain, with hard clipping. */
+	x = value / 2147483648.0f;
+	y = x - audio_g.prod.dc_in + audio_g.prod.dc_coeff *
+			audio_g.prod.dc_out;
+	audio_g.prod.dc_in = x;
+	audio_g.prod.dc_out = y;
+
+	y *= audio_g.prod.gain;
+	if (y > 1) {
+		y = 1;
+	} else if (y < -1) {
+		y = -1;
+	}
+
+	head = atomic_load_explicit(&audio_g.head, memory_order_relaxed);
+	tail = atomic_load_explicit(&audio_g.tail, memory_order_acquire);
+	if (head - tail > audio_g.mask) {
+		audio_g.prod.overruns++;
+		return;
+	}
+
+	audio_g.ring[head & audio_g.mask] = y;
+	atomic_store_explicit(&audio_g.head, head + 1, memory_order_release);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the audio monitoring module.
+ *
+ * This plays one graph's data through the host's sound output while an
+ * acquisition is running, so the signal can be listened to.
+ *
+ * Samples are handed from the device thread to the SDL audio callback
+ * through a lock-free ring buffer.  The device's sample clock and the
+ * sound card's clock are independent, so the callback resamples with a
+ * ratio that is continuously trimmed to hold the ring buffer at the
+ * configured latency.
+ */
+
+#ifndef BV_AUDIO_H
+#define BV_AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Start audio monitoring for an acquisition.
+ *
+ * Does nothing if audio monitoring is not enabled in the config.
+ *
+ * \param[in]  frequency  The acquisition's sampling rate in Hz.
+ * \return true on success or false on failure.
+ */
+bool audio_start(unsigned frequency);
+
+/**
+ * Stop audio monitoring, and report the latency seen.
+ */
+void audio_finish(void);
+
+/**
+ * Get whether a graph is being monitored.
+ *
+ * Must be called from the device thread.
+ *
+ * \param[in]  idx  Index of the graph to check.
+ * \return true if the graph's samples are played, false otherwise.
+ */
+bool audio_is_monitored(unsigned idx);
+
+/**
+ * Add a graph's sample to the audio output.
+ *
+ * Must be called from the device thread, with the same values as given
+ * to the graph.  Samples for graphs other than the one being monitored
+ * are ignored.
+ *
+ * \param[in]  idx    Index of the graph the sample is for.
+ * \param[in]  value  The sample value.
+ */
+void audio_data_add(unsigned idx, int32_t value);
+
+#endif /* BV_AUDIO_H */
@@ -21,20 +21,37 @@
  * This provides the main entry point from the OS, and high level functionality.
  */
 
+#include <time.h>
+#include <stdio.h>
 #include <assert.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
 #include <getopt.h>
+#include <pthread.h>
+
+#include "common/msg.h"
 
 #include "dpp/dpp.h"
 
 #include "sdl.h"
+#include "data.h"
 #include "util.h"
+#include "browse.h"
 #include "device.h"
+#include "quality.h"
 #include "main-menu.h"
 
+/** Default interval between statistics reports when headless, in seconds. */
+#define BV_STATS_INTERVAL_DEFAULT 10
+
+/** Time to wait for an acquisition to stop when restarting, in seconds. */
+#define BV_RESTART_TIMEOUT 5
+
 /** Bloodview global context data. */
 static struct {
 	volatile bool quit;
@@ -107,9 +124,13 @@ struct bv_options {
 	const char *path_config;    /**< Directory where configs are stored. */
 	const char *file_config;    /**< Config filename to load on startup. */
 	const char *path_font;      /**< Path to font file to use. */
+	const char *path_browse;    /**< Recording to browse, or NULL. */
 
 	bool config_previous; /**< "Previous" config file. (Saved on exit.) */
 	bool config_default;  /**< Default config file for the revision. */
+
+	bool headless;           /**< Whether to run without a display. */
+	unsigned stats_interval; /**< Seconds between statistics reports. */
 };
 
 /**
@@ -128,6 +149,7 @@ static bool bloodview__parse_cli(
 	struct bv_options opt = {
 		.path_resources = "resources",
 		.path_config    = "config",
+		.stats_interval = BV_STATS_INTERVAL_DEFAULT,
 	};
 	enum options {
 		BV_OPTION_PATH_RESOURCES_DIR = 'R',
@@ -137,9 +159,12 @@ static bool bloodview__parse_cli(
 		BV_OPTION_CONFIG_DEFAULT     = 'd',
 		BV_OPTION_FILE_CONFIG        = 'c',
 		BV_OPTION_PATH_FONT          = 'f',
+		BV_OPTION_PATH_BROWSE        = 'b',
+		BV_OPTION_HEADLESS           = 'H',
+		BV_OPTION_STATS_INTERVAL     = 'S',
 
 	};
-	static const char optstr[] = "R:C:pdc:f:D:";
+	static const char optstr[] = "R:C:pdc:f:D:b:HS:";
 	static struct option options[] = {
 		{
 			.val = BV_OPTION_PATH_RESOURCES_DIR,
@@ -176,6 +201,21 @@ static bool bloodview__parse_cli(
 			.name = "font",
 			.has_arg = required_argument,
 		},
+		{
+			.val = BV_OPTION_PATH_BROWSE,
+			.name = "browse",
+			.has_arg = required_argument,
+		},
+		{
+			.val = BV_OPTION_HEADLESS,
+			.name = "headless",
+			.has_arg = no_argument,
+		},
+		{
+			.val = BV_OPTION_STATS_INTERVAL,
+			.name = "stats-interval",
+			.has_arg = required_argument,
+		},
 		{
 			.name = NULL,
 		},
@@ -222,18 +262,245 @@ static bool bloodview__parse_cli(
 		case BV_OPTION_PATH_FONT:
 			opt.path_font = optarg;
 			break;
+
+		case BV_OPTION_PATH_BROWSE:
+			opt.path_browse = optarg;
+			break;
+
+		case BV_OPTION_HEADLESS:
+			opt.headless = true;
+			break;
+
+		case BV_OPTION_STATS_INTERVAL:
+			if (!util_read_unsigned(optarg, &opt.stats_interval)) {
+				fprintf(stderr, "%s: Bad stats interval: %s\n",
+						argv[0], optarg);
+				return false;
+			}
+			break;
 		}
 	}
 	if (optind != argc) {
 		fprintf(stderr, "%s: Unexpected arguments\n", argv[0]);
 		return false;
 	}
+	if (opt.headless && opt.path_browse != NULL) {
+		fprintf(stderr, "%s: Can't browse when headless\n", argv[0]);
+		return false;
+	}
 
 	*options_out = opt;
 
 	return true;
 }
 
+/**
+ * Report the time taken by a startup phase.
+ *
+ * \param[in]      phase  Name of the phase that has completed.
+ * \param[in,out]  time   Time the phase started, updated to the current time.
+ */
+static void bloodview__startup_phase(
+		const char *phase,
+		struct timespec *time)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		return;
+	}
+
+	fprintf(stderr, "Startup: %s: %"PRId64" ms\n", phase,
+			util_time_diff_ms(time, &now));
+	*time = now;
+}
+
+/**
+ * Get the startup config file name, if any.
+ *
+ * This doesn't handle the revision default config, which has to wait for
+ * the device.
+ *
+ * \param[in]  options  Command line options.
+ * \return config file name, or NULL.
+ */
+static const char *bloodview__config_file(
+		const struct bv_options *options)
+{
+	if (options->file_config != NULL) {
+		return options->file_config;
+	}
+
+	if (options->config_previous) {
+		return "previous.yaml";
+	}
+
+	return NULL;
+}
+
+/**
+ * Load the default config file for the device revision.
+ *
+ * The device handshake happens on the device thread while the interface is
+ * created, so the revision is usually known by the time this is called.
+ * Failure isn't fatal, since the interface is already up with the built-in
+ * settings.
+ */
+static void bloodview__load_config_default(void)
+{
+	char s[64];
+	int ret;
+
+	if (!device_await_revision()) {
+		fprintf(stderr, "Warning: Revision unknown; "
+				"not loading default config.\n");
+		return;
+	}
+
+	ret = snprintf(s, sizeof(s), "rev%u-default.yaml",
+			device_get_revision());
+	if (ret < 0 || (unsigned)ret >= sizeof(s)) {
+		return;
+	}
+
+	if (!main_menu_load_config(s)) {
+		fprintf(stderr, "Warning: Continuing with built-in config.\n");
+	}
+}
+
+/**
+ * Get the signals which control Bloodview when headless.
+ *
+ * \param[out] set  Returns the signal set.
+ */
+static void bloodview__headless_signals(sigset_t *set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGINT);
+	sigaddset(set, SIGTERM);
+	sigaddset(set, SIGHUP);
+	sigaddset(set, SIGUSR1);
+}
+
+/**
+ * Print the live statistics for each channel of the acquisition.
+ */
+static void bloodview__print_stats(void)
+{
+	for (unsigned i = 0; i < sizeof(unsigned) * CHAR_BIT; i++) {
+		struct data_clip_stats clip;
+		struct quality_stats quality;
+
+		if (!data_get_clip_stats(i, &clip)) {
+			continue;
+		}
+
+		fprintf(stderr, "Stats: Channel %u: %"PRIu64" samples, "
+				"%"PRIu64" high, %"PRIu64" low",
+				i, clip.samples, clip.high, clip.low);
+		if (quality_get(i, &quality)) {
+			fprintf(stderr, ", quality %.0f%% (mean %.0f%%), "
+					"%.0f bpm", quality.quality,
+					quality.mean, quality.rate);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+/**
+ * Stop the acquisition, reload the config, and start a new acquisition.
+ *
+ * The new acquisition goes to a new recording.
+ *
+ * \param[in]  options  Command line options.
+ */
+static void bloodview__headless_restart(
+		const struct bv_options *options)
+{
+	const char *config_file = bloodview__config_file(options);
+	struct timespec wait = { .tv_nsec = 10 * 1000 * 1000 };
+	unsigned waited = 0;
+
+	fprintf(stderr, "Restarting acquisition.\n");
+
+	device_stop();
+	while (bloodview_g.device_state == DEVICE_STATE_ACTIVE &&
+			waited++ < BV_RESTART_TIMEOUT * 100) {
+		nanosleep(&wait, NULL);
+	}
+
+	if (config_file != NULL) {
+		if (!main_menu_load_config(config_file)) {
+			fprintf(stderr, "Warning: Keeping previous config.\n");
+		}
+	} else if (options->config_default) {
+		bloodview__load_config_default();
+	}
+	main_menu_update();
+
+	if (!device_acquisition_start()) {
+		fprintf(stderr, "Error: Failed to start acquisition.\n");
+	}
+}
+
+/**
+ * Run an acquisition without a display, until told to quit.
+ *
+ * The acquisition is controlled by signals, which must be blocked in all
+ * threads: SIGINT and SIGTERM stop it and quit, SIGHUP restarts it with
+ * the config reloaded, and SIGUSR1 prints the live statistics.  They are
+ * also printed every stats interval, unless that is zero.
+ *
+ * \param[in]  options  Command line options.
+ * \return true on success, false on failure.
+ */
+static bool bloodview__run_headless(
+		const struct bv_options *options)
+{
+	struct timespec wait = { .tv_sec = 1 };
+	unsigned elapsed = 0;
+	sigset_t set;
+
+	bloodview__headless_signals(&set);
+
+	if (!device_acquisition_start()) {
+		fprintf(stderr, "Error: Failed to start acquisition.\n");
+		return false;
+	}
+
+	while (!bloodview_g.quit) {
+		int sig = sigtimedwait(&set, NULL, &wait);
+
+		/* Apply any config changes from the other threads. */
+		main_menu_update();
+
+		switch (sig) {
+		case SIGINT:
+		case SIGTERM:
+			return true;
+
+		case SIGHUP:
+			bloodview__headless_restart(options);
+			elapsed = 0;
+			break;
+
+		case SIGUSR1:
+			bloodview__print_stats();
+			break;
+
+		default:
+			if (options->stats_interval != 0 &&
+			    ++elapsed >= options->stats_interval) {
+				bloodview__print_stats();
+				elapsed = 0;
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
 /**
  * Main entry point from OS.
  *
@@ -244,54 +511,92 @@ static bool bloodview__parse_cli(
 int main(int argc, char *argv[])
 {
 	struct bv_options options;
+	struct timespec time_start;
+	struct timespec time_phase;
 	int ret = EXIT_FAILURE;
 
 	if (bloodview__parse_cli(argc, argv, &options) == false) {
 		return EXIT_FAILURE;
 	}
 
-	if (!dpp_init(options.path_resources)) {
-		return EXIT_FAILURE;
+	clock_gettime(CLOCK_MONOTONIC, &time_start);
+	time_phase = time_start;
+
+	/* Block the control signals before any threads are made, so they
+	 * all inherit the mask, and the signals can be waited for. */
+	if (options.headless) {
+		sigset_t set;
+
+		bloodview__headless_signals(&set);
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
 	}
 
-	if (!device_init(options.path_device,
-			bloodview_device_state_change_cb, NULL)) {
-		dpp_fini();
+	if (!dpp_init(options.path_resources)) {
 		return EXIT_FAILURE;
 	}
-
-	if (options.file_config == NULL) {
-		if (options.config_default) {
-			static char s[64];
-			int ret = snprintf(s, sizeof(s), "rev%u-default.yaml",
-					device_get_revision());
-			if (ret > 0 || (unsigned)ret < sizeof(s)) {
-				options.file_config = s;
-			}
-		}
-		if (options.config_previous) {
-			options.file_config = "previous.yaml";
+	bloodview__startup_phase("dpp", &time_phase);
+
+	/* This only starts the device handshake; it completes on the
+	 * device thread while the interface is created.  No device is
+	 * needed to browse a recording. */
+	if (options.path_browse == NULL) {
+		if (!device_init(options.path_device,
+				bloodview_device_state_change_cb, NULL)) {
+			dpp_fini();
+			return EXIT_FAILURE;
 		}
+		bloodview__startup_phase("device", &time_phase);
 	}
 
 	if (!sdl_init(options.path_resources,
 			options.path_config,
-			options.file_config,
-			options.path_font)) {
+			bloodview__config_file(&options),
+			options.path_font,
+			options.headless)) {
 		device_fini();
 		dpp_fini();
 		return EXIT_FAILURE;
 	}
+	bloodview__startup_phase("interface", &time_phase);
+
+	/* The default config depends on the device revision, so its
+	 * selection is deferred until the interface is up. */
+	if (bloodview__config_file(&options) == NULL &&
+			options.config_default &&
+			options.path_browse == NULL) {
+		bloodview__load_config_default();
+		bloodview__startup_phase("config", &time_phase);
+	}
 
-	bloodview_g.started = true;
-	main_menu_set_acq_available(
-			bloodview_g.device_state != DEVICE_STATE_ACTIVE);
+	if (options.path_browse != NULL) {
+		if (!browse_open(options.path_browse)) {
+			sdl_fini();
+			dpp_fini();
+			return EXIT_FAILURE;
+		}
+		bloodview__startup_phase("browse", &time_phase);
+	}
+	bloodview__startup_phase("total", &time_start);
 
-	while (!bloodview_g.quit && sdl_handle_input()) {
-		sdl_present();
+	bloodview_g.started = true;
+	if (options.path_browse != NULL) {
+		main_menu_set_acq_available(false);
+		sdl_main_menu_close();
+	} else {
+		main_menu_set_acq_available(
+				bloodview_g.device_state != DEVICE_STATE_ACTIVE);
 	}
 
-	ret = EXIT_SUCCESS;
+	if (options.headless) {
+		if (bloodview__run_headless(&options)) {
+			ret = EXIT_SUCCESS;
+		}
+	} else {
+		while (!bloodview_g.quit && sdl_handle_input()) {
+			sdl_present();
+		}
+		ret = EXIT_SUCCESS;
+	}
 
 	device_fini();
 	sdl_fini();
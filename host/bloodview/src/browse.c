@@ -0,0 +1,612 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the recording browser module.
+ *
+ * Each channel is drawn in its own row, scaled to fit the visible range
+ * of its values.  When there are fewer than \ref OVERVIEW_FANOUT samples
+ * per pixel, the samples are read from the recording and joined up.
+ * Otherwise, each pixel column is drawn as a line from the minimum to the
+ * maximum sample value it covers, from the overview, so the cost of a
+ * frame depends on the window width rather than the zoom level.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/channel.h"
+
+#include "sdl-tk/text.h"
+
+#include "util.h"
+#include "browse.h"
+#include "overview.h"
+#include "main-menu.h"
+
+/** Most pixels a sample is drawn across, at the deepest zoom. */
+#define BROWSE_SAMPLE_WIDTH_MAX 32
+
+/** Zoom factor for each mouse wheel or key step. */
+#define BROWSE_ZOOM_STEP 1.25
+
+/** Fraction of the view that is panned for each key step. */
+#define BROWSE_PAN_STEP 0.125
+
+/** Pixels per sample from which samples are marked. */
+#define BROWSE_MARK_WIDTH 8
+
+/** Minimum and maximum sample values covered by a pixel column. */
+struct browse_column {
+	uint32_t min; /**< Minimum sample value. */
+	uint32_t max; /**< Maximum sample value. */
+	bool valid;   /**< Whether the column covers any samples. */
+};
+
+/** Per-channel browser state. */
+struct browse_channel {
+	unsigned channel;          /**< Acquisition channel. */
+	struct sdl_tk_text *label; /**< The channel name. */
+
+	uint32_t *raw;      /**< Samples read from the recording. */
+	uint64_t raw_start; /**< First sample in raw. */
+	unsigned raw_count; /**< Number of samples in raw. */
+	unsigned raw_alloc; /**< Allocated length of raw. */
+};
+
+/** Recording browser global context. */
+static struct browse_ctx {
+	struct overview *ov; /**< The recording's overview, or NULL. */
+	unsigned frequency;  /**< Sampling rate in Hz. */
+	uint64_t length;     /**< Sample count of the longest channel. */
+
+	struct browse_channel channel[BL_CHANNEL_MAX]; /**< Channels. */
+	unsigned count; /**< Number of channels. */
+
+	double start; /**< First visible sample. */
+	double span;  /**< Number of samples across the view. */
+
+	bool   drag;       /**< Whether the view is being dragged. */
+	int    drag_x;     /**< Pointer x-coordinate at drag start. */
+	double drag_start; /**< View start at drag start. */
+
+	struct browse_column *column; /**< Pixel column scratch space. */
+	unsigned column_alloc;        /**< Allocated length of column. */
+
+	SDL_Point *points;     /**< Sample point scratch space. */
+	unsigned points_alloc; /**< Allocated length of points. */
+
+	struct sdl_tk_text *time_text; /**< Visible time range text. */
+	char time_string[96];          /**< String shown by time_text. */
+} browse_g;
+
+/**
+ * Ensure a scratch array has room for a number of entries.
+ *
+ * \param[in,out] array  The array to grow.
+ * \param[in,out] alloc  The allocated length of the array.
+ * \param[in]     count  The number of entries needed.
+ * \param[in]     size   The size of an entry.
+ * \return true on success, false on allocation failure.
+ */
+static bool browse__ensure(
+		void **array,
+		unsigned *alloc,
+		unsigned count,
+		size_t size)
+{
+	void *tmp;
+
+	if (count <= *alloc) {
+		return true;
+	}
+
+	tmp = realloc(*array, count * size);
+	if (tmp == NULL) {
+		return false;
+	}
+
+	*array = tmp;
+	*alloc = count;
+	return true;
+}
+
+/**
+ * Keep the view within the recording and the zoom limits.
+ *
+ * \param[in]  r  The rectangle the recording is rendered into.
+ */
+static void browse__clamp(const SDL_Rect *r)
+{
+	double span_min = (double) r->w / BROWSE_SAMPLE_WIDTH_MAX;
+	double length = browse_g.length;
+
+	if (span_min < 2) {
+		span_min = 2;
+	}
+	if (span_min > length) {
+		span_min = length;
+	}
+
+	if (browse_g.span > length) {
+		browse_g.span = length;
+	}
+	if (browse_g.span < span_min) {
+		browse_g.span = span_min;
+	}
+
+	if (browse_g.start > length - browse_g.span) {
+		browse_g.start = length - browse_g.span;
+	}
+	if (browse_g.start < 0) {
+		browse_g.start = 0;
+	}
+}
+
+/**
+ * Zoom the view, keeping the sample under a given x-coordinate in place.
+ *
+ * \param[in]  r       The rectangle the recording is rendered into.
+ * \param[in]  factor  Factor to multiply the number of visible samples by.
+ * \param[in]  x       The x-coordinate to zoom about.
+ */
+static void browse__zoom(const SDL_Rect *r, double factor, int x)
+{
+	double pos = (double) (x - r->x) / r->w;
+	double anchor = browse_g.start + pos * browse_g.span;
+
+	browse_g.span *= factor;
+	browse__clamp(r);
+
+	browse_g.start = anchor - pos * browse_g.span;
+	browse__clamp(r);
+}
+
+/**
+ * Get the y-coordinate for a sample value.
+ *
+ * \param[in]  r      The rectangle for the channel.
+ * \param[in]  value  The sample value.
+ * \param[in]  min    The minimum value in view.
+ * \param[in]  max    The maximum value in view.
+ * \return the y-coordinate.
+ */
+static inline int browse__y(
+		const SDL_Rect *r,
+		uint32_t value,
+		uint32_t min,
+		uint32_t max)
+{
+	if (max == min) {
+		return r->y + r->h / 2;
+	}
+
+	return r->y + 2 + (double) (max - value) * (r->h - 4) / (max - min);
+}
+
+/**
+ * Render a channel's samples from the recording.
+ *
+ * \param[in]  ren  The SDL renderer.
+ * \param[in]  c    The channel to render.
+ * \param[in]  r    The rectangle for the channel.
+ */
+static void browse__render_samples(
+		SDL_Renderer *ren,
+		struct browse_channel *c,
+		const SDL_Rect *r)
+{
+	uint64_t count = overview_sample_count(browse_g.ov, c->channel);
+	uint64_t first = floor(browse_g.start);
+	uint64_t last = ceil(browse_g.start + browse_g.span) + 1;
+	double width = r->w / browse_g.span;
+	uint32_t min, max;
+	unsigned n;
+
+	if (last > count) {
+		last = count;
+	}
+	if (first >= last) {
+		return;
+	}
+	n = last - first;
+
+	if (c->raw_start != first || c->raw_count != n) {
+		if (!browse__ensure((void **) &c->raw, &c->raw_alloc,
+				n, sizeof(*c->raw))) {
+			return;
+		}
+		c->raw_start = first;
+		c->raw_count = overview_samples(browse_g.ov, c->channel,
+				first, n, c->raw);
+	}
+
+	n = c->raw_count;
+	if (n == 0 || !browse__ensure((void **) &browse_g.points,
+			&browse_g.points_alloc, n, sizeof(*browse_g.points))) {
+		return;
+	}
+
+	min = max = c->raw[0];
+	for (unsigned i = 1; i < n; i++) {
+		if (c->raw[i] < min) {
+			min = c->raw[i];
+		}
+		if (c->raw[i] > max) {
+			max = c->raw[i];
+		}
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		browse_g.points[i].x = r->x + (first + i - browse_g.start) *
+				width;
+		browse_g.points[i].y = browse__y(r, c->raw[i], min, max);
+	}
+
+	SDL_RenderDrawLines(ren, browse_g.points, n);
+
+	if (width >= BROWSE_MARK_WIDTH) {
+		for (unsigned i = 0; i < n; i++) {
+			SDL_Rect mark = {
+				.x = browse_g.points[i].x - 1,
+				.y = browse_g.points[i].y - 1,
+				.w = 3,
+				.h = 3,
+			};
+			SDL_RenderFillRect(ren, &mark);
+		}
+	}
+}
+
+/**
+ * Render a channel from its overview.
+ *
+ * \param[in]  ren  The SDL renderer.
+ * \param[in]  c    The channel to render.
+ * \param[in]  r    The rectangle for the channel.
+ */
+static void browse__render_overview(
+		SDL_Renderer *ren,
+		const struct browse_channel *c,
+		const SDL_Rect *r)
+{
+	struct browse_column *col;
+	double spp = browse_g.span / r->w;
+	uint32_t min = UINT32_MAX;
+	uint32_t max = 0;
+
+	if (!browse__ensure((void **) &browse_g.column,
+			&browse_g.column_alloc, r->w,
+			sizeof(*browse_g.column))) {
+		return;
+	}
+	col = browse_g.column;
+
+	for (int x = 0; x < r->w; x++) {
+		double start = browse_g.start + x * spp;
+
+		col[x].valid = overview_range(browse_g.ov, c->channel,
+				start, ceil(start + spp),
+				&col[x].min, &col[x].max);
+		if (!col[x].valid) {
+			continue;
+		}
+		if (col[x].min < min) {
+			min = col[x].min;
+		}
+		if (col[x].max > max) {
+			max = col[x].max;
+		}
+	}
+
+	for (int x = 0; x < r->w; x++) {
+		uint32_t lo = col[x].min;
+		uint32_t hi = col[x].max;
+
+		if (!col[x].valid) {
+			continue;
+		}
+
+		/* Join up with the previous column. */
+		if (x > 0 && col[x - 1].valid) {
+			if (col[x - 1].max < lo) {
+				lo = col[x - 1].max;
+			}
+			if (col[x - 1].min > hi) {
+				hi = col[x - 1].min;
+			}
+		}
+
+		SDL_RenderDrawLine(ren,
+				r->x + x, browse__y(r, hi, min, max),
+				r->x + x, browse__y(r, lo, min, max));
+	}
+}
+
+/**
+ * Render a channel.
+ *
+ * \param[in]  ren  The SDL renderer.
+ * \param[in]  c    The channel to render.
+ * \param[in]  r    The rectangle for the channel.
+ */
+static void browse__render_channel(
+		SDL_Renderer *ren,
+		struct browse_channel *c,
+		const SDL_Rect *r)
+{
+	SDL_Color colour = main_menu_config_get_channel_colour(c->channel);
+
+	SDL_SetRenderDrawColor(ren, colour.r, colour.g, colour.b,
+			SDL_ALPHA_OPAQUE);
+
+	if (browse_g.span / r->w < OVERVIEW_FANOUT) {
+		browse__render_samples(ren, c, r);
+	} else {
+		browse__render_overview(ren, c, r);
+	}
+
+	if (c->label == NULL) {
+		c->label = sdl_tk_text_create(
+				main_menu_config_get_channel_name(c->channel),
+				colour, SDL_TK_TEXT_SIZE_NORMAL);
+	}
+
+	if (c->label != NULL) {
+		SDL_Rect rect = {
+			.x = r->x + 2,
+			.y = r->y + 2,
+			.w = c->label->w,
+			.h = c->label->h,
+		};
+
+		SDL_RenderCopy(ren, c->label->t, NULL, &rect);
+	}
+}
+
+/**
+ * Render the visible time range.
+ *
+ * \param[in]  ren  The SDL renderer.
+ * \param[in]  r    The rectangle the recording is rendered into.
+ */
+static void browse__render_time(
+		SDL_Renderer *ren,
+		const SDL_Rect *r)
+{
+	static const SDL_Color colour = { .r = 200, .g = 200, .b = 200 };
+	char string[sizeof(browse_g.time_string)];
+	double freq = browse_g.frequency;
+
+	snprintf(string, sizeof(string), "Time: %.3f s to %.3f s of %.3f s",
+			browse_g.start / freq,
+			(browse_g.start + browse_g.span) / freq,
+			browse_g.length / freq);
+
+	if (strcmp(string, browse_g.time_string) != 0) {
+		sdl_tk_text_destroy(browse_g.time_text);
+		memcpy(browse_g.time_string, string, sizeof(string));
+		browse_g.time_text = sdl_tk_text_create(string, colour,
+				SDL_TK_TEXT_SIZE_NORMAL);
+	}
+
+	if (browse_g.time_text != NULL) {
+		SDL_Rect rect = {
+			.x = r->x + r->w - browse_g.time_text->w - 2,
+			.y = r->y + r->h - browse_g.time_text->h - 2,
+			.w = browse_g.time_text->w,
+			.h = browse_g.time_text->h,
+		};
+
+		SDL_RenderCopy(ren, browse_g.time_text->t, NULL, &rect);
+	}
+}
+
+/* Exported function, documented in browse.h */
+void browse_render(
+		SDL_Renderer   *ren,
+		const SDL_Rect *r)
+{
+	SDL_Rect rect = *r;
+
+	if (browse_g.ov == NULL || r->w <= 0) {
+		return;
+	}
+
+	browse__clamp(r);
+
+	rect.h = r->h / browse_g.count;
+	for (unsigned i = 0; i < browse_g.count; i++) {
+		if (i % 2 == 1) {
+			SDL_SetRenderDrawColor(ren, 32, 32, 32,
+					SDL_ALPHA_OPAQUE);
+			SDL_RenderFillRect(ren, &rect);
+		}
+		browse__render_channel(ren, &browse_g.channel[i], &rect);
+		rect.y += rect.h;
+	}
+
+	browse__render_time(ren, r);
+}
+
+/**
+ * Handle a keyboard input event.
+ *
+ * \param[in]  event  The SDL event.
+ * \param[in]  r      The rectangle the recording is rendered into.
+ * \param[in]  ctrl   True if the control key is pressed.
+ * \return true if the event was handled, or false otherwise.
+ */
+static bool browse__handle_key(
+		const SDL_Event *event,
+		const SDL_Rect *r,
+		bool ctrl)
+{
+	double pan = (ctrl) ? browse_g.span : browse_g.span * BROWSE_PAN_STEP;
+
+	switch (event->key.keysym.sym) {
+	case SDLK_LEFT:
+		browse_g.start -= pan;
+		break;
+
+	case SDLK_RIGHT:
+		browse_g.start += pan;
+		break;
+
+	case SDLK_UP:
+		browse__zoom(r, 1 / BROWSE_ZOOM_STEP, r->x + r->w / 2);
+		break;
+
+	case SDLK_DOWN:
+		browse__zoom(r, BROWSE_ZOOM_STEP, r->x + r->w / 2);
+		break;
+
+	case SDLK_HOME:
+		browse_g.start = 0;
+		browse_g.span = browse_g.length;
+		break;
+
+	case SDLK_END:
+		browse_g.start = browse_g.length;
+		break;
+
+	default:
+		return false;
+	}
+
+	browse__clamp(r);
+	return true;
+}
+
+/* Exported function, documented in browse.h */
+bool browse_handle_input(
+		const SDL_Event *event,
+		const SDL_Rect *r,
+		bool shift,
+		bool ctrl)
+{
+	int x;
+
+	BV_UNUSED(shift);
+
+	if (browse_g.ov == NULL || r->w <= 0) {
+		return false;
+	}
+
+	switch (event->type) {
+	case SDL_KEYDOWN:
+		return browse__handle_key(event, r, ctrl);
+
+	case SDL_MOUSEWHEEL:
+		if (event->wheel.y == 0) {
+			return false;
+		}
+		SDL_GetMouseState(&x, NULL);
+		browse__zoom(r, pow(BROWSE_ZOOM_STEP, -event->wheel.y), x);
+		return true;
+
+	case SDL_MOUSEBUTTONDOWN:
+		if (event->button.button != SDL_BUTTON_LEFT) {
+			return false;
+		}
+		browse_g.drag = true;
+		browse_g.drag_x = event->button.x;
+		browse_g.drag_start = browse_g.start;
+		return true;
+
+	case SDL_MOUSEBUTTONUP:
+		if (event->button.button != SDL_BUTTON_LEFT) {
+			return false;
+		}
+		browse_g.drag = false;
+		return true;
+
+	case SDL_MOUSEMOTION:
+		if (!browse_g.drag) {
+			return false;
+		}
+		browse_g.start = browse_g.drag_start -
+				(event->motion.x - browse_g.drag_x) *
+				browse_g.span / r->w;
+		browse__clamp(r);
+		return true;
+	}
+
+	return false;
+}
+
+/* Exported function, documented in browse.h */
+bool browse_open(const char *path)
+{
+	assert(browse_g.ov == NULL);
+
+	browse_g.ov = overview_open(path);
+	if (browse_g.ov == NULL) {
+		return false;
+	}
+
+	browse_g.frequency = overview_frequency(browse_g.ov);
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		uint64_t count = overview_sample_count(browse_g.ov, i);
+
+		if (count == 0) {
+			continue;
+		}
+
+		browse_g.channel[browse_g.count++].channel = i;
+		if (count > browse_g.length) {
+			browse_g.length = count;
+		}
+	}
+
+	if (browse_g.count == 0) {
+		fprintf(stderr, "Error: Browse: '%s' has no samples\n", path);
+		browse_close();
+		return false;
+	}
+
+	/* Start with the whole recording in view. */
+	browse_g.start = 0;
+	browse_g.span = browse_g.length;
+
+	return true;
+}
+
+/* Exported function, documented in browse.h */
+void browse_close(void)
+{
+	for (unsigned i = 0; i < browse_g.count; i++) {
+		sdl_tk_text_destroy(browse_g.channel[i].label);
+		free(browse_g.channel[i].raw);
+	}
+
+	sdl_tk_text_destroy(browse_g.time_text);
+	free(browse_g.column);
+	free(browse_g.points);
+	overview_close(browse_g.ov);
+
+	memset(&browse_g, 0, sizeof(browse_g));
+}
+
+/* Exported function, documented in browse.h */
+bool browse_active(void)
+{
+	return browse_g.ov != NULL;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the recording browser module.
+ *
+ * This shows a recording file, instead of live data, with panning and
+ * zooming from the whole recording down to individual samples.
+ */
+
+#ifndef BV_BROWSE_H
+#define BV_BROWSE_H
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+/**
+ * Open a recording for browsing.
+ *
+ * \param[in]  path  Path to the recording.
+ * \return true on success or false on failure.
+ */
+bool browse_open(const char *path);
+
+/**
+ * Close the recording being browsed, if any.
+ *
+ * Must be called on the rendering thread.
+ */
+void browse_close(void);
+
+/**
+ * Check whether a recording is being browsed.
+ *
+ * \return true if a recording is open.
+ */
+bool browse_active(void);
+
+/**
+ * Render the recording being browsed.
+ *
+ * \param[in]  ren  The SDL renderer.
+ * \param[in]  r    The rectangle to render into.
+ */
+void browse_render(
+		SDL_Renderer   *ren,
+		const SDL_Rect *r);
+
+/**
+ * Handle an input event.
+ *
+ * \param[in]  event  The SDL event.
+ * \param[in]  r      The rectangle the recording is rendered into.
+ * \param[in]  shift  True if the shift key is pressed.
+ * \param[in]  ctrl   True if the control key is pressed.
+ * \return true if the event was handled, or false otherwise.
+ */
+bool browse_handle_input(
+		const SDL_Event *event,
+		const SDL_Rect *r,
+		bool shift,
+		bool ctrl);
+
+#endif /* BV_BROWSE_H */
@@ -0,0 +1,624 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the cache module.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "cache.h"
+
+/** Magic bytes at the start of every cache file. */
+static const char cache__magic[8] = "BVCACHE";
+
+/** Identity of a cache's source file. */
+struct cache_key {
+	char    *path;       /**< Absolute path to source file. */
+	uint64_t size;       /**< Source file size in bytes. */
+	int64_t  mtime_sec;  /**< Source file modification time, seconds. */
+	int64_t  mtime_nsec; /**< Source file modification time, nanoseconds. */
+	uint64_t hash;       /**< Hash of source file contents. */
+};
+
+/** Cache writer. */
+struct cache_writer {
+	FILE  *stream; /**< Memory stream the cache is built in. */
+	char  *data;   /**< Buffer for stream. */
+	size_t len;    /**< Length of buffer for stream. */
+	char  *path;   /**< Path to cache file. */
+	bool   error;  /**< Whether a write has failed. */
+};
+
+/**
+ * Hash some data with 64-bit FNV-1a.
+ *
+ * \param[in]  hash  Hash to continue from.
+ * \param[in]  data  Data to hash.
+ * \param[in]  len   Length of data in bytes.
+ * \return the updated hash.
+ */
+static uint64_t cache__hash(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
+/** Initial value for \ref cache__hash. */
+#define CACHE__HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+/**
+ * Free a cache key.
+ *
+ * \param[in]  key  The key to free the contents of.
+ */
+static void cache__key_fini(struct cache_key *key)
+{
+	free(key->path);
+	key->path = NULL;
+}
+
+/**
+ * Get the key for a source file.
+ *
+ * \param[in]  source_path  Path to source file.
+ * \param[out] key          Returns the source file's key on success.
+ * \return true on success, or false on error.
+ */
+static bool cache__key_init(
+		const char *source_path,
+		struct cache_key *key)
+{
+	uint8_t buffer[4096];
+	struct stat st;
+	size_t read;
+	FILE *file;
+
+	key->path = realpath(source_path, NULL);
+	if (key->path == NULL) {
+		return false;
+	}
+
+	file = fopen(key->path, "rb");
+	if (file == NULL) {
+		goto error;
+	}
+
+	if (fstat(fileno(file), &st) != 0) {
+		fclose(file);
+		goto error;
+	}
+
+	key->size = st.st_size;
+	key->mtime_sec = st.st_mtim.tv_sec;
+	key->mtime_nsec = st.st_mtim.tv_nsec;
+	key->hash = CACHE__HASH_INIT;
+
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		key->hash = cache__hash(key->hash, buffer, read);
+	}
+
+	if (ferror(file)) {
+		fclose(file);
+		goto error;
+	}
+
+	fclose(file);
+	return true;
+
+error:
+	cache__key_fini(key);
+	return false;
+}
+
+/**
+ * Create a directory if it doesn't already exist.
+ *
+ * \param[in]  path  Path to directory to create.
+ * \return true on success, or false on error.
+ */
+static bool cache__mkdir(const char *path)
+{
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Get the path to the cache file for a source file.
+ *
+ * \param[in]  kind  Name for the type of data cached.
+ * \param[in]  key   The source file's key.
+ * \param[in]  make  Whether to create the cache directory.
+ * \return newly allocated path, or NULL on error.
+ */
+static char *cache__path(
+		const char *kind,
+		const struct cache_key *key,
+		bool make)
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	char *path = NULL;
+	char *base = NULL;
+	char *dir = NULL;
+	char name[64];
+	int ret;
+
+	if (xdg != NULL && xdg[0] != '\0') {
+		base = strdup(xdg);
+	} else {
+		const char *home = getenv("HOME");
+
+		if (home == NULL) {
+			return NULL;
+		}
+
+		base = util_create_path(home, ".cache");
+	}
+	if (base == NULL) {
+		goto cleanup;
+	}
+
+	if (make && !cache__mkdir(base)) {
+		goto cleanup;
+	}
+
+	dir = util_create_path(base, "bloodview");
+	if (dir == NULL) {
+		goto cleanup;
+	}
+
+	if (make && !cache__mkdir(dir)) {
+		goto cleanup;
+	}
+
+	ret = snprintf(name, sizeof(name), "%s-%016"PRIx64".bin", kind,
+			cache__hash(CACHE__HASH_INIT,
+					key->path, strlen(key->path)));
+	if (ret < 0 || (unsigned)ret >= sizeof(name)) {
+		goto cleanup;
+	}
+
+	path = util_create_path(dir, name);
+
+cleanup:
+	free(base);
+	free(dir);
+	return path;
+}
+
+/**
+ * Read raw bytes from a cache.
+ *
+ * \param[in]  reader  The cache reader.
+ * \param[out] data    Buffer to read into.
+ * \param[in]  len     Number of bytes to read.
+ * \return true on success, or false on error.
+ */
+static bool cache__read(
+		struct cache_reader *reader,
+		void *data,
+		size_t len)
+{
+	if (reader->error || reader->len - reader->pos < len) {
+		reader->error = true;
+		memset(data, 0, len);
+		return false;
+	}
+
+	memcpy(data, reader->data + reader->pos, len);
+	reader->pos += len;
+	return true;
+}
+
+/**
+ * Read an unsigned 64-bit value from a cache.
+ *
+ * \param[in]  reader  The cache reader.
+ * \return the value read, or zero on error.
+ */
+static uint64_t cache__read_u64(
+		struct cache_reader *reader)
+{
+	uint64_t value;
+
+	cache__read(reader, &value, sizeof(value));
+	return value;
+}
+
+/* Exported function, documented in cache.h */
+uint32_t cache_read_u32(
+		struct cache_reader *reader)
+{
+	uint32_t value;
+
+	cache__read(reader, &value, sizeof(value));
+	return value;
+}
+
+/* Exported function, documented in cache.h */
+double cache_read_double(
+		struct cache_reader *reader)
+{
+	double value;
+
+	cache__read(reader, &value, sizeof(value));
+	return value;
+}
+
+/* Exported function, documented in cache.h */
+char *cache_read_string(
+		struct cache_reader *reader)
+{
+	uint32_t len = cache_read_u32(reader);
+	char *string;
+
+	if (reader->error || len == UINT32_MAX) {
+		return NULL;
+	}
+
+	if (reader->len - reader->pos < len) {
+		reader->error = true;
+		return NULL;
+	}
+
+	string = malloc(len + 1);
+	if (string == NULL) {
+		reader->error = true;
+		return NULL;
+	}
+
+	cache__read(reader, string, len);
+	string[len] = '\0';
+	return string;
+}
+
+/* Exported function, documented in cache.h */
+void *cache_read_array(
+		struct cache_reader *reader,
+		uint32_t *count,
+		size_t size)
+{
+	void *array;
+
+	*count = cache_read_u32(reader);
+	if (reader->error || *count == 0) {
+		*count = 0;
+		return NULL;
+	}
+
+	/* Every entry takes at least one byte in the cache, so this
+	 * stops a corrupt count causing a huge allocation. */
+	if (reader->len - reader->pos < *count) {
+		reader->error = true;
+		*count = 0;
+		return NULL;
+	}
+
+	array = calloc(*count, size);
+	if (array == NULL) {
+		reader->error = true;
+		*count = 0;
+		return NULL;
+	}
+
+	return array;
+}
+
+/**
+ * Check a cache's header matches the source file.
+ *
+ * \param[in]  reader  The cache reader, positioned at the start.
+ * \param[in]  key     The source file's key.
+ * \return true if the cache is for the current source file.
+ */
+static bool cache__read_header(
+		struct cache_reader *reader,
+		const struct cache_key *key)
+{
+	char magic[sizeof(cache__magic)];
+	bool match = false;
+	char *path;
+
+	if (!cache__read(reader, magic, sizeof(magic)) ||
+	    memcmp(magic, cache__magic, sizeof(magic)) != 0) {
+		return false;
+	}
+
+	if (cache_read_u32(reader) != BV_CACHE_VERSION) {
+		return false;
+	}
+
+	path = cache_read_string(reader);
+	if (path != NULL) {
+		match = (strcmp(path, key->path) == 0);
+		free(path);
+	}
+
+	match = match &&
+		cache__read_u64(reader) == key->size &&
+		(int64_t)cache__read_u64(reader) == key->mtime_sec &&
+		(int64_t)cache__read_u64(reader) == key->mtime_nsec &&
+		cache__read_u64(reader) == key->hash;
+
+	return match && !reader->error;
+}
+
+/* Exported function, documented in cache.h */
+bool cache_read_open(
+		const char *kind,
+		const char *source_path,
+		struct cache_reader *reader)
+{
+	struct cache_key key;
+	struct stat st;
+	char *path;
+	FILE *file;
+
+	*reader = (struct cache_reader) { 0 };
+
+	if (!cache__key_init(source_path, &key)) {
+		return false;
+	}
+
+	path = cache__path(kind, &key, false);
+	if (path == NULL) {
+		goto error;
+	}
+
+	file = fopen(path, "rb");
+	free(path);
+	if (file == NULL) {
+		goto error;
+	}
+
+	if (fstat(fileno(file), &st) != 0 || st.st_size <= 0) {
+		fclose(file);
+		goto error;
+	}
+
+	reader->len = st.st_size;
+	reader->data = malloc(reader->len);
+	if (reader->data == NULL) {
+		fclose(file);
+		goto error;
+	}
+
+	if (fread(reader->data, reader->len, 1, file) != 1) {
+		fclose(file);
+		goto error;
+	}
+	fclose(file);
+
+	if (!cache__read_header(reader, &key)) {
+		goto error;
+	}
+
+	cache__key_fini(&key);
+	return true;
+
+error:
+	free(reader->data);
+	*reader = (struct cache_reader) { 0 };
+	cache__key_fini(&key);
+	return false;
+}
+
+/* Exported function, documented in cache.h */
+bool cache_read_close(
+		struct cache_reader *reader)
+{
+	bool ok = !reader->error && reader->pos == reader->len;
+
+	free(reader->data);
+	*reader = (struct cache_reader) { 0 };
+
+	return ok;
+}
+
+/**
+ * Write raw bytes to a cache.
+ *
+ * \param[in]  writer  The cache writer, or NULL.
+ * \param[in]  data    Data to write.
+ * \param[in]  len     Number of bytes to write.
+ */
+static void cache__write(
+		struct cache_writer *writer,
+		const void *data,
+		size_t len)
+{
+	if (writer == NULL || writer->error || len == 0) {
+		return;
+	}
+
+	if (fwrite(data, len, 1, writer->stream) != 1) {
+		writer->error = true;
+	}
+}
+
+/**
+ * Write an unsigned 64-bit value to a cache.
+ *
+ * \param[in]  writer  The cache writer, or NULL.
+ * \param[in]  value   The value to write.
+ */
+static void cache__write_u64(
+		struct cache_writer *writer,
+		uint64_t value)
+{
+	cache__write(writer, &value, sizeof(value));
+}
+
+/* Exported function, documented in cache.h */
+void cache_write_u32(
+		struct cache_writer *writer,
+		uint32_t value)
+{
+	cache__write(writer, &value, sizeof(value));
+}
+
+/* Exported function, documented in cache.h */
+void cache_write_double(
+		struct cache_writer *writer,
+		double value)
+{
+	cache__write(writer, &value, sizeof(value));
+}
+
+/* Exported function, documented in cache.h */
+void cache_write_string(
+		struct cache_writer *writer,
+		const char *string)
+{
+	size_t len;
+
+	if (string == NULL) {
+		cache_write_u32(writer, UINT32_MAX);
+		return;
+	}
+
+	len = strlen(string);
+	if (len >= UINT32_MAX) {
+		if (writer != NULL) {
+			writer->error = true;
+		}
+		return;
+	}
+
+	cache_write_u32(writer, len);
+	cache__write(writer, string, len);
+}
+
+/* Exported function, documented in cache.h */
+struct cache_writer *cache_write_open(
+		const char *kind,
+		const char *source_path)
+{
+	struct cache_writer *writer;
+	struct cache_key key;
+
+	if (!cache__key_init(source_path, &key)) {
+		return NULL;
+	}
+
+	writer = calloc(1, sizeof(*writer));
+	if (writer == NULL) {
+		goto error;
+	}
+
+	writer->path = cache__path(kind, &key, true);
+	if (writer->path == NULL) {
+		goto error;
+	}
+
+	writer->stream = open_memstream(&writer->data, &writer->len);
+	if (writer->stream == NULL) {
+		goto error;
+	}
+
+	cache__write(writer, cache__magic, sizeof(cache__magic));
+	cache_write_u32(writer, BV_CACHE_VERSION);
+	cache_write_string(writer, key.path);
+	cache__write_u64(writer, key.size);
+	cache__write_u64(writer, key.mtime_sec);
+	cache__write_u64(writer, key.mtime_nsec);
+	cache__write_u64(writer, key.hash);
+
+	cache__key_fini(&key);
+	return writer;
+
+error:
+	if (writer != NULL) {
+		free(writer->path);
+		free(writer);
+	}
+	cache__key_fini(&key);
+	return NULL;
+}
+
+/* Exported function, documented in cache.h */
+void cache_write_close(
+		struct cache_writer *writer,
+		bool commit)
+{
+	char *tmp = NULL;
+	FILE *file;
+	size_t len;
+
+	if (writer == NULL) {
+		return;
+	}
+
+	if (fclose(writer->stream) != 0) {
+		writer->error = true;
+	}
+
+	if (!commit || writer->error) {
+		goto cleanup;
+	}
+
+	len = strlen(writer->path) + 32;
+	tmp = malloc(len);
+	if (tmp == NULL) {
+		goto cleanup;
+	}
+	snprintf(tmp, len, "%s.%ld", writer->path, (long)getpid());
+
+	/* Write to a temporary file and rename it into place, so that a
+	 * concurrent reader never sees a partially written cache. */
+	file = fopen(tmp, "wb");
+	if (file == NULL) {
+		goto cleanup;
+	}
+
+	if (fwrite(writer->data, writer->len, 1, file) != 1) {
+		fclose(file);
+		unlink(tmp);
+		goto cleanup;
+	}
+
+	if (fclose(file) != 0 || rename(tmp, writer->path) != 0) {
+		unlink(tmp);
+		goto cleanup;
+	}
+
+cleanup:
+	free(tmp);
+	free(writer->data);
+	free(writer->path);
+	free(writer);
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the cache module.
+ *
+ * This module stores data parsed from YAML files in a binary form, so
+ * that it can be reloaded without parsing the YAML again.
+ *
+ * Cache files live in `$XDG_CACHE_HOME/bloodview`, or `~/.cache/bloodview`.
+ * Each cache file is keyed by the source file's path, size, modification
+ * time and content hash.  If any of these differ, the cache is stale and
+ * the caller should fall back to parsing the source file.
+ *
+ * Users of the module serialise their own data with the read and write
+ * helpers.  Errors are sticky: once a read or write fails, further reads
+ * return zero or NULL, and the error is reported by \ref cache_read_close
+ * or ignored by \ref cache_write_close.
+ */
+
+#ifndef BV_CACHE_H
+#define BV_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Cache format version.
+ *
+ * This must be increased whenever the layout of any cached data changes.
+ */
+#define BV_CACHE_VERSION 1
+
+/** Cache reader. */
+struct cache_reader {
+	uint8_t *data; /**< Cache file contents. */
+	size_t   len;  /**< Length of data in bytes. */
+	size_t   pos;  /**< Current read position in data. */
+	bool    error; /**< Whether a read has failed. */
+};
+
+/** Cache writer. */
+struct cache_writer;
+
+/**
+ * Open a cache file for reading.
+ *
+ * The cache file is read in one go, and its key is checked against the
+ * source file.
+ *
+ * \param[in]  kind         Name for the type of data cached.
+ * \param[in]  source_path  Path to the YAML file the cache was made from.
+ * \param[out] reader       Returns the cache reader on success.
+ * \return true if an up to date cache was found, false otherwise.
+ */
+bool cache_read_open(
+		const char *kind,
+		const char *source_path,
+		struct cache_reader *reader);
+
+/**
+ * Close a cache reader.
+ *
+ * \param[in]  reader  The cache reader to close.
+ * \return true if all reads succeeded and all the data was used,
+ *         or false otherwise.
+ */
+bool cache_read_close(
+		struct cache_reader *reader);
+
+/**
+ * Read an unsigned 32-bit value from a cache.
+ *
+ * \param[in]  reader  The cache reader.
+ * \return the value read, or zero on error.
+ */
+uint32_t cache_read_u32(
+		struct cache_reader *reader);
+
+/**
+ * Read a double from a cache.
+ *
+ * \param[in]  reader  The cache reader.
+ * \return the value read, or zero on error.
+ */
+double cache_read_double(
+		struct cache_reader *reader);
+
+/**
+ * Read a string from a cache.
+ *
+ * \param[in]  reader  The cache reader.
+ * \return newly allocated string, or NULL if a NULL string was cached
+ *         or on error.
+ */
+char *cache_read_string(
+		struct cache_reader *reader);
+
+/**
+ * Read an array from a cache.
+ *
+ * This reads the entry count and allocates zeroed storage for the entries,
+ * which the caller then reads.
+ *
+ * \param[in]  reader  The cache reader.
+ * \param[out] count   Returns the number of entries.
+ * \param[in]  size    Size of each entry in bytes.
+ * \return newly allocated array, or NULL if count is zero or on error.
+ */
+void *cache_read_array(
+		struct cache_reader *reader,
+		uint32_t *count,
+		size_t size);
+
+/**
+ * Open a cache file for writing.
+ *
+ * This must be called before the source file is parsed, so that the key
+ * matches the data that was parsed.
+ *
+ * \param[in]  kind         Name for the type of data cached.
+ * \param[in]  source_path  Path to the YAML file the cache is made from.
+ * \return a cache writer, or NULL if the cache can't be written.
+ */
+struct cache_writer *cache_write_open(
+		const char *kind,
+		const char *source_path);
+
+/**
+ * Close a cache writer.
+ *
+ * \param[in]  writer  The cache writer to close, or NULL.
+ * \param[in]  commit  Whether to store the cache file.
+ */
+void cache_write_close(
+		struct cache_writer *writer,
+		bool commit);
+
+/**
+ * Write an unsigned 32-bit value to a cache.
+ *
+ * \param[in]  writer  The cache writer, or NULL.
+ * \param[in]  value   The value to write.
+ */
+void cache_write_u32(
+		struct cache_writer *writer,
+		uint32_t value);
+
+/**
+ * Write a double to a cache.
+ *
+ * \param[in]  writer  The cache writer, or NULL.
+ * \param[in]  value   The value to write.
+ */
+void cache_write_double(
+		struct cache_writer *writer,
+		double value);
+
+/**
+ * Write a string to a cache.
+ *
+ * \param[in]  writer  The cache writer, or NULL.
+ * \param[in]  string  The string to write, or NULL.
+ */
+void cache_write_string(
+		struct cache_writer *writer,
+		const char *string);
+
+#endif /* BV_CACHE_H */
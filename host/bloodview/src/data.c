@@ -24,16 +24,23 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
+
+#include <pthread.h>
 
 #include "common/msg.h"
 
 #include "host/common/fifo.h"
+#include "host/common/sample.h"
 
 #include "dpp/dpp.h"
 
 #include "data.h"
 #include "util.h"
+#include "audio.h"
 #include "graph.h"
+#include "device.h"
+#include "quality.h"
 #include "data-avg.h"
 #include "data-cal.h"
 #include "main-menu.h"
@@ -46,6 +53,9 @@
 /** Mask into sample_masks array. */
 #define DATA_MASKS_MASK  (DATA_MASKS_COUNT - 1)
 
+/** Percentage of clipped samples in a second which triggers a warning. */
+#define DATA_CLIP_WARN_PERCENT 1
+
 /** Data filter details. */
 struct data_filter {
 	void *ctx; /**< The filter context. */
@@ -70,6 +80,20 @@ struct data_channel {
 	uint64_t sample_count; /**< Channel's sample count. */
 };
 
+/** Per-channel clipping detector. */
+struct data_clip {
+	uint32_t full16; /**< Full scale of 16-bit samples. */
+	uint32_t full32; /**< Full scale of 32-bit samples. */
+
+	uint32_t high;  /**< Samples at full scale in the current second. */
+	uint32_t low;   /**< Samples at zero in the current second. */
+	uint32_t count; /**< Samples checked in the current second. */
+	bool warned;    /**< Whether a warning was given this acquisition. */
+
+	/** Statistics published to other threads, under clip_lock. */
+	struct data_clip_stats stats;
+};
+
 /** Data module global data. */
 static struct {
 	/** Whether the data module has been initialised. */
@@ -93,7 +117,21 @@ static struct {
 
 	/** Data processing pipeline, if enabled. */
 	struct bv_value *pipeline;
-} data_g;
+
+	/** Sampling frequency of the current acquisition. */
+	unsigned frequency;
+
+	/** Clipping detectors, indexed by acquisition channel. */
+	struct data_clip clip[sizeof(unsigned) * CHAR_BIT];
+
+	/** Acquisition channels in the current or last acquisition. */
+	unsigned clip_mask;
+
+	/** Lock for published clipping statistics. */
+	pthread_mutex_t clip_lock;
+} data_g = {
+	.clip_lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /**
  * Destroy channels.
@@ -174,6 +212,7 @@ static bool data__process_sample(
 		if (!graph_data_add(channel, sample - INT32_MAX)) {
 			return false;
 		}
+		audio_data_add(channel, sample - INT32_MAX);
 	} else {
 		data_g.pipeline[channel].type = BV_VALUE_UNSIGNED;
 		data_g.pipeline[channel].type_unsigned = sample;
@@ -243,21 +282,124 @@ static bool data__handle_sample(
 	return true;
 }
 
+/**
+ * Publish a channel's clipping counts for the current second.
+ *
+ * Call with the clip_lock held.
+ *
+ * \param[in]  acq_channel  Acquisition channel to publish counts for.
+ */
+static void data__clip_publish(
+		unsigned acq_channel)
+{
+	struct data_clip *clip = &data_g.clip[acq_channel];
+
+	clip->stats.samples += clip->count;
+	clip->stats.high += clip->high;
+	clip->stats.low += clip->low;
+	clip->stats.second_high = clip->high;
+	clip->stats.second_low = clip->low;
+	if (clip->high != 0 || clip->low != 0) {
+		clip->stats.seconds++;
+	}
+
+	clip->high = 0;
+	clip->low = 0;
+	clip->count = 0;
+}
+
+/**
+ * Count clipped samples.
+ *
+ * Samples are compared with the channel's real full scale, which depends
+ * on its source's oversampling and its own offset and shift.  32-bit
+ * samples never get anywhere near 0xFFFFFFFF, and 16-bit samples only
+ * reach 0xFFFF if the offset and shift leave no headroom.
+ *
+ * \param[in]  acq_channel  Acquisition channel the samples are for.
+ * \param[in]  sample32     Whether the samples are 32-bit.
+ * \param[in]  samples      The unpacked samples.
+ * \param[in]  count        Number of samples.
+ */
+static void data__clip_check(
+		unsigned acq_channel,
+		bool sample32,
+		const uint32_t *samples,
+		unsigned count)
+{
+	struct data_clip *clip = &data_g.clip[acq_channel];
+	unsigned high;
+	unsigned low;
+
+	bl_sample_clip_count(samples, count,
+			sample32 ? clip->full32 : clip->full16, &high, &low);
+
+	clip->high += high;
+	clip->low += low;
+	clip->count += count;
+
+	if (clip->count < data_g.frequency) {
+		return;
+	}
+
+	if (!clip->warned && (clip->high + clip->low) * 100 >=
+			clip->count * DATA_CLIP_WARN_PERCENT) {
+		fprintf(stderr, "Warning: Channel %u is clipping "
+				"(%"PRIu32" high, %"PRIu32" low in %"PRIu32" "
+				"samples); consider recalibrating.\n",
+				acq_channel, clip->high, clip->low,
+				clip->count);
+		clip->warned = true;
+	}
+
+	pthread_mutex_lock(&data_g.clip_lock);
+	data__clip_publish(acq_channel);
+	pthread_mutex_unlock(&data_g.clip_lock);
+}
+
 /* Exported interface, documented in data.h */
-bool data_handle_msg_u16(const bl_msg_sample_data_t *msg)
+bool data_get_clip_stats(
+		unsigned acq_channel,
+		struct data_clip_stats *stats)
 {
-	unsigned acq_channel = msg->channel;
+	bool ret = false;
 
-	if (data_g.enabled == false) {
-		return true;
+	if (acq_channel >= BV_ARRAY_LEN(data_g.clip)) {
+		return false;
 	}
 
-	assert(msg->type == BL_MSG_SAMPLE_DATA16);
+	pthread_mutex_lock(&data_g.clip_lock);
+	if (data_g.clip_mask & (1u << acq_channel)) {
+		*stats = data_g.clip[acq_channel].stats;
+		ret = true;
+	}
+	pthread_mutex_unlock(&data_g.clip_lock);
 
-	for (unsigned i = 0; i < msg->count; i++) {
-		if (!data__handle_sample(
-				acq_channel,
-				msg->data16[i])) {
+	return ret;
+}
+
+/**
+ * Handle all the samples in a sample data message.
+ *
+ * \param[in]  acq_channel  Acquisition channel the message is for.
+ * \param[in]  msg          The sample data message.
+ * \return true on success, false on error.
+ */
+static bool data__handle_samples(
+		unsigned acq_channel,
+		const bl_msg_sample_data_t *msg)
+{
+	uint32_t samples[BL_SAMPLE_MAX];
+	unsigned count;
+
+	count = bl_sample_unpack(msg, samples);
+	data__clip_check(acq_channel, msg->type == BL_MSG_SAMPLE_DATA32,
+			samples, count);
+	quality_samples(acq_channel, msg->type == BL_MSG_SAMPLE_DATA32,
+			samples, count);
+
+	for (unsigned i = 0; i < count; i++) {
+		if (!data__handle_sample(acq_channel, samples[i])) {
 			return false;
 		}
 	}
@@ -266,7 +408,7 @@ bool data_handle_msg_u16(const bl_msg_sample_data_t *msg)
 }
 
 /* Exported interface, documented in data.h */
-bool data_handle_msg_u32(const bl_msg_sample_data_t *msg)
+bool data_handle_msg_u16(const bl_msg_sample_data_t *msg)
 {
 	unsigned acq_channel = msg->channel;
 
@@ -274,17 +416,23 @@ bool data_handle_msg_u32(const bl_msg_sample_data_t *msg)
 		return true;
 	}
 
-	assert(msg->type == BL_MSG_SAMPLE_DATA32);
+	assert(msg->type == BL_MSG_SAMPLE_DATA16);
 
-	for (unsigned i = 0; i < msg->count; i++) {
-		if (!data__handle_sample(
-				acq_channel,
-				msg->data32[i])) {
-			return false;
-		}
+	return data__handle_samples(acq_channel, msg);
+}
+
+/* Exported interface, documented in data.h */
+bool data_handle_msg_u32(const bl_msg_sample_data_t *msg)
+{
+	unsigned acq_channel = msg->channel;
+
+	if (data_g.enabled == false) {
+		return true;
 	}
 
-	return true;
+	assert(msg->type == BL_MSG_SAMPLE_DATA32);
+
+	return data__handle_samples(acq_channel, msg);
 }
 
 /* Exported interface, documented in data.h */
@@ -292,6 +440,21 @@ void data_finish(void)
 {
 	data_g.enabled = false;
 
+	audio_finish();
+	quality_finish();
+
+	/* Include any partial second in the totals.  The totals are
+	 * kept until the next acquisition starts. */
+	pthread_mutex_lock(&data_g.clip_lock);
+	for (unsigned i = 0; i < BV_ARRAY_LEN(data_g.clip); i++) {
+		if (data_g.clip[i].count != 0) {
+			data__clip_publish(i);
+		}
+		data_g.clip[i].stats.second_high = 0;
+		data_g.clip[i].stats.second_low = 0;
+	}
+	pthread_mutex_unlock(&data_g.clip_lock);
+
 	for (unsigned i = 0; i < data_g.count; i++) {
 		data_g.filter[i].fini(data_g.filter[i].ctx);
 	}
@@ -626,12 +789,29 @@ static bool data__register_filters(
 }
 
 /* Exported interface, documented in data.h */
-bool data_start(bool calibrate, unsigned frequency, unsigned channel_mask)
+bool data_start(bool calibrate, unsigned frequency, unsigned channel_mask,
+		const char *rec_path)
 {
 	unsigned channels = util_bit_count(channel_mask);
 
 	assert(data_g.enabled == false);
 
+	data_g.frequency = frequency;
+
+	pthread_mutex_lock(&data_g.clip_lock);
+	memset(data_g.clip, 0, sizeof(data_g.clip));
+	data_g.clip_mask = channel_mask;
+	pthread_mutex_unlock(&data_g.clip_lock);
+
+	for (unsigned i = 0; i < BV_ARRAY_LEN(data_g.clip); i++) {
+		if (channel_mask & (1u << i)) {
+			data_g.clip[i].full16 =
+					device_get_channel_full_scale(i, false);
+			data_g.clip[i].full32 =
+					device_get_channel_full_scale(i, true);
+		}
+	}
+
 	if (!data__create_channels(channel_mask)) {
 		fprintf(stderr, "Error: data__create_channels failed\n");
 		return false;
@@ -665,6 +845,19 @@ bool data_start(bool calibrate, unsigned frequency, unsigned channel_mask)
 		}
 	}
 
+	if (!calibrate && rec_path != NULL && data_g.pipeline != NULL &&
+	    main_menu_config_get_record_outputs() &&
+	    !dpp_record(rec_path)) {
+		fprintf(stderr, "Warning: Continuing without recording "
+				"pipeline outputs\n");
+	}
+
+	quality_start(frequency, calibrate ? 0 : channel_mask);
+
+	if (!calibrate && !audio_start(frequency)) {
+		fprintf(stderr, "Warning: Continuing without audio\n");
+	}
+
 	data_g.enabled = true;
 
 	return true;
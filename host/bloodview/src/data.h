@@ -24,6 +24,19 @@
 #ifndef BV_DATA_H
 #define BV_DATA_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Clipping statistics for a channel. */
+struct data_clip_stats {
+	uint64_t samples;     /**< Samples checked. */
+	uint64_t high;        /**< Samples at full scale. */
+	uint64_t low;         /**< Samples at zero. */
+	uint32_t second_high; /**< Samples at full scale in the last second. */
+	uint32_t second_low;  /**< Samples at zero in the last second. */
+	uint32_t seconds;     /**< Seconds in which any samples clipped. */
+};
+
 /**
  * Finish a data processing session.
  */
@@ -32,12 +45,17 @@ void data_finish(void);
 /**
  * Start a data processing session.
  *
+ * If enabled in the config, an acquisition's data processing pipeline
+ * outputs are recorded alongside its recording.
+ *
  * \param[in]  calibrate     Whether this is a calibration acquisition.
  * \param[in]  frequency     The sampling frequency.
  * \param[in]  channel_mask  The channel mask.
+ * \param[in]  rec_path      Path of the recording, or NULL if not recording.
  * \return true on success, false on error.
  */
-bool data_start(bool calibrate, unsigned frequency, unsigned channel_mask);
+bool data_start(bool calibrate, unsigned frequency, unsigned channel_mask,
+		const char *rec_path);
 
 /**
  * Handle a BL_MSG_SAMPLE_DATA16 message.
@@ -55,4 +73,22 @@ bool data_handle_msg_u16(const bl_msg_sample_data_t *msg);
  */
 bool data_handle_msg_u32(const bl_msg_sample_data_t *msg);
 
+/**
+ * Get a channel's clipping statistics.
+ *
+ * Samples are counted as clipped if they are at zero or full scale.
+ * Statistics cover the current acquisition, or the last one if none is
+ * running.  They are updated once per second of samples, and when the
+ * acquisition finishes.
+ *
+ * This may be called from any thread.
+ *
+ * \param[in]  acq_channel  Acquisition channel to get statistics for.
+ * \param[out] stats        Returns the statistics on success.
+ * \return true on success, or false if the channel wasn't acquired.
+ */
+bool data_get_clip_stats(
+		unsigned acq_channel,
+		struct data_clip_stats *stats);
+
 #endif /* BV_DATA_H */
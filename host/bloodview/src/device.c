@@ -26,10 +26,13 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <inttypes.h>
 
 #include <unistd.h>
 
@@ -37,12 +40,17 @@
 #include "common/channel.h"
 
 #include "host/common/msg.h"
+#include "host/common/clock.h"
 #include "host/common/device.h"
+#include "host/common/sample.h"
+#include "host/common/catalogue.h"
 
 #include "data.h"
 #include "util.h"
 #include "device.h"
 #include "locked.h"
+#include "outputs.h"
+#include "quality.h"
 #include "main-menu.h"
 
 /** Special code for indicating the start of a calibration. */
@@ -54,6 +62,31 @@
 /** Maximum number of messages that can be queued for sending. */
 #define MSG_FIFO_MAX 32
 
+/** A period of poor signal quality, in acquisition sample numbers. */
+struct device_gate_span {
+	uint64_t start; /**< First sample of poor quality. */
+	uint64_t end;   /**< Sample after the last of poor quality. */
+};
+
+/**
+ * Signal quality gate for recordings.
+ *
+ * All channels are sampled together, so the gate opens and closes at a
+ * sample number, which is the same for every channel.  Channels' messages
+ * arrive in turn, so some channels are behind the others when the gate
+ * changes, and their samples before the change are treated as before it.
+ */
+struct device_gate {
+	bool     open; /**< Whether the signal quality is acceptable. */
+	uint64_t edge; /**< Sample number at which \ref open last changed. */
+
+	/** Number of samples received for each channel this acquisition. */
+	uint64_t samples[BL_CHANNEL_MAX];
+
+	struct device_gate_span *span; /**< Periods of poor quality. */
+	unsigned count; /**< Number of entries in span. */
+};
+
 /** Device module global context. */
 static struct {
 	locked_uint_t state;  /**< Mutex locked device state. */
@@ -77,8 +110,28 @@ static struct {
 
 	volatile uint8_t revision; /**< Device revision.  Zero means unset. */
 
+	/**
+	 * Number of commands that may await replies at once.
+	 *
+	 * This is one until the device reports that it accepts pipelined
+	 * commands, since older firmware loses commands sent back to back.
+	 */
+	unsigned pipeline;
+
 	FILE *rec; /**< File for acquisition recordings. */
-} bv_device_g;
+	char rec_path[80]; /**< Path of the current recording. */
+	struct bl_catalogue_scan rec_scan; /**< Catalogue scan of recording. */
+	struct device_gate gate; /**< Signal quality gate for recording. */
+
+	struct bl_clock clock;      /**< Device clock estimator. */
+	pthread_mutex_t clock_lock; /**< Lock for clock, read by other threads. */
+
+	/** Number of samples received for each channel this acquisition. */
+	uint64_t clock_samples[BL_CHANNEL_MAX];
+} bv_device_g = {
+	.pipeline = 1,
+	.clock_lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /**
  * Advance the a send message queue position pointer.
@@ -223,7 +276,8 @@ static FILE *device__open_recording(bool calibrate)
 	size_t len;
 	time_t rawtime;
 	struct tm *timeinfo;
-	static char buf[80];
+	char *buf = bv_device_g.rec_path;
+	size_t size = sizeof(bv_device_g.rec_path);
 
 	rawtime = time(NULL);
 	if (rawtime == (time_t)-1) {
@@ -237,19 +291,374 @@ static FILE *device__open_recording(bool calibrate)
 		return NULL;
 	}
 
-	len = strftime(buf, sizeof(buf), "%Y-%m-%d.%H:%M:%S", timeinfo);
+	len = strftime(buf, size, "%Y-%m-%d.%H:%M:%S", timeinfo);
 	assert(len > 0);
 
-	assert(sizeof(buf) > len + 4);
+	assert(size > len + 4);
 	memcpy(&buf[len], calibrate ? "-cal" : "-acq", 5);
 	len += 4;
 
-	assert(sizeof(buf) > len + 5);
+	assert(size > len + 5);
 	memcpy(&buf[len], ".yaml", 6);
 
+	bl_catalogue_scan_init(&bv_device_g.rec_scan, calibrate);
+
 	return fopen(buf, "w+");
 }
 
+/**
+ * Write a message to the current recording, if any.
+ *
+ * \param[in]  msg  The message to record.
+ */
+static void device__record(const union bl_msg_data *msg)
+{
+	if (bv_device_g.rec == NULL) {
+		return;
+	}
+
+	bl_msg_yaml_print(bv_device_g.rec, msg);
+	bl_catalogue_scan_msg(&bv_device_g.rec_scan, msg);
+}
+
+/**
+ * Reset the signal quality gate, for the start of an acquisition.
+ *
+ * This also frees the gate's record of periods of poor quality.
+ */
+static void device__gate_reset(void)
+{
+	struct device_gate *gate = &bv_device_g.gate;
+
+	free(gate->span);
+	memset(gate, 0, sizeof(*gate));
+	gate->open = true;
+}
+
+/**
+ * Get the number of samples received on the furthest ahead channel.
+ *
+ * \return the sample count.
+ */
+static uint64_t device__gate_samples(void)
+{
+	const struct device_gate *gate = &bv_device_g.gate;
+	uint64_t samples = 0;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		if (gate->samples[i] > samples) {
+			samples = gate->samples[i];
+		}
+	}
+
+	return samples;
+}
+
+/**
+ * Open or close the signal quality gate.
+ *
+ * \param[in]  open  Whether the signal quality is acceptable.
+ */
+static void device__gate_change(bool open)
+{
+	struct device_gate *gate = &bv_device_g.gate;
+	uint64_t edge = device__gate_samples();
+
+	if (open) {
+		if (gate->count != 0) {
+			gate->span[gate->count - 1].end = edge;
+		}
+	} else {
+		struct device_gate_span *span;
+
+		span = realloc(gate->span, sizeof(*span) * (gate->count + 1));
+		if (span != NULL) {
+			span[gate->count].start = edge;
+			span[gate->count].end = UINT64_MAX;
+			gate->span = span;
+			gate->count++;
+		}
+	}
+
+	fprintf(stderr, "Signal quality %s at sample %"PRIu64"%s\n",
+			open ? "recovered" : "poor", edge,
+			!quality_pause() ? "" :
+			open ? "; recording resumed" : "; recording paused");
+
+	gate->open = open;
+	gate->edge = edge;
+}
+
+/**
+ * Write a sample data message to the current recording, if any.
+ *
+ * If recording pauses while the signal quality is poor, only the samples
+ * passed by the signal quality gate are written.  If only pipeline outputs
+ * are recorded, no samples are written, but they are still counted in the
+ * recording's catalogue entry.
+ *
+ * \param[in]  msg  The sample data message to record.
+ */
+static void device__record_samples(const union bl_msg_data *msg)
+{
+	struct device_gate *gate = &bv_device_g.gate;
+	const bl_msg_sample_data_t *data = &msg->sample_data;
+	union bl_msg_data trimmed;
+	uint64_t start, first, last;
+	unsigned skip;
+
+	if (data->channel >= BL_CHANNEL_MAX) {
+		device__record(msg);
+		return;
+	}
+
+	if (quality_ok() != gate->open) {
+		device__gate_change(!gate->open);
+	}
+
+	start = gate->samples[data->channel];
+	first = start;
+	last = start + data->count;
+	gate->samples[data->channel] = last;
+
+	/* Only the pipeline outputs are wanted.  The catalogue still
+	 * counts the samples, since the outputs cover them. */
+	if (!outputs_record_raw()) {
+		if (bv_device_g.rec != NULL) {
+			bl_catalogue_scan_msg(&bv_device_g.rec_scan, msg);
+		}
+		return;
+	}
+
+	if (!quality_pause()) {
+		device__record(msg);
+		return;
+	}
+
+	/* Samples from the edge on are on the current side of the gate,
+	 * and samples before it are on the other side. */
+	if (gate->open) {
+		first = (first > gate->edge) ? first : gate->edge;
+	} else {
+		last = (last < gate->edge) ? last : gate->edge;
+	}
+
+	if (first >= last) {
+		return;
+	}
+
+	if (last - first == data->count) {
+		device__record(msg);
+		return;
+	}
+
+	skip = first - start;
+	trimmed = *msg;
+	trimmed.sample_data.count = last - first;
+	if (data->type == BL_MSG_SAMPLE_DATA16) {
+		memmove(trimmed.sample_data.data16,
+				trimmed.sample_data.data16 + skip,
+				sizeof(data->data16[0]) * (last - first));
+	} else {
+		memmove(trimmed.sample_data.data32,
+				trimmed.sample_data.data32 + skip,
+				sizeof(data->data32[0]) * (last - first));
+	}
+
+	device__record(&trimmed);
+}
+
+/**
+ * Write the signal quality section of a recording metadata file.
+ *
+ * \param[in]  file  The metadata file.
+ */
+static void device__write_quality_meta(FILE *file)
+{
+	const struct device_gate *gate = &bv_device_g.gate;
+	uint64_t samples = device__gate_samples();
+	bool header = false;
+
+	for (unsigned i = 0; i < sizeof(unsigned) * CHAR_BIT; i++) {
+		struct quality_stats stats;
+
+		if (!quality_get(i, &stats)) {
+			continue;
+		}
+
+		if (!header) {
+			fprintf(file, "quality:\n");
+			fprintf(file, "  threshold: %u\n", quality_threshold());
+			fprintf(file, "  paused: %s\n",
+					quality_pause() ? "true" : "false");
+			fprintf(file, "  channels:\n");
+			header = true;
+		}
+
+		fprintf(file, "    - channel: %u\n", i);
+		fprintf(file, "      mean: %.1f\n", stats.mean);
+		fprintf(file, "      estimates: %"PRIu32"\n", stats.estimates);
+	}
+
+	if (!header || gate->count == 0) {
+		return;
+	}
+
+	fprintf(file, "  poor:\n");
+	for (unsigned i = 0; i < gate->count; i++) {
+		uint64_t end = gate->span[i].end;
+
+		fprintf(file, "    - start: %"PRIu64"\n", gate->span[i].start);
+		fprintf(file, "      end: %"PRIu64"\n",
+				(end == UINT64_MAX) ? samples : end);
+	}
+}
+
+/**
+ * Add the current recording to the recording catalogue.
+ *
+ * The catalogue is in the same directory as the recordings.
+ */
+static void device__catalogue_recording(void)
+{
+	struct bl_catalogue_entry entry;
+	struct bl_clock_map map;
+	bool have_map = device_get_clock_map(&map);
+
+	if (!bl_catalogue_scan_finish(&bv_device_g.rec_scan,
+			bv_device_g.rec_path, have_map ? &map : NULL,
+			&entry)) {
+		return;
+	}
+
+	if (!bl_catalogue_append(BL_CATALOGUE_DEFAULT_PATH, &entry)) {
+		fprintf(stderr, "Warning: Failed to add recording "
+				"to catalogue.\n");
+	}
+
+	free(entry.path);
+}
+
+/**
+ * Write the metadata file for the current recording.
+ *
+ * The metadata file is named after the recording, with a ".meta.yaml"
+ * extension instead of ".yaml".  It records the mapping from sample number
+ * to host time, per-channel clipping statistics from the data module,
+ * signal quality statistics, with any periods of poor quality, and the
+ * details of any recorded pipeline outputs.
+ */
+static void device__write_recording_meta(void)
+{
+	const char *rec_path = bv_device_g.rec_path;
+	char path[sizeof(bv_device_g.rec_path) + 5];
+	size_t len = strlen(rec_path) - strlen(".yaml");
+	struct bl_clock_map map;
+	bool header = false;
+	FILE *file;
+
+	memcpy(path, rec_path, len);
+	memcpy(path + len, ".meta.yaml", sizeof(".meta.yaml"));
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Warning: Failed to open recording "
+				"metadata file.\n");
+		return;
+	}
+
+	fprintf(file, "recording: %s\n", rec_path);
+
+	if (device_get_clock_map(&map)) {
+		bl_clock_map_write(file, &map);
+	}
+
+	for (unsigned i = 0; i < sizeof(unsigned) * CHAR_BIT; i++) {
+		struct data_clip_stats stats;
+
+		if (!data_get_clip_stats(i, &stats)) {
+			continue;
+		}
+
+		if (!header) {
+			fprintf(file, "clipping:\n");
+			header = true;
+		}
+
+		fprintf(file, "  - channel: %u\n", i);
+		fprintf(file, "    samples: %"PRIu64"\n", stats.samples);
+		fprintf(file, "    high: %"PRIu64"\n", stats.high);
+		fprintf(file, "    low: %"PRIu64"\n", stats.low);
+		fprintf(file, "    seconds: %"PRIu32"\n", stats.seconds);
+	}
+
+	device__write_quality_meta(file);
+	outputs_write_meta(file, rec_path);
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Warning: Failed to write recording "
+				"metadata file.\n");
+	}
+}
+
+/**
+ * Close the current recording, if any, write its metadata, and add it to
+ * the recording catalogue.
+ *
+ * The data module must have finished with the acquisition, so that its
+ * statistics are complete.
+ */
+static void device__close_recording(void)
+{
+	if (bv_device_g.rec == NULL) {
+		return;
+	}
+
+	fclose(bv_device_g.rec);
+	bv_device_g.rec = NULL;
+
+	device__write_recording_meta();
+	device__catalogue_recording();
+}
+
+/**
+ * Reset the device clock estimator, for the start of an acquisition.
+ *
+ * \param[in]  frequency  The acquisition's sampling rate.
+ */
+static void device__clock_start(unsigned frequency)
+{
+	pthread_mutex_lock(&bv_device_g.clock_lock);
+	bl_clock_init(&bv_device_g.clock, frequency);
+	memset(bv_device_g.clock_samples, 0,
+			sizeof(bv_device_g.clock_samples));
+	pthread_mutex_unlock(&bv_device_g.clock_lock);
+}
+
+/**
+ * Add a sample data message's arrival to the device clock estimator.
+ *
+ * All channels are sampled on the same device clock, so every channel's
+ * messages contribute to the one estimate.
+ *
+ * \param[in]  msg   The sample data message.
+ * \param[in]  host  The CLOCK_MONOTONIC time the message arrived.
+ */
+static void device__clock_add(
+		const bl_msg_sample_data_t *msg,
+		double host)
+{
+	if (msg->channel >= BL_CHANNEL_MAX || msg->count == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&bv_device_g.clock_lock);
+	bv_device_g.clock_samples[msg->channel] += msg->count;
+	bl_clock_add(&bv_device_g.clock,
+			bv_device_g.clock_samples[msg->channel] - 1, host);
+	pthread_mutex_unlock(&bv_device_g.clock_lock);
+}
+
 /**
  * Get the channel mask, according to the acquisition mode.
  *
@@ -275,17 +684,80 @@ static unsigned device__get_channel_mask(uint16_t src_mask)
 	return mask;
 }
 
+/** Commands sent to the device which are awaiting replies, oldest first. */
+struct device_outstanding {
+	enum bl_msg_type type[BL_MSG_PIPELINE_MAX]; /**< Command types. */
+	unsigned count; /**< Number of commands awaiting replies. */
+};
+
+/**
+ * Find the oldest outstanding command of a given type.
+ *
+ * \param[in]  outstanding  The outstanding commands.
+ * \param[in]  type         The command type to look for.
+ * \return index of the command, or outstanding->count if not found.
+ */
+static unsigned device__outstanding_find(
+		const struct device_outstanding *outstanding,
+		enum bl_msg_type type)
+{
+	unsigned i;
+
+	for (i = 0; i < outstanding->count; i++) {
+		if (outstanding->type[i] == type) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * Retire the oldest outstanding command of a given type.
+ *
+ * Replies are expected in order, so this is usually the first entry.
+ *
+ * \param[in,out]  outstanding  The outstanding commands.
+ * \param[in]      type         The type of command which has been replied to.
+ * \return true if a command of the given type was outstanding.
+ */
+static bool device__outstanding_complete(
+		struct device_outstanding *outstanding,
+		enum bl_msg_type type)
+{
+	unsigned i = device__outstanding_find(outstanding, type);
+
+	if (i == outstanding->count) {
+		return false;
+	}
+
+	outstanding->count--;
+	for (; i < outstanding->count; i++) {
+		outstanding->type[i] = outstanding->type[i + 1];
+	}
+
+	return true;
+}
+
 /**
  * Send a queued message, if any.
  *
- * \param[out]  sent_type  Returns the type of any sent message.
+ * \param[in,out]  outstanding  Commands awaiting replies.  Any sent
+ *                              message is added.
+ * \param[out]     consumed     Returns whether a queued message was
+ *                              consumed.
  * \return false on error, or true otherwise.
  */
 static bool device__thread_send_msg(
-		enum bl_msg_type *sent_type)
+		struct device_outstanding *outstanding,
+		bool *consumed)
 {
 	static bool calibrating;
 	union bl_msg_data *send_msg = device__msg_get_next_queued();
+
+	assert(outstanding->count < BL_MSG_PIPELINE_MAX);
+
+	*consumed = false;
 	if (send_msg == NULL) {
 		return true;
 	}
@@ -301,30 +773,34 @@ static bool device__thread_send_msg(
 
 		calibrating = (send_msg->type == MSG_START_SPECIAL_CAL);
 		device__msg_sent(send_msg);
+		*consumed = true;
 		return true;
 	}
 
 	if (bl_msg_write(bv_device_g.dev_fd, "Discovered device", send_msg)) {
-		*sent_type = send_msg->type;
+		outstanding->type[outstanding->count++] = send_msg->type;
 		if (send_msg->type == BL_MSG_START) {
 			unsigned channel_mask = device__get_channel_mask(
 					send_msg->start.src_mask);
 			if (!data_start(calibrating,
 					send_msg->start.frequency,
-					channel_mask)) {
+					channel_mask,
+					bv_device_g.rec != NULL ?
+						bv_device_g.rec_path : NULL)) {
 				fprintf(stderr, "Error in data_start\n");
 				/* TODO: If this fails, we'll block on
 				 * never clearing this message. */
 				return false;
 			}
+			device__clock_start(send_msg->start.frequency);
+			device__gate_reset();
 		}
 
-		if (bv_device_g.rec != NULL) {
-			bl_msg_yaml_print(bv_device_g.rec, send_msg);
-		}
+		device__record(send_msg);
 		bl_msg_yaml_print(stderr, send_msg);
 
 		device__msg_sent(send_msg);
+		*consumed = true;
 	}
 
 	return true;
@@ -333,21 +809,20 @@ static bool device__thread_send_msg(
 /**
  * Handle an incoming response message sent from the device.
  *
- * \param[in]  sent_type  The type of any outstanding sent message.
- * \param[in]  recv_msg   The incoming response message to handle.
- * \return BL_MSG__COUNT if the recv_msg was a response to sent_type,
- *         or sent_type otherwise.
+ * \param[in,out]  outstanding  Commands awaiting replies.  Any command
+ *                              this is the response to is removed.
+ * \param[in]      recv_msg     The incoming response message to handle.
  */
-static enum bl_msg_type device__thread_receive_msg_response(
-		const enum bl_msg_type  *sent_type,
-		const union bl_msg_data *recv_msg)
+static void device__thread_receive_msg_response(
+		struct device_outstanding *outstanding,
+		const union bl_msg_data   *recv_msg)
 {
-	if (recv_msg->response.response_to == *sent_type) {
-		if (bv_device_g.rec != NULL) {
-			bl_msg_yaml_print(bv_device_g.rec, recv_msg);
-		}
+	enum bl_msg_type type = bl_msg_reply_to(recv_msg);
 
-		switch (*sent_type) {
+	if (device__outstanding_complete(outstanding, type)) {
+		device__record(recv_msg);
+
+		switch (type) {
 		case BL_MSG_START:
 			if (recv_msg->response.error_code == BL_ERROR_NONE) {
 				device__set_state(DEVICE_STATE_ACTIVE);
@@ -360,23 +835,16 @@ static enum bl_msg_type device__thread_receive_msg_response(
 			if (recv_msg->response.error_code == BL_ERROR_NONE) {
 				device__set_state(DEVICE_STATE_IDLE);
 				data_finish();
-
-				if (bv_device_g.rec != NULL) {
-					fclose(bv_device_g.rec);
-					bv_device_g.rec = NULL;
-				}
+				device__close_recording();
 			}
 			break;
 		default:
 			break;
 		}
 
-		bl_msg_yaml_print(stderr, recv_msg);
-		return BL_MSG__COUNT;
 	}
 
 	bl_msg_yaml_print(stderr, recv_msg);
-	return *sent_type;
 }
 
 /** Array of device source capabilities. */
@@ -414,48 +882,52 @@ static void device__update_source_cap(
 /**
  * Handle an incoming message sent from the device.
  *
- * \param[in,out]  sent_type  The type of any outstanding sent message.
- *                            Returns BL_MSG__COUNT if the incoming message
- *                            was a response to this type.
+ * \param[in,out]  outstanding  Commands awaiting replies.  Any command
+ *                              the incoming message replies to is removed.
  */
 static void device__thread_receive_msg(
-		enum bl_msg_type *sent_type)
+		struct device_outstanding *outstanding)
 {
 	union bl_msg_data recv_msg;
 
 	if (bl_msg_read(bv_device_g.dev_fd, 1000 / 3, &recv_msg)) {
+		double arrival = bl_clock_monotonic();
 		unsigned failed_reads = 0;
 
 		switch (recv_msg.type) {
 		case BL_MSG_RESPONSE:
-			*sent_type = device__thread_receive_msg_response(
-					sent_type, &recv_msg);
+			device__thread_receive_msg_response(
+					outstanding, &recv_msg);
 			break;
 
 		case BL_MSG_SOURCE_CAP:
 			device__update_source_cap(&recv_msg.source_cap);
 			bl_msg_yaml_print(stderr, &recv_msg);
-			*sent_type = BL_MSG__COUNT;
+			device__outstanding_complete(outstanding,
+					bl_msg_reply_to(&recv_msg));
 			break;
 
 		case BL_MSG_SAMPLE_DATA16:
+			device__clock_add(&recv_msg.sample_data, arrival);
 			data_handle_msg_u16(&recv_msg.sample_data);
-			if (bv_device_g.rec != NULL) {
-				bl_msg_yaml_print(bv_device_g.rec, &recv_msg);
-			}
+			device__record_samples(&recv_msg);
 			break;
 
 		case BL_MSG_SAMPLE_DATA32:
+			device__clock_add(&recv_msg.sample_data, arrival);
 			data_handle_msg_u32(&recv_msg.sample_data);
-			if (bv_device_g.rec != NULL) {
-				bl_msg_yaml_print(bv_device_g.rec, &recv_msg);
-			}
+			device__record_samples(&recv_msg);
 			break;
 
 		case BL_MSG_VERSION:
 			bv_device_g.revision = recv_msg.version.revision;
+			if (recv_msg.version.capabilities &
+					BL_MSG_CAP_PIPELINE) {
+				bv_device_g.pipeline = BL_MSG_PIPELINE_MAX;
+			}
 			bl_msg_yaml_print(stderr, &recv_msg);
-			*sent_type = BL_MSG__COUNT;
+			device__outstanding_complete(outstanding,
+					bl_msg_reply_to(&recv_msg));
 			break;
 
 		default:
@@ -483,26 +955,37 @@ static void device__thread_receive_msg(
  */
 static void *device__thread(void *ctx)
 {
-	enum bl_msg_type sent_type = BL_MSG__COUNT;
+	struct device_outstanding outstanding = {
+		.count = 0,
+	};
 
 	if (ctx != &bv_device_g) {
 		return NULL;
 	}
 
 	while (bv_device_g.quit == false ) {
-		if (sent_type == BL_MSG__COUNT) {
-			/* Not already waiting for outstanding response. */
-			if (!device__thread_send_msg(&sent_type)) {
+		/* Send as many queued messages as the device can buffer
+		 * replies for.  Nothing may follow an abort until it has
+		 * been acknowledged, since that ends the current recording. */
+		while (outstanding.count < bv_device_g.pipeline &&
+		       device__outstanding_find(&outstanding, BL_MSG_ABORT) ==
+				outstanding.count) {
+			bool consumed;
+
+			if (!device__thread_send_msg(&outstanding, &consumed)) {
 				fprintf(stderr, "Fatal error\n");
 				return NULL;
 			}
+			if (!consumed) {
+				break;
+			}
 		}
 
-		if ((sent_type != BL_MSG__COUNT) ||
+		if ((outstanding.count != 0) ||
 		    (device__get_current_state() == DEVICE_STATE_ACTIVE)) {
-			/* Awaiting response to sent message,
+			/* Awaiting responses to sent messages,
 			 * or running an acquisition. */
-			device__thread_receive_msg(&sent_type);
+			device__thread_receive_msg(&outstanding);
 		} else {
 			/* When we're not waiting for messages, don't
 			 * thrash the device thread main loop. */
@@ -605,6 +1088,26 @@ enum bl_acq_source device_get_channel_source(uint8_t channel)
 	return BL_ACQ_SOURCE_MAX;
 }
 
+/* Exported function, documented in device.h */
+uint32_t device_get_channel_full_scale(uint8_t channel, bool sample32)
+{
+	enum bl_acq_source source = device_get_channel_source(channel);
+	bl_msg_source_conf_t conf = { 0 };
+
+	if (source < BL_ACQ_SOURCE_MAX) {
+		conf.source        = source;
+		conf.sw_oversample = main_menu_config_get_source_sw_oversample(source);
+		conf.hw_oversample = main_menu_config_get_source_hw_oversample(source);
+		conf.hw_shift      = main_menu_config_get_source_hw_shift(source);
+	}
+
+	return bl_sample_full_scale(
+			(source < BL_ACQ_SOURCE_MAX) ? &conf : NULL,
+			main_menu_config_get_channel_offset(channel),
+			main_menu_config_get_channel_shift(channel),
+			sample32 ? BL_MSG_SAMPLE_DATA32 : BL_MSG_SAMPLE_DATA16);
+}
+
 /**
  * Configure a channel on the device.
  *
@@ -903,13 +1406,12 @@ bool device_stop(void)
 	return true;
 }
 
-/**
- * Await device version response.
- *
- * \return true on success, false otherwise.
- */
-static bool device__await_revision(void)
+/* Exported function, documented in device.h */
+bool device_await_revision(void)
 {
+	const struct timespec poll_interval = {
+		.tv_nsec = 1000 * 1000,
+	};
 	struct timespec time_start;
 	struct timespec time_check;
 	int ret;
@@ -935,6 +1437,8 @@ static bool device__await_revision(void)
 			fprintf(stderr, "Error: Timed out awaiting device revision.\n");
 			return false;
 		}
+
+		nanosleep(&poll_interval, NULL);
 	}
 
 	return true;
@@ -943,7 +1447,8 @@ static bool device__await_revision(void)
 /**
  * Get device info.
  *
- * This queues messages to query the device.
+ * This queues messages to query the device.  The replies are handled by
+ * the device thread, so this doesn't wait for them.
  *
  * \return true on success, or false on error.
  */
@@ -959,10 +1464,6 @@ bool device__query(void)
 		}
 	}
 
-	if (!device__await_revision()) {
-		return false;
-	}
-
 	return true;
 }
 
@@ -1071,10 +1572,8 @@ void device_fini(void)
 	memset(&bv_device_g.thread_id, 0,
 			sizeof(bv_device_g.thread_id));
 
-	if (bv_device_g.rec != NULL) {
-		fclose(bv_device_g.rec);
-		bv_device_g.rec = NULL;
-	}
+	device__close_recording();
+	device__gate_reset();
 
 	bl_device_close(bv_device_g.dev_fd);
 	bv_device_g.dev_fd = 0;
@@ -1096,3 +1595,15 @@ unsigned device_get_revision(void)
 {
 	return bv_device_g.revision;
 }
+
+/* Exported function, documented in device.h */
+bool device_get_clock_map(struct bl_clock_map *map)
+{
+	bool ok;
+
+	pthread_mutex_lock(&bv_device_g.clock_lock);
+	ok = bl_clock_get(&bv_device_g.clock, map);
+	pthread_mutex_unlock(&bv_device_g.clock_lock);
+
+	return ok;
+}
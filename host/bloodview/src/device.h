@@ -26,6 +26,8 @@
 
 #include <common/acq.h>
 
+struct bl_clock_map;
+
 /** List of device states. */
 typedef enum device_state {
 	DEVICE_STATE_NONE,
@@ -60,6 +62,10 @@ typedef void (* device_state_change_cb)(
  *
  * This will try to connect to a device, and fail if it can't.
  *
+ * The device's revision and source capabilities are queried, but this
+ * doesn't wait for the replies.  Call \ref device_await_revision before
+ * relying on \ref device_get_revision.
+ *
  * \param[in]  dev_path Node to open, or NULL for device discovery.
  * \param[in]  cb       Callback to handle device state changes.
  * \param[in]  pw       Client private context data.
@@ -119,11 +125,42 @@ const struct device_source_cap *device_get_source_cap(
  */
 enum bl_acq_source device_get_channel_source(uint8_t channel);
 
+/**
+ * Get the largest sample value a channel can produce, from the config.
+ *
+ * \param[in]  channel   The channel to get the full scale of.
+ * \param[in]  sample32  Whether the channel's samples are 32-bit.
+ * \return the channel's full scale sample value.
+ */
+uint32_t device_get_channel_full_scale(uint8_t channel, bool sample32);
+
+/**
+ * Wait for the device to report its hardware revision.
+ *
+ * Gives up if the device hasn't replied within two seconds.
+ *
+ * \return true on success, or false on error.
+ */
+bool device_await_revision(void);
+
 /**
  * Get the hardware revision.
  *
- * \return the hardware revision.
+ * \return the hardware revision, or zero if it is not yet known.
  */
 unsigned device_get_revision(void);
 
+/**
+ * Get the current acquisition's mapping from sample number to host time.
+ *
+ * The mapping is refined as sample data arrives, so it may be called
+ * repeatedly during an acquisition.  It is kept after the acquisition
+ * ends, until the next one starts.  It is also written to the recording's
+ * metadata file.
+ *
+ * \param[out] map  Returns the mapping on success.
+ * \return true on success, or false if too little data has arrived.
+ */
+bool device_get_clock_map(struct bl_clock_map *map);
+
 #endif /* BV_DEVICE_H */
@@ -29,12 +29,21 @@
 #include "sdl-tk/colour.h"
 
 #include "../util.h"
+#include "../audio.h"
 #include "../graph.h"
+#include "../outputs.h"
 
 #include "dpp.h"
 #include "file.h"
 #include "filter.h"
 
+#include "filter/acdc.h"
+#include "filter/band.h"
+#include "filter/fir.h"
+#include "filter/beat.h"
+#include "filter/hrv.h"
+#include "filter/xcorr.h"
+#include "filter/savgol.h"
 #include "filter/average.h"
 #include "filter/derivative.h"
 
@@ -64,6 +73,9 @@ struct dpp_filter {
 
 	unsigned *filter_inputs;
 	unsigned *filter_outputs;
+
+	bool live;   /**< Whether the filter is currently being run. */
+	bool wanted; /**< Liveness scratch space. */
 };
 
 /** Internal graph representation. */
@@ -72,6 +84,8 @@ struct dpp_graph {
 	const struct bv_graph *graph;     /**< Loaded graph context. */
 
 	unsigned dpp_offset; /**< Offset in the data processing pipeline. */
+	bool live; /**< Whether the graph is currently displayed. */
+	bool monitored; /**< Whether the graph is played as audio. */
 };
 
 /** Global context for the data processing pipeline module. */
@@ -90,6 +104,11 @@ struct {
 
 	struct dpp_graph *graph;
 	unsigned graph_count;
+
+	bool *demand; /**< Per pipeline slot; whether anything consumes it. */
+
+	const struct bv_setup *setup; /**< The running setup. */
+	uint32_t *record; /**< Graph values to record, or NULL if not. */
 } dpp_g; /**< Module's global context. */
 
 /**
@@ -124,6 +143,13 @@ static void dpp__cleanup(void)
 	}
 	dpp_g.graph_count = 0;
 
+	free(dpp_g.demand);
+	dpp_g.demand = NULL;
+
+	free(dpp_g.record);
+	dpp_g.record = NULL;
+	dpp_g.setup = NULL;
+
 	dpp_g.dpp_offset_next = 0;
 	dpp_g.pipeline_len = 0;
 	dpp_g.frequency = 0;
@@ -162,6 +188,34 @@ static bool dpp__init_filter(void)
 		return false;
 	}
 
+	if (!filter_savgol_register()) {
+		return false;
+	}
+
+	if (!filter_xcorr_register()) {
+		return false;
+	}
+
+	if (!filter_band_register()) {
+		return false;
+	}
+
+	if (!filter_fir_register()) {
+		return false;
+	}
+
+	if (!filter_beat_register()) {
+		return false;
+	}
+
+	if (!filter_hrv_register()) {
+		return false;
+	}
+
+	if (!filter_acdc_register()) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -435,6 +489,7 @@ static bool dpp__get_dpp_filter(
 
 	f[dpp_g.filter_count].context = context;
 	f[dpp_g.filter_count].filter = filter;
+	f[dpp_g.filter_count].live = true;
 
 	f[dpp_g.filter_count].output_count = out_count;
 	f[dpp_g.filter_count].output = output;
@@ -771,12 +826,22 @@ static bool dpp__filter_validate(void)
 						f->input[j].name);
 				return false;
 			}
+		}
+
+		/* Filters may have outputs that the pipeline doesn't use.
+		 * They still need somewhere to write to. */
+		for (unsigned j = 0; j < f->output_count; j++) {
 			if (f->output[j].set == false) {
-				fprintf(stderr, "Error: Filter %s: "
-						"output %s unset\n",
-						f->filter->filter,
-						f->output[j].name);
-				return false;
+				const struct bv_filter *spec;
+
+				spec = dpp__get_filter_spec(f->filter->filter);
+				if (spec == NULL) {
+					return false;
+				}
+
+				f->output[j].name = spec->output[j].name;
+				f->output[j].dpp_offset = dpp__next_dpp_offset();
+				f->output[j].set = true;
 			}
 		}
 	}
@@ -784,6 +849,42 @@ static bool dpp__filter_validate(void)
 	return true;
 }
 
+/**
+ * Get the key identifying a filter's place in the data processing setup.
+ *
+ * Filters get the same key in any setup which runs the same pipeline on
+ * the same acquisition channels, so state can be carried between them.
+ *
+ * \param[in]  f  Filter internal representation to get key for.
+ * \return newly allocated key on success, or NULL on failure.
+ */
+static char *dpp__filter_key(const struct dpp_filter *f)
+{
+	const struct bv_context *ctx = f->context;
+	char *key = NULL;
+	size_t size;
+	FILE *stream;
+
+	stream = open_memstream(&key, &size);
+	if (stream == NULL) {
+		return NULL;
+	}
+
+	fprintf(stream, "%s/%s", ctx->pipeline, f->filter->label);
+	for (unsigned i = 0; i < ctx->channel_count; i++) {
+		fprintf(stream, "%c%s=%u", (i == 0) ? '@' : ',',
+				ctx->channel[i].label,
+				ctx->channel[i].channel);
+	}
+
+	if (fclose(stream) != 0) {
+		free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
 /**
  * Create a filter for a particular filter's internal representation.
  *
@@ -794,6 +895,8 @@ static bool dpp__filter_create_filter(struct dpp_filter *f)
 {
 	unsigned *input = malloc(f->input_count * sizeof(*input));
 	unsigned *output = malloc(f->output_count * sizeof(*output));
+	char *key;
+	bool ok;
 
 	if (input == NULL || output == NULL) {
 		free(input);
@@ -812,17 +915,22 @@ static bool dpp__filter_create_filter(struct dpp_filter *f)
 	f->filter_inputs = input;
 	f->filter_outputs = output;
 
-	if (!filter_add(f->filter->filter,
+	key = dpp__filter_key(f);
+	if (key == NULL) {
+		return false;
+	}
+
+	ok = filter_add(key,
+			f->filter->filter,
 			f->filter->parameters,
 			f->filter_outputs,
 			f->filter_inputs,
 			f->filter->parameters_count,
 			f->output_count,
-			f->input_count)) {
-		return false;
-	}
+			f->input_count);
 
-	return true;
+	free(key);
+	return ok;
 }
 
 /**
@@ -946,6 +1054,8 @@ static bool dpp__get_dpp_graph(
 
 	g[dpp_g.graph_count].context = ctx;
 	g[dpp_g.graph_count].graph = graph;
+	g[dpp_g.graph_count].live = true;
+	g[dpp_g.graph_count].monitored = true;
 
 	*dpp_graph = &g[dpp_g.graph_count];
 	dpp_g.graph_count++;
@@ -1215,34 +1325,220 @@ bool dpp_start(
 		return false;
 	}
 
+	dpp_g.demand = calloc(dpp_g.pipeline_len, sizeof(*dpp_g.demand));
+	if (dpp_g.demand == NULL) {
+		free(pipeline);
+		dpp__cleanup();
+		filter_finish();
+		return false;
+	}
+
+	dpp_g.setup = &dpp_g.dpp->setup[dpp_index];
+
 	*pipeline_out = pipeline;
 	*channels_out = dpp_g.channel_count;
 	return true;
 }
 
+/* Exported interface, documented in dpp.h */
+bool dpp_record(const char *rec_path)
+{
+	const char **names;
+	bool ok;
+
+	if (dpp_g.graph_count == 0) {
+		fprintf(stderr, "Error: DPP: No graphs to record.\n");
+		return false;
+	}
+
+	names = calloc(dpp_g.graph_count, sizeof(*names));
+	if (names == NULL) {
+		return false;
+	}
+
+	dpp_g.record = calloc(dpp_g.graph_count, sizeof(*dpp_g.record));
+	if (dpp_g.record == NULL) {
+		free(names);
+		return false;
+	}
+
+	for (unsigned i = 0; i < dpp_g.graph_count; i++) {
+		names[i] = dpp_g.graph[i].graph->name;
+	}
+
+	ok = outputs_start(rec_path, dpp_g.setup->name, dpp_g.frequency,
+			dpp_g.graph_count, names);
+	free(names);
+
+	if (!ok) {
+		free(dpp_g.record);
+		dpp_g.record = NULL;
+	}
+
+	return ok;
+}
+
 /* Exported interface, documented in dpp.h */
 void dpp_stop(struct bv_value *pipeline)
 {
+	outputs_finish();
+
+	/* Keep filter history, so restarting doesn't mean warming up again. */
+	filter_checkpoint();
+
 	dpp__cleanup();
 	filter_finish();
 
 	free(pipeline);
 }
 
+/**
+ * Work out which filters have a consumer for their output.
+ *
+ * A pipeline slot is in demand if a displayed, monitored or recorded graph
+ * reads it, or if it is an input to a filter which is itself live.  Filters
+ * are live if any of their outputs are in demand.  Filters are not
+ * necessarily stored in dependency order, so this iterates until nothing
+ * changes.
+ */
+static void dpp__liveness_compute(void)
+{
+	bool changed;
+
+	memset(dpp_g.demand, 0, dpp_g.pipeline_len * sizeof(*dpp_g.demand));
+
+	for (unsigned i = 0; i < dpp_g.graph_count; i++) {
+		if (dpp_g.graph[i].live || dpp_g.graph[i].monitored ||
+		    dpp_g.record != NULL) {
+			dpp_g.demand[dpp_g.graph[i].dpp_offset] = true;
+		}
+	}
+
+	for (unsigned i = 0; i < dpp_g.filter_count; i++) {
+		dpp_g.filter[i].wanted = false;
+	}
+
+	do {
+		changed = false;
+
+		for (unsigned i = 0; i < dpp_g.filter_count; i++) {
+			struct dpp_filter *f = &dpp_g.filter[i];
+
+			if (f->wanted) {
+				continue;
+			}
+
+			for (unsigned j = 0; j < f->output_count; j++) {
+				if (dpp_g.demand[f->filter_outputs[j]]) {
+					f->wanted = true;
+					break;
+				}
+			}
+
+			if (!f->wanted) {
+				continue;
+			}
+
+			for (unsigned j = 0; j < f->input_count; j++) {
+				dpp_g.demand[f->filter_inputs[j]] = true;
+			}
+			changed = true;
+		}
+	} while (changed);
+}
+
+/**
+ * Suspend pipeline branches which nobody is looking at or listening to.
+ *
+ * Filters which are resumed restart from their initial state, and graphs
+ * which are shown again have their history cleared, since neither has seen
+ * the samples that arrived while they were suspended.
+ *
+ * \return true on success, false otherwise.
+ */
+static bool dpp__liveness_update(void)
+{
+	bool changed = false;
+
+	for (unsigned i = 0; i < dpp_g.graph_count; i++) {
+		bool monitored = audio_is_monitored(i);
+		bool live = graph_is_visible(i);
+
+		if (dpp_g.graph[i].monitored != monitored) {
+			dpp_g.graph[i].monitored = monitored;
+			changed = true;
+		}
+
+		if (dpp_g.graph[i].live != live) {
+			if (live) {
+				graph_data_reset(i);
+			}
+			dpp_g.graph[i].live = live;
+			changed = true;
+		}
+	}
+
+	if (!changed) {
+		return true;
+	}
+
+	dpp__liveness_compute();
+
+	for (unsigned i = 0; i < dpp_g.filter_count; i++) {
+		struct dpp_filter *f = &dpp_g.filter[i];
+
+		if (f->live == f->wanted) {
+			continue;
+		}
+
+		if (!filter_set_active(i, f->wanted)) {
+			return false;
+		}
+		f->live = f->wanted;
+	}
+
+	return true;
+}
+
 /* Exported interface, documented in dpp.h */
 bool dpp_process(struct bv_value *pipeline)
 {
+	if (!dpp__liveness_update()) {
+		return false;
+	}
+
 	if (!filter_proc(pipeline, dpp_g.pipeline_len)) {
 		return false;
 	}
 
 	for (unsigned i = 0; i < dpp_g.graph_count; i++) {
-		if (!graph_data_add(i, bv_value_unsigned(
-				&pipeline[dpp_g.graph[i].dpp_offset]) - INT32_MAX)) {
+		uint32_t sample;
+		int32_t value;
+
+		if (!dpp_g.graph[i].live && !dpp_g.graph[i].monitored &&
+		    dpp_g.record == NULL) {
+			continue;
+		}
+
+		sample = bv_value_unsigned(&pipeline[dpp_g.graph[i].dpp_offset]);
+		if (dpp_g.record != NULL) {
+			dpp_g.record[i] = sample;
+		}
+
+		value = sample - INT32_MAX;
+		if (dpp_g.graph[i].monitored) {
+			audio_data_add(i, value);
+		}
+
+		if (dpp_g.graph[i].live && !graph_data_add(i, value)) {
 			return false;
 		}
 	}
 
+	if (dpp_g.record != NULL) {
+		outputs_add(dpp_g.record);
+	}
+
 	return true;
 }
 
@@ -193,9 +193,24 @@ bool dpp_start(
 		struct bv_value **pipeline_out,
 		unsigned *channels_out);
 
+/**
+ * Record the values of every graph in the running setup.
+ *
+ * The values are recorded next to the acquisition's recording, until
+ * \ref dpp_stop, whether or not the graphs are displayed.
+ *
+ * \param[in]  rec_path  Path of the acquisition's recording.
+ * \return true on success, false otherwise.
+ */
+bool dpp_record(const char *rec_path);
+
 /**
  * Stop an acquisition and clean it up.
  *
+ * The state of filters which support it is kept, and restored into the
+ * same filters if a later \ref dpp_start uses a setup which runs the same
+ * pipelines on the same channels at the same sampling rate.
+ *
  * \param[in]  pipeline  The data processing pipeline.
  * \return true on success, false otherwise.
  */
@@ -207,6 +222,10 @@ void dpp_stop(struct bv_value *pipeline);
  * The input channel data must have already been inserted into the first
  * entries of the array.
  *
+ * Only the filters which contribute to a displayed graph are run.  Hidden
+ * branches are suspended, and reset when they are displayed again.  While
+ * the graphs are being recorded, every branch is run.
+ *
  * \param[in]  pipeline  The data processing pipeline.
  * \return true on success, false otherwise.
  */
@@ -29,6 +29,7 @@
 #include "common/acq.h"
 
 #include "../util.h"
+#include "../cache.h"
 
 #include "dpp.h"
 #include "param.h"
@@ -38,6 +39,7 @@ static const cyaml_strval_t bv_value_kind[] = {
 	{ .val = BV_VALUE_BOOL,     .str = "bool" },
 	{ .val = BV_VALUE_DOUBLE,   .str = "double" },
 	{ .val = BV_VALUE_UNSIGNED, .str = "unsigned" },
+	{ .val = BV_VALUE_STRING,   .str = "string" },
 };
 
 /** CYAML schema: Value union fields. */
@@ -51,6 +53,9 @@ static const cyaml_schema_field_t bv_value_fields[] = {
 			struct bv_value, type_double),
 	CYAML_FIELD_UINT("unsigned", CYAML_FLAG_DEFAULT,
 			struct bv_value, type_unsigned),
+	CYAML_FIELD_STRING_PTR("string", CYAML_FLAG_POINTER,
+			struct bv_value, type_string,
+			0, CYAML_UNLIMITED),
 	CYAML_FIELD_END
 };
 
@@ -403,9 +408,443 @@ static const cyaml_config_t config = {
 	.mem_fn    = cyaml_mem,         /* Use the default memory allocator. */
 };
 
+/**
+ * Write a value to the cache.
+ *
+ * \param[in]  cache  The cache writer.
+ * \param[in]  value  The value to write.
+ */
+static void dpp_file__cache_write_value(
+		struct cache_writer *cache,
+		const struct bv_value *value)
+{
+	cache_write_u32(cache, value->type);
+
+	switch (value->type) {
+	case BV_VALUE_BOOL:
+		cache_write_u32(cache, value->type_bool);
+		break;
+	case BV_VALUE_DOUBLE:
+		cache_write_double(cache, value->type_double);
+		break;
+	case BV_VALUE_UNSIGNED:
+		cache_write_u32(cache, value->type_unsigned);
+		break;
+	case BV_VALUE_STRING:
+		cache_write_string(cache, value->type_string);
+		break;
+	}
+}
+
+/**
+ * Read a value from the cache.
+ *
+ * \param[in]  cache  The cache reader.
+ * \param[out] value  Returns the value read.
+ */
+static void dpp_file__cache_read_value(
+		struct cache_reader *cache,
+		struct bv_value *value)
+{
+	value->type = cache_read_u32(cache);
+
+	switch (value->type) {
+	case BV_VALUE_BOOL:
+		value->type_bool = cache_read_u32(cache);
+		break;
+	case BV_VALUE_DOUBLE:
+		value->type_double = cache_read_double(cache);
+		break;
+	case BV_VALUE_UNSIGNED:
+		value->type_unsigned = cache_read_u32(cache);
+		break;
+	case BV_VALUE_STRING:
+		value->type_string = cache_read_string(cache);
+		if (value->type_string == NULL) {
+			cache->error = true;
+		}
+		break;
+	default:
+		cache->error = true;
+		break;
+	}
+}
+
+/**
+ * Write a pipeline stage node to the cache.
+ *
+ * \param[in]  cache  The cache writer.
+ * \param[in]  node   The node to write.
+ */
+static void dpp_file__cache_write_node(
+		struct cache_writer *cache,
+		const struct bv_node *node)
+{
+	cache_write_u32(cache, node->type);
+
+	switch (node->type) {
+	case BV_NODE_GRAPH:
+		cache_write_string(cache, node->graph.label);
+		break;
+	case BV_NODE_FILTER:
+		cache_write_string(cache, node->filter.label);
+		cache_write_string(cache, node->filter.endpoint);
+		break;
+	case BV_NODE_CHANNEL:
+		cache_write_string(cache, node->channel.label);
+		break;
+	}
+}
+
+/**
+ * Read a pipeline stage node from the cache.
+ *
+ * \param[in]  cache  The cache reader.
+ * \param[out] node   Returns the node read.
+ */
+static void dpp_file__cache_read_node(
+		struct cache_reader *cache,
+		struct bv_node *node)
+{
+	node->type = cache_read_u32(cache);
+
+	switch (node->type) {
+	case BV_NODE_GRAPH:
+		node->graph.label = cache_read_string(cache);
+		break;
+	case BV_NODE_FILTER:
+		node->filter.label = cache_read_string(cache);
+		node->filter.endpoint = cache_read_string(cache);
+		break;
+	case BV_NODE_CHANNEL:
+		node->channel.label = cache_read_string(cache);
+		break;
+	default:
+		cache->error = true;
+		break;
+	}
+}
+
+/**
+ * Write a graph colour to the cache.
+ *
+ * \param[in]  cache   The cache writer.
+ * \param[in]  colour  The colour to write.
+ */
+static void dpp_file__cache_write_colour(
+		struct cache_writer *cache,
+		const struct bv_colour *colour)
+{
+	cache_write_u32(cache, colour->type);
+
+	switch (colour->type) {
+	case BV_COLOUR_RGB:
+		cache_write_u32(cache, colour->rgb.r);
+		cache_write_u32(cache, colour->rgb.g);
+		cache_write_u32(cache, colour->rgb.b);
+		break;
+	case BV_COLOUR_HSV:
+		cache_write_u32(cache, colour->hsv.h);
+		cache_write_u32(cache, colour->hsv.s);
+		cache_write_u32(cache, colour->hsv.v);
+		break;
+	}
+}
+
+/**
+ * Read a graph colour from the cache.
+ *
+ * \param[in]  cache   The cache reader.
+ * \param[out] colour  Returns the colour read.
+ */
+static void dpp_file__cache_read_colour(
+		struct cache_reader *cache,
+		struct bv_colour *colour)
+{
+	colour->type = cache_read_u32(cache);
+
+	switch (colour->type) {
+	case BV_COLOUR_RGB:
+		colour->rgb.r = cache_read_u32(cache);
+		colour->rgb.g = cache_read_u32(cache);
+		colour->rgb.b = cache_read_u32(cache);
+		break;
+	case BV_COLOUR_HSV:
+		colour->hsv.h = cache_read_u32(cache);
+		colour->hsv.s = cache_read_u32(cache);
+		colour->hsv.v = cache_read_u32(cache);
+		break;
+	default:
+		cache->error = true;
+		break;
+	}
+}
+
+/**
+ * Write an array of endpoints to the cache.
+ *
+ * \param[in]  cache     The cache writer.
+ * \param[in]  endpoint  The endpoints to write.
+ * \param[in]  count     Number of endpoints.
+ */
+static void dpp_file__cache_write_endpoints(
+		struct cache_writer *cache,
+		const struct bv_endpoint *endpoint,
+		uint32_t count)
+{
+	cache_write_u32(cache, count);
+	for (unsigned i = 0; i < count; i++) {
+		cache_write_string(cache, endpoint[i].name);
+		cache_write_u32(cache, endpoint[i].kind);
+	}
+}
+
+/**
+ * Read an array of endpoints from the cache.
+ *
+ * \param[in]  cache  The cache reader.
+ * \param[out] count  Returns the number of endpoints.
+ * \return the endpoints read.
+ */
+static struct bv_endpoint *dpp_file__cache_read_endpoints(
+		struct cache_reader *cache,
+		uint32_t *count)
+{
+	struct bv_endpoint *endpoint;
+
+	endpoint = cache_read_array(cache, count, sizeof(*endpoint));
+	for (unsigned i = 0; i < *count; i++) {
+		endpoint[i].name = cache_read_string(cache);
+		endpoint[i].kind = cache_read_u32(cache);
+	}
+
+	return endpoint;
+}
+
+/**
+ * Write the parsed filters file to the cache.
+ *
+ * \param[in]  cache  The cache writer.
+ * \param[in]  dpp    The parsed filters file.
+ */
+static void dpp_file__cache_write(
+		struct cache_writer *cache,
+		const struct dpp *dpp)
+{
+	cache_write_u32(cache, dpp->filters_count);
+	for (unsigned i = 0; i < dpp->filters_count; i++) {
+		const struct bv_filter *filter = dpp->filters + i;
+
+		cache_write_string(cache, filter->name);
+		cache_write_u32(cache, filter->param_count);
+		for (unsigned j = 0; j < filter->param_count; j++) {
+			cache_write_string(cache, filter->param[j].name);
+			cache_write_u32(cache, filter->param[j].kind);
+		}
+		dpp_file__cache_write_endpoints(cache,
+				filter->input, filter->input_count);
+		dpp_file__cache_write_endpoints(cache,
+				filter->output, filter->output_count);
+	}
+
+	cache_write_u32(cache, dpp->pipeline_count);
+	for (unsigned i = 0; i < dpp->pipeline_count; i++) {
+		const struct bv_pipeline *pipeline = dpp->pipeline + i;
+
+		cache_write_string(cache, pipeline->name);
+		cache_write_u32(cache, pipeline->filter_count);
+		for (unsigned j = 0; j < pipeline->filter_count; j++) {
+			const struct bv_pipeline_filter *filter =
+					pipeline->filter + j;
+
+			cache_write_string(cache, filter->label);
+			cache_write_string(cache, filter->filter);
+			cache_write_u32(cache, filter->parameters_count);
+			for (unsigned k = 0; k < filter->parameters_count; k++) {
+				cache_write_string(cache,
+						filter->parameters[k].name);
+				dpp_file__cache_write_value(cache,
+						&filter->parameters[k].value);
+			}
+		}
+		cache_write_u32(cache, pipeline->stage_count);
+		for (unsigned j = 0; j < pipeline->stage_count; j++) {
+			dpp_file__cache_write_node(cache,
+					&pipeline->stage[j].from);
+			dpp_file__cache_write_node(cache,
+					&pipeline->stage[j].to);
+		}
+	}
+
+	cache_write_u32(cache, dpp->setup_count);
+	for (unsigned i = 0; i < dpp->setup_count; i++) {
+		const struct bv_setup *setup = dpp->setup + i;
+
+		cache_write_string(cache, setup->name);
+		cache_write_u32(cache, setup->acq_mode);
+		cache_write_u32(cache, setup->context_count);
+		for (unsigned j = 0; j < setup->context_count; j++) {
+			const struct bv_context *context = setup->context + j;
+
+			cache_write_string(cache, context->pipeline);
+			cache_write_u32(cache, context->channel_count);
+			for (unsigned k = 0; k < context->channel_count; k++) {
+				cache_write_string(cache,
+						context->channel[k].label);
+				cache_write_u32(cache,
+						context->channel[k].channel);
+			}
+			cache_write_u32(cache, context->graph_count);
+			for (unsigned k = 0; k < context->graph_count; k++) {
+				cache_write_string(cache,
+						context->graph[k].label);
+				cache_write_string(cache,
+						context->graph[k].name);
+				dpp_file__cache_write_colour(cache,
+						&context->graph[k].colour);
+			}
+		}
+	}
+}
+
+/**
+ * Read the parsed filters file from the cache.
+ *
+ * \param[in]  cache  The cache reader.
+ * \param[out] dpp    Returns the parsed filters file.
+ */
+static void dpp_file__cache_read(
+		struct cache_reader *cache,
+		struct dpp *dpp)
+{
+	dpp->filters = cache_read_array(cache, &dpp->filters_count,
+			sizeof(*dpp->filters));
+	for (unsigned i = 0; i < dpp->filters_count; i++) {
+		struct bv_filter *filter = dpp->filters + i;
+
+		filter->name = cache_read_string(cache);
+		filter->param = cache_read_array(cache, &filter->param_count,
+				sizeof(*filter->param));
+		for (unsigned j = 0; j < filter->param_count; j++) {
+			filter->param[j].name = cache_read_string(cache);
+			filter->param[j].kind = cache_read_u32(cache);
+		}
+		filter->input = dpp_file__cache_read_endpoints(cache,
+				&filter->input_count);
+		filter->output = dpp_file__cache_read_endpoints(cache,
+				&filter->output_count);
+	}
+
+	dpp->pipeline = cache_read_array(cache, &dpp->pipeline_count,
+			sizeof(*dpp->pipeline));
+	for (unsigned i = 0; i < dpp->pipeline_count; i++) {
+		struct bv_pipeline *pipeline = dpp->pipeline + i;
+
+		pipeline->name = cache_read_string(cache);
+		pipeline->filter = cache_read_array(cache,
+				&pipeline->filter_count,
+				sizeof(*pipeline->filter));
+		for (unsigned j = 0; j < pipeline->filter_count; j++) {
+			struct bv_pipeline_filter *filter =
+					pipeline->filter + j;
+
+			filter->label = cache_read_string(cache);
+			filter->filter = cache_read_string(cache);
+			filter->parameters = cache_read_array(cache,
+					&filter->parameters_count,
+					sizeof(*filter->parameters));
+			for (unsigned k = 0; k < filter->parameters_count; k++) {
+				filter->parameters[k].name =
+						cache_read_string(cache);
+				dpp_file__cache_read_value(cache,
+						&filter->parameters[k].value);
+			}
+		}
+		pipeline->stage = cache_read_array(cache,
+				&pipeline->stage_count,
+				sizeof(*pipeline->stage));
+		for (unsigned j = 0; j < pipeline->stage_count; j++) {
+			dpp_file__cache_read_node(cache,
+					&pipeline->stage[j].from);
+			dpp_file__cache_read_node(cache,
+					&pipeline->stage[j].to);
+		}
+	}
+
+	dpp->setup = cache_read_array(cache, &dpp->setup_count,
+			sizeof(*dpp->setup));
+	for (unsigned i = 0; i < dpp->setup_count; i++) {
+		struct bv_setup *setup = dpp->setup + i;
+
+		setup->name = cache_read_string(cache);
+		setup->acq_mode = cache_read_u32(cache);
+		setup->context = cache_read_array(cache,
+				&setup->context_count,
+				sizeof(*setup->context));
+		for (unsigned j = 0; j < setup->context_count; j++) {
+			struct bv_context *context = setup->context + j;
+
+			context->pipeline = cache_read_string(cache);
+			context->channel = cache_read_array(cache,
+					&context->channel_count,
+					sizeof(*context->channel));
+			for (unsigned k = 0; k < context->channel_count; k++) {
+				context->channel[k].label =
+						cache_read_string(cache);
+				context->channel[k].channel =
+						cache_read_u32(cache);
+			}
+			context->graph = cache_read_array(cache,
+					&context->graph_count,
+					sizeof(*context->graph));
+			for (unsigned k = 0; k < context->graph_count; k++) {
+				context->graph[k].label =
+						cache_read_string(cache);
+				context->graph[k].name =
+						cache_read_string(cache);
+				dpp_file__cache_read_colour(cache,
+						&context->graph[k].colour);
+			}
+		}
+	}
+}
+
+/**
+ * Load the parsed filters file from the cache, if it is up to date.
+ *
+ * \param[in]  path  Path to the filters file.
+ * \return the parsed filters file, or NULL if there is no usable cache.
+ */
+static struct dpp *dpp_file__cache_load(
+		const char *path)
+{
+	struct cache_reader cache;
+	struct dpp *dpp;
+
+	if (!cache_read_open("filters", path, &cache)) {
+		return NULL;
+	}
+
+	dpp = calloc(1, sizeof(*dpp));
+	if (dpp == NULL) {
+		cache_read_close(&cache);
+		return NULL;
+	}
+
+	dpp_file__cache_read(&cache, dpp);
+	if (!cache_read_close(&cache)) {
+		fprintf(stderr, "Warning: Ignoring bad cache for %s\n", path);
+		cyaml_free(&config, &bv_top, dpp, 0);
+		return NULL;
+	}
+
+	return dpp;
+}
+
 struct dpp *dpp_file_load(
 		const char *resources_dir_path)
 {
+	struct cache_writer *cache;
 	struct dpp *dpp = NULL;
 	cyaml_err_t err;
 	char *path;
@@ -415,13 +854,24 @@ struct dpp *dpp_file_load(
 		goto error;
 	}
 
+	dpp = dpp_file__cache_load(path);
+	if (dpp != NULL) {
+		free(path);
+		return dpp;
+	}
+
+	cache = cache_write_open("filters", path);
 	err = cyaml_load_file(path, &config, &bv_top, (void **) &dpp, 0);
 	free(path);
 	if (err != CYAML_OK) {
 		fprintf(stderr, "ERROR: %s\n", cyaml_strerror(err));
+		cache_write_close(cache, false);
 		goto error;
 	}
 
+	dpp_file__cache_write(cache, dpp);
+	cache_write_close(cache, true);
+
 	return dpp;
 
 error:
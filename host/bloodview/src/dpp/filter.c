@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "param.h"
 #include "filter.h"
 
 /**
@@ -33,6 +34,9 @@ struct filter_impl {
 	filter_init_cb init; /**< Filter's initialisation function */
 	filter_proc_cb proc; /**< Filter's sample processing function */
 	filter_fini_cb fini; /**< Filter's finalisation function */
+
+	filter_save_cb save;       /**< Filter's state saving function */
+	filter_restore_cb restore; /**< Filter's state restoring function */
 };
 
 /**
@@ -41,6 +45,29 @@ struct filter_impl {
 struct filter_entry {
 	filter_ctx ctx;                 /**< Filter's context. */
 	const struct filter_impl *impl; /**< Filter's implementation. */
+	bool active;                    /**< Whether the filter is run. */
+	char *key;                      /**< Filter's checkpoint key. */
+
+	const struct bv_param *param; /**< Filter's parameters. */
+	const unsigned *output;       /**< Filter's output offsets. */
+	const unsigned *input;        /**< Filter's input offsets. */
+	unsigned param_count;         /**< Number of parameters. */
+	unsigned n_output;            /**< Number of outputs. */
+	unsigned n_input;             /**< Number of inputs. */
+};
+
+/**
+ * Saved filter state.
+ */
+struct filter_checkpoint {
+	char *key;                      /**< Key of the saved filter. */
+	const struct filter_impl *impl; /**< Saved filter's implementation. */
+	const struct bv_param *param;   /**< Saved filter's parameters. */
+	unsigned param_count;           /**< Number of parameters. */
+	unsigned frequency;             /**< Saved filter's sampling rate. */
+
+	void *state;                    /**< Saved state. */
+	size_t size;                    /**< Size of saved state in bytes. */
 };
 
 struct {
@@ -50,6 +77,9 @@ struct {
 	struct filter_entry *filter;
 	unsigned filter_count;
 
+	struct filter_checkpoint *checkpoint;
+	unsigned checkpoint_count;
+
 	unsigned frequency;
 } filter_g;
 
@@ -58,6 +88,14 @@ void filter_fini(void)
 {
 	filter_finish();
 
+	for (unsigned i = 0; i < filter_g.checkpoint_count; i++) {
+		free(filter_g.checkpoint[i].key);
+		free(filter_g.checkpoint[i].state);
+	}
+	free(filter_g.checkpoint);
+	filter_g.checkpoint = NULL;
+	filter_g.checkpoint_count = 0;
+
 	free(filter_g.implementation);
 	filter_g.implementation = NULL;
 	filter_g.implementation_count = 0;
@@ -112,6 +150,8 @@ bool filter_register(
 	impl[count].init = init;
 	impl[count].proc = proc;
 	impl[count].fini = fini;
+	impl[count].save = NULL;
+	impl[count].restore = NULL;
 
 	filter_g.implementation_count++;
 	filter_g.implementation = impl;
@@ -119,6 +159,120 @@ bool filter_register(
 	return true;
 }
 
+/* Exported function, documented in filter.h */
+bool filter_register_state(
+		const char *name,
+		filter_save_cb save,
+		filter_restore_cb restore)
+{
+	struct filter_impl *impl;
+
+	impl = filter__lookup_impl(name);
+	if (impl == NULL) {
+		fprintf(stderr, "Error: %s filter not registered.\n", name);
+		return false;
+	}
+
+	impl->save = save;
+	impl->restore = restore;
+
+	return true;
+}
+
+/**
+ * Check whether two parameter arrays are the same.
+ *
+ * \param[in]  a        First array of parameters.
+ * \param[in]  b        Second array of parameters.
+ * \param[in]  count    Number of parameters in both arrays.
+ * \return true if the parameters are the same, false otherwise.
+ */
+static bool filter__param_equal(
+		const struct bv_param *a,
+		const struct bv_param *b,
+		unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		if (strcmp(a[i].name, b[i].name) != 0 ||
+		    a[i].value.type != b[i].value.type) {
+			return false;
+		}
+
+		switch (a[i].value.type) {
+		case BV_VALUE_BOOL:
+			if (a[i].value.type_bool != b[i].value.type_bool) {
+				return false;
+			}
+			break;
+		case BV_VALUE_DOUBLE:
+			if (a[i].value.type_double != b[i].value.type_double) {
+				return false;
+			}
+			break;
+		case BV_VALUE_UNSIGNED:
+			if (a[i].value.type_unsigned !=
+					b[i].value.type_unsigned) {
+				return false;
+			}
+			break;
+		case BV_VALUE_STRING:
+			if (strcmp(a[i].value.type_string,
+					b[i].value.type_string) != 0) {
+				return false;
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Find the saved state for a given key.
+ *
+ * \param[in]  key  Filter checkpoint key.
+ * \return the checkpoint, or NULL if there isn't one.
+ */
+static struct filter_checkpoint *filter__lookup_checkpoint(const char *key)
+{
+	for (unsigned i = 0; i < filter_g.checkpoint_count; i++) {
+		if (strcmp(filter_g.checkpoint[i].key, key) == 0) {
+			return &filter_g.checkpoint[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Restore a new filter's state from any matching checkpoint.
+ *
+ * \param[in]  filter  The filter sequence entry to restore.
+ */
+static void filter__restore(const struct filter_entry *filter)
+{
+	const struct filter_checkpoint *cp;
+
+	if (filter->key == NULL || filter->impl->restore == NULL) {
+		return;
+	}
+
+	cp = filter__lookup_checkpoint(filter->key);
+	if (cp == NULL ||
+	    cp->impl != filter->impl ||
+	    cp->frequency != filter_g.frequency ||
+	    cp->param_count != filter->param_count ||
+	    !filter__param_equal(cp->param, filter->param,
+			filter->param_count)) {
+		return;
+	}
+
+	if (!filter->impl->restore(filter->ctx, cp->state, cp->size)) {
+		fprintf(stderr, "Warning: %s: Couldn't restore state.\n",
+				filter->key);
+	}
+}
+
 /* Exported function, documented in filter.h */
 bool filter_start(
 		unsigned frequency)
@@ -130,6 +284,7 @@ bool filter_start(
 
 /* Exported function, documented in filter.h */
 bool filter_add(
+		const char *key,
 		const char *name,
 		const struct bv_param *param,
 		const unsigned *output,
@@ -140,6 +295,7 @@ bool filter_add(
 {
 	const struct filter_impl *impl;
 	struct filter_entry *filter;
+	char *key_copy = NULL;
 	unsigned count;
 	filter_ctx ctx;
 
@@ -149,10 +305,18 @@ bool filter_add(
 		return false;
 	}
 
+	if (key != NULL) {
+		key_copy = strdup(key);
+		if (key_copy == NULL) {
+			return false;
+		}
+	}
+
 	ctx = impl->init(param, output, input,
 			param_count, filter_g.frequency,
 			n_output, n_input);
 	if (ctx == NULL) {
+		free(key_copy);
 		return false;
 	}
 
@@ -160,15 +324,80 @@ bool filter_add(
 	filter = realloc(filter_g.filter, (count + 1) * sizeof(*filter));
 	if (filter == NULL) {
 		impl->fini(ctx);
+		free(key_copy);
 		return false;
 	}
 
 	filter[count].ctx = ctx;
 	filter[count].impl = impl;
+	filter[count].active = true;
+	filter[count].key = key_copy;
+
+	filter[count].param = param;
+	filter[count].output = output;
+	filter[count].input = input;
+	filter[count].param_count = param_count;
+	filter[count].n_output = n_output;
+	filter[count].n_input = n_input;
 
 	filter_g.filter_count++;
 	filter_g.filter = filter;
 
+	filter__restore(&filter[count]);
+
+	return true;
+}
+
+/**
+ * Recreate a filter instance, discarding any accumulated state.
+ *
+ * \param[in]  filter  The filter sequence entry to reset.
+ * \return true on success, or false on error.
+ */
+static bool filter__reset(struct filter_entry *filter)
+{
+	const struct filter_impl *impl = filter->impl;
+	filter_ctx ctx;
+
+	ctx = impl->init(filter->param, filter->output, filter->input,
+			filter->param_count, filter_g.frequency,
+			filter->n_output, filter->n_input);
+	if (ctx == NULL) {
+		return false;
+	}
+
+	impl->fini(filter->ctx);
+	filter->ctx = ctx;
+
+	return true;
+}
+
+/* Exported function, documented in filter.h */
+bool filter_set_active(
+		unsigned idx,
+		bool active)
+{
+	struct filter_entry *filter;
+
+	if (idx >= filter_g.filter_count) {
+		fprintf(stderr, "Error: Filter index %u out of range.\n", idx);
+		return false;
+	}
+
+	filter = &filter_g.filter[idx];
+	if (filter->active == active) {
+		return true;
+	}
+
+	if (active) {
+		/* State is stale after a suspension; start again from scratch
+		 * rather than let the filter's history straddle the gap. */
+		if (!filter__reset(filter)) {
+			return false;
+		}
+	}
+
+	filter->active = active;
 	return true;
 }
 
@@ -181,6 +410,10 @@ bool filter_proc(
 		const struct filter_entry *filter = &filter_g.filter[i];
 		const struct filter_impl *impl = filter->impl;
 
+		if (!filter->active) {
+			continue;
+		}
+
 		if (!impl->proc(filter->ctx, pipeline, pipeline_len)) {
 			return false;
 		}
@@ -189,6 +422,78 @@ bool filter_proc(
 	return true;
 }
 
+/**
+ * Save a filter's state, replacing any older state for its key.
+ *
+ * \param[in]  filter  The filter sequence entry to save.
+ * \return true on success, or false on error.
+ */
+static bool filter__save(const struct filter_entry *filter)
+{
+	struct filter_checkpoint *cp;
+	size_t size;
+	void *state;
+
+	state = filter->impl->save(filter->ctx, &size);
+	if (state == NULL) {
+		return false;
+	}
+
+	cp = filter__lookup_checkpoint(filter->key);
+	if (cp == NULL) {
+		unsigned count = filter_g.checkpoint_count;
+		char *key = strdup(filter->key);
+
+		if (key == NULL) {
+			free(state);
+			return false;
+		}
+
+		cp = realloc(filter_g.checkpoint, (count + 1) * sizeof(*cp));
+		if (cp == NULL) {
+			free(state);
+			free(key);
+			return false;
+		}
+
+		filter_g.checkpoint = cp;
+		filter_g.checkpoint_count++;
+
+		cp = &cp[count];
+		cp->key = key;
+	} else {
+		free(cp->state);
+	}
+
+	cp->impl = filter->impl;
+	cp->param = filter->param;
+	cp->param_count = filter->param_count;
+	cp->frequency = filter_g.frequency;
+	cp->state = state;
+	cp->size = size;
+
+	return true;
+}
+
+/* Exported function, documented in filter.h */
+void filter_checkpoint(void)
+{
+	for (unsigned i = 0; i < filter_g.filter_count; i++) {
+		const struct filter_entry *filter = &filter_g.filter[i];
+
+		/* Suspended filters' state is stale. */
+		if (filter->key == NULL || filter->impl->save == NULL ||
+		    !filter->active) {
+			continue;
+		}
+
+		if (!filter__save(filter)) {
+			fprintf(stderr, "Warning: %s: Couldn't save state.\n",
+					filter->key);
+		}
+	}
+}
+
 /* Exported function, documented in filter.h */
 void filter_finish(void)
 {
@@ -196,6 +501,7 @@ void filter_finish(void)
 		for (unsigned i = 0; i < filter_g.filter_count; i++) {
 			filter_g.filter[i].impl->fini(
 					filter_g.filter[i].ctx);
+			free(filter_g.filter[i].key);
 		}
 		free(filter_g.filter);
 		filter_g.filter = NULL;
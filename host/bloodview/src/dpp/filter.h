@@ -93,6 +93,45 @@ typedef bool (* filter_proc_cb)(
 typedef void (* filter_fini_cb)(
 		filter_ctx ctx);
 
+/**
+ * Save a filter instance's state.
+ *
+ * This is an optional filter implementation callback table entry, for
+ * filters which take a while to build up their history.  It gets called
+ * by \ref filter_checkpoint, so that the state can be given to an
+ * equivalent instance created for a later acquisition.
+ *
+ * The state only needs to be understood by \ref filter_restore_cb for the
+ * same filter, in the same process.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+typedef void * (* filter_save_cb)(
+		filter_ctx ctx,
+		size_t *size);
+
+/**
+ * Restore a filter instance's state.
+ *
+ * This is the counterpart to \ref filter_save_cb, and must be provided
+ * if that is.  It gets called on a newly created filter instance, with state
+ * saved from an instance which had the same parameters, sampling rate and
+ * place in the data processing pipeline.
+ *
+ * If the state can't be used, the filter instance must be left as created.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_save_cb.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+typedef bool (* filter_restore_cb)(
+		filter_ctx ctx,
+		const void *state,
+		size_t size);
+
 /**
  * Initialise the filter module.
  *
@@ -119,6 +158,22 @@ bool filter_register(
 		filter_proc_cb proc,
 		filter_fini_cb fini);
 
+/**
+ * Register a filter's state saving and restoring functions.
+ *
+ * This is optional, and can be called once on startup, after the filter
+ * has been registered with \ref filter_register.
+ *
+ * \param[in]  name     Filter's name.
+ * \param[in]  save     Filter's state saving function.
+ * \param[in]  restore  Filter's state restoring function.
+ * \return true on success, or false on error.
+ */
+bool filter_register_state(
+		const char *name,
+		filter_save_cb save,
+		filter_restore_cb restore);
+
 /**
  * Finalise the filter module.
  *
@@ -146,6 +201,13 @@ bool filter_start(
  * Inputs and outputs are in the order that the inputs and outputs are
  * listed in the filter specification YAML.
  *
+ * If state was saved by \ref filter_checkpoint for a filter with the same
+ * key, name, parameters and sampling rate, the new filter carries on from
+ * that state, rather than starting empty.
+ *
+ * \param[in]  key          Identifies the filter's place in the data
+ *                          processing setup, or NULL.  Used to find
+ *                          checkpointed state.
  * \param[in]  name         The name of the registered filter to add.
  * \param[in]  param        Array of filter parameter/values.
  * \param[in]  output       Array of pipeline value offsets for outputs.
@@ -156,6 +218,7 @@ bool filter_start(
  * \return true on success, or false on error.
  */
 bool filter_add(
+		const char *key,
 		const char *name,
 		const struct bv_param *param,
 		const unsigned *output,
@@ -164,6 +227,21 @@ bool filter_add(
 		unsigned n_output,
 		unsigned n_input);
 
+/**
+ * Suspend or resume a filter in the filtering sequence.
+ *
+ * Filters are indexed in the order they were added with \ref filter_add.
+ * Suspended filters are skipped by \ref filter_proc, and their outputs are
+ * left untouched.  When a suspended filter is resumed its instance is
+ * recreated, so it restarts from its initial state.
+ *
+ * \param[in]  idx     Index of the filter in the filtering sequence.
+ * \param[in]  active  Whether the filter should be run.
+ * \return true on success, or false on error.
+ */
+bool filter_set_active(
+		unsigned idx,
+		bool active);
 
 /**
  * Run the registered filters over the pipeline.
@@ -176,6 +254,20 @@ bool filter_proc(
 		struct bv_value *pipeline,
 		size_t pipeline_len);
 
+/**
+ * Save the state of the filters in the filtering sequence.
+ *
+ * Call this at the end of an acquisition, before \ref filter_finish.
+ * Only filters with a key, which are running, and which registered state
+ * functions with \ref filter_register_state are saved.  Saved state
+ * replaces any older state for the same key, and is kept until
+ * \ref filter_fini.
+ *
+ * The state is only kept in memory; it is not written anywhere, so it
+ * does not survive the process exiting.
+ */
+void filter_checkpoint(void);
+
 /**
  * Cleanup the filter module after an acquisition.
  *
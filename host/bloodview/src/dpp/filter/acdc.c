@@ -0,0 +1,574 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline AC/DC decomposition
+ *        filter.
+ *
+ * This splits each of several input channels into a DC component (the mean
+ * over a sliding window) and an AC component (peak-to-peak or RMS over the
+ * same window).  It also gives the ratio of ratios, (AC_i / DC_i) divided by
+ * (AC_j / DC_j), for every pair of channels, which is the basis of
+ * multi-wavelength oximetry.
+ *
+ * All channels share one sample history and window position, so the cost
+ * of the window bookkeeping is paid once rather than per channel.
+ *
+ * The filter is registered once per supported channel count, since filter
+ * specifications have a fixed set of endpoints.  For N channels, outputs
+ * are the N DC values, then the N AC values, then the ratios for each pair
+ * (i, j) with i < j, in order.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "acdc.h"
+
+/** Largest supported window length, in samples. */
+#define ACDC_WINDOW_MAX (1u << 16)
+
+/** Sliding window extremum tracker; a monotonic queue of sample numbers. */
+struct acdc_queue {
+	uint64_t *seq; /**< Sample numbers, circular, capacity of the window. */
+	unsigned head; /**< Index of the oldest entry. */
+	unsigned len;  /**< Number of entries. */
+};
+
+/** Per-channel state. */
+struct acdc_channel {
+	unsigned input;  /**< Input pipeline offset. */
+	unsigned out_dc; /**< DC output pipeline offset. */
+	unsigned out_ac; /**< AC output pipeline offset. */
+
+	double ref;   /**< Reference level that sums are taken relative to. */
+	double sum;   /**< Sum of samples in window, relative to ref. */
+	double sumsq; /**< Sum of squared samples in window, relative to ref. */
+
+	struct acdc_queue max; /**< Window maximum tracker. */
+	struct acdc_queue min; /**< Window minimum tracker. */
+
+	double ratio; /**< Current AC / DC ratio. */
+};
+
+/** Filter context. */
+struct acdc_ctx {
+	struct acdc_channel *channel; /**< Per-channel state. */
+	unsigned n; /**< Number of channels. */
+
+	unsigned *out_ratio; /**< Ratio output pipeline offsets. */
+
+	bool rms;        /**< Use RMS rather than peak-to-peak for AC. */
+	unsigned window; /**< Window length in samples. */
+	unsigned count;  /**< Samples in window. */
+	uint64_t seq;    /**< Number of the next sample. */
+
+	/** Samples until sums are recomputed, to stop rounding drift. */
+	unsigned refresh;
+
+	/** Shared history; window rows of one sample per channel. */
+	double *history;
+
+	double *row; /**< Scratch space for one sample per channel. */
+};
+
+/** Saved filter state. */
+struct acdc_state {
+	unsigned n;       /**< Number of channels. */
+	unsigned window;  /**< Window length in samples. */
+	unsigned count;   /**< Samples in window. */
+	double history[]; /**< Samples in window, oldest row first. */
+};
+
+/**
+ * Get the number of outputs for a given number of channels.
+ *
+ * \param[in]  n  Number of channels.
+ * \return the number of outputs.
+ */
+static inline unsigned filter_acdc__output_count(unsigned n)
+{
+	return n * 2 + n * (n - 1) / 2;
+}
+
+/**
+ * Get a sample from the shared history.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  seq  Sample number, which must be within the window.
+ * \param[in]  c    Channel index.
+ * \return the sample value.
+ */
+static inline double filter_acdc__sample(
+		const struct acdc_ctx *ctx,
+		uint64_t seq,
+		unsigned c)
+{
+	return ctx->history[(seq % ctx->window) * ctx->n + c];
+}
+
+/**
+ * Add the newest sample to a sliding extremum tracker.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  q    The tracker to update.
+ * \param[in]  c    Channel index.
+ * \param[in]  max  True to track the maximum, false for the minimum.
+ */
+static void filter_acdc__queue_push(
+		const struct acdc_ctx *ctx,
+		struct acdc_queue *q,
+		unsigned c,
+		bool max)
+{
+	double v = filter_acdc__sample(ctx, ctx->seq, c);
+
+	/* Drop entries which can no longer be the extremum. */
+	while (q->len > 0) {
+		unsigned back = (q->head + q->len - 1) % ctx->window;
+		double b = filter_acdc__sample(ctx, q->seq[back], c);
+
+		if (max ? (b > v) : (b < v)) {
+			break;
+		}
+		q->len--;
+	}
+
+	/* Drop the oldest entry if it has left the window. */
+	if (q->len > 0 && q->seq[q->head] + ctx->window <= ctx->seq) {
+		q->head = (q->head + 1) % ctx->window;
+		q->len--;
+	}
+
+	q->seq[(q->head + q->len) % ctx->window] = ctx->seq;
+	q->len++;
+}
+
+/**
+ * Recompute a channel's window sums from the history.
+ *
+ * The reference level is moved to the current mean, so that the squared
+ * sums stay small relative to the signal, and any rounding error which has
+ * accumulated in the running sums is discarded.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  c    Channel index.
+ */
+static void filter_acdc__refresh(
+		struct acdc_ctx *ctx,
+		unsigned c)
+{
+	struct acdc_channel *ch = &ctx->channel[c];
+	uint64_t first = ctx->seq + 1 - ctx->count;
+
+	ch->ref += ch->sum / ctx->count;
+	ch->sum = 0;
+	ch->sumsq = 0;
+
+	for (uint64_t s = first; s <= ctx->seq; s++) {
+		double v = filter_acdc__sample(ctx, s, c) - ch->ref;
+
+		ch->sum += v;
+		ch->sumsq += v * v;
+	}
+}
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_acdc__fini(
+		filter_ctx ctx)
+{
+	struct acdc_ctx *ad_ctx = ctx;
+
+	if (ad_ctx == NULL) {
+		return;
+	}
+
+	if (ad_ctx->channel != NULL) {
+		for (unsigned i = 0; i < ad_ctx->n; i++) {
+			free(ad_ctx->channel[i].max.seq);
+			free(ad_ctx->channel[i].min.seq);
+		}
+		free(ad_ctx->channel);
+	}
+	free(ad_ctx->out_ratio);
+	free(ad_ctx->history);
+	free(ad_ctx->row);
+	free(ad_ctx);
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_acdc__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	const struct bv_param *param_window;
+	const struct bv_param *param_rms;
+	struct acdc_ctx *ctx;
+	double window;
+
+	if (n_input < 1) {
+		fprintf(stderr, "Error: ACDC: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+	if (n_output != filter_acdc__output_count(n_input)) {
+		fprintf(stderr, "Error: ACDC: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+
+	param_window = param_lookup(param, param_count,
+			"window", BV_VALUE_DOUBLE);
+	if (param_window == NULL) {
+		return NULL;
+	}
+
+	param_rms = param_lookup(param, param_count,
+			"rms", BV_VALUE_BOOL);
+	if (param_rms == NULL) {
+		return NULL;
+	}
+
+	window = bv_value_double(&param_window->value) * frequency;
+	if (!(window >= 1) || window > ACDC_WINDOW_MAX) {
+		fprintf(stderr, "Error: ACDC: Bad window: %f.\n",
+				bv_value_double(&param_window->value));
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	ctx->n = n_input;
+	ctx->window = window;
+	ctx->refresh = ctx->window;
+	ctx->rms = bv_value_bool(&param_rms->value);
+
+	ctx->history = calloc(ctx->window * ctx->n, sizeof(*ctx->history));
+	ctx->channel = calloc(ctx->n, sizeof(*ctx->channel));
+	ctx->row = calloc(ctx->n, sizeof(*ctx->row));
+	if (ctx->history == NULL || ctx->channel == NULL || ctx->row == NULL) {
+		goto error;
+	}
+
+	for (unsigned i = 0; i < ctx->n; i++) {
+		struct acdc_channel *ch = &ctx->channel[i];
+
+		if (!ctx->rms) {
+			ch->max.seq = malloc(ctx->window * sizeof(uint64_t));
+			ch->min.seq = malloc(ctx->window * sizeof(uint64_t));
+			if (ch->max.seq == NULL || ch->min.seq == NULL) {
+				goto error;
+			}
+		}
+
+		ch->input = input[i];
+		ch->out_dc = output[i];
+		ch->out_ac = output[ctx->n + i];
+	}
+
+	if (ctx->n > 1) {
+		unsigned n_ratio = n_output - ctx->n * 2;
+
+		ctx->out_ratio = malloc(n_ratio * sizeof(*ctx->out_ratio));
+		if (ctx->out_ratio == NULL) {
+			goto error;
+		}
+
+		for (unsigned i = 0; i < n_ratio; i++) {
+			ctx->out_ratio[i] = output[ctx->n * 2 + i];
+		}
+	}
+
+	return ctx;
+
+error:
+	filter_acdc__fini(ctx);
+	return NULL;
+}
+
+/**
+ * Set an unsigned pipeline output.
+ *
+ * \param[in]  pipeline  The data pipeline.
+ * \param[in]  offset    Output pipeline offset.
+ * \param[in]  v         Value to write, which is clamped to range.
+ */
+static inline void filter_acdc__output(
+		struct bv_value *pipeline,
+		unsigned offset,
+		double v)
+{
+	pipeline[offset].type = BV_VALUE_UNSIGNED;
+	pipeline[offset].type_unsigned =
+			(v <= 0) ? 0 :
+			(v >= UINT_MAX) ? UINT_MAX :
+			(unsigned)(v + 0.5);
+}
+
+/**
+ * Add the current sample number's samples to the window.
+ *
+ * \param[in]  ctx     A filter instance.
+ * \param[in]  sample  One sample per channel.
+ */
+static void filter_acdc__push(
+		struct acdc_ctx *ctx,
+		const double *sample)
+{
+	unsigned row = (ctx->seq % ctx->window) * ctx->n;
+	bool full = (ctx->count == ctx->window);
+
+	if (!full) {
+		ctx->count++;
+	}
+
+	for (unsigned i = 0; i < ctx->n; i++) {
+		struct acdc_channel *ch = &ctx->channel[i];
+		double v = sample[i];
+
+		if (ctx->seq == 0) {
+			ch->ref = v;
+		}
+
+		if (full) {
+			double old = ctx->history[row + i] - ch->ref;
+
+			ch->sum -= old;
+			ch->sumsq -= old * old;
+		}
+
+		ctx->history[row + i] = v;
+		v -= ch->ref;
+		ch->sum += v;
+		ch->sumsq += v * v;
+
+		if (!ctx->rms) {
+			filter_acdc__queue_push(ctx, &ch->max, i, true);
+			filter_acdc__queue_push(ctx, &ch->min, i, false);
+		}
+	}
+
+	if (--ctx->refresh == 0) {
+		ctx->refresh = ctx->window;
+		for (unsigned i = 0; i < ctx->n; i++) {
+			filter_acdc__refresh(ctx, i);
+		}
+	}
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_acdc__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct acdc_ctx *ad_ctx = ctx;
+	unsigned r = 0;
+
+	BV_UNUSED(pipeline_len);
+
+	for (unsigned i = 0; i < ad_ctx->n; i++) {
+		assert(ad_ctx->channel[i].input < pipeline_len);
+
+		ad_ctx->row[i] = bv_value_unsigned(
+				&pipeline[ad_ctx->channel[i].input]);
+	}
+
+	filter_acdc__push(ad_ctx, ad_ctx->row);
+
+	for (unsigned i = 0; i < ad_ctx->n; i++) {
+		struct acdc_channel *ch = &ad_ctx->channel[i];
+		double mean = ch->sum / ad_ctx->count;
+		double dc = ch->ref + mean;
+		double ac;
+
+		if (ad_ctx->rms) {
+			double var = ch->sumsq / ad_ctx->count - mean * mean;
+			ac = (var > 0) ? sqrt(var) : 0;
+		} else {
+			ac = filter_acdc__sample(ad_ctx,
+					ch->max.seq[ch->max.head], i) -
+			     filter_acdc__sample(ad_ctx,
+					ch->min.seq[ch->min.head], i);
+		}
+
+		ch->ratio = (dc > 0) ? ac / dc : 0;
+
+		filter_acdc__output(pipeline, ch->out_dc, dc);
+		filter_acdc__output(pipeline, ch->out_ac, INT_MAX + ac);
+	}
+
+	for (unsigned i = 0; i < ad_ctx->n; i++) {
+		for (unsigned j = i + 1; j < ad_ctx->n; j++) {
+			double ratio_j = ad_ctx->channel[j].ratio;
+			double rr = (ratio_j > 0) ?
+					ad_ctx->channel[i].ratio / ratio_j : 0;
+
+			/* In millionths, like the correlation peak. */
+			filter_acdc__output(pipeline, ad_ctx->out_ratio[r++],
+					INT_MAX + rr * 1000000);
+		}
+	}
+
+	ad_ctx->seq++;
+
+	return true;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_acdc__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct acdc_ctx *ad_ctx = ctx;
+	uint64_t first = ad_ctx->seq - ad_ctx->count;
+	struct acdc_state *state;
+	double *row;
+
+	*size = sizeof(*state) + (size_t)ad_ctx->count * ad_ctx->n *
+			sizeof(*state->history);
+	state = malloc(*size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->n = ad_ctx->n;
+	state->window = ad_ctx->window;
+	state->count = ad_ctx->count;
+
+	row = state->history;
+	for (uint64_t s = first; s < ad_ctx->seq; s++) {
+		for (unsigned i = 0; i < ad_ctx->n; i++) {
+			*row++ = filter_acdc__sample(ad_ctx, s, i);
+		}
+	}
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * The saved samples are replayed into the window, which rebuilds the
+ * running sums and extremum trackers.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_acdc__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_acdc__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct acdc_ctx *ad_ctx = ctx;
+	const struct acdc_state *ad_state = state;
+
+	if (size < sizeof(*ad_state) ||
+	    ad_state->n != ad_ctx->n ||
+	    ad_state->window != ad_ctx->window ||
+	    ad_state->count > ad_ctx->window ||
+	    size != sizeof(*ad_state) + (size_t)ad_state->count *
+			ad_ctx->n * sizeof(*ad_state->history)) {
+		return false;
+	}
+
+	for (unsigned s = 0; s < ad_state->count; s++) {
+		filter_acdc__push(ad_ctx, ad_state->history + s * ad_ctx->n);
+		ad_ctx->seq++;
+	}
+
+	return true;
+}
+
+/* Exported function, documented in filter/acdc.h */
+bool filter_acdc_register(void)
+{
+	static const char * const names[] = {
+		"ACDC2",
+		"ACDC3",
+		"ACDC4",
+	};
+
+	for (unsigned i = 0; i < BV_ARRAY_LEN(names); i++) {
+		if (!filter_register(names[i],
+				filter_acdc__init,
+				filter_acdc__proc,
+				filter_acdc__fini)) {
+			return false;
+		}
+
+		if (!filter_register_state(names[i],
+				filter_acdc__save,
+				filter_acdc__restore)) {
+			return false;
+		}
+	}
+
+	return true;
+}
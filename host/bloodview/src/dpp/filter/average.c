@@ -238,11 +238,80 @@ static void filter_average__fini(
 	}
 }
 
+/**
+ * Save a filter instance's state.
+ *
+ * The state is the samples in the FIFO, oldest first.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_average__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct average_ctx *avg_ctx = ctx;
+	unsigned used = avg_ctx->fifo->used;
+	struct bv_value *state;
+
+	state = malloc((used + 1) * sizeof(*state));
+	if (state == NULL) {
+		return NULL;
+	}
+
+	for (unsigned i = 0; i < used; i++) {
+		if (!fifo_peek_back(avg_ctx->fifo, used - 1 - i, &state[i])) {
+			free(state);
+			return NULL;
+		}
+	}
+
+	*size = used * sizeof(*state);
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_average__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_average__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct average_ctx *avg_ctx = ctx;
+	const struct bv_value *sample = state;
+	unsigned count = size / sizeof(*sample);
+	unsigned skip = 0;
+
+	/* There's always space for the next sample to be added. */
+	if (count >= avg_ctx->fifo->capacity) {
+		skip = count - (avg_ctx->fifo->capacity - 1);
+	}
+
+	for (unsigned i = skip; i < count; i++) {
+		filter_average__add_sample(avg_ctx, &sample[i]);
+	}
+
+	return true;
+}
+
 /* Exported function, documented in filter/average.h */
 bool filter_average_register(void)
 {
-	return filter_register("Average",
+	if (!filter_register("Average",
 			filter_average__init,
 			filter_average__proc,
-			filter_average__fini);
+			filter_average__fini)) {
+		return false;
+	}
+
+	return filter_register_state("Average",
+			filter_average__save,
+			filter_average__restore);
 }
@@ -0,0 +1,512 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline band analysis
+ *        filter.
+ *
+ * This finds the dominant frequency within a narrow band, such as the
+ * heart rate or respiration rate, without computing the full spectrum.
+ *
+ * The input is block averaged down to around four times the top of the
+ * band.  Every update period, the most recent window of decimated samples
+ * has its mean removed, is Hann windowed, and a bank of Goertzel bins
+ * evenly spaced across the band is evaluated.  The strongest bin is refined
+ * by parabolic interpolation.
+ *
+ * Outputs are held between updates.  The cost per update is the window
+ * length at the decimated rate times the number of bins, so it is
+ * independent of the acquisition rate.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "band.h"
+
+/** Largest supported window length, in decimated samples. */
+#define BAND_WINDOW_MAX (1u << 16)
+
+/** Largest supported number of frequency bins. */
+#define BAND_BINS_MAX 1024
+
+/** Filter outputs, in the order of the filter specification. */
+enum band_output {
+	BAND_OUT_FREQUENCY, /**< Dominant frequency, in millihertz. */
+	BAND_OUT_PEAK,      /**< Peak bin share of band power, in millionths. */
+	BAND_OUT__COUNT,
+};
+
+/** Filter context. */
+struct band_ctx {
+	unsigned output[BAND_OUT__COUNT]; /**< Output pipeline offsets. */
+	unsigned input;                   /**< Input pipeline offset. */
+
+	unsigned decimate;  /**< Input samples per decimated sample. */
+	unsigned window;    /**< Analysis window length in decimated samples. */
+	unsigned hop;       /**< Input samples between updates. */
+	unsigned bins;      /**< Number of frequency bins. */
+
+	double   block_sum;   /**< Sum of the current decimation block. */
+	unsigned block_count; /**< Input samples in the current block. */
+
+	unsigned pos;       /**< Next history write position. */
+	unsigned count;     /**< Decimated samples seen, saturating at window. */
+	unsigned countdown; /**< Input samples until the next update. */
+
+	/** Decimated history, stored twice so the window is contiguous. */
+	double *history;
+
+	double *taper; /**< Hann window coefficients. */
+	double *work;  /**< Tapered window being analysed. */
+	double *coeff; /**< Per-bin Goertzel coefficients. */
+	double *power; /**< Per-bin power from the last update. */
+
+	double low;  /**< Frequency of the first bin, in Hz. */
+	double step; /**< Spacing between bins, in Hz. */
+
+	unsigned frequency; /**< Current frequency output value. */
+	unsigned peak;      /**< Current peak output value. */
+};
+
+/** Saved filter state. */
+struct band_state {
+	unsigned window;      /**< Analysis window length in decimated samples. */
+	unsigned decimate;    /**< Input samples per decimated sample. */
+	unsigned count;       /**< Decimated samples seen. */
+	unsigned countdown;   /**< Input samples until the next update. */
+	unsigned block_count; /**< Input samples in the current block. */
+	double   block_sum;   /**< Sum of the current decimation block. */
+	unsigned frequency;   /**< Current frequency output value. */
+	unsigned peak;        /**< Current peak output value. */
+
+	/** Decimated history, oldest first. */
+	double history[];
+};
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_band__fini(
+		filter_ctx ctx)
+{
+	struct band_ctx *b_ctx = ctx;
+
+	if (b_ctx == NULL) {
+		return;
+	}
+
+	free(b_ctx->history);
+	free(b_ctx->taper);
+	free(b_ctx->work);
+	free(b_ctx->coeff);
+	free(b_ctx->power);
+
+	free(b_ctx);
+}
+
+/**
+ * Get a double parameter which must be positive.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  name         Name of parameter to get.
+ * \param[out] value        Returns the parameter value on success.
+ * \return true on success, or false on error.
+ */
+static bool filter_band__param_double(
+		const struct bv_param *param,
+		unsigned param_count,
+		const char *name,
+		double *value)
+{
+	const struct bv_param *p;
+
+	p = param_lookup(param, param_count, name, BV_VALUE_DOUBLE);
+	if (p == NULL) {
+		return false;
+	}
+
+	*value = bv_value_double(&p->value);
+	if (!(*value > 0) || isinf(*value)) {
+		fprintf(stderr, "Error: Band: Bad %s: %f.\n", name, *value);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_band__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	const struct bv_param *param_bins;
+	struct band_ctx *ctx;
+	unsigned decimate;
+	unsigned window;
+	unsigned bins;
+	double seconds;
+	double update;
+	double high;
+	double low;
+	double rate;
+
+	if (n_output != BAND_OUT__COUNT) {
+		fprintf(stderr, "Error: Band: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+	if (n_input != 1) {
+		fprintf(stderr, "Error: Band: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+
+	if (!filter_band__param_double(param, param_count, "low", &low) ||
+	    !filter_band__param_double(param, param_count, "high", &high) ||
+	    !filter_band__param_double(param, param_count, "window",
+			&seconds) ||
+	    !filter_band__param_double(param, param_count, "update",
+			&update)) {
+		return NULL;
+	}
+
+	if (low >= high || high > frequency / 2.0) {
+		fprintf(stderr, "Error: Band: Band must be non-empty, and "
+				"below the Nyquist frequency.\n");
+		return NULL;
+	}
+	if (update > frequency) {
+		fprintf(stderr, "Error: Band: Bad update rate: %f.\n", update);
+		return NULL;
+	}
+
+	param_bins = param_lookup(param, param_count,
+			"bins", BV_VALUE_UNSIGNED);
+	if (param_bins == NULL) {
+		return NULL;
+	}
+
+	bins = bv_value_unsigned(&param_bins->value);
+	if (bins < 3 || bins > BAND_BINS_MAX) {
+		fprintf(stderr, "Error: Band: Bins must be in range 3..%u.\n",
+				BAND_BINS_MAX);
+		return NULL;
+	}
+
+	/* Block averaging is a poor anti-aliasing filter, so keep the
+	 * decimated rate well above the top of the band. */
+	decimate = frequency / (4 * high);
+	if (decimate < 1) {
+		decimate = 1;
+	}
+	rate = (double) frequency / decimate;
+
+	if (seconds * rate < 4 || seconds * rate > BAND_WINDOW_MAX) {
+		fprintf(stderr, "Error: Band: Bad window: %f.\n", seconds);
+		return NULL;
+	}
+	window = seconds * rate;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	ctx->decimate = decimate;
+	ctx->window = window;
+	ctx->bins = bins;
+	ctx->hop = frequency / update;
+	ctx->countdown = ctx->hop;
+	ctx->low = low;
+	ctx->step = (high - low) / (bins - 1);
+
+	ctx->history = calloc(window * 2, sizeof(double));
+	ctx->taper = calloc(window, sizeof(double));
+	ctx->work = calloc(window, sizeof(double));
+	ctx->coeff = calloc(bins, sizeof(double));
+	ctx->power = calloc(bins, sizeof(double));
+	if (ctx->history == NULL ||
+	    ctx->taper == NULL ||
+	    ctx->work == NULL ||
+	    ctx->coeff == NULL ||
+	    ctx->power == NULL) {
+		goto error;
+	}
+
+	for (unsigned i = 0; i < window; i++) {
+		ctx->taper[i] = 0.5 - 0.5 * cos(2 * M_PI * i / (window - 1));
+	}
+
+	for (unsigned k = 0; k < bins; k++) {
+		double f = low + k * ctx->step;
+
+		ctx->coeff[k] = 2 * cos(2 * M_PI * f / rate);
+	}
+
+	ctx->input = input[0];
+	for (unsigned i = 0; i < BAND_OUT__COUNT; i++) {
+		ctx->output[i] = output[i];
+	}
+
+	return ctx;
+
+error:
+	filter_band__fini(ctx);
+	return NULL;
+}
+
+/**
+ * Recompute the frequency and peak outputs from the current window.
+ *
+ * \param[in]  ctx  A filter instance.
+ */
+static void filter_band__update(
+		struct band_ctx *ctx)
+{
+	const double *history = ctx->history + ctx->pos;
+	unsigned best_bin = 0;
+	double offset = 0;
+	double total = 0;
+	double mean = 0;
+	double best;
+
+	for (unsigned i = 0; i < ctx->window; i++) {
+		mean += history[i];
+	}
+	mean /= ctx->window;
+
+	for (unsigned i = 0; i < ctx->window; i++) {
+		ctx->work[i] = (history[i] - mean) * ctx->taper[i];
+	}
+
+	for (unsigned k = 0; k < ctx->bins; k++) {
+		double coeff = ctx->coeff[k];
+		double s1 = 0;
+		double s2 = 0;
+
+		for (unsigned i = 0; i < ctx->window; i++) {
+			double s = ctx->work[i] + coeff * s1 - s2;
+			s2 = s1;
+			s1 = s;
+		}
+
+		ctx->power[k] = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+		total += ctx->power[k];
+		if (ctx->power[k] > ctx->power[best_bin]) {
+			best_bin = k;
+		}
+	}
+
+	if (total <= 0) {
+		return;
+	}
+
+	best = ctx->power[best_bin];
+	if (best_bin > 0 && best_bin < ctx->bins - 1) {
+		double y0 = ctx->power[best_bin - 1];
+		double y2 = ctx->power[best_bin + 1];
+		double den = y0 - 2 * best + y2;
+
+		if (den < 0) {
+			offset = 0.5 * (y0 - y2) / den;
+		}
+	}
+
+	ctx->frequency = lround((ctx->low + (best_bin + offset) * ctx->step) *
+			1000);
+	ctx->peak = lround(best / total * 1000000);
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_band__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct band_ctx *b_ctx = ctx;
+
+	BV_UNUSED(pipeline_len);
+
+	assert(b_ctx->input < pipeline_len);
+
+	b_ctx->block_sum += bv_value_unsigned(&pipeline[b_ctx->input]);
+	if (++b_ctx->block_count == b_ctx->decimate) {
+		double sample = b_ctx->block_sum / b_ctx->decimate;
+
+		b_ctx->history[b_ctx->pos] = sample;
+		b_ctx->history[b_ctx->pos + b_ctx->window] = sample;
+
+		b_ctx->pos++;
+		if (b_ctx->pos == b_ctx->window) {
+			b_ctx->pos = 0;
+		}
+		if (b_ctx->count < b_ctx->window) {
+			b_ctx->count++;
+		}
+
+		b_ctx->block_sum = 0;
+		b_ctx->block_count = 0;
+	}
+
+	if (--b_ctx->countdown == 0) {
+		b_ctx->countdown = b_ctx->hop;
+		if (b_ctx->count == b_ctx->window) {
+			filter_band__update(b_ctx);
+		}
+	}
+
+	assert(b_ctx->output[BAND_OUT_FREQUENCY] < pipeline_len);
+	assert(b_ctx->output[BAND_OUT_PEAK]      < pipeline_len);
+
+	pipeline[b_ctx->output[BAND_OUT_FREQUENCY]].type = BV_VALUE_UNSIGNED;
+	pipeline[b_ctx->output[BAND_OUT_FREQUENCY]].type_unsigned =
+			b_ctx->frequency;
+	pipeline[b_ctx->output[BAND_OUT_PEAK]].type = BV_VALUE_UNSIGNED;
+	pipeline[b_ctx->output[BAND_OUT_PEAK]].type_unsigned = b_ctx->peak;
+
+	return true;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_band__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct band_ctx *b_ctx = ctx;
+	size_t len = b_ctx->window * sizeof(double);
+	struct band_state *state;
+
+	*size = sizeof(*state) + len;
+	state = malloc(*size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->window = b_ctx->window;
+	state->decimate = b_ctx->decimate;
+	state->count = b_ctx->count;
+	state->countdown = b_ctx->countdown;
+	state->block_count = b_ctx->block_count;
+	state->block_sum = b_ctx->block_sum;
+	state->frequency = b_ctx->frequency;
+	state->peak = b_ctx->peak;
+
+	memcpy(state->history, b_ctx->history + b_ctx->pos, len);
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_band__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_band__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct band_ctx *b_ctx = ctx;
+	const struct band_state *b_state = state;
+	size_t len = b_ctx->window * sizeof(double);
+
+	if (size != sizeof(*b_state) + len ||
+	    b_state->window != b_ctx->window ||
+	    b_state->decimate != b_ctx->decimate ||
+	    b_state->block_count >= b_ctx->decimate ||
+	    b_state->countdown == 0 ||
+	    b_state->countdown > b_ctx->hop) {
+		return false;
+	}
+
+	memcpy(b_ctx->history, b_state->history, len);
+	memcpy(b_ctx->history + b_ctx->window, b_state->history, len);
+
+	b_ctx->pos = 0;
+	b_ctx->count = b_state->count;
+	b_ctx->countdown = b_state->countdown;
+	b_ctx->block_count = b_state->block_count;
+	b_ctx->block_sum = b_state->block_sum;
+	b_ctx->frequency = b_state->frequency;
+	b_ctx->peak = b_state->peak;
+
+	return true;
+}
+
+/* Exported function, documented in filter/band.h */
+bool filter_band_register(void)
+{
+	if (!filter_register("Band",
+			filter_band__init,
+			filter_band__proc,
+			filter_band__fini)) {
+		return false;
+	}
+
+	return filter_register_state("Band",
+			filter_band__save,
+			filter_band__restore);
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline beat detection
+ *        filter.
+ *
+ * This turns a pulse waveform into a beat event stream.  The input is
+ * expected to be centred on INT_MAX, as given by the normalising Average
+ * filter.
+ *
+ * A peak envelope follows the positive excursions of the input, decaying
+ * slowly so that it adapts to changes in pulse amplitude.  Each excursion
+ * above a fraction of the envelope is a candidate beat, and the beat time
+ * is that of the excursion's highest sample.  Candidates closer than the
+ * refractory period to the previous beat are ignored.
+ *
+ * The output is zero, except on the sample where a beat is confirmed, when
+ * it is the interval since the previous beat, in microseconds.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "beat.h"
+
+/** Time constant of the peak envelope decay, in seconds. */
+#define BEAT_ENVELOPE_DECAY 3.0
+
+/** Filter context. */
+struct beat_ctx {
+	unsigned input;  /**< Input pipeline offset. */
+	unsigned output; /**< Output pipeline offset. */
+
+	double   level;      /**< Fraction of the envelope for a candidate. */
+	double   decay;      /**< Per-sample envelope decay factor. */
+	double   us;         /**< Microseconds per sample. */
+	uint64_t refractory; /**< Minimum beat interval, in samples. */
+
+	double   envelope; /**< Current peak envelope. */
+	bool     in_peak;  /**< Whether the input is in a candidate excursion. */
+	double   peak;     /**< Highest value of the current excursion. */
+	uint64_t peak_seq; /**< Sample number of the current excursion peak. */
+
+	bool     have_beat; /**< Whether there has been a beat. */
+	uint64_t beat_seq;  /**< Sample number of the previous beat. */
+
+	uint64_t seq; /**< Number of the next sample. */
+};
+
+/** Saved filter state. */
+struct beat_state {
+	double envelope; /**< Current peak envelope. */
+};
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_beat__fini(
+		filter_ctx ctx)
+{
+	free(ctx);
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_beat__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	const struct bv_param *param_refractory;
+	const struct bv_param *param_level;
+	struct beat_ctx *ctx;
+	double refractory;
+	double level;
+
+	if (n_output != 1) {
+		fprintf(stderr, "Error: Beat: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+	if (n_input != 1) {
+		fprintf(stderr, "Error: Beat: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+
+	param_level = param_lookup(param, param_count,
+			"level", BV_VALUE_DOUBLE);
+	if (param_level == NULL) {
+		return NULL;
+	}
+
+	param_refractory = param_lookup(param, param_count,
+			"refractory", BV_VALUE_DOUBLE);
+	if (param_refractory == NULL) {
+		return NULL;
+	}
+
+	level = bv_value_double(&param_level->value);
+	if (!(level > 0) || !(level < 1)) {
+		fprintf(stderr, "Error: Beat: Level must be between 0 and 1.\n");
+		return NULL;
+	}
+
+	refractory = bv_value_double(&param_refractory->value);
+	if (!(refractory >= 0) || refractory > 60) {
+		fprintf(stderr, "Error: Beat: Bad refractory: %f.\n",
+				refractory);
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	ctx->level = level;
+	ctx->decay = exp(-1 / (BEAT_ENVELOPE_DECAY * frequency));
+	ctx->us = 1000000.0 / frequency;
+	ctx->refractory = refractory * frequency;
+
+	ctx->input = input[0];
+	ctx->output = output[0];
+
+	return ctx;
+}
+
+/**
+ * Handle the end of a candidate excursion.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \return the interval since the previous beat in microseconds if the
+ *         candidate is a beat, or zero otherwise.
+ */
+static unsigned filter_beat__candidate(
+		struct beat_ctx *ctx)
+{
+	double interval;
+
+	if (!ctx->have_beat) {
+		ctx->have_beat = true;
+		ctx->beat_seq = ctx->peak_seq;
+		return 0;
+	}
+
+	if (ctx->peak_seq - ctx->beat_seq < ctx->refractory) {
+		return 0;
+	}
+
+	interval = (ctx->peak_seq - ctx->beat_seq) * ctx->us;
+	ctx->beat_seq = ctx->peak_seq;
+
+	return (interval >= UINT_MAX) ? UINT_MAX : (unsigned)(interval + 0.5);
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_beat__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct beat_ctx *b_ctx = ctx;
+	unsigned interval = 0;
+	double sample;
+
+	BV_UNUSED(pipeline_len);
+
+	assert(b_ctx->input < pipeline_len);
+	assert(b_ctx->output < pipeline_len);
+
+	sample = (double) bv_value_unsigned(&pipeline[b_ctx->input]) - INT_MAX;
+
+	b_ctx->envelope *= b_ctx->decay;
+	if (sample > b_ctx->envelope) {
+		b_ctx->envelope = sample;
+	}
+
+	if (sample > 0 && sample > b_ctx->envelope * b_ctx->level) {
+		if (!b_ctx->in_peak || sample > b_ctx->peak) {
+			b_ctx->in_peak = true;
+			b_ctx->peak = sample;
+			b_ctx->peak_seq = b_ctx->seq;
+		}
+	} else if (b_ctx->in_peak) {
+		b_ctx->in_peak = false;
+		interval = filter_beat__candidate(b_ctx);
+	}
+
+	pipeline[b_ctx->output].type = BV_VALUE_UNSIGNED;
+	pipeline[b_ctx->output].type_unsigned = interval;
+
+	b_ctx->seq++;
+
+	return true;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_beat__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct beat_ctx *b_ctx = ctx;
+	struct beat_state *state;
+
+	*size = sizeof(*state);
+	state = calloc(1, *size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->envelope = b_ctx->envelope;
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * Only the envelope is restored.  There is an unknown gap between the
+ * acquisitions, so the interval to the first beat after the restart would
+ * be wrong, and so would any excursion in progress at the stop.  The
+ * restored instance waits for a fresh beat to start a new chain of
+ * intervals.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_beat__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_beat__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct beat_ctx *b_ctx = ctx;
+	const struct beat_state *b_state = state;
+
+	if (size != sizeof(*b_state)) {
+		return false;
+	}
+
+	b_ctx->envelope = b_state->envelope;
+
+	return true;
+}
+
+/* Exported function, documented in filter/beat.h */
+bool filter_beat_register(void)
+{
+	if (!filter_register("Beat",
+			filter_beat__init,
+			filter_beat__proc,
+			filter_beat__fini)) {
+		return false;
+	}
+
+	return filter_register_state("Beat",
+			filter_beat__save,
+			filter_beat__restore);
+}
@@ -144,11 +144,64 @@ static void filter_derivative__fini(
 	free(deriv_ctx);
 }
 
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_derivative__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct derivative_ctx *deriv_ctx = ctx;
+	struct bv_value *state;
+
+	state = malloc(sizeof(*state));
+	if (state == NULL) {
+		return NULL;
+	}
+
+	*state = deriv_ctx->prev;
+	*size = sizeof(*state);
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_derivative__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_derivative__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct derivative_ctx *deriv_ctx = ctx;
+
+	if (size != sizeof(deriv_ctx->prev)) {
+		return false;
+	}
+
+	deriv_ctx->prev = *(const struct bv_value *)state;
+	return true;
+}
+
 /* Exported function, documented in filter/derivative.h */
 bool filter_derivative_register(void)
 {
-	return filter_register("Derivative",
+	if (!filter_register("Derivative",
 			filter_derivative__init,
 			filter_derivative__proc,
-			filter_derivative__fini);
+			filter_derivative__fini)) {
+		return false;
+	}
+
+	return filter_register_state("Derivative",
+			filter_derivative__save,
+			filter_derivative__restore);
 }
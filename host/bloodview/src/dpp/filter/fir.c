@@ -0,0 +1,811 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline FIR filter.
+ *
+ * This convolves its input with an arbitrary kernel.  The coefficients are
+ * given by the `coefficients` string parameter, either inline as a list of
+ * numbers, or as the path to a file containing them.  In either case the
+ * numbers may be separated by whitespace or commas, and `#` starts a comment
+ * which runs to the end of the line.
+ *
+ * Short kernels are run in direct form.  Longer kernels use uniformly
+ * partitioned overlap-save FFT convolution, which processes the input in
+ * blocks of \ref FIR_PARTITION samples.  This adds a fixed latency of one
+ * block on top of the kernel's own delay, which is reported when the filter
+ * is created.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fftw3.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "fir.h"
+
+/** Largest supported kernel length. */
+#define FIR_TAPS_MAX (1u << 16)
+
+/** Longest kernel run in direct form. */
+#define FIR_DIRECT_MAX 64
+
+/** Partition and block length for FFT convolution, in samples. */
+#define FIR_PARTITION 64
+
+/** Number of bins in a partition's spectrum. */
+#define FIR_BINS (FIR_PARTITION + 1)
+
+/**
+ * Number of accumulators in the direct form convolution.
+ *
+ * The kernel is padded to a multiple of this, so the compiler can map the
+ * accumulators onto vector lanes.
+ */
+#define FIR_LANES 4
+
+/** Filter context. */
+struct fir_ctx {
+	unsigned output; /**< Output pipeline offset. */
+	unsigned input;  /**< Input pipeline offset. */
+
+	bool is_signed;  /**< Whether to offset the output by INT_MAX. */
+	bool primed;     /**< Whether the history has been filled. */
+	unsigned taps;   /**< Kernel length. */
+
+	/* Direct form. */
+	unsigned len;    /**< Kernel length padded to FIR_LANES. */
+	unsigned pos;    /**< Next history write position. */
+	double *coeff;   /**< Coefficients, oldest sample first. */
+	double *history; /**< Sample history, stored twice. */
+
+	/* Overlap-save. */
+	unsigned partitions;    /**< Number of kernel partitions. */
+	unsigned fill;          /**< Samples in the current block. */
+	unsigned fdl_pos;       /**< Newest frequency delay line entry. */
+	double *time;           /**< Previous and current input blocks. */
+	double *result;         /**< Inverse transform output. */
+	double *block_out;      /**< Outputs for the current block. */
+	fftw_complex *spectrum; /**< Transform scratch buffer. */
+	fftw_complex *kernel;   /**< Spectrum of each kernel partition. */
+	fftw_complex *fdl;      /**< Spectra of recent input blocks. */
+	fftw_plan forward;      /**< Real to complex plan, time to spectrum. */
+	fftw_plan inverse;      /**< Complex to real plan, spectrum to result. */
+};
+
+/** Saved filter state. */
+struct fir_state {
+	unsigned taps;    /**< Kernel length. */
+	bool primed;      /**< Whether the history has been filled. */
+	unsigned fill;    /**< Samples in the current block. */
+	unsigned fdl_pos; /**< Newest frequency delay line entry. */
+
+	/**
+	 * In direct form, the history, oldest first.
+	 *
+	 * For overlap-save, the input blocks, the current block's outputs,
+	 * and the frequency delay line.
+	 */
+	double data[];
+};
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_fir__fini(
+		filter_ctx ctx)
+{
+	struct fir_ctx *fir_ctx = ctx;
+
+	if (fir_ctx == NULL) {
+		return;
+	}
+
+	if (fir_ctx->forward != NULL) {
+		fftw_destroy_plan(fir_ctx->forward);
+	}
+	if (fir_ctx->inverse != NULL) {
+		fftw_destroy_plan(fir_ctx->inverse);
+	}
+
+	free(fir_ctx->coeff);
+	free(fir_ctx->history);
+	fftw_free(fir_ctx->time);
+	fftw_free(fir_ctx->result);
+	fftw_free(fir_ctx->block_out);
+	fftw_free(fir_ctx->spectrum);
+	fftw_free(fir_ctx->kernel);
+	fftw_free(fir_ctx->fdl);
+
+	free(fir_ctx);
+}
+
+/**
+ * Parse a list of coefficients.
+ *
+ * \param[in]  text   The coefficients as text.
+ * \param[out] coeff  Returns newly allocated coefficients on success.
+ * \param[out] taps   Returns the number of coefficients on success.
+ * \return true on success, or false on error.
+ */
+static bool filter_fir__parse(
+		const char *text,
+		double **coeff,
+		unsigned *taps)
+{
+	double *values = NULL;
+	unsigned count = 0;
+	unsigned alloc = 0;
+
+	while (*text != '\0') {
+		double *temp;
+		char *end;
+
+		if (isspace((unsigned char)*text) || *text == ',') {
+			text++;
+			continue;
+		}
+		if (*text == '#') {
+			text += strcspn(text, "\n");
+			continue;
+		}
+
+		if (count == FIR_TAPS_MAX) {
+			fprintf(stderr, "Error: FIR: Too many coefficients.\n");
+			goto error;
+		}
+
+		if (count == alloc) {
+			alloc = (alloc == 0) ? 64 : alloc * 2;
+			temp = realloc(values, alloc * sizeof(*values));
+			if (temp == NULL) {
+				goto error;
+			}
+			values = temp;
+		}
+
+		values[count] = strtod(text, &end);
+		if (end == text) {
+			fprintf(stderr, "Error: FIR: Bad coefficient: '%.16s'.\n",
+					text);
+			goto error;
+		}
+		text = end;
+		count++;
+	}
+
+	if (count == 0) {
+		fprintf(stderr, "Error: FIR: No coefficients.\n");
+		goto error;
+	}
+
+	*coeff = values;
+	*taps = count;
+	return true;
+
+error:
+	free(values);
+	return false;
+}
+
+/**
+ * Load a list of coefficients from a file.
+ *
+ * \param[in]  path   Path to the file.
+ * \param[out] coeff  Returns newly allocated coefficients on success.
+ * \param[out] taps   Returns the number of coefficients on success.
+ * \return true on success, or false on error.
+ */
+static bool filter_fir__load(
+		const char *path,
+		double **coeff,
+		unsigned *taps)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *file;
+	bool ret;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Error: FIR: Couldn't open '%s'.\n", path);
+		return false;
+	}
+
+	for (;;) {
+		char *temp = realloc(text, len + BUFSIZ + 1);
+		size_t read;
+
+		if (temp == NULL) {
+			free(text);
+			fclose(file);
+			return false;
+		}
+		text = temp;
+
+		read = fread(text + len, 1, BUFSIZ, file);
+		len += read;
+		if (read < BUFSIZ) {
+			break;
+		}
+	}
+	text[len] = '\0';
+
+	if (ferror(file)) {
+		fprintf(stderr, "Error: FIR: Couldn't read '%s'.\n", path);
+		ret = false;
+	} else {
+		ret = filter_fir__parse(text, coeff, taps);
+	}
+
+	fclose(file);
+	free(text);
+	return ret;
+}
+
+/**
+ * Get the filter coefficients from the filter parameters.
+ *
+ * If the parameter starts with a number or a comment, it is an inline list
+ * of coefficients.  Otherwise it is the path to a coefficient file.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  param_count  Number of parameters.
+ * \param[out] coeff        Returns newly allocated coefficients on success.
+ * \param[out] taps         Returns the number of coefficients on success.
+ * \return true on success, or false on error.
+ */
+static bool filter_fir__coefficients(
+		const struct bv_param *param,
+		unsigned param_count,
+		double **coeff,
+		unsigned *taps)
+{
+	const struct bv_param *p;
+	const char *text;
+
+	p = param_lookup(param, param_count,
+			"coefficients", BV_VALUE_STRING);
+	if (p == NULL) {
+		return false;
+	}
+
+	text = bv_value_string(&p->value);
+	text += strspn(text, " \t\r\n");
+
+	if (isdigit((unsigned char)text[0]) ||
+	    strchr("+-.#", text[0]) != NULL) {
+		return filter_fir__parse(text, coeff, taps);
+	}
+
+	return filter_fir__load(text, coeff, taps);
+}
+
+/**
+ * Set up direct form convolution.
+ *
+ * \param[in]  ctx     A filter instance.
+ * \param[in]  kernel  The filter kernel.
+ * \return true on success, or false on error.
+ */
+static bool filter_fir__init_direct(
+		struct fir_ctx *ctx,
+		const double *kernel)
+{
+	unsigned pad;
+
+	ctx->len = (ctx->taps + FIR_LANES - 1) / FIR_LANES * FIR_LANES;
+	pad = ctx->len - ctx->taps;
+
+	ctx->coeff = calloc(ctx->len, sizeof(*ctx->coeff));
+	ctx->history = calloc(ctx->len * 2, sizeof(*ctx->history));
+	if (ctx->coeff == NULL || ctx->history == NULL) {
+		return false;
+	}
+
+	/* The history is oldest first, so the kernel is reversed, and the
+	 * padding goes before the oldest sample. */
+	for (unsigned i = 0; i < ctx->taps; i++) {
+		ctx->coeff[pad + i] = kernel[ctx->taps - 1 - i];
+	}
+
+	return true;
+}
+
+/**
+ * Set up overlap-save convolution.
+ *
+ * \param[in]  ctx     A filter instance.
+ * \param[in]  kernel  The filter kernel.
+ * \return true on success, or false on error.
+ */
+static bool filter_fir__init_fft(
+		struct fir_ctx *ctx,
+		const double *kernel)
+{
+	unsigned partitions;
+
+	partitions = (ctx->taps + FIR_PARTITION - 1) / FIR_PARTITION;
+	ctx->partitions = partitions;
+
+	ctx->time = fftw_alloc_real(FIR_PARTITION * 2);
+	ctx->result = fftw_alloc_real(FIR_PARTITION * 2);
+	ctx->block_out = fftw_alloc_real(FIR_PARTITION);
+	ctx->spectrum = fftw_alloc_complex(FIR_BINS);
+	ctx->kernel = fftw_alloc_complex(FIR_BINS * partitions);
+	ctx->fdl = fftw_alloc_complex(FIR_BINS * partitions);
+	if (ctx->time == NULL ||
+	    ctx->result == NULL ||
+	    ctx->block_out == NULL ||
+	    ctx->spectrum == NULL ||
+	    ctx->kernel == NULL ||
+	    ctx->fdl == NULL) {
+		return false;
+	}
+
+	ctx->forward = fftw_plan_dft_r2c_1d(FIR_PARTITION * 2,
+			ctx->time, ctx->spectrum, FFTW_ESTIMATE);
+	ctx->inverse = fftw_plan_dft_c2r_1d(FIR_PARTITION * 2,
+			ctx->spectrum, ctx->result, FFTW_ESTIMATE);
+	if (ctx->forward == NULL || ctx->inverse == NULL) {
+		return false;
+	}
+
+	/* Each partition is zero padded to the transform length, so the
+	 * circular convolution of a block is linear over its second half. */
+	for (unsigned p = 0; p < partitions; p++) {
+		unsigned start = p * FIR_PARTITION;
+		unsigned count = ctx->taps - start;
+
+		if (count > FIR_PARTITION) {
+			count = FIR_PARTITION;
+		}
+
+		memset(ctx->time, 0, FIR_PARTITION * 2 * sizeof(*ctx->time));
+		memcpy(ctx->time, kernel + start, count * sizeof(*ctx->time));
+		fftw_execute(ctx->forward);
+		memcpy(ctx->kernel + p * FIR_BINS, ctx->spectrum,
+				FIR_BINS * sizeof(*ctx->spectrum));
+	}
+
+	return true;
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_fir__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	const struct bv_param *param_signed;
+	struct fir_ctx *ctx;
+	double *kernel;
+	unsigned latency;
+	unsigned taps;
+	bool ok;
+
+	if (n_output != 1) {
+		fprintf(stderr, "Error: FIR: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+	if (n_input != 1) {
+		fprintf(stderr, "Error: FIR: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+
+	param_signed = param_lookup(param, param_count,
+			"signed", BV_VALUE_BOOL);
+	if (param_signed == NULL) {
+		return NULL;
+	}
+
+	if (!filter_fir__coefficients(param, param_count, &kernel, &taps)) {
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		free(kernel);
+		return NULL;
+	}
+
+	ctx->taps = taps;
+	ctx->is_signed = bv_value_bool(&param_signed->value);
+	ctx->output = output[0];
+	ctx->input = input[0];
+
+	if (taps <= FIR_DIRECT_MAX) {
+		ok = filter_fir__init_direct(ctx, kernel);
+		latency = 0;
+	} else {
+		ok = filter_fir__init_fft(ctx, kernel);
+		latency = FIR_PARTITION;
+	}
+	free(kernel);
+
+	if (!ok) {
+		filter_fir__fini(ctx);
+		return NULL;
+	}
+
+	fprintf(stderr, "FIR: %u taps, %s, latency %u samples (%.1f ms).\n",
+			taps, (latency == 0) ? "direct form" : "overlap-save",
+			latency, latency * 1000.0 / frequency);
+
+	return ctx;
+}
+
+/**
+ * Convert a filter result to a pipeline value, with saturation.
+ *
+ * \param[in]  v  Value to convert.
+ * \return the nearest representable unsigned value.
+ */
+static inline unsigned filter_fir__to_unsigned(double v)
+{
+	if (v <= 0) {
+		return 0;
+	}
+	if (v >= UINT_MAX) {
+		return UINT_MAX;
+	}
+
+	return (unsigned)(v + 0.5);
+}
+
+/**
+ * Run one sample through the direct form convolution.
+ *
+ * \param[in]  ctx     A filter instance.
+ * \param[in]  sample  The input sample.
+ * \return the filter output.
+ */
+static double filter_fir__direct(
+		struct fir_ctx *ctx,
+		double sample)
+{
+	double acc[FIR_LANES] = { 0 };
+	const double *history;
+	double sum = 0;
+
+	ctx->history[ctx->pos] = sample;
+	ctx->history[ctx->pos + ctx->len] = sample;
+	ctx->pos++;
+	if (ctx->pos == ctx->len) {
+		ctx->pos = 0;
+	}
+
+	history = ctx->history + ctx->pos;
+	for (unsigned i = 0; i < ctx->len; i += FIR_LANES) {
+		for (unsigned l = 0; l < FIR_LANES; l++) {
+			acc[l] += ctx->coeff[i + l] * history[i + l];
+		}
+	}
+
+	for (unsigned l = 0; l < FIR_LANES; l++) {
+		sum += acc[l];
+	}
+
+	return sum;
+}
+
+/**
+ * Convolve the current input block with the kernel.
+ *
+ * The newest block's spectrum goes into the frequency delay line, and
+ * each kernel partition is applied to the spectrum of the block it lines
+ * up with.
+ *
+ * \param[in]  ctx  A filter instance.
+ */
+static void filter_fir__block(
+		struct fir_ctx *ctx)
+{
+	fftw_complex *acc = ctx->spectrum;
+
+	fftw_execute(ctx->forward);
+	memcpy(ctx->fdl + ctx->fdl_pos * FIR_BINS, ctx->spectrum,
+			FIR_BINS * sizeof(*ctx->spectrum));
+
+	memset(acc, 0, FIR_BINS * sizeof(*acc));
+	for (unsigned p = 0; p < ctx->partitions; p++) {
+		unsigned slot = (ctx->fdl_pos + ctx->partitions - p) %
+				ctx->partitions;
+		fftw_complex *x = ctx->fdl + slot * FIR_BINS;
+		fftw_complex *h = ctx->kernel + p * FIR_BINS;
+
+		for (unsigned i = 0; i < FIR_BINS; i++) {
+			acc[i][0] += x[i][0] * h[i][0] - x[i][1] * h[i][1];
+			acc[i][1] += x[i][0] * h[i][1] + x[i][1] * h[i][0];
+		}
+	}
+
+	fftw_execute(ctx->inverse);
+
+	/* FFTW's inverse is unnormalised; it's scaled by the length. */
+	for (unsigned i = 0; i < FIR_PARTITION; i++) {
+		ctx->block_out[i] = ctx->result[FIR_PARTITION + i] /
+				(FIR_PARTITION * 2);
+	}
+
+	memcpy(ctx->time, ctx->time + FIR_PARTITION,
+			FIR_PARTITION * sizeof(*ctx->time));
+
+	ctx->fdl_pos++;
+	if (ctx->fdl_pos == ctx->partitions) {
+		ctx->fdl_pos = 0;
+	}
+}
+
+/**
+ * Run one sample through the overlap-save convolution.
+ *
+ * \param[in]  ctx     A filter instance.
+ * \param[in]  sample  The input sample.
+ * \return the filter output, from one block earlier.
+ */
+static double filter_fir__fft(
+		struct fir_ctx *ctx,
+		double sample)
+{
+	double out = ctx->block_out[ctx->fill];
+
+	ctx->time[FIR_PARTITION + ctx->fill] = sample;
+	ctx->fill++;
+	if (ctx->fill == FIR_PARTITION) {
+		filter_fir__block(ctx);
+		ctx->fill = 0;
+	}
+
+	return out;
+}
+
+/**
+ * Fill the filter's history with a sample.
+ *
+ * This starts the filter from a flat history, rather than a step from zero.
+ *
+ * \param[in]  ctx     A filter instance.
+ * \param[in]  sample  The first input sample.
+ */
+static void filter_fir__prime(
+		struct fir_ctx *ctx,
+		double sample)
+{
+	if (ctx->partitions == 0) {
+		for (unsigned i = 0; i < ctx->len * 2; i++) {
+			ctx->history[i] = sample;
+		}
+		return;
+	}
+
+	for (unsigned i = 0; i < FIR_PARTITION * 2; i++) {
+		ctx->time[i] = sample;
+	}
+
+	fftw_execute(ctx->forward);
+	for (unsigned p = 0; p < ctx->partitions; p++) {
+		memcpy(ctx->fdl + p * FIR_BINS, ctx->spectrum,
+				FIR_BINS * sizeof(*ctx->spectrum));
+	}
+
+	/* Run a block to get the flat output for the first block's worth
+	 * of samples.  This advances the delay line, which holds the same
+	 * spectrum in every entry, so it doesn't matter. */
+	filter_fir__block(ctx);
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_fir__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct fir_ctx *fir_ctx = ctx;
+	double sample;
+	double out;
+
+	assert(fir_ctx->input < pipeline_len);
+	assert(fir_ctx->output < pipeline_len);
+
+	BV_UNUSED(pipeline_len);
+
+	sample = bv_value_unsigned(&pipeline[fir_ctx->input]);
+
+	if (!fir_ctx->primed) {
+		filter_fir__prime(fir_ctx, sample);
+		fir_ctx->primed = true;
+	}
+
+	if (fir_ctx->partitions == 0) {
+		out = filter_fir__direct(fir_ctx, sample);
+	} else {
+		out = filter_fir__fft(fir_ctx, sample);
+	}
+
+	if (fir_ctx->is_signed) {
+		out += INT_MAX;
+	}
+
+	pipeline[fir_ctx->output].type = BV_VALUE_UNSIGNED;
+	pipeline[fir_ctx->output].type_unsigned = filter_fir__to_unsigned(out);
+
+	return true;
+}
+
+/**
+ * Get the size of the data in a filter instance's saved state.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \return the number of doubles in the saved state data.
+ */
+static size_t filter_fir__state_len(
+		const struct fir_ctx *ctx)
+{
+	if (ctx->partitions == 0) {
+		return ctx->len;
+	}
+
+	return FIR_PARTITION * 3 + ctx->partitions * FIR_BINS * 2;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_fir__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct fir_ctx *fir_ctx = ctx;
+	struct fir_state *state;
+	double *data;
+
+	*size = sizeof(*state) + filter_fir__state_len(fir_ctx) *
+			sizeof(double);
+	state = malloc(*size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->taps = fir_ctx->taps;
+	state->primed = fir_ctx->primed;
+	state->fill = fir_ctx->fill;
+	state->fdl_pos = fir_ctx->fdl_pos;
+
+	data = state->data;
+	if (fir_ctx->partitions == 0) {
+		memcpy(data, fir_ctx->history + fir_ctx->pos,
+				fir_ctx->len * sizeof(*data));
+		return state;
+	}
+
+	memcpy(data, fir_ctx->time, FIR_PARTITION * 2 * sizeof(*data));
+	data += FIR_PARTITION * 2;
+	memcpy(data, fir_ctx->block_out, FIR_PARTITION * sizeof(*data));
+	data += FIR_PARTITION;
+	memcpy(data, fir_ctx->fdl,
+			fir_ctx->partitions * FIR_BINS * sizeof(fftw_complex));
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_fir__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_fir__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct fir_ctx *fir_ctx = ctx;
+	const struct fir_state *fir_state = state;
+	size_t len = fir_ctx->len * sizeof(double);
+	const double *data;
+
+	if (size != sizeof(*fir_state) + filter_fir__state_len(fir_ctx) *
+			sizeof(double) ||
+	    fir_state->taps != fir_ctx->taps ||
+	    fir_state->fill >= FIR_PARTITION ||
+	    (fir_ctx->partitions != 0 &&
+	     fir_state->fdl_pos >= fir_ctx->partitions)) {
+		return false;
+	}
+
+	fir_ctx->primed = fir_state->primed;
+	fir_ctx->fill = fir_state->fill;
+	fir_ctx->fdl_pos = fir_state->fdl_pos;
+
+	data = fir_state->data;
+	if (fir_ctx->partitions == 0) {
+		memcpy(fir_ctx->history, data, len);
+		memcpy(fir_ctx->history + fir_ctx->len, data, len);
+		fir_ctx->pos = 0;
+		return true;
+	}
+
+	memcpy(fir_ctx->time, data, FIR_PARTITION * 2 * sizeof(*data));
+	data += FIR_PARTITION * 2;
+	memcpy(fir_ctx->block_out, data, FIR_PARTITION * sizeof(*data));
+	data += FIR_PARTITION;
+	memcpy(fir_ctx->fdl, data,
+			fir_ctx->partitions * FIR_BINS * sizeof(fftw_complex));
+
+	return true;
+}
+
+/* Exported function, documented in filter/fir.h */
+bool filter_fir_register(void)
+{
+	if (!filter_register("FIR",
+			filter_fir__init,
+			filter_fir__proc,
+			filter_fir__fini)) {
+		return false;
+	}
+
+	return filter_register_state("FIR",
+			filter_fir__save,
+			filter_fir__restore);
+}
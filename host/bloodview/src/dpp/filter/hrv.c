@@ -0,0 +1,583 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline heart rate
+ *        variability filter.
+ *
+ * This takes a beat event stream, as given by the Beat filter, where each
+ * non-zero sample is a beat interval in microseconds.  It keeps the beat
+ * intervals from a sliding time window, and gives the standard time domain
+ * heart rate variability statistics over them:
+ *
+ * - mean interval, in microseconds,
+ * - SDNN, the standard deviation of intervals, in microseconds,
+ * - RMSSD, the root mean square of successive differences, in microseconds,
+ * - pNN50, the share of successive differences over 50ms, in millionths,
+ * - range, the longest interval minus the shortest, in microseconds.
+ *
+ * Beats are added and expired in constant time.  Running sums are kept in
+ * integers, so they are exact and don't drift over long windows, and the
+ * range comes from a pair of monotonic queues.
+ *
+ * Intervals outside the physiological range are taken to be missed or
+ * spurious beats.  They are dropped, and the intervals either side of them
+ * are not counted as successive.
+ *
+ * Outputs are zero until there are enough beats in the window, and they
+ * are held between beats.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "hrv.h"
+
+/** Shortest accepted beat interval, in microseconds (300 bpm). */
+#define HRV_INTERVAL_MIN 200000
+
+/** Longest accepted beat interval, in microseconds (20 bpm). */
+#define HRV_INTERVAL_MAX 3000000
+
+/** Successive difference threshold for pNN50, in microseconds. */
+#define HRV_NN50 50000
+
+/** Longest supported window, in seconds. */
+#define HRV_WINDOW_MAX 3600
+
+/** Filter outputs, in the order of the filter specification. */
+enum hrv_output {
+	HRV_OUT_MEAN,  /**< Mean interval, in microseconds. */
+	HRV_OUT_SDNN,  /**< Standard deviation of intervals. */
+	HRV_OUT_RMSSD, /**< Root mean square of successive differences. */
+	HRV_OUT_PNN50, /**< Successive differences over 50ms, in millionths. */
+	HRV_OUT_RANGE, /**< Longest minus shortest interval. */
+	HRV_OUT__COUNT,
+};
+
+/** A beat in the window. */
+struct hrv_beat {
+	uint64_t seq;      /**< Sample number of the beat. */
+	uint32_t interval; /**< Interval ending at the beat, in microseconds. */
+	bool     linked;   /**< Whether it follows on from the previous beat. */
+};
+
+/** Sliding window extremum tracker; a monotonic queue of beat numbers. */
+struct hrv_queue {
+	uint64_t *beat; /**< Beat numbers, circular, capacity of the window. */
+	unsigned head;  /**< Index of the oldest entry. */
+	unsigned len;   /**< Number of entries. */
+};
+
+/** Filter context. */
+struct hrv_ctx {
+	unsigned output[HRV_OUT__COUNT]; /**< Output pipeline offsets. */
+	unsigned input;                  /**< Input pipeline offset. */
+
+	uint64_t window;   /**< Window length in samples. */
+	unsigned capacity; /**< Most beats the window can hold. */
+
+	struct hrv_beat *beat; /**< Beats in window, circular by beat number. */
+	uint64_t first;        /**< Beat number of the oldest beat. */
+	uint64_t next;         /**< Beat number of the next beat. */
+	bool     linked;       /**< Whether the next beat is successive. */
+
+	uint64_t sum;    /**< Sum of intervals. */
+	uint64_t sumsq;  /**< Sum of squared intervals. */
+	uint64_t diffsq; /**< Sum of squared successive differences. */
+	unsigned diffs;  /**< Number of successive differences. */
+	unsigned nn50;   /**< Successive differences over threshold. */
+
+	struct hrv_queue max; /**< Window maximum tracker. */
+	struct hrv_queue min; /**< Window minimum tracker. */
+
+	bool     dirty;                  /**< Whether the window changed. */
+	unsigned value[HRV_OUT__COUNT];  /**< Current output values. */
+
+	uint64_t seq; /**< Number of the next sample. */
+};
+
+/** A saved beat. */
+struct hrv_saved_beat {
+	uint64_t age;      /**< Samples since the beat. */
+	uint32_t interval; /**< Interval ending at the beat, in microseconds. */
+	bool     linked;   /**< Whether it follows on from the previous beat. */
+};
+
+/** Saved filter state. */
+struct hrv_state {
+	uint64_t window; /**< Window length in samples. */
+	unsigned count;  /**< Number of beats in window. */
+	bool     linked; /**< Whether the next beat is successive. */
+
+	/** Beats in window, oldest first. */
+	struct hrv_saved_beat beat[];
+};
+
+/**
+ * Get a beat from the window.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  n    Beat number, which must be within the window.
+ * \return the beat.
+ */
+static inline struct hrv_beat *filter_hrv__beat(
+		const struct hrv_ctx *ctx,
+		uint64_t n)
+{
+	return &ctx->beat[n % ctx->capacity];
+}
+
+/**
+ * Add the newest beat to a sliding extremum tracker.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  q    The tracker to update.
+ * \param[in]  max  True to track the maximum, false for the minimum.
+ */
+static void filter_hrv__queue_push(
+		const struct hrv_ctx *ctx,
+		struct hrv_queue *q,
+		bool max)
+{
+	uint64_t n = ctx->next - 1;
+	uint32_t v = filter_hrv__beat(ctx, n)->interval;
+
+	/* Drop entries which can no longer be the extremum. */
+	while (q->len > 0) {
+		unsigned back = (q->head + q->len - 1) % ctx->capacity;
+		uint32_t b = filter_hrv__beat(ctx, q->beat[back])->interval;
+
+		if (max ? (b > v) : (b < v)) {
+			break;
+		}
+		q->len--;
+	}
+
+	q->beat[(q->head + q->len) % ctx->capacity] = n;
+	q->len++;
+}
+
+/**
+ * Remove the oldest beat from a sliding extremum tracker, if it's there.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  q    The tracker to update.
+ */
+static void filter_hrv__queue_pop(
+		const struct hrv_ctx *ctx,
+		struct hrv_queue *q)
+{
+	if (q->len > 0 && q->beat[q->head] == ctx->first) {
+		q->head = (q->head + 1) % ctx->capacity;
+		q->len--;
+	}
+}
+
+/**
+ * Account for the successive difference between a beat and the one before.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  n    Beat number of the later beat.
+ * \param[in]  add  True to add the difference, false to remove it.
+ */
+static void filter_hrv__diff(
+		struct hrv_ctx *ctx,
+		uint64_t n,
+		bool add)
+{
+	int64_t d = (int64_t) filter_hrv__beat(ctx, n)->interval -
+	                      filter_hrv__beat(ctx, n - 1)->interval;
+	bool nn50 = (d > HRV_NN50 || d < -HRV_NN50);
+
+	if (add) {
+		ctx->diffsq += d * d;
+		ctx->diffs++;
+		ctx->nn50 += nn50;
+	} else {
+		ctx->diffsq -= d * d;
+		ctx->diffs--;
+		ctx->nn50 -= nn50;
+	}
+}
+
+/**
+ * Remove the oldest beat from the window.
+ *
+ * \param[in]  ctx  A filter instance.
+ */
+static void filter_hrv__pop(
+		struct hrv_ctx *ctx)
+{
+	struct hrv_beat *oldest = filter_hrv__beat(ctx, ctx->first);
+	uint64_t v = oldest->interval;
+
+	assert(ctx->first < ctx->next);
+
+	ctx->sum -= v;
+	ctx->sumsq -= v * v;
+
+	if (ctx->first + 1 < ctx->next) {
+		struct hrv_beat *after = filter_hrv__beat(ctx, ctx->first + 1);
+
+		if (after->linked) {
+			filter_hrv__diff(ctx, ctx->first + 1, false);
+			after->linked = false;
+		}
+	}
+
+	filter_hrv__queue_pop(ctx, &ctx->max);
+	filter_hrv__queue_pop(ctx, &ctx->min);
+
+	ctx->first++;
+	ctx->dirty = true;
+}
+
+/**
+ * Add a beat to the window.
+ *
+ * \param[in]  ctx       A filter instance.
+ * \param[in]  seq       Sample number of the beat.
+ * \param[in]  interval  Interval ending at the beat, in microseconds.
+ */
+static void filter_hrv__push(
+		struct hrv_ctx *ctx,
+		uint64_t seq,
+		uint32_t interval)
+{
+	struct hrv_beat *beat;
+	uint64_t v = interval;
+
+	if (interval < HRV_INTERVAL_MIN || interval > HRV_INTERVAL_MAX) {
+		ctx->linked = false;
+		return;
+	}
+
+	if (ctx->next - ctx->first == ctx->capacity) {
+		filter_hrv__pop(ctx);
+	}
+
+	beat = filter_hrv__beat(ctx, ctx->next);
+	beat->seq = seq;
+	beat->interval = interval;
+	beat->linked = ctx->linked && ctx->first < ctx->next;
+	ctx->next++;
+
+	ctx->sum += v;
+	ctx->sumsq += v * v;
+	if (beat->linked) {
+		filter_hrv__diff(ctx, ctx->next - 1, true);
+	}
+
+	filter_hrv__queue_push(ctx, &ctx->max, true);
+	filter_hrv__queue_push(ctx, &ctx->min, false);
+
+	ctx->linked = true;
+	ctx->dirty = true;
+}
+
+/**
+ * Recompute the outputs from the running sums.
+ *
+ * \param[in]  ctx  A filter instance.
+ */
+static void filter_hrv__update(
+		struct hrv_ctx *ctx)
+{
+	uint64_t n = ctx->next - ctx->first;
+
+	for (unsigned i = 0; i < HRV_OUT__COUNT; i++) {
+		ctx->value[i] = 0;
+	}
+
+	if (n > 0) {
+		uint32_t max = filter_hrv__beat(ctx,
+				ctx->max.beat[ctx->max.head])->interval;
+		uint32_t min = filter_hrv__beat(ctx,
+				ctx->min.beat[ctx->min.head])->interval;
+
+		ctx->value[HRV_OUT_MEAN] = lround((double) ctx->sum / n);
+		ctx->value[HRV_OUT_RANGE] = max - min;
+	}
+
+	if (n > 1) {
+		double sum = ctx->sum;
+		double var = (ctx->sumsq - sum * sum / n) / (n - 1);
+
+		ctx->value[HRV_OUT_SDNN] = (var > 0) ? lround(sqrt(var)) : 0;
+	}
+
+	if (ctx->diffs > 0) {
+		ctx->value[HRV_OUT_RMSSD] = lround(sqrt(
+				(double) ctx->diffsq / ctx->diffs));
+		ctx->value[HRV_OUT_PNN50] = lround(
+				ctx->nn50 * 1000000.0 / ctx->diffs);
+	}
+
+	ctx->dirty = false;
+}
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_hrv__fini(
+		filter_ctx ctx)
+{
+	struct hrv_ctx *h_ctx = ctx;
+
+	if (h_ctx == NULL) {
+		return;
+	}
+
+	free(h_ctx->beat);
+	free(h_ctx->max.beat);
+	free(h_ctx->min.beat);
+
+	free(h_ctx);
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_hrv__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	const struct bv_param *param_window;
+	struct hrv_ctx *ctx;
+	double window;
+
+	if (n_output != HRV_OUT__COUNT) {
+		fprintf(stderr, "Error: HRV: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+	if (n_input != 1) {
+		fprintf(stderr, "Error: HRV: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+
+	param_window = param_lookup(param, param_count,
+			"window", BV_VALUE_DOUBLE);
+	if (param_window == NULL) {
+		return NULL;
+	}
+
+	window = bv_value_double(&param_window->value);
+	if (!(window * frequency >= 1) || window > HRV_WINDOW_MAX) {
+		fprintf(stderr, "Error: HRV: Bad window: %f.\n", window);
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	ctx->window = window * frequency;
+	ctx->capacity = window * 1000000 / HRV_INTERVAL_MIN + 1;
+
+	ctx->beat = calloc(ctx->capacity, sizeof(*ctx->beat));
+	ctx->max.beat = calloc(ctx->capacity, sizeof(*ctx->max.beat));
+	ctx->min.beat = calloc(ctx->capacity, sizeof(*ctx->min.beat));
+	if (ctx->beat == NULL ||
+	    ctx->max.beat == NULL ||
+	    ctx->min.beat == NULL) {
+		goto error;
+	}
+
+	ctx->input = input[0];
+	for (unsigned i = 0; i < HRV_OUT__COUNT; i++) {
+		ctx->output[i] = output[i];
+	}
+
+	return ctx;
+
+error:
+	filter_hrv__fini(ctx);
+	return NULL;
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_hrv__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct hrv_ctx *h_ctx = ctx;
+	unsigned interval;
+
+	BV_UNUSED(pipeline_len);
+
+	assert(h_ctx->input < pipeline_len);
+
+	while (h_ctx->first < h_ctx->next &&
+	       h_ctx->seq - filter_hrv__beat(h_ctx, h_ctx->first)->seq >=
+			h_ctx->window) {
+		filter_hrv__pop(h_ctx);
+	}
+
+	interval = bv_value_unsigned(&pipeline[h_ctx->input]);
+	if (interval != 0) {
+		filter_hrv__push(h_ctx, h_ctx->seq, interval);
+	}
+
+	if (h_ctx->dirty) {
+		filter_hrv__update(h_ctx);
+	}
+
+	for (unsigned i = 0; i < HRV_OUT__COUNT; i++) {
+		assert(h_ctx->output[i] < pipeline_len);
+
+		pipeline[h_ctx->output[i]].type = BV_VALUE_UNSIGNED;
+		pipeline[h_ctx->output[i]].type_unsigned = h_ctx->value[i];
+	}
+
+	h_ctx->seq++;
+
+	return true;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_hrv__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct hrv_ctx *h_ctx = ctx;
+	unsigned count = h_ctx->next - h_ctx->first;
+	struct hrv_state *state;
+
+	*size = sizeof(*state) + count * sizeof(*state->beat);
+	state = calloc(1, *size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->window = h_ctx->window;
+	state->count = count;
+	state->linked = h_ctx->linked;
+
+	for (unsigned i = 0; i < count; i++) {
+		const struct hrv_beat *beat = filter_hrv__beat(h_ctx,
+				h_ctx->first + i);
+
+		state->beat[i].age = h_ctx->seq - beat->seq;
+		state->beat[i].interval = beat->interval;
+		state->beat[i].linked = beat->linked;
+	}
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * The saved beats are replayed into the window, which rebuilds the running
+ * sums and extremum trackers.  Sample numbers are saved as ages, and
+ * sample number differences are taken modulo 2^64, so the restored
+ * instance can carry on from its own sample count.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_hrv__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_hrv__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct hrv_ctx *h_ctx = ctx;
+	const struct hrv_state *h_state = state;
+
+	if (size < sizeof(*h_state) ||
+	    h_state->window != h_ctx->window ||
+	    h_state->count > h_ctx->capacity ||
+	    size != sizeof(*h_state) + h_state->count *
+			sizeof(*h_state->beat)) {
+		return false;
+	}
+
+	for (unsigned i = 0; i < h_state->count; i++) {
+		h_ctx->linked = h_state->beat[i].linked;
+		filter_hrv__push(h_ctx, h_ctx->seq - h_state->beat[i].age,
+				h_state->beat[i].interval);
+	}
+	h_ctx->linked = h_state->linked;
+
+	filter_hrv__update(h_ctx);
+
+	return true;
+}
+
+/* Exported function, documented in filter/hrv.h */
+bool filter_hrv_register(void)
+{
+	if (!filter_register("HRV",
+			filter_hrv__init,
+			filter_hrv__proc,
+			filter_hrv__fini)) {
+		return false;
+	}
+
+	return filter_register_state("HRV",
+			filter_hrv__save,
+			filter_hrv__restore);
+}
@@ -0,0 +1,499 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline Savitzky-Golay filter.
+ *
+ * This fits a polynomial to a sliding window of samples by least squares,
+ * and evaluates the fitted polynomial and its first and second derivatives
+ * at the centre of the window.  Since the fit is linear in the samples, each
+ * output is a fixed convolution, and the coefficients are computed once at
+ * filter creation.
+ *
+ * The outputs refer to the centre of the window, so they lag the input by
+ * half the window length.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "savgol.h"
+
+/** Highest supported polynomial order. */
+#define SAVGOL_ORDER_MAX 6
+
+/** Largest supported window length, in samples. */
+#define SAVGOL_WINDOW_MAX 4095
+
+/** Filter outputs, in the order of the filter specification. */
+enum savgol_output {
+	SAVGOL_SMOOTHED, /**< Smoothed value. */
+	SAVGOL_FIRST,    /**< First derivative. */
+	SAVGOL_SECOND,   /**< Second derivative. */
+	SAVGOL__COUNT,
+};
+
+/**
+ * Number of coefficients stored per window position.
+ *
+ * The coefficients for all outputs are interleaved and padded to a power
+ * of two, so the convolution loop computes every output in a single pass,
+ * and the compiler can map the per-output accumulators onto vector lanes.
+ */
+#define SAVGOL_LANES 4
+
+/** Filter context. */
+struct savgol_ctx {
+	unsigned output[SAVGOL__COUNT]; /**< Output pipeline offsets. */
+	unsigned input;                 /**< Input pipeline offset. */
+
+	unsigned window; /**< Window length in samples.  Always odd. */
+	unsigned pos;    /**< Next history write position. */
+	bool primed;     /**< Whether the history has been filled. */
+
+	/** Coefficients, indexed by window position (oldest first). */
+	double (*coeff)[SAVGOL_LANES];
+
+	/** Sample history, stored twice so the window is always contiguous. */
+	double *history;
+};
+
+/** Saved filter state. */
+struct savgol_state {
+	unsigned window;  /**< Window length in samples. */
+	bool primed;      /**< Whether the history has been filled. */
+	double history[]; /**< Sample history, oldest first. */
+};
+
+/**
+ * Get magnitude of a double.
+ *
+ * \param[in]  v  Value to get the magnitude of.
+ * \return the magnitude.
+ */
+static inline double filter_savgol__abs(double v)
+{
+	return (v < 0) ? -v : v;
+}
+
+/**
+ * Solve a small linear system by Gaussian elimination.
+ *
+ * \param[in,out] a  Augmented matrix; n rows of n + 1 columns.  Clobbered.
+ * \param[in]     n  Number of unknowns.
+ * \param[out]    x  Returns the solution on success.
+ * \return true on success, or false if the system is singular.
+ */
+static bool filter_savgol__solve(
+		double a[SAVGOL_ORDER_MAX + 1][SAVGOL_ORDER_MAX + 2],
+		unsigned n,
+		double *x)
+{
+	for (unsigned col = 0; col < n; col++) {
+		unsigned pivot = col;
+
+		for (unsigned row = col + 1; row < n; row++) {
+			if (filter_savgol__abs(a[row][col]) >
+			    filter_savgol__abs(a[pivot][col])) {
+				pivot = row;
+			}
+		}
+
+		if (filter_savgol__abs(a[pivot][col]) < 1e-12) {
+			return false;
+		}
+
+		if (pivot != col) {
+			for (unsigned i = 0; i <= n; i++) {
+				double tmp = a[col][i];
+				a[col][i] = a[pivot][i];
+				a[pivot][i] = tmp;
+			}
+		}
+
+		for (unsigned row = col + 1; row < n; row++) {
+			double f = a[row][col] / a[col][col];
+
+			for (unsigned i = col; i <= n; i++) {
+				a[row][i] -= f * a[col][i];
+			}
+		}
+	}
+
+	for (unsigned row = n; row-- > 0;) {
+		double sum = a[row][n];
+
+		for (unsigned i = row + 1; i < n; i++) {
+			sum -= a[row][i] * x[i];
+		}
+		x[row] = sum / a[row][row];
+	}
+
+	return true;
+}
+
+/**
+ * Compute the convolution coefficients for each output.
+ *
+ * Abscissae are normalised to [-1, 1] across the window, to keep the
+ * normal equations well conditioned for long windows, and the derivative
+ * coefficients are rescaled back to units of samples afterwards.
+ *
+ * \param[in]  ctx    Filter instance to fill coefficients for.
+ * \param[in]  order  Polynomial order to fit.
+ * \return true on success, or false on error.
+ */
+static bool filter_savgol__coefficients(
+		struct savgol_ctx *ctx,
+		unsigned order)
+{
+	double moment[2 * SAVGOL_ORDER_MAX + 1] = { 0 };
+	double half = ctx->window / 2;
+	unsigned n = order + 1;
+	double scale = 1;
+
+	for (unsigned i = 0; i < ctx->window; i++) {
+		double t = (i - half) / half;
+		double p = 1;
+
+		for (unsigned k = 0; k <= 2 * order; k++) {
+			moment[k] += p;
+			p *= t;
+		}
+	}
+
+	for (unsigned d = 0; d < SAVGOL__COUNT; d++) {
+		double a[SAVGOL_ORDER_MAX + 1][SAVGOL_ORDER_MAX + 2];
+		double x[SAVGOL_ORDER_MAX + 1];
+
+		/* Derivative d of the fit at the centre is d! * a_d, and
+		 * each differentiation with respect to sample index brings
+		 * out a factor of 1 / half. */
+		if (d > 0) {
+			scale *= d / half;
+		}
+
+		if (d > order) {
+			/* Coefficients are already zeroed. */
+			continue;
+		}
+
+		for (unsigned r = 0; r < n; r++) {
+			for (unsigned c = 0; c < n; c++) {
+				a[r][c] = moment[r + c];
+			}
+			a[r][n] = (r == d) ? 1 : 0;
+		}
+
+		if (!filter_savgol__solve(a, n, x)) {
+			fprintf(stderr, "Error: SavGol: Can't fit order %u "
+					"to window %u.\n", order, ctx->window);
+			return false;
+		}
+
+		for (unsigned i = 0; i < ctx->window; i++) {
+			double t = (i - half) / half;
+			double p = 1;
+			double c = 0;
+
+			for (unsigned k = 0; k < n; k++) {
+				c += x[k] * p;
+				p *= t;
+			}
+
+			ctx->coeff[i][d] = c * scale;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_savgol__fini(
+		filter_ctx ctx)
+{
+	if (ctx != NULL) {
+		struct savgol_ctx *sg_ctx = ctx;
+		free(sg_ctx->coeff);
+		free(sg_ctx->history);
+		free(sg_ctx);
+	}
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_savgol__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	struct savgol_ctx *ctx;
+	const struct bv_param *param_window;
+	const struct bv_param *param_order;
+	unsigned window;
+	unsigned order;
+
+	BV_UNUSED(frequency);
+
+	if (n_output != SAVGOL__COUNT) {
+		fprintf(stderr, "Error: SavGol: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+	if (n_input != 1) {
+		fprintf(stderr, "Error: SavGol: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+
+	param_window = param_lookup(param, param_count,
+			"window", BV_VALUE_UNSIGNED);
+	if (param_window == NULL) {
+		return NULL;
+	}
+
+	param_order = param_lookup(param, param_count,
+			"order", BV_VALUE_UNSIGNED);
+	if (param_order == NULL) {
+		return NULL;
+	}
+
+	window = bv_value_unsigned(&param_window->value);
+	order = bv_value_unsigned(&param_order->value);
+
+	if (window < 3 || window > SAVGOL_WINDOW_MAX || (window & 1) == 0) {
+		fprintf(stderr, "Error: SavGol: Window must be odd, "
+				"and in range 3..%u.\n", SAVGOL_WINDOW_MAX);
+		return NULL;
+	}
+	if (order > SAVGOL_ORDER_MAX || order >= window) {
+		fprintf(stderr, "Error: SavGol: Order must be less than "
+				"window, and at most %u.\n", SAVGOL_ORDER_MAX);
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	ctx->window = window;
+	ctx->coeff = calloc(window, sizeof(*ctx->coeff));
+	ctx->history = calloc(window * 2, sizeof(*ctx->history));
+	if (ctx->coeff == NULL || ctx->history == NULL) {
+		goto error;
+	}
+
+	if (!filter_savgol__coefficients(ctx, order)) {
+		goto error;
+	}
+
+	for (unsigned i = 0; i < SAVGOL__COUNT; i++) {
+		ctx->output[i] = output[i];
+	}
+	ctx->input = input[0];
+
+	return ctx;
+
+error:
+	filter_savgol__fini(ctx);
+	return NULL;
+}
+
+/**
+ * Convert a filter result to a pipeline value, with saturation.
+ *
+ * \param[in]  v  Value to convert.
+ * \return the nearest representable unsigned value.
+ */
+static inline unsigned filter_savgol__to_unsigned(double v)
+{
+	if (v <= 0) {
+		return 0;
+	}
+	if (v >= UINT_MAX) {
+		return UINT_MAX;
+	}
+
+	return (unsigned)(v + 0.5);
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_savgol__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct savgol_ctx *sg_ctx = ctx;
+	double acc[SAVGOL_LANES] = { 0 };
+	const double *history;
+	double sample;
+
+	assert(sg_ctx->input < pipeline_len);
+
+	BV_UNUSED(pipeline_len);
+
+	sample = bv_value_unsigned(&pipeline[sg_ctx->input]);
+
+	if (!sg_ctx->primed) {
+		/* Start from a flat history, rather than a step from zero. */
+		for (unsigned i = 0; i < sg_ctx->window * 2; i++) {
+			sg_ctx->history[i] = sample;
+		}
+		sg_ctx->primed = true;
+	}
+
+	sg_ctx->history[sg_ctx->pos] = sample;
+	sg_ctx->history[sg_ctx->pos + sg_ctx->window] = sample;
+	sg_ctx->pos++;
+	if (sg_ctx->pos == sg_ctx->window) {
+		sg_ctx->pos = 0;
+	}
+
+	history = sg_ctx->history + sg_ctx->pos;
+	for (unsigned i = 0; i < sg_ctx->window; i++) {
+		for (unsigned l = 0; l < SAVGOL_LANES; l++) {
+			acc[l] += sg_ctx->coeff[i][l] * history[i];
+		}
+	}
+
+	for (unsigned i = 0; i < SAVGOL__COUNT; i++) {
+		assert(sg_ctx->output[i] < pipeline_len);
+
+		/* Derivatives are signed, so offset them like the
+		 * Derivative filter does. */
+		if (i != SAVGOL_SMOOTHED) {
+			acc[i] += INT_MAX;
+		}
+
+		pipeline[sg_ctx->output[i]].type = BV_VALUE_UNSIGNED;
+		pipeline[sg_ctx->output[i]].type_unsigned =
+				filter_savgol__to_unsigned(acc[i]);
+	}
+
+	return true;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_savgol__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct savgol_ctx *sg_ctx = ctx;
+	struct savgol_state *state;
+
+	*size = sizeof(*state) + sg_ctx->window * sizeof(*state->history);
+	state = malloc(*size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->window = sg_ctx->window;
+	state->primed = sg_ctx->primed;
+	memcpy(state->history, sg_ctx->history + sg_ctx->pos,
+			sg_ctx->window * sizeof(*state->history));
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_savgol__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_savgol__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct savgol_ctx *sg_ctx = ctx;
+	const struct savgol_state *sg_state = state;
+	size_t len = sg_ctx->window * sizeof(*sg_state->history);
+
+	if (size != sizeof(*sg_state) + len ||
+	    sg_state->window != sg_ctx->window) {
+		return false;
+	}
+
+	memcpy(sg_ctx->history, sg_state->history, len);
+	memcpy(sg_ctx->history + sg_ctx->window, sg_state->history, len);
+	sg_ctx->primed = sg_state->primed;
+	sg_ctx->pos = 0;
+
+	return true;
+}
+
+/* Exported function, documented in filter/savgol.h */
+bool filter_savgol_register(void)
+{
+	if (!filter_register("SavGol",
+			filter_savgol__init,
+			filter_savgol__proc,
+			filter_savgol__fini)) {
+		return false;
+	}
+
+	return filter_register_state("SavGol",
+			filter_savgol__save,
+			filter_savgol__restore);
+}
@@ -0,0 +1,564 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the data processing pipeline cross-correlation
+ *        filter.
+ *
+ * This estimates the time lag between two input streams, such as the pulse
+ * arriving at two photodiodes, or at one photodiode under two wavelengths.
+ *
+ * Every update period, the most recent window of each input has its mean
+ * removed and is cross-correlated with the other by FFT.  The windows are
+ * zero-padded to at least the window length plus the maximum lag, so the
+ * circular correlation is equal to the linear one over the lags searched.
+ * The correlation is corrected for the reduced overlap at larger lags, and
+ * the peak is refined to sub-sample precision by parabolic interpolation.
+ *
+ * Outputs are held between updates.  The cost per update is fixed by the
+ * window length, so the cost per sample is bounded by the update rate.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fftw3.h>
+
+#include "../../util.h"
+
+#include "../param.h"
+#include "../filter.h"
+
+#include "xcorr.h"
+
+/** Largest supported window length, in samples. */
+#define XCORR_WINDOW_MAX (1u << 16)
+
+/** Filter inputs, in the order of the filter specification. */
+enum xcorr_input {
+	XCORR_IN_A,
+	XCORR_IN_B,
+	XCORR_IN__COUNT,
+};
+
+/** Filter outputs, in the order of the filter specification. */
+enum xcorr_output {
+	XCORR_OUT_LAG,  /**< Lag of b behind a, in microseconds. */
+	XCORR_OUT_PEAK, /**< Normalised correlation peak, in millionths. */
+	XCORR_OUT__COUNT,
+};
+
+/** Filter context. */
+struct xcorr_ctx {
+	unsigned output[XCORR_OUT__COUNT]; /**< Output pipeline offsets. */
+	unsigned input[XCORR_IN__COUNT];   /**< Input pipeline offsets. */
+
+	unsigned frequency; /**< Acquisition sampling rate. */
+	unsigned window;    /**< Correlation window length in samples. */
+	unsigned max_lag;   /**< Largest lag searched, in samples. */
+	unsigned hop;       /**< Samples between updates. */
+	unsigned fft_len;   /**< Padded transform length. */
+
+	unsigned pos;       /**< Next history write position. */
+	unsigned count;     /**< Samples seen, saturating at window. */
+	unsigned countdown; /**< Samples until the next update. */
+
+	/** Per-input history, stored twice so the window is contiguous. */
+	double *history[XCORR_IN__COUNT];
+
+	double *time[XCORR_IN__COUNT];          /**< Transform inputs. */
+	fftw_complex *freq[XCORR_IN__COUNT];    /**< Transform outputs. */
+	double *corr;                           /**< Correlation result. */
+
+	fftw_plan forward; /**< Real to complex plan, reused for both inputs. */
+	fftw_plan inverse; /**< Complex to real plan. */
+
+	unsigned lag;  /**< Current lag output value. */
+	unsigned peak; /**< Current peak output value. */
+};
+
+/** Saved filter state. */
+struct xcorr_state {
+	unsigned window;    /**< Correlation window length in samples. */
+	unsigned count;     /**< Samples seen, saturating at window. */
+	unsigned countdown; /**< Samples until the next update. */
+	unsigned lag;       /**< Current lag output value. */
+	unsigned peak;      /**< Current peak output value. */
+
+	/** Each input's history in turn, oldest first. */
+	double history[];
+};
+
+/**
+ * Destroy a filter instance.
+ *
+ * \param[in] ctx  A filter instance.
+ */
+static void filter_xcorr__fini(
+		filter_ctx ctx)
+{
+	struct xcorr_ctx *xc_ctx = ctx;
+
+	if (xc_ctx == NULL) {
+		return;
+	}
+
+	if (xc_ctx->forward != NULL) {
+		fftw_destroy_plan(xc_ctx->forward);
+	}
+	if (xc_ctx->inverse != NULL) {
+		fftw_destroy_plan(xc_ctx->inverse);
+	}
+
+	for (unsigned i = 0; i < XCORR_IN__COUNT; i++) {
+		free(xc_ctx->history[i]);
+		fftw_free(xc_ctx->time[i]);
+		fftw_free(xc_ctx->freq[i]);
+	}
+	fftw_free(xc_ctx->corr);
+
+	free(xc_ctx);
+}
+
+/**
+ * Get a parameter converted to a number of samples.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  name         Name of parameter, in seconds, to convert.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[out] samples      Returns the number of samples on success.
+ * \return true on success, or false on error.
+ */
+static bool filter_xcorr__param_samples(
+		const struct bv_param *param,
+		unsigned param_count,
+		const char *name,
+		unsigned frequency,
+		unsigned *samples)
+{
+	const struct bv_param *p;
+	double seconds;
+
+	p = param_lookup(param, param_count, name, BV_VALUE_DOUBLE);
+	if (p == NULL) {
+		return false;
+	}
+
+	seconds = bv_value_double(&p->value);
+	if (!(seconds >= 0) || seconds * frequency > XCORR_WINDOW_MAX) {
+		fprintf(stderr, "Error: XCorr: Bad %s: %f.\n", name, seconds);
+		return false;
+	}
+
+	*samples = seconds * frequency;
+	return true;
+}
+
+/**
+ * Create a filter instance.
+ *
+ * The input and output arrays are valid until \ref filter_finish is called,
+ * so they can be referred to during \ref filter_proc.
+ *
+ * Inputs and outputs are in the order that the inputs and outputs are
+ * listed in the filter specification YAML.
+ *
+ * \param[in]  param        Array of filter parameter/values.
+ * \param[in]  output       Array of pipeline value offsets for outputs.
+ * \param[in]  input        Array of pipeline value offsets for inputs.
+ * \param[in]  param_count  Number of parameters.
+ * \param[in]  frequency    The acquisition sampling rate.
+ * \param[in]  n_output     Number of outputs.
+ * \param[in]  n_input      Number of inputs.
+ * \return A filter instance on success, of NULL on failure.
+ */
+static filter_ctx filter_xcorr__init(
+		const struct bv_param *param,
+		const unsigned *output,
+		const unsigned *input,
+		unsigned param_count,
+		unsigned frequency,
+		unsigned n_output,
+		unsigned n_input)
+{
+	const struct bv_param *param_update;
+	struct xcorr_ctx *ctx;
+	unsigned max_lag;
+	unsigned window;
+	unsigned fft_len;
+	double update;
+
+	if (n_output != XCORR_OUT__COUNT) {
+		fprintf(stderr, "Error: XCorr: Bad output count: %u.\n",
+				n_output);
+		return NULL;
+	}
+	if (n_input != XCORR_IN__COUNT) {
+		fprintf(stderr, "Error: XCorr: Bad input count: %u.\n",
+				n_input);
+		return NULL;
+	}
+
+	if (!filter_xcorr__param_samples(param, param_count,
+			"window", frequency, &window) ||
+	    !filter_xcorr__param_samples(param, param_count,
+			"max_lag", frequency, &max_lag)) {
+		return NULL;
+	}
+
+	if (window < 4 || max_lag >= window) {
+		fprintf(stderr, "Error: XCorr: Window must be at least 4 "
+				"samples, and longer than max_lag.\n");
+		return NULL;
+	}
+
+	param_update = param_lookup(param, param_count,
+			"update", BV_VALUE_DOUBLE);
+	if (param_update == NULL) {
+		return NULL;
+	}
+
+	update = bv_value_double(&param_update->value);
+	if (!(update > 0) || update > frequency) {
+		fprintf(stderr, "Error: XCorr: Bad update rate: %f.\n", update);
+		return NULL;
+	}
+
+	fft_len = 1;
+	while (fft_len < window + max_lag) {
+		fft_len <<= 1;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	ctx->frequency = frequency;
+	ctx->window = window;
+	ctx->max_lag = max_lag;
+	ctx->fft_len = fft_len;
+	ctx->hop = frequency / update;
+	ctx->countdown = ctx->hop;
+	ctx->lag = INT_MAX;
+	ctx->peak = INT_MAX;
+
+	for (unsigned i = 0; i < XCORR_IN__COUNT; i++) {
+		ctx->history[i] = calloc(window * 2, sizeof(double));
+		ctx->time[i] = fftw_alloc_real(fft_len);
+		ctx->freq[i] = fftw_alloc_complex(fft_len / 2 + 1);
+		if (ctx->history[i] == NULL ||
+		    ctx->time[i] == NULL ||
+		    ctx->freq[i] == NULL) {
+			goto error;
+		}
+		ctx->input[i] = input[i];
+	}
+
+	ctx->corr = fftw_alloc_real(fft_len);
+	if (ctx->corr == NULL) {
+		goto error;
+	}
+
+	/* The forward plan is applied to both inputs with the new-array
+	 * execute interface, so one plan serves both. */
+	ctx->forward = fftw_plan_dft_r2c_1d(fft_len,
+			ctx->time[XCORR_IN_A], ctx->freq[XCORR_IN_A],
+			FFTW_ESTIMATE);
+	ctx->inverse = fftw_plan_dft_c2r_1d(fft_len,
+			ctx->freq[XCORR_IN_A], ctx->corr,
+			FFTW_ESTIMATE);
+	if (ctx->forward == NULL || ctx->inverse == NULL) {
+		goto error;
+	}
+
+	for (unsigned i = 0; i < XCORR_OUT__COUNT; i++) {
+		ctx->output[i] = output[i];
+	}
+
+	return ctx;
+
+error:
+	filter_xcorr__fini(ctx);
+	return NULL;
+}
+
+/**
+ * Copy an input's window into its transform buffer, removing the mean.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  in   The input to prepare.
+ * \return the energy of the window after mean removal.
+ */
+static double filter_xcorr__prepare(
+		struct xcorr_ctx *ctx,
+		enum xcorr_input in)
+{
+	const double *history = ctx->history[in] + ctx->pos;
+	double *time = ctx->time[in];
+	double energy = 0;
+	double mean = 0;
+
+	for (unsigned i = 0; i < ctx->window; i++) {
+		mean += history[i];
+	}
+	mean /= ctx->window;
+
+	for (unsigned i = 0; i < ctx->window; i++) {
+		time[i] = history[i] - mean;
+		energy += time[i] * time[i];
+	}
+
+	memset(time + ctx->window, 0,
+			(ctx->fft_len - ctx->window) * sizeof(*time));
+
+	return energy;
+}
+
+/**
+ * Get the correlation at a given lag.
+ *
+ * The windows only overlap for window - |lag| samples, so the sum is scaled
+ * up to the full window.  Otherwise the estimate is biased towards zero lag,
+ * which is significant when the window spans only a few pulses.
+ *
+ * \param[in]  ctx  A filter instance.
+ * \param[in]  lag  The lag, which must be within the searched range.
+ * \return the correlation, scaled by the transform length.
+ */
+static inline double filter_xcorr__at(
+		const struct xcorr_ctx *ctx,
+		int lag)
+{
+	unsigned overlap = ctx->window - abs(lag);
+
+	return ctx->corr[(lag + (int)ctx->fft_len) % (int)ctx->fft_len] *
+			ctx->window / overlap;
+}
+
+/**
+ * Recompute the lag and peak outputs from the current windows.
+ *
+ * \param[in]  ctx  A filter instance.
+ */
+static void filter_xcorr__update(
+		struct xcorr_ctx *ctx)
+{
+	fftw_complex *a = ctx->freq[XCORR_IN_A];
+	fftw_complex *b = ctx->freq[XCORR_IN_B];
+	int max_lag = ctx->max_lag;
+	double energy_a;
+	double energy_b;
+	double offset = 0;
+	double best;
+	int best_lag;
+
+	energy_a = filter_xcorr__prepare(ctx, XCORR_IN_A);
+	energy_b = filter_xcorr__prepare(ctx, XCORR_IN_B);
+	if (energy_a == 0 || energy_b == 0) {
+		return;
+	}
+
+	fftw_execute_dft_r2c(ctx->forward, ctx->time[XCORR_IN_A], a);
+	fftw_execute_dft_r2c(ctx->forward, ctx->time[XCORR_IN_B], b);
+
+	/* Correlation of a with b is the inverse of conj(A) * B.
+	 * The product is written over A, which the inverse plan reads. */
+	for (unsigned i = 0; i < ctx->fft_len / 2 + 1; i++) {
+		double re = a[i][0] * b[i][0] + a[i][1] * b[i][1];
+		double im = a[i][0] * b[i][1] - a[i][1] * b[i][0];
+
+		a[i][0] = re;
+		a[i][1] = im;
+	}
+
+	fftw_execute(ctx->inverse);
+
+	best_lag = -max_lag;
+	best = filter_xcorr__at(ctx, best_lag);
+	for (int lag = -max_lag + 1; lag <= max_lag; lag++) {
+		double v = filter_xcorr__at(ctx, lag);
+		if (v > best) {
+			best = v;
+			best_lag = lag;
+		}
+	}
+
+	if (best_lag > -max_lag && best_lag < max_lag) {
+		double y0 = filter_xcorr__at(ctx, best_lag - 1);
+		double y2 = filter_xcorr__at(ctx, best_lag + 1);
+		double den = y0 - 2 * best + y2;
+
+		if (den < 0) {
+			offset = 0.5 * (y0 - y2) / den;
+			best -= 0.25 * (y0 - y2) * offset;
+		}
+	}
+
+	/* FFTW's inverse is unnormalised; it's scaled by fft_len. */
+	best /= ctx->fft_len * sqrt(energy_a * energy_b);
+
+	ctx->lag = INT_MAX + lround((best_lag + offset) * 1000000 /
+			ctx->frequency);
+	ctx->peak = INT_MAX + lround(best * 1000000);
+}
+
+/**
+ * Run the filter over the pipeline.
+ *
+ * \param[in] ctx           A filter instance.
+ * \param[in] pipeline      The data pipeline.
+ * \param[in] pipeline_len  The length of the pipeline.
+ */
+static bool filter_xcorr__proc(
+		filter_ctx ctx,
+		struct bv_value *pipeline,
+		size_t pipeline_len)
+{
+	struct xcorr_ctx *xc_ctx = ctx;
+
+	BV_UNUSED(pipeline_len);
+
+	for (unsigned i = 0; i < XCORR_IN__COUNT; i++) {
+		double sample;
+
+		assert(xc_ctx->input[i] < pipeline_len);
+
+		sample = bv_value_unsigned(&pipeline[xc_ctx->input[i]]);
+		xc_ctx->history[i][xc_ctx->pos] = sample;
+		xc_ctx->history[i][xc_ctx->pos + xc_ctx->window] = sample;
+	}
+
+	xc_ctx->pos++;
+	if (xc_ctx->pos == xc_ctx->window) {
+		xc_ctx->pos = 0;
+	}
+	if (xc_ctx->count < xc_ctx->window) {
+		xc_ctx->count++;
+	}
+
+	if (--xc_ctx->countdown == 0) {
+		xc_ctx->countdown = xc_ctx->hop;
+		if (xc_ctx->count == xc_ctx->window) {
+			filter_xcorr__update(xc_ctx);
+		}
+	}
+
+	assert(xc_ctx->output[XCORR_OUT_LAG]  < pipeline_len);
+	assert(xc_ctx->output[XCORR_OUT_PEAK] < pipeline_len);
+
+	pipeline[xc_ctx->output[XCORR_OUT_LAG]].type = BV_VALUE_UNSIGNED;
+	pipeline[xc_ctx->output[XCORR_OUT_LAG]].type_unsigned = xc_ctx->lag;
+	pipeline[xc_ctx->output[XCORR_OUT_PEAK]].type = BV_VALUE_UNSIGNED;
+	pipeline[xc_ctx->output[XCORR_OUT_PEAK]].type_unsigned = xc_ctx->peak;
+
+	return true;
+}
+
+/**
+ * Save a filter instance's state.
+ *
+ * \param[in]  ctx   A filter instance.
+ * \param[out] size  Returns the size of the state in bytes on success.
+ * \return Newly allocated state on success, or NULL on failure.
+ */
+static void *filter_xcorr__save(
+		filter_ctx ctx,
+		size_t *size)
+{
+	const struct xcorr_ctx *xc_ctx = ctx;
+	size_t len = xc_ctx->window * sizeof(double);
+	struct xcorr_state *state;
+
+	*size = sizeof(*state) + XCORR_IN__COUNT * len;
+	state = malloc(*size);
+	if (state == NULL) {
+		return NULL;
+	}
+
+	state->window = xc_ctx->window;
+	state->count = xc_ctx->count;
+	state->countdown = xc_ctx->countdown;
+	state->lag = xc_ctx->lag;
+	state->peak = xc_ctx->peak;
+
+	for (unsigned i = 0; i < XCORR_IN__COUNT; i++) {
+		memcpy(state->history + i * xc_ctx->window,
+				xc_ctx->history[i] + xc_ctx->pos, len);
+	}
+
+	return state;
+}
+
+/**
+ * Restore a filter instance's state.
+ *
+ * \param[in] ctx    A filter instance.
+ * \param[in] state  State saved by \ref filter_xcorr__save.
+ * \param[in] size   Size of the state in bytes.
+ * \return true if the state was restored, or false otherwise.
+ */
+static bool filter_xcorr__restore(
+		filter_ctx ctx,
+		const void *state,
+		size_t size)
+{
+	struct xcorr_ctx *xc_ctx = ctx;
+	const struct xcorr_state *xc_state = state;
+	size_t len = xc_ctx->window * sizeof(double);
+
+	if (size != sizeof(*xc_state) + XCORR_IN__COUNT * len ||
+	    xc_state->window != xc_ctx->window ||
+	    xc_state->countdown == 0 ||
+	    xc_state->countdown > xc_ctx->hop) {
+		return false;
+	}
+
+	for (unsigned i = 0; i < XCORR_IN__COUNT; i++) {
+		const double *history = xc_state->history + i * xc_ctx->window;
+
+		memcpy(xc_ctx->history[i], history, len);
+		memcpy(xc_ctx->history[i] + xc_ctx->window, history, len);
+	}
+
+	xc_ctx->pos = 0;
+	xc_ctx->count = xc_state->count;
+	xc_ctx->countdown = xc_state->countdown;
+	xc_ctx->lag = xc_state->lag;
+	xc_ctx->peak = xc_state->peak;
+
+	return true;
+}
+
+/* Exported function, documented in filter/xcorr.h */
+bool filter_xcorr_register(void)
+{
+	if (!filter_register("XCorr",
+			filter_xcorr__init,
+			filter_xcorr__proc,
+			filter_xcorr__fini)) {
+		return false;
+	}
+
+	return filter_register_state("XCorr",
+			filter_xcorr__save,
+			filter_xcorr__restore);
+}
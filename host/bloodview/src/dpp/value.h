@@ -31,11 +31,13 @@ struct bv_value {
 		BV_VALUE_BOOL,
 		BV_VALUE_DOUBLE,
 		BV_VALUE_UNSIGNED,
+		BV_VALUE_STRING,
 	} type;
 	union {
 		bool     type_bool;       /**< Data for bool values */
 		double   type_double;     /**< Data for double values */
 		unsigned type_unsigned;   /**< Data for unsigned values */
+		char    *type_string;     /**< Data for string values */
 	};
 };
 
@@ -81,4 +83,18 @@ static inline unsigned bv_value_unsigned(const struct bv_value *v)
 	return v->type_unsigned;
 }
 
+/**
+ * Get a string value from a bv_value.
+ *
+ * \param[in]  v  The bv_value to extract the value from.
+ * \return The value.
+ */
+static inline const char *bv_value_string(const struct bv_value *v)
+{
+	assert(v != NULL);
+	assert(v->type == BV_VALUE_STRING);
+
+	return v->type_string;
+}
+
 #endif
@@ -19,12 +19,21 @@
  * \brief Implementation of the graph module.
  *
  * This renders sample data in real time.
+ *
+ * Samples are added on the ingest thread and rendered on the main thread,
+ * and neither waits for the other.  Each graph's ring buffer has a single
+ * writer, which publishes a count of samples written after each sample.
+ * The renderer copies the samples it needs, seqlock style, and draws from
+ * the copy.  The lock only guards the graph array itself, and is held by
+ * the renderer just while copying, never while drawing.
  */
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include <pthread.h>
 
@@ -45,14 +54,21 @@
 /** Maximum number of seconds of graph data to store for each channel. */
 #define GRAPH_HISTORY_SECONDS 64
 
+/** Value of graph_g.shown when all graphs are shown. */
+#define GRAPH_SHOWN_ALL UINT_MAX
+
 /** Per-graph data context. */
 struct graph {
 	int32_t *data; /**< The graph's sample data. */
 
 	unsigned max; /**< Maximum number of samples \ref data can store. */
-	unsigned len; /**< Number of available samples (<= \ref max). */
 	unsigned pos; /**< Position of next sample to insert. */
-	unsigned ren; /**< Last rendered sample. */
+
+	/** Number of samples added, published after each is written. */
+	_Atomic uint64_t written;
+
+	/** Value of \ref written when the sample history was discarded. */
+	_Atomic uint64_t reset;
 
 	unsigned x_step; /**< Rendering scale in time dimension. */
 	uint64_t scale;  /**< The vertical scale. */
@@ -62,6 +78,20 @@ struct graph {
 	SDL_Color colour;    /**< Graph render colour. */
 };
 
+/** Snapshot of a graph, taken for rendering. */
+struct graph_view {
+	bool valid;      /**< Whether the graph is to be rendered. */
+	size_t offset;   /**< Offset of the samples in the snapshot buffer. */
+	unsigned len;    /**< Number of samples, oldest first. */
+
+	unsigned x_step; /**< Rendering scale in time dimension. */
+	uint64_t scale;  /**< The vertical scale. */
+	bool invert;     /**< Whether to invert the magnitudes. */
+
+	const char *legend; /**< The graph legend text. */
+	SDL_Color colour;   /**< Graph render colour. */
+};
+
 /** Per-graph render context. */
 struct render {
 	struct sdl_tk_text *label; /**< The graph name. */
@@ -78,12 +108,40 @@ static struct {
 	unsigned current;
 	bool     single;
 
+	/**
+	 * The graph shown on its own, or \ref GRAPH_SHOWN_ALL.
+	 *
+	 * This is \ref current and \ref single, published for the ingest
+	 * thread, which reads it without the lock.
+	 */
+	_Atomic unsigned shown;
+
 	struct render *render;
 	unsigned render_count;
 	bool render_finalise;
 
+	struct graph_view *view; /**< Graph snapshots, for render thread. */
+	unsigned view_count;     /**< Number of entries in view. */
+	int32_t *snapshot;       /**< Sample buffer for graph snapshots. */
+	size_t snapshot_len;     /**< Number of entries in snapshot. */
+
 	pthread_mutex_t lock;
-} graph_g;
+} graph_g = {
+	.shown = GRAPH_SHOWN_ALL,
+};
+
+/**
+ * Publish which graphs are shown, for the ingest thread.
+ *
+ * Call with the lock held, after changing \ref graph_g.current or
+ * \ref graph_g.single.
+ */
+static void graph__publish_shown(void)
+{
+	atomic_store_explicit(&graph_g.shown,
+			graph_g.single ? graph_g.current : GRAPH_SHOWN_ALL,
+			memory_order_relaxed);
+}
 
 /* Exported function, documented in graph.h */
 void graph_fini(void)
@@ -108,6 +166,7 @@ void graph_fini(void)
 	graph_g.current = 0;
 	graph_g.count   = 0;
 	graph_g.single  = false;
+	graph__publish_shown();
 
 	graph_g.render_finalise = true;
 
@@ -125,8 +184,18 @@ bool graph_init(void)
 	return true;
 }
 
-/* Exported function, documented in graph.h */
-bool graph_create(unsigned idx, unsigned freq,
+/**
+ * Create a graph at given index.
+ *
+ * Call with the lock held.
+ *
+ * \param[in]  idx      Graph index to create.
+ * \param[in]  freq     The sampling frequency used for the graph.
+ * \param[in]  legend   The graph's legend text.
+ * \param[in]  colour   The graph's render colour.
+ * \return true on success, or false on errer.
+ */
+static bool graph__create(unsigned idx, unsigned freq,
 		const char *legend, SDL_Color colour)
 {
 	struct graph *g;
@@ -170,6 +239,20 @@ bool graph_create(unsigned idx, unsigned freq,
 	return true;
 }
 
+/* Exported function, documented in graph.h */
+bool graph_create(unsigned idx, unsigned freq,
+		const char *legend, SDL_Color colour)
+{
+	bool ret;
+
+	/* The renderer may be reading the graph array. */
+	pthread_mutex_lock(&graph_g.lock);
+	ret = graph__create(idx, freq, legend, colour);
+	pthread_mutex_unlock(&graph_g.lock);
+
+	return ret;
+}
+
 /**
  * Ensure that a graph at the given index exists.
  *
@@ -205,60 +288,71 @@ static inline unsigned graph_pos_increment(
 	return pos;
 }
 
-/**
- * Decrement the position pointer of a graph object.
- *
- * \param[in]  graph  The graph object.
- * \param[in]  pos    The position to decrement.
- * \return the new position.
- */
-static inline unsigned graph_pos_decrement(
-		const struct graph *graph,
-		unsigned pos)
+/* Exported function, documented in graph.h */
+bool graph_data_add(unsigned idx, int32_t value)
 {
-	if (pos == 0) {
-		pos = graph->max - 1;
-	} else {
-		pos--;
+	struct graph *g = graph_g.channel + idx;
+	uint64_t written;
+
+	if (!graph__ensure(idx)) {
+		return false;
 	}
 
-	return pos;
+	written = atomic_load_explicit(&g->written, memory_order_relaxed);
+
+	g->data[g->pos] = value;
+	g->pos = graph_pos_increment(g, g->pos);
+
+	/* Publish the sample to the renderer. */
+	atomic_store_explicit(&g->written, written + 1, memory_order_release);
+
+	return true;
 }
 
 /* Exported function, documented in graph.h */
-bool graph_data_add(unsigned idx, int32_t value)
+void graph_data_reset(unsigned idx)
 {
 	struct graph *g = graph_g.channel + idx;
 
 	if (!graph__ensure(idx)) {
-		return false;
+		return;
 	}
 
-	g->data[g->pos] = value;
+	atomic_store_explicit(&g->reset,
+			atomic_load_explicit(&g->written, memory_order_relaxed),
+			memory_order_release);
+}
 
-	if (g->len < g->max) {
-		g->len++;
+/* Exported function, documented in graph.h */
+bool graph_is_visible(unsigned idx)
+{
+	unsigned shown;
+
+	if (!graph__ensure(idx)) {
+		return false;
 	}
 
-	g->pos = graph_pos_increment(g, g->pos);
+	shown = atomic_load_explicit(&graph_g.shown, memory_order_relaxed);
 
-	return true;
+	return shown == GRAPH_SHOWN_ALL || shown == idx;
 }
 
 /**
- * Get a graph data value.
+ * Get a graph data value from a snapshot.
  *
- * \param[in]  g    The graph to get a data value from.
+ * \param[in]  v    The graph snapshot to get a data value from.
  * \param[in]  pos  The position of the data value to get.
  * \return a data value.
  */
-static inline int32_t graph__data(const struct graph *g, unsigned pos)
+static inline int32_t graph__data(const struct graph_view *v, unsigned pos)
 {
-	if (g->invert) {
-		return g->data[pos] * -1;
+	int32_t value = graph_g.snapshot[v->offset + pos];
+
+	if (v->invert) {
+		return value * -1;
 	}
 
-	return g->data[pos];
+	return value;
 }
 
 /**
@@ -318,15 +412,15 @@ static struct sdl_tk_text *graph__create_scale(
  *
  * \param[in]  ren  The SDL renderer.
  * \param[in]  idx  The graph index to render the label for.
- * \param[in]  g    The graph to render the label for.
+ * \param[in]  g    Snapshot of the graph to render the label for.
  * \param[in]  r    The rectangle containing the graphs.
  * \return new text label, or NULL on error.
  */
 static void graph__render_label(
-		SDL_Renderer   *ren,
-		unsigned        idx,
-		struct graph   *g,
-		const SDL_Rect *r)
+		SDL_Renderer            *ren,
+		unsigned                 idx,
+		const struct graph_view *g,
+		const SDL_Rect          *r)
 {
 	struct render *render;
 
@@ -410,11 +504,146 @@ static void graph__render_fini(void)
 
 		graph_g.render_count = 0;
 		graph_g.render_finalise = false;
+
+		free(graph_g.view);
+		graph_g.view = NULL;
+		graph_g.view_count = 0;
+
+		free(graph_g.snapshot);
+		graph_g.snapshot = NULL;
+		graph_g.snapshot_len = 0;
 	}
 }
 
 /**
- * Render a graph.
+ * Copy a graph's newest samples into its snapshot.
+ *
+ * The ingest thread adds samples without taking the lock, so this reads
+ * like a seqlock reader.  The published sample count is read before the
+ * copy and again after it.  Copied samples which the ingest thread may
+ * have overwritten in between are dropped, rather than retrying, so the
+ * renderer never waits for the ingest thread.
+ *
+ * \param[in]      g  The graph to copy samples from.
+ * \param[in,out]  v  The graph's snapshot, with space for len samples at
+ *                    offset.  Updated to the samples copied.
+ */
+static void graph__snapshot_data(
+		const struct graph *g,
+		struct graph_view *v)
+{
+	int32_t *out = graph_g.snapshot + v->offset;
+	uint64_t written;
+	uint64_t oldest;
+	uint64_t first;
+	unsigned chunk;
+	unsigned slot;
+	unsigned n;
+
+	written = atomic_load_explicit(&g->written, memory_order_acquire);
+	first = atomic_load_explicit(&g->reset, memory_order_acquire);
+
+	n = v->len;
+	if (first >= written) {
+		n = 0;
+	} else if (written - first < n) {
+		n = written - first;
+	}
+	first = written - n;
+
+	slot = first % g->max;
+	chunk = (g->max - slot < n) ? g->max - slot : n;
+	memcpy(out, g->data + slot, chunk * sizeof(*out));
+	memcpy(out + chunk, g->data, (n - chunk) * sizeof(*out));
+
+	/* The sample being written now, if any, overwrites the one a whole
+	 * ring before it, so that and anything older can't be trusted. */
+	atomic_thread_fence(memory_order_acquire);
+	written = atomic_load_explicit(&g->written, memory_order_relaxed);
+	oldest = (written >= g->max) ? written - g->max + 1 : 0;
+	if (first < oldest) {
+		unsigned skip = (oldest - first < n) ? oldest - first : n;
+
+		v->offset += skip;
+		n -= skip;
+	}
+
+	v->len = n;
+}
+
+/**
+ * Take snapshots of the graphs to be rendered.
+ *
+ * Call with the lock held.
+ *
+ * \param[in]  r  The rectangle containing the graphs.
+ * \return true on success, or false on error.
+ */
+static bool graph__snapshot(const SDL_Rect *r)
+{
+	size_t len = 0;
+
+	if (graph_g.view_count < graph_g.count) {
+		struct graph_view *view;
+
+		view = realloc(graph_g.view, graph_g.count * sizeof(*view));
+		if (view == NULL) {
+			return false;
+		}
+
+		graph_g.view = view;
+		graph_g.view_count = graph_g.count;
+	}
+
+	for (unsigned i = 0; i < graph_g.count; i++) {
+		const struct graph *g = graph_g.channel + i;
+		struct graph_view *v = graph_g.view + i;
+
+		v->valid = (g->data != NULL) &&
+				(!graph_g.single || i == graph_g.current);
+		if (!v->valid) {
+			continue;
+		}
+
+		v->x_step = g->x_step;
+		v->scale = g->scale;
+		v->invert = g->invert;
+		v->legend = g->legend;
+		v->colour = g->colour;
+
+		/* Enough samples to fill the width, and one more. */
+		v->offset = len;
+		v->len = (unsigned) r->w * g->x_step + 1;
+		if (v->len > g->max) {
+			v->len = g->max;
+		}
+		len += v->len;
+	}
+
+	if (graph_g.snapshot_len < len) {
+		int32_t *snapshot;
+
+		snapshot = realloc(graph_g.snapshot, len * sizeof(*snapshot));
+		if (snapshot == NULL) {
+			return false;
+		}
+
+		graph_g.snapshot = snapshot;
+		graph_g.snapshot_len = len;
+	}
+
+	for (unsigned i = 0; i < graph_g.count; i++) {
+		if (graph_g.view[i].valid) {
+			graph__snapshot_data(graph_g.channel + i,
+					graph_g.view + i);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Render a graph from its snapshot.
  *
  * \param[in]  ren    The SDL renderer.
  * \param[in]  idx    The graph index to render.
@@ -427,52 +656,52 @@ void graph__render(
 		const SDL_Rect *r,
 		unsigned        y_off)
 {
-	unsigned len;
 	unsigned x_step;
 	unsigned x_min;
 	unsigned y_next;
 	unsigned y_prev;
-	unsigned pos_next;
-	struct graph *g = graph_g.channel + idx;
+	unsigned pos;
+	const struct graph_view *v = graph_g.view + idx;
 
-	if (idx >= graph_g.count) {
+	if (idx >= graph_g.view_count) {
 		return;
 	}
-	if (g->data == NULL) {
+	if (!v->valid) {
 		return;
 	}
 
-	graph__render_label(ren, idx, g, r);
+	graph__render_label(ren, idx, v, r);
 
-	x_step = g->x_step;
+	if (v->len == 0) {
+		return;
+	}
+
+	x_step = v->x_step;
 
 	SDL_SetRenderDrawColor(ren,
-			g->colour.r,
-			g->colour.g,
-			g->colour.b,
+			v->colour.r,
+			v->colour.g,
+			v->colour.b,
 			SDL_ALPHA_OPAQUE);
 
-	len = 0;
-	pos_next = graph_pos_decrement(g, g->pos);
+	pos = v->len - 1;
 
 	y_off += r->y;
-	y_next = y_off + graph__data(g, pos_next) * g->scale / Y_SCALE_DATUM;
+	y_next = y_off + graph__data(v, pos) * v->scale / Y_SCALE_DATUM;
 
 	x_min = r->x;
-	for (unsigned x = r->x + r->w; x > x_min && len < g->len; x--) {
-		for (unsigned i = 0; i < x_step - 1; i++) {
-			pos_next = graph_pos_decrement(g, pos_next);
+	for (unsigned x = r->x + r->w; x > x_min && pos > 0; x--) {
+		for (unsigned i = 0; i < x_step - 1 && pos > 1; i++) {
+			pos--;
 			y_prev = y_next;
-			y_next = y_off + graph__data(g, pos_next) * g->scale / Y_SCALE_DATUM;
+			y_next = y_off + graph__data(v, pos) * v->scale / Y_SCALE_DATUM;
 			SDL_RenderDrawLine(ren, x, y_prev, x, y_next);
-			len++;
 		}
 
-		pos_next = graph_pos_decrement(g, pos_next);
+		pos--;
 		y_prev = y_next;
-		y_next = y_off + graph__data(g, pos_next) * g->scale / Y_SCALE_DATUM;
+		y_next = y_off + graph__data(v, pos) * v->scale / Y_SCALE_DATUM;
 		SDL_RenderDrawLine(ren, x, y_prev, x - 1, y_next);
-		len++;
 	}
 }
 
@@ -482,35 +711,49 @@ void graph_render(
 		const SDL_Rect *r)
 {
 	SDL_Rect graph_rect = *r;
+	unsigned current;
+	unsigned count;
+	bool single;
+	bool ok = false;
 
+	/* Hold the lock just while taking the snapshots, so that graphs
+	 * can be created and finalised without waiting for drawing. */
 	pthread_mutex_lock(&graph_g.lock);
 
-	if ((graph_g.channel == NULL) ||
-	    (graph_g.count == 0)) {
-		goto cleanup;
+	graph__render_fini();
+
+	if ((graph_g.channel != NULL) &&
+	    (graph_g.count != 0)) {
+		ok = graph__snapshot(r);
 	}
 
-	if (graph_g.single) {
-		graph__render(ren, graph_g.current, r, r->h / 2);
-		goto cleanup;
+	current = graph_g.current;
+	count = graph_g.count;
+	single = graph_g.single;
+
+	pthread_mutex_unlock(&graph_g.lock);
+
+	if (!ok) {
+		return;
 	}
 
-	graph_rect.h = r->h / graph_g.count;
-	graph_rect.y = (r->h - graph_rect.h * graph_g.count) / 2 +
-			graph_rect.h * graph_g.current;
+	if (single) {
+		graph__render(ren, current, r, r->h / 2);
+		return;
+	}
+
+	graph_rect.h = r->h / count;
+	graph_rect.y = (r->h - graph_rect.h * count) / 2 +
+			graph_rect.h * current;
 
 	SDL_SetRenderDrawColor(ren, 32, 32, 32, SDL_ALPHA_OPAQUE);
 	SDL_RenderFillRect(ren, &graph_rect);
 
-	graph_rect.y = (r->h - graph_rect.h * graph_g.count) / 2;
-	for (unsigned i = 0; i < graph_g.count; i++) {
+	graph_rect.y = (r->h - graph_rect.h * count) / 2;
+	for (unsigned i = 0; i < count; i++) {
 		graph__render(ren, i, &graph_rect, graph_rect.h / 2);
 		graph_rect.y += graph_rect.h;
 	}
-
-cleanup:
-	graph__render_fini();
-	pthread_mutex_unlock(&graph_g.lock);
 }
 
 /**
@@ -823,6 +1066,8 @@ bool graph_handle_input(
 		break;
 	}
 
+	graph__publish_shown();
+
 cleanup:
 	pthread_mutex_unlock(&graph_g.lock);
 	return handled;
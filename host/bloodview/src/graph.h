@@ -55,12 +55,35 @@ bool graph_create(unsigned idx, unsigned freq,
 /**
  * Add a sample to a graph.
  *
+ * Samples for a graph must all be added from the same thread.  This never
+ * waits for rendering.
+ *
  * \param[in]  g_idx  Index of the graph to add sample to.
  * \param[in]  value  Sample to add to graph.
  * \return true on success, false on error.
  */
 bool graph_data_add(unsigned g_idx, int32_t value);
 
+/**
+ * Discard a graph's sample history.
+ *
+ * Used when a graph's data stream resumes after a gap, so that the samples
+ * either side of the gap are not drawn as if they were contiguous.
+ *
+ * \param[in]  g_idx  Index of the graph to reset.
+ */
+void graph_data_reset(unsigned g_idx);
+
+/**
+ * Check whether a graph is currently displayed.
+ *
+ * May be called from the ingest thread without holding any lock.
+ *
+ * \param[in]  g_idx  Index of the graph to check.
+ * \return true if the graph is displayed, false otherwise.
+ */
+bool graph_is_visible(unsigned g_idx);
+
 /**
  * Render all the graphs
  *
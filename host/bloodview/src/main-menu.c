@@ -40,6 +40,7 @@
 #include "sdl-tk/widget/toggle.h"
 
 #include "util.h"
+#include "cache.h"
 #include "locked.h"
 #include "bloodview.h"
 #include "main-menu.h"
@@ -1296,6 +1297,214 @@ static bool main_menu__load_config_helper(
 	return true;
 }
 
+/**
+ * Write a widget value to the cache.
+ *
+ * \param[in]  cache  The cache writer.
+ * \param[in]  value  The widget value to write.
+ */
+static void main_menu__cache_write_value(
+		struct cache_writer *cache,
+		const struct desc_widget_value *value)
+{
+	cache_write_u32(cache, value->type);
+
+	switch (value->type) {
+	case INPUT_TYPE_DOUBLE:
+		cache_write_double(cache, value->type_double);
+		break;
+	case INPUT_TYPE_UNSIGNED:
+		cache_write_u32(cache, value->type_unsigned);
+		break;
+	case INPUT_TYPE_SETUP_MODE:
+		cache_write_u32(cache, value->type_setup_mode);
+		break;
+	case INPUT_TYPE_ACQ_EMISSION_MODE:
+		cache_write_u32(cache, value->type_acq_emission_mode);
+		break;
+	case INPUT_TYPE_ACQ_DETECTION_MODE:
+		cache_write_u32(cache, value->type_acq_detection_mode);
+		break;
+	case INPUT_TYPE_DERIVATIVE:
+		cache_write_u32(cache, value->type_derivative);
+		break;
+	}
+}
+
+/**
+ * Read a widget value from the cache.
+ *
+ * \param[in]  cache  The cache reader.
+ * \param[out] value  Returns the widget value read.
+ */
+static void main_menu__cache_read_value(
+		struct cache_reader *cache,
+		struct desc_widget_value *value)
+{
+	value->type = cache_read_u32(cache);
+
+	switch (value->type) {
+	case INPUT_TYPE_DOUBLE:
+		value->type_double = cache_read_double(cache);
+		break;
+	case INPUT_TYPE_UNSIGNED:
+		value->type_unsigned = cache_read_u32(cache);
+		break;
+	case INPUT_TYPE_SETUP_MODE:
+		value->type_setup_mode = cache_read_u32(cache);
+		break;
+	case INPUT_TYPE_ACQ_EMISSION_MODE:
+		value->type_acq_emission_mode = cache_read_u32(cache);
+		break;
+	case INPUT_TYPE_ACQ_DETECTION_MODE:
+		value->type_acq_detection_mode = cache_read_u32(cache);
+		break;
+	case INPUT_TYPE_DERIVATIVE:
+		value->type_derivative = cache_read_u32(cache);
+		break;
+	default:
+		cache->error = true;
+		break;
+	}
+}
+
+/**
+ * Recursively write a widget descriptor to the cache.
+ *
+ * \param[in]  cache  The cache writer.
+ * \param[in]  desc   The widget descriptor to write.
+ */
+static void main_menu__cache_write_desc(
+		struct cache_writer *cache,
+		const struct desc_widget *desc)
+{
+	cache_write_u32(cache, desc->type);
+
+	switch (desc->type) {
+	case WIDGET_TYPE_MENU:
+		cache_write_string(cache, desc->menu.title);
+		cache_write_u32(cache, desc->menu.entry_count);
+		for (unsigned i = 0; i < desc->menu.entry_count; i++) {
+			main_menu__cache_write_desc(cache,
+					desc->menu.entry[i]);
+		}
+		break;
+	case WIDGET_TYPE_INPUT:
+		cache_write_string(cache, desc->input.title);
+		main_menu__cache_write_value(cache, &desc->input.value);
+		break;
+	case WIDGET_TYPE_ACTION:
+		cache_write_string(cache, desc->action.title);
+		cache_write_u32(cache, desc->action.cb);
+		break;
+	case WIDGET_TYPE_SELECT:
+		cache_write_string(cache, desc->select.title);
+		main_menu__cache_write_value(cache, &desc->select.value);
+		break;
+	case WIDGET_TYPE_TOGGLE:
+		cache_write_string(cache, desc->toggle.title);
+		cache_write_u32(cache, desc->toggle.value);
+		break;
+	}
+}
+
+/**
+ * Recursively read a widget descriptor from the cache.
+ *
+ * \param[in]  cache  The cache reader.
+ * \return newly allocated widget descriptor, or NULL on error.
+ */
+static struct desc_widget *main_menu__cache_read_desc(
+		struct cache_reader *cache)
+{
+	struct desc_widget *desc;
+	uint32_t count;
+
+	desc = calloc(1, sizeof(*desc));
+	if (desc == NULL) {
+		cache->error = true;
+		return NULL;
+	}
+
+	desc->type = cache_read_u32(cache);
+
+	switch (desc->type) {
+	case WIDGET_TYPE_MENU:
+		desc->menu.title = cache_read_string(cache);
+		desc->menu.entry = cache_read_array(cache, &count,
+				sizeof(*desc->menu.entry));
+		desc->menu.entry_count = count;
+		for (unsigned i = 0; i < desc->menu.entry_count; i++) {
+			desc->menu.entry[i] = main_menu__cache_read_desc(cache);
+		}
+		break;
+	case WIDGET_TYPE_INPUT:
+		desc->input.title = cache_read_string(cache);
+		main_menu__cache_read_value(cache, &desc->input.value);
+		break;
+	case WIDGET_TYPE_ACTION:
+		desc->action.title = cache_read_string(cache);
+		desc->action.cb = cache_read_u32(cache);
+		break;
+	case WIDGET_TYPE_SELECT:
+		desc->select.title = cache_read_string(cache);
+		main_menu__cache_read_value(cache, &desc->select.value);
+		break;
+	case WIDGET_TYPE_TOGGLE:
+		desc->toggle.title = cache_read_string(cache);
+		desc->toggle.value = cache_read_u32(cache);
+		break;
+	default:
+		cache->error = true;
+		break;
+	}
+
+	return desc;
+}
+
+/**
+ * Parse a menu description file, using the cache if it is up to date.
+ *
+ * \param[in]  path  Path to the menu description YAML file.
+ * \param[out] desc  Returns the parsed menu description on success.
+ * \return true on success, or false on error.
+ */
+static bool main_menu__load_desc(
+		const char *path,
+		struct desc_widget **desc)
+{
+	struct cache_reader reader;
+	struct cache_writer *writer;
+	cyaml_err_t err;
+
+	if (cache_read_open("main-menu", path, &reader)) {
+		*desc = main_menu__cache_read_desc(&reader);
+		if (cache_read_close(&reader)) {
+			return true;
+		}
+
+		fprintf(stderr, "Warning: Ignoring bad cache for %s\n", path);
+		if (*desc != NULL) {
+			cyaml_free(&config, &schema_main_menu, *desc, 0);
+			*desc = NULL;
+		}
+	}
+
+	writer = cache_write_open("main-menu", path);
+	err = cyaml_load_file(path, &config, &schema_main_menu,
+			(void **) desc, NULL);
+	if (err != CYAML_OK) {
+		fprintf(stderr, "ERROR: %s: %s\n", path, cyaml_strerror(err));
+		cache_write_close(writer, false);
+		return false;
+	}
+
+	main_menu__cache_write_desc(writer, *desc);
+	cache_write_close(writer, true);
+
+	return true;
+}
+
 /**
  * Load a config file.
  *
@@ -1308,7 +1517,6 @@ static bool main_menu__load_config(
 	struct desc_widget *current = NULL;
 	struct desc_widget *load = NULL;
 	bool ret = false;
-	cyaml_err_t err;
 	char *path;
 
 	path = util_create_path(bv_config_dir_path, config_file);
@@ -1316,10 +1524,7 @@ static bool main_menu__load_config(
 		goto cleanup;
 	}
 
-	err = cyaml_load_file(path, &config, &schema_main_menu,
-			(void **) &load, 0);
-	if (err != CYAML_OK) {
-		fprintf(stderr, "ERROR: %s\n", cyaml_strerror(err));
+	if (!main_menu__load_desc(path, &load)) {
 		goto cleanup;
 	}
 
@@ -1343,13 +1548,24 @@ cleanup:
 	return ret;
 }
 
+/* Exported function, documented in main-menu.h */
+bool main_menu_load_config(const char *config_file)
+{
+	if (!main_menu__load_config(config_file)) {
+		fprintf(stderr, "Error: Failed to load config '%s'.\n",
+				config_file);
+		return false;
+	}
+
+	return true;
+}
+
 /* Exported function, documented in main-menu.h */
 struct sdl_tk_widget *main_menu_create(
 		const char *resources_dir_path,
 		const char *config_dir_path,
 		const char *config_file)
 {
-	cyaml_err_t err;
 	char *path;
 
 	bv_config_dir_path = config_dir_path;
@@ -1359,14 +1575,12 @@ struct sdl_tk_widget *main_menu_create(
 		goto error;
 	}
 
-	err = cyaml_load_file(path, &config, &schema_main_menu,
-			(void **) &bl_main_menu, NULL);
-	free(path);
-	if (err != CYAML_OK) {
-		fprintf(stderr, "Failed to load main-menu.yaml: %s\n",
-				cyaml_strerror(err));
+	if (!main_menu__load_desc(path, &bl_main_menu)) {
+		free(path);
+		fprintf(stderr, "Failed to load main-menu.yaml\n");
 		goto error;
 	}
+	free(path);
 
 	if (bl_main_menu->type != WIDGET_TYPE_MENU) {
 		fprintf(stderr, "Error: Main menu has bad type.\n");
@@ -1379,9 +1593,7 @@ struct sdl_tk_widget *main_menu_create(
 	}
 
 	if (config_file != NULL) {
-		if (!main_menu__load_config(config_file)) {
-			fprintf(stderr, "Error: Failed to load config '%s'.\n",
-					config_file);
+		if (!main_menu_load_config(config_file)) {
 			goto error;
 		}
 	}
@@ -1838,6 +2050,76 @@ double main_menu_config_get_filter_ac_denoise_frequency(void)
 			"Config/Filtering/AC denoise frequency (Hz)");
 }
 
+/* Exported interface, documented in main-menu.h */
+bool main_menu_config_get_audio_enabled(void)
+{
+	return main_menu__get_desc_toggle_value(bl_main_menu,
+			"Config/Audio/Monitor");
+}
+
+/* Exported interface, documented in main-menu.h */
+unsigned main_menu_config_get_audio_graph(void)
+{
+	return main_menu__get_desc_input_unsigned(bl_main_menu,
+			"Config/Audio/Graph");
+}
+
+/* Exported interface, documented in main-menu.h */
+double main_menu_config_get_audio_gain(void)
+{
+	return main_menu__get_desc_input_double(bl_main_menu,
+			"Config/Audio/Gain (dB)");
+}
+
+/* Exported interface, documented in main-menu.h */
+unsigned main_menu_config_get_audio_latency(void)
+{
+	return main_menu__get_desc_input_unsigned(bl_main_menu,
+			"Config/Audio/Latency (ms)");
+}
+
+/* Exported interface, documented in main-menu.h */
+bool main_menu_config_get_quality_shown(void)
+{
+	return main_menu__get_desc_toggle_value(bl_main_menu,
+			"Config/Signal quality/Show");
+}
+
+/* Exported interface, documented in main-menu.h */
+unsigned main_menu_config_get_quality_threshold(void)
+{
+	return main_menu__get_desc_input_unsigned(bl_main_menu,
+			"Config/Signal quality/Threshold (%)");
+}
+
+/* Exported interface, documented in main-menu.h */
+bool main_menu_config_get_quality_pause(void)
+{
+	return main_menu__get_desc_toggle_value(bl_main_menu,
+			"Config/Signal quality/Pause recording");
+}
+
+/* Exported interface, documented in main-menu.h */
+bool main_menu_config_get_record_raw(void)
+{
+	return main_menu__get_desc_toggle_value(bl_main_menu,
+			"Config/Recording/Raw samples");
+}
+
+/* Exported interface, documented in main-menu.h */
+bool main_menu_config_get_record_outputs(void)
+{
+	return main_menu__get_desc_toggle_value(bl_main_menu,
+			"Config/Recording/Pipeline outputs");
+}
+
+/* Exported interface, documented in main-menu.h */
+unsigned main_menu_config_get_record_output_rate(void)
+{
+	return main_menu__get_desc_input_unsigned(bl_main_menu,
+			"Config/Recording/Output rate (Hz)");
+}
+
 /**
  * Convert an unsigned value to a string.
  *
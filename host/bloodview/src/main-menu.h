@@ -61,6 +61,16 @@ struct sdl_tk_widget *main_menu_create(
  */
 void main_menu_destroy(struct sdl_tk_widget *main_menu);
 
+/**
+ * Load a config file into the main menu.
+ *
+ * The main menu must have been created.
+ *
+ * \param[in]  config_file  Config filename in the config directory.
+ * \return true on success, or false on error.
+ */
+bool main_menu_load_config(const char *config_file);
+
 /**
  * Update the main menu state.
  */
@@ -238,6 +248,76 @@ double main_menu_config_get_filter_normalise_frequency(void);
  */
 double main_menu_config_get_filter_ac_denoise_frequency(void);
 
+/**
+ * Get whether audio monitoring is enabled.
+ *
+ * \return true if enabled, false otherwise.
+ */
+bool main_menu_config_get_audio_enabled(void);
+
+/**
+ * Get the index of the graph to play for audio monitoring.
+ *
+ * \return the graph index.
+ */
+unsigned main_menu_config_get_audio_graph(void);
+
+/**
+ * Get the audio monitoring gain.
+ *
+ * \return gain in dB.
+ */
+double main_menu_config_get_audio_gain(void);
+
+/**
+ * Get the audio monitoring target latency.
+ *
+ * \return latency in milliseconds.
+ */
+unsigned main_menu_config_get_audio_latency(void);
+
+/**
+ * Get whether the signal quality indicator is shown.
+ *
+ * \return true if shown, false otherwise.
+ */
+bool main_menu_config_get_quality_shown(void);
+
+/**
+ * Get the signal quality threshold.
+ *
+ * \return the quality index, from 0 to 100, below which quality is poor.
+ */
+unsigned main_menu_config_get_quality_threshold(void);
+
+/**
+ * Get whether recording pauses while signal quality is poor.
+ *
+ * \return true to pause recording, false to record everything.
+ */
+bool main_menu_config_get_quality_pause(void);
+
+/**
+ * Get whether raw samples are recorded when pipeline outputs are recorded.
+ *
+ * \return true to record raw samples, false otherwise.
+ */
+bool main_menu_config_get_record_raw(void);
+
+/**
+ * Get whether data processing pipeline outputs are recorded.
+ *
+ * \return true to record pipeline outputs, false otherwise.
+ */
+bool main_menu_config_get_record_outputs(void);
+
+/**
+ * Get the rate to record pipeline outputs at.
+ *
+ * \return rate in Hz, or zero for the acquisition's sampling rate.
+ */
+unsigned main_menu_config_get_record_output_rate(void);
+
 /**
  * Set the shift configuration value for a given channel.
  *
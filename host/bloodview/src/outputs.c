@@ -0,0 +1,277 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the pipeline output recording module.
+ *
+ * The outputs file is named after the recording, with an ".outputs"
+ * extension instead of ".yaml".  It starts with a header:
+ *
+ * | Field      | Type     | Description                                |
+ * | ---------- | -------- | ------------------------------------------ |
+ * | magic      | char[8]  | "BVOUTS01", including the format version.  |
+ * | frequency  | uint32_t | Acquisition sampling rate in Hz.           |
+ * | decimation | uint32_t | Acquisition samples per output row.        |
+ * | columns    | uint32_t | Number of outputs.                         |
+ * | reserved   | uint32_t | Zero.                                      |
+ *
+ * This is followed by a 32 byte NUL padded name for each output, and then
+ * rows of one uint32_t value per output, until the end of the file.  Row
+ * `n` is the mean of acquisition samples `n * decimation` up to
+ * `(n + 1) * decimation`.  Values are offset by `INT32_MAX`, as given to
+ * the graphs.  All values are in host byte order.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "outputs.h"
+#include "main-menu.h"
+
+/** Outputs file identifier, which includes the format version. */
+#define OUTPUTS_MAGIC "BVOUTS01"
+
+/** Length of an output name in the outputs file, including padding. */
+#define OUTPUTS_NAME_LEN 32
+
+/** Outputs file header. */
+struct outputs_header {
+	char     magic[8];   /**< Must be \ref OUTPUTS_MAGIC. */
+	uint32_t frequency;  /**< Sampling rate in Hz. */
+	uint32_t decimation; /**< Acquisition samples per row. */
+	uint32_t columns;    /**< Number of outputs. */
+	uint32_t reserved;   /**< Padding; zero. */
+};
+
+/** Pipeline output recording module global data. */
+static struct {
+	FILE *file; /**< The outputs file, while recording. */
+	bool raw;   /**< Whether raw samples are recorded. */
+
+	char rec_path[80];  /**< Path of the recording. */
+	char path[80];      /**< Path of the outputs file. */
+	char *setup;        /**< Name of the pipeline setup. */
+
+	unsigned frequency;  /**< Sampling rate in Hz. */
+	unsigned decimation; /**< Acquisition samples per row. */
+	unsigned columns;    /**< Number of outputs. */
+	char (*name)[OUTPUTS_NAME_LEN]; /**< Output names. */
+
+	uint64_t *acc; /**< Per output sums for the current row. */
+	uint32_t *row; /**< Row to write. */
+	unsigned count; /**< Samples summed into acc. */
+	uint64_t rows;  /**< Number of rows written. */
+} outputs_g = {
+	.raw = true,
+};
+
+/**
+ * Discard the previous recording's details.
+ */
+static void outputs__reset(void)
+{
+	free(outputs_g.setup);
+	free(outputs_g.name);
+	free(outputs_g.acc);
+	free(outputs_g.row);
+
+	outputs_g.setup = NULL;
+	outputs_g.name = NULL;
+	outputs_g.acc = NULL;
+	outputs_g.row = NULL;
+
+	outputs_g.rec_path[0] = '\0';
+	outputs_g.columns = 0;
+	outputs_g.count = 0;
+	outputs_g.rows = 0;
+	outputs_g.raw = true;
+}
+
+/**
+ * Write the outputs file header.
+ *
+ * \return true on success or false on failure.
+ */
+static bool outputs__write_header(void)
+{
+	struct outputs_header header = {
+		.frequency = outputs_g.frequency,
+		.decimation = outputs_g.decimation,
+		.columns = outputs_g.columns,
+	};
+
+	memcpy(header.magic, OUTPUTS_MAGIC, sizeof(header.magic));
+
+	if (fwrite(&header, sizeof(header), 1, outputs_g.file) != 1) {
+		return false;
+	}
+
+	return fwrite(outputs_g.name, OUTPUTS_NAME_LEN,
+			outputs_g.columns, outputs_g.file) == outputs_g.columns;
+}
+
+/* Exported interface, documented in outputs.h */
+bool outputs_start(
+		const char *rec_path,
+		const char *setup,
+		unsigned frequency,
+		unsigned columns,
+		const char *const *names)
+{
+	unsigned rate = main_menu_config_get_record_output_rate();
+	size_t len = strlen(rec_path);
+
+	outputs__reset();
+
+	if (len < strlen(".yaml") ||
+	    len + 1 > sizeof(outputs_g.rec_path) ||
+	    len - strlen(".yaml") + sizeof(".outputs") >
+			sizeof(outputs_g.path)) {
+		fprintf(stderr, "Error: Recording path too long: %s\n",
+				rec_path);
+		return false;
+	}
+
+	len -= strlen(".yaml");
+	memcpy(outputs_g.path, rec_path, len);
+	memcpy(outputs_g.path + len, ".outputs", sizeof(".outputs"));
+
+	outputs_g.setup = strdup(setup);
+	outputs_g.name = calloc(columns, sizeof(*outputs_g.name));
+	outputs_g.acc = calloc(columns, sizeof(*outputs_g.acc));
+	outputs_g.row = calloc(columns, sizeof(*outputs_g.row));
+	if (outputs_g.setup == NULL || outputs_g.name == NULL ||
+	    outputs_g.acc == NULL || outputs_g.row == NULL) {
+		goto error;
+	}
+
+	for (unsigned i = 0; i < columns; i++) {
+		strncpy(outputs_g.name[i], names[i], OUTPUTS_NAME_LEN - 1);
+	}
+
+	outputs_g.columns = columns;
+	outputs_g.frequency = frequency;
+	outputs_g.decimation = 1;
+	if (rate != 0 && rate < frequency) {
+		outputs_g.decimation = (frequency + rate / 2) / rate;
+	}
+
+	outputs_g.file = fopen(outputs_g.path, "wb");
+	if (outputs_g.file == NULL) {
+		fprintf(stderr, "Error: Failed to open '%s': %s\n",
+				outputs_g.path, strerror(errno));
+		goto error;
+	}
+
+	if (!outputs__write_header()) {
+		fprintf(stderr, "Error: Failed to write '%s'\n",
+				outputs_g.path);
+		fclose(outputs_g.file);
+		outputs_g.file = NULL;
+		goto error;
+	}
+
+	memcpy(outputs_g.rec_path, rec_path, len + strlen(".yaml") + 1);
+	outputs_g.raw = main_menu_config_get_record_raw();
+	return true;
+
+error:
+	outputs__reset();
+	return false;
+}
+
+/* Exported interface, documented in outputs.h */
+void outputs_finish(void)
+{
+	if (outputs_g.file == NULL) {
+		return;
+	}
+
+	if (fclose(outputs_g.file) != 0) {
+		fprintf(stderr, "Warning: Failed to write '%s'\n",
+				outputs_g.path);
+	}
+	outputs_g.file = NULL;
+}
+
+/* Exported interface, documented in outputs.h */
+void outputs_add(const uint32_t *values)
+{
+	unsigned columns = outputs_g.columns;
+
+	if (outputs_g.file == NULL) {
+		return;
+	}
+
+	for (unsigned i = 0; i < columns; i++) {
+		outputs_g.acc[i] += values[i];
+	}
+
+	if (++outputs_g.count < outputs_g.decimation) {
+		return;
+	}
+
+	for (unsigned i = 0; i < columns; i++) {
+		outputs_g.row[i] = (outputs_g.acc[i] + outputs_g.count / 2) /
+				outputs_g.count;
+		outputs_g.acc[i] = 0;
+	}
+	outputs_g.count = 0;
+
+	if (fwrite(outputs_g.row, sizeof(*outputs_g.row), columns,
+			outputs_g.file) != columns) {
+		fprintf(stderr, "Error: Failed to write '%s'; "
+				"no longer recording outputs\n",
+				outputs_g.path);
+		fclose(outputs_g.file);
+		outputs_g.file = NULL;
+		return;
+	}
+	outputs_g.rows++;
+}
+
+/* Exported interface, documented in outputs.h */
+bool outputs_record_raw(void)
+{
+	return outputs_g.raw || outputs_g.file == NULL;
+}
+
+/* Exported interface, documented in outputs.h */
+void outputs_write_meta(FILE *file, const char *rec_path)
+{
+	if (outputs_g.columns == 0 ||
+	    strcmp(outputs_g.rec_path, rec_path) != 0) {
+		return;
+	}
+
+	fprintf(file, "outputs:\n");
+	fprintf(file, "  file: %s\n", outputs_g.path);
+	fprintf(file, "  setup: %s\n", outputs_g.setup);
+	fprintf(file, "  raw: %s\n", outputs_g.raw ? "true" : "false");
+	fprintf(file, "  frequency: %u\n", outputs_g.frequency);
+	fprintf(file, "  decimation: %u\n", outputs_g.decimation);
+	fprintf(file, "  rate: %g\n",
+			(double) outputs_g.frequency / outputs_g.decimation);
+	fprintf(file, "  rows: %"PRIu64"\n", outputs_g.rows);
+	fprintf(file, "  columns:\n");
+	for (unsigned i = 0; i < outputs_g.columns; i++) {
+		fprintf(file, "    - %s\n", outputs_g.name[i]);
+	}
+}
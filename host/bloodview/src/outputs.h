@@ -0,0 +1,93 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the pipeline output recording module.
+ *
+ * This records the outputs of a data processing pipeline to a binary file
+ * next to the acquisition's recording, so they don't have to be computed
+ * again from the raw samples.  The outputs can be recorded at a reduced
+ * rate, in which case each recorded value is the mean of the values it
+ * replaces.
+ */
+
+#ifndef BV_OUTPUTS_H
+#define BV_OUTPUTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Start recording pipeline outputs for an acquisition.
+ *
+ * The output rate and whether raw samples are still recorded are taken
+ * from the config.  Any previous acquisition's details are discarded.
+ *
+ * \param[in]  rec_path   Path of the acquisition's recording.
+ * \param[in]  setup      Name of the data processing pipeline setup.
+ * \param[in]  frequency  The acquisition's sampling rate in Hz.
+ * \param[in]  columns    Number of outputs to record.
+ * \param[in]  names      Array of the outputs' names.
+ * \return true on success or false on failure.
+ */
+bool outputs_start(
+		const char *rec_path,
+		const char *setup,
+		unsigned frequency,
+		unsigned columns,
+		const char *const *names);
+
+/**
+ * Stop recording pipeline outputs.
+ *
+ * The details are kept for the recording's metadata.  Any samples towards
+ * an incomplete output value are dropped.
+ */
+void outputs_finish(void);
+
+/**
+ * Add a row of pipeline output values.
+ *
+ * Must be called from the device thread, once per acquisition sample.
+ *
+ * \param[in]  values  One value for each output.
+ */
+void outputs_add(const uint32_t *values);
+
+/**
+ * Get whether raw samples should be recorded.
+ *
+ * Raw samples can only be left out of a recording while its pipeline
+ * outputs are being recorded.
+ *
+ * \return true to record raw samples, false otherwise.
+ */
+bool outputs_record_raw(void);
+
+/**
+ * Write the outputs section of a recording's metadata file.
+ *
+ * Nothing is written unless the recording's pipeline outputs were
+ * recorded.
+ *
+ * \param[in]  file      The metadata file.
+ * \param[in]  rec_path  Path of the recording.
+ */
+void outputs_write_meta(FILE *file, const char *rec_path);
+
+#endif /* BV_OUTPUTS_H */
@@ -0,0 +1,1024 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the recording overview module.
+ *
+ * The recording is parsed directly from its memory map, rather than with
+ * \ref bl_msg_yaml_parse, since only the sample data messages matter and
+ * the parse has to be fast for recordings of several hours.
+ *
+ * While building, each channel has an accumulator per level.  A sample is
+ * merged into the first level's accumulator, and whenever an accumulator
+ * has merged \ref OVERVIEW_FANOUT entries, it is appended to its level and
+ * merged into the next level's accumulator.  Partial accumulators are
+ * flushed the same way at the end of the recording.
+ *
+ * The sidecar is in host byte order and layout, since it is only a cache.
+ * If it can't be written, the overview that was built is used from memory.
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common/channel.h"
+
+#include "overview.h"
+
+/** Number of overview levels, enough for 8^11 samples per bucket. */
+#define OVERVIEW_LEVELS 11
+
+/** Sidecar file identifier, which includes the format version. */
+#define OVERVIEW_MAGIC "BVOVER01"
+
+/** Minimum and maximum sample values over a bucket. */
+struct overview_bucket {
+	uint32_t min; /**< Minimum sample value. */
+	uint32_t max; /**< Maximum sample value. */
+};
+
+/** Sidecar file header. */
+struct overview_header {
+	char     magic[8];       /**< Must be \ref OVERVIEW_MAGIC. */
+	uint64_t rec_size;       /**< Size of recording in bytes. */
+	int64_t  rec_mtime_sec;  /**< Recording modification time seconds. */
+	int64_t  rec_mtime_nsec; /**< Recording modification time nanoseconds. */
+	uint32_t frequency;      /**< Sampling rate in Hz. */
+	uint32_t channels;       /**< Number of channel headers following. */
+};
+
+/** Sidecar file channel header. */
+struct overview_channel_header {
+	uint32_t channel;      /**< Acquisition channel number. */
+	uint32_t reserved;     /**< Padding; zero. */
+	uint64_t count;        /**< Number of samples. */
+	uint64_t block_offset; /**< File offset of recording positions. */
+	uint64_t block_count;  /**< Number of recording positions. */
+
+	/** File offset of each level's buckets. */
+	uint64_t level_offset[OVERVIEW_LEVELS];
+	/** Number of buckets in each level. */
+	uint64_t level_count[OVERVIEW_LEVELS];
+};
+
+/** Overview data for a channel. */
+struct overview_channel {
+	uint64_t count;        /**< Number of samples. */
+	const uint64_t *block; /**< Recording offsets of every block's start. */
+	uint64_t block_count;  /**< Number of entries in block. */
+
+	/** Buckets for each level. */
+	const struct overview_bucket *level[OVERVIEW_LEVELS];
+	/** Number of buckets in each level. */
+	uint64_t level_count[OVERVIEW_LEVELS];
+};
+
+/** Overview build state for a channel. */
+struct overview_build {
+	/** Accumulator for each level. */
+	struct overview_bucket acc[OVERVIEW_LEVELS];
+	/** Number of entries merged into each accumulator. */
+	unsigned acc_count[OVERVIEW_LEVELS];
+
+	/** Buckets for each level. */
+	struct overview_bucket *level[OVERVIEW_LEVELS];
+	/** Allocated length of each level's buckets. */
+	uint64_t level_alloc[OVERVIEW_LEVELS];
+
+	uint64_t *block;      /**< Recording offsets of every block's start. */
+	uint64_t block_alloc; /**< Allocated length of block. */
+};
+
+/** Overview object. */
+struct overview {
+	const char *rec; /**< Memory map of the recording. */
+	size_t rec_len;  /**< Length of the recording. */
+
+	void *map;      /**< Memory map of the sidecar, or NULL. */
+	size_t map_len; /**< Length of the sidecar. */
+
+	/** Build state, if the overview is used from memory, or NULL. */
+	struct overview_build *build;
+
+	unsigned frequency; /**< Sampling rate in Hz. */
+
+	/** Per-channel overview data. */
+	struct overview_channel channel[BL_CHANNEL_MAX];
+};
+
+/** Recording parse cursor. */
+struct overview_cursor {
+	const char *line; /**< Start of the current line. */
+	size_t len;       /**< Length of current line, without newline. */
+	const char *next; /**< Start of the next line. */
+	const char *end;  /**< End of the recording. */
+};
+
+/**
+ * Move a cursor to the next line.
+ *
+ * \param[in]  c  The cursor.
+ * \return true if there was another line, false at the end.
+ */
+static bool overview__next_line(struct overview_cursor *c)
+{
+	const char *nl;
+
+	if (c->next >= c->end) {
+		c->line = c->end;
+		c->len = 0;
+		return false;
+	}
+
+	c->line = c->next;
+	nl = memchr(c->line, '\n', c->end - c->line);
+	c->len = ((nl != NULL) ? nl : c->end) - c->line;
+	c->next = c->line + c->len + ((nl != NULL) ? 1 : 0);
+
+	return true;
+}
+
+/**
+ * Check whether a cursor's line starts with a given string.
+ *
+ * \param[in]  c       The cursor.
+ * \param[in]  prefix  The string to check for.
+ * \return true if the line starts with prefix.
+ */
+static bool overview__prefix(
+		const struct overview_cursor *c,
+		const char *prefix)
+{
+	size_t len = strlen(prefix);
+
+	return c->len >= len && memcmp(c->line, prefix, len) == 0;
+}
+
+/**
+ * Check whether a cursor's line starts a message.
+ *
+ * \param[in]  c  The cursor.
+ * \return true if the line starts a message.
+ */
+static inline bool overview__is_message(const struct overview_cursor *c)
+{
+	return overview__prefix(c, "- ");
+}
+
+/**
+ * Read a decimal value following a prefix on a cursor's line.
+ *
+ * \param[in]  c       The cursor.
+ * \param[in]  prefix  The string the line must start with.
+ * \param[out] value   Returns the value on success.
+ * \return true on success, false if the line doesn't match.
+ */
+static bool overview__value(
+		const struct overview_cursor *c,
+		const char *prefix,
+		uint32_t *value)
+{
+	size_t pos = strlen(prefix);
+	uint64_t v = 0;
+
+	if (!overview__prefix(c, prefix) ||
+	    pos >= c->len || c->line[pos] < '0' || c->line[pos] > '9') {
+		return false;
+	}
+
+	for (; pos < c->len && c->line[pos] >= '0' && c->line[pos] <= '9';
+			pos++) {
+		v = v * 10 + (c->line[pos] - '0');
+		if (v > UINT32_MAX) {
+			return false;
+		}
+	}
+
+	*value = v;
+	return true;
+}
+
+/**
+ * Ensure a dynamic array has room for another entry.
+ *
+ * \param[in,out] array  The array to grow.
+ * \param[in,out] alloc  The allocated length of the array.
+ * \param[in]     count  The number of entries in use.
+ * \param[in]     size   The size of an entry.
+ * \return true on success, false on allocation failure.
+ */
+static bool overview__grow(
+		void **array,
+		uint64_t *alloc,
+		uint64_t count,
+		size_t size)
+{
+	uint64_t len = (*alloc == 0) ? 64 : *alloc * 2;
+	void *tmp;
+
+	if (count < *alloc) {
+		return true;
+	}
+
+	tmp = realloc(*array, len * size);
+	if (tmp == NULL) {
+		return false;
+	}
+
+	*array = tmp;
+	*alloc = len;
+	return true;
+}
+
+/**
+ * Append a bucket to a level of a channel being built.
+ *
+ * \param[in]  c      The channel's overview data.
+ * \param[in]  b      The channel's build state.
+ * \param[in]  level  The level to append to.
+ * \param[in]  entry  The bucket to append.
+ * \return true on success, false on allocation failure.
+ */
+static bool overview__append(
+		struct overview_channel *c,
+		struct overview_build *b,
+		unsigned level,
+		struct overview_bucket entry)
+{
+	if (!overview__grow((void **) &b->level[level],
+			&b->level_alloc[level], c->level_count[level],
+			sizeof(*b->level[level]))) {
+		return false;
+	}
+
+	b->level[level][c->level_count[level]++] = entry;
+	return true;
+}
+
+/**
+ * Merge an entry into a level's accumulator.
+ *
+ * \param[in]  c      The channel's overview data.
+ * \param[in]  b      The channel's build state.
+ * \param[in]  level  The level to merge into.
+ * \param[in]  entry  The sample or bucket to merge.
+ * \return true on success, false on allocation failure.
+ */
+static bool overview__merge(
+		struct overview_channel *c,
+		struct overview_build *b,
+		unsigned level,
+		struct overview_bucket entry)
+{
+	struct overview_bucket *acc = &b->acc[level];
+
+	if (b->acc_count[level] == 0) {
+		*acc = entry;
+	} else {
+		if (entry.min < acc->min) {
+			acc->min = entry.min;
+		}
+		if (entry.max > acc->max) {
+			acc->max = entry.max;
+		}
+	}
+
+	if (++b->acc_count[level] < OVERVIEW_FANOUT) {
+		return true;
+	}
+
+	b->acc_count[level] = 0;
+	if (!overview__append(c, b, level, *acc)) {
+		return false;
+	}
+
+	if (level + 1 < OVERVIEW_LEVELS) {
+		return overview__merge(c, b, level + 1, *acc);
+	}
+
+	return true;
+}
+
+/**
+ * Add a sample to a channel being built.
+ *
+ * \param[in]  ov       The overview being built.
+ * \param[in]  channel  The acquisition channel.
+ * \param[in]  value    The sample value.
+ * \param[in]  offset   Recording offset of the sample's line.
+ * \return true on success, false on allocation failure.
+ */
+static bool overview__add(
+		struct overview *ov,
+		unsigned channel,
+		uint32_t value,
+		uint64_t offset)
+{
+	struct overview_channel *c = &ov->channel[channel];
+	struct overview_build *b = &ov->build[channel];
+	struct overview_bucket entry = {
+		.min = value,
+		.max = value,
+	};
+
+	if (c->count % OVERVIEW_BLOCK == 0) {
+		if (!overview__grow((void **) &b->block, &b->block_alloc,
+				c->block_count, sizeof(*b->block))) {
+			return false;
+		}
+		b->block[c->block_count++] = offset;
+	}
+
+	c->count++;
+	return overview__merge(c, b, 0, entry);
+}
+
+/**
+ * Flush a channel's partial buckets at the end of the recording.
+ *
+ * \param[in]  ov       The overview being built.
+ * \param[in]  channel  The acquisition channel.
+ * \return true on success, false on allocation failure.
+ */
+static bool overview__flush(
+		struct overview *ov,
+		unsigned channel)
+{
+	struct overview_channel *c = &ov->channel[channel];
+	struct overview_build *b = &ov->build[channel];
+
+	for (unsigned i = 0; i < OVERVIEW_LEVELS; i++) {
+		if (b->acc_count[i] == 0) {
+			continue;
+		}
+
+		b->acc_count[i] = 0;
+		if (!overview__append(c, b, i, b->acc[i])) {
+			return false;
+		}
+		if (i + 1 < OVERVIEW_LEVELS &&
+		    !overview__merge(c, b, i + 1, b->acc[i])) {
+			return false;
+		}
+	}
+
+	c->block = b->block;
+	for (unsigned i = 0; i < OVERVIEW_LEVELS; i++) {
+		c->level[i] = b->level[i];
+	}
+
+	return true;
+}
+
+/**
+ * Parse a Start message.
+ *
+ * \param[in]  ov  The overview being built.
+ * \param[in]  c   Cursor at the message's first line.  Returns at the
+ *                 next message.
+ * \return true on success, false on error.
+ */
+static bool overview__start(
+		struct overview *ov,
+		struct overview_cursor *c)
+{
+	uint32_t frequency = 0;
+
+	while (overview__next_line(c) && !overview__is_message(c)) {
+		overview__value(c, "    Frequency: ", &frequency);
+	}
+
+	if (frequency == 0) {
+		fprintf(stderr, "Error: Overview: Bad frequency in Start\n");
+		return false;
+	}
+
+	if (ov->frequency != 0 && ov->frequency != frequency) {
+		fprintf(stderr, "Error: Overview: Sampling rate changed "
+				"from %u to %u Hz\n",
+				ov->frequency, (unsigned) frequency);
+		return false;
+	}
+
+	ov->frequency = frequency;
+	return true;
+}
+
+/**
+ * Parse a sample data message.
+ *
+ * \param[in]  ov  The overview being built.
+ * \param[in]  c   Cursor at the message's first line.  Returns at the
+ *                 next message.
+ * \return true on success, false on error.
+ */
+static bool overview__sample_data(
+		struct overview *ov,
+		struct overview_cursor *c)
+{
+	uint32_t channel;
+	uint32_t value;
+
+	if (!overview__next_line(c) ||
+	    !overview__value(c, "    Channel: ", &channel) ||
+	    channel >= BL_CHANNEL_MAX) {
+		fprintf(stderr, "Error: Overview: Bad sample data message "
+				"at offset %zu\n",
+				(size_t) (c->line - ov->rec));
+		return false;
+	}
+
+	while (overview__next_line(c) && !overview__is_message(c)) {
+		if (!overview__value(c, "    - ", &value)) {
+			continue;
+		}
+		if (!overview__add(ov, channel, value, c->line - ov->rec)) {
+			fprintf(stderr, "Error: Overview: Out of memory\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Build an overview from the recording.
+ *
+ * \param[in]  ov  The overview to build, with the recording mapped.
+ * \return true on success, false on error.
+ */
+static bool overview__build(struct overview *ov)
+{
+	struct overview_cursor c = {
+		.next = ov->rec,
+		.end = ov->rec + ov->rec_len,
+	};
+	bool ok = true;
+
+	ov->build = calloc(BL_CHANNEL_MAX, sizeof(*ov->build));
+	if (ov->build == NULL) {
+		return false;
+	}
+
+	madvise((void *) ov->rec, ov->rec_len, MADV_SEQUENTIAL);
+
+	overview__next_line(&c);
+	while (ok && c.line < c.end) {
+		if (overview__prefix(&c, "- Start:")) {
+			ok = overview__start(ov, &c);
+		} else if (overview__prefix(&c, "- Sample Data")) {
+			ok = overview__sample_data(ov, &c);
+		} else if (!overview__next_line(&c)) {
+			break;
+		}
+	}
+
+	for (unsigned i = 0; ok && i < BL_CHANNEL_MAX; i++) {
+		ok = overview__flush(ov, i);
+	}
+
+	madvise((void *) ov->rec, ov->rec_len, MADV_RANDOM);
+
+	if (ok && ov->frequency == 0) {
+		fprintf(stderr, "Error: Overview: No Start message\n");
+		ok = false;
+	}
+
+	return ok;
+}
+
+/**
+ * Get the sidecar path for a recording.
+ *
+ * \param[in]  path  Path to the recording.
+ * \return newly allocated sidecar path, or NULL on error.
+ */
+static char *overview__sidecar_path(const char *path)
+{
+	static const char ext[] = ".overview";
+	size_t len = strlen(path);
+	char *sidecar;
+
+	if (len > 5 && strcmp(path + len - 5, ".yaml") == 0) {
+		len -= 5;
+	}
+
+	sidecar = malloc(len + sizeof(ext));
+	if (sidecar == NULL) {
+		return NULL;
+	}
+
+	memcpy(sidecar, path, len);
+	memcpy(sidecar + len, ext, sizeof(ext));
+	return sidecar;
+}
+
+/**
+ * Fill out a sidecar header for a recording.
+ *
+ * \param[in]  ov      The overview.
+ * \param[in]  st      The recording's file status.
+ * \param[out] header  Returns the header.
+ */
+static void overview__header(
+		const struct overview *ov,
+		const struct stat *st,
+		struct overview_header *header)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, OVERVIEW_MAGIC, sizeof(header->magic));
+	header->rec_size = st->st_size;
+	header->rec_mtime_sec = st->st_mtim.tv_sec;
+	header->rec_mtime_nsec = st->st_mtim.tv_nsec;
+	header->frequency = ov->frequency;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		if (ov->channel[i].count != 0) {
+			header->channels++;
+		}
+	}
+}
+
+/**
+ * Write a built overview to its sidecar file.
+ *
+ * \param[in]  ov    The built overview.
+ * \param[in]  st    The recording's file status.
+ * \param[in]  path  The sidecar path.
+ * \return true on success, false on error.
+ */
+static bool overview__write(
+		const struct overview *ov,
+		const struct stat *st,
+		const char *path)
+{
+	struct overview_header header;
+	uint64_t offset;
+	size_t len = strlen(path) + 32;
+	bool ok = true;
+	FILE *file;
+	char *tmp;
+
+	tmp = malloc(len);
+	if (tmp == NULL) {
+		return false;
+	}
+
+	/* Write to a temporary file and rename it into place, so that a
+	 * partial sidecar is never seen. */
+	snprintf(tmp, len, "%s.%ld", path, (long) getpid());
+	file = fopen(tmp, "wb");
+	if (file == NULL) {
+		free(tmp);
+		return false;
+	}
+
+	overview__header(ov, st, &header);
+	ok &= fwrite(&header, sizeof(header), 1, file) == 1;
+
+	offset = sizeof(header) + header.channels *
+			sizeof(struct overview_channel_header);
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		const struct overview_channel *c = &ov->channel[i];
+		struct overview_channel_header ch = {
+			.channel = i,
+			.count = c->count,
+			.block_count = c->block_count,
+		};
+
+		if (c->count == 0) {
+			continue;
+		}
+
+		ch.block_offset = offset;
+		offset += c->block_count * sizeof(*c->block);
+		for (unsigned l = 0; l < OVERVIEW_LEVELS; l++) {
+			ch.level_count[l] = c->level_count[l];
+			ch.level_offset[l] = offset;
+			offset += c->level_count[l] * sizeof(*c->level[l]);
+		}
+
+		ok &= fwrite(&ch, sizeof(ch), 1, file) == 1;
+	}
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		const struct overview_channel *c = &ov->channel[i];
+
+		if (c->count == 0) {
+			continue;
+		}
+
+		ok &= fwrite(c->block, sizeof(*c->block),
+				c->block_count, file) == c->block_count;
+		for (unsigned l = 0; l < OVERVIEW_LEVELS; l++) {
+			ok &= fwrite(c->level[l], sizeof(*c->level[l]),
+					c->level_count[l], file) ==
+					c->level_count[l];
+		}
+	}
+
+	if (fclose(file) != 0 || !ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		ok = false;
+	}
+
+	free(tmp);
+	return ok;
+}
+
+/**
+ * Check that a section of a mapped sidecar is in bounds.
+ *
+ * \param[in]  ov      The overview, with the sidecar mapped.
+ * \param[in]  offset  Offset of the section.
+ * \param[in]  count   Number of entries in the section.
+ * \param[in]  size    Size of each entry.
+ * \return true if the section is in bounds.
+ */
+static bool overview__in_bounds(
+		const struct overview *ov,
+		uint64_t offset,
+		uint64_t count,
+		size_t size)
+{
+	return offset <= ov->map_len && offset % sizeof(uint64_t) == 0 &&
+			count <= (ov->map_len - offset) / size;
+}
+
+/**
+ * Check that a channel's block offsets can be seeked to in the recording.
+ *
+ * \param[in]  ov  The overview, with the recording mapped.
+ * \param[in]  c   The channel, with its blocks from the sidecar.
+ * \return true if every offset is within the recording, and the offsets
+ *         don't go backwards.
+ */
+static bool overview__blocks_valid(
+		const struct overview *ov,
+		const struct overview_channel *c)
+{
+	uint64_t prev = 0;
+
+	for (uint64_t b = 0; b < c->block_count; b++) {
+		if (c->block[b] >= ov->rec_len || c->block[b] < prev) {
+			return false;
+		}
+		prev = c->block[b];
+	}
+
+	return true;
+}
+
+/**
+ * Try to use an existing sidecar file for an overview.
+ *
+ * \param[in]  ov    The overview, with the recording mapped.
+ * \param[in]  st    The recording's file status.
+ * \param[in]  path  The sidecar path.
+ * \return true if the sidecar is up to date and now in use.
+ */
+static bool overview__load(
+		struct overview *ov,
+		const struct stat *st,
+		const char *path)
+{
+	const struct overview_channel_header *ch;
+	const struct overview_header *header;
+	struct overview_header expected;
+	struct stat sidecar_st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+
+	if (fstat(fd, &sidecar_st) == -1 ||
+	    (size_t) sidecar_st.st_size < sizeof(*header)) {
+		close(fd);
+		return false;
+	}
+
+	ov->map_len = sidecar_st.st_size;
+	ov->map = mmap(NULL, ov->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ov->map == MAP_FAILED) {
+		ov->map = NULL;
+		return false;
+	}
+
+	header = ov->map;
+	ov->frequency = header->frequency;
+	overview__header(ov, st, &expected);
+	if (memcmp(header->magic, expected.magic, sizeof(header->magic)) ||
+	    header->rec_size != expected.rec_size ||
+	    header->rec_mtime_sec != expected.rec_mtime_sec ||
+	    header->rec_mtime_nsec != expected.rec_mtime_nsec ||
+	    header->frequency == 0 ||
+	    !overview__in_bounds(ov, sizeof(*header),
+			header->channels, sizeof(*ch))) {
+		goto stale;
+	}
+
+	ch = (const void *) (header + 1);
+	for (unsigned i = 0; i < header->channels; i++, ch++) {
+		uint64_t size = OVERVIEW_FANOUT;
+		struct overview_channel *c;
+
+		if (ch->channel >= BL_CHANNEL_MAX ||
+		    !overview__in_bounds(ov, ch->block_offset,
+				ch->block_count, sizeof(*c->block))) {
+			goto stale;
+		}
+
+		c = &ov->channel[ch->channel];
+		c->count = ch->count;
+		c->block_count = ch->block_count;
+		c->block = (const void *)
+				((const char *) ov->map + ch->block_offset);
+
+		for (unsigned l = 0; l < OVERVIEW_LEVELS; l++) {
+			if (ch->level_count[l] != (ch->count + size - 1) / size ||
+			    !overview__in_bounds(ov, ch->level_offset[l],
+					ch->level_count[l],
+					sizeof(*c->level[l]))) {
+				goto stale;
+			}
+			size *= OVERVIEW_FANOUT;
+			c->level_count[l] = ch->level_count[l];
+			c->level[l] = (const void *) ((const char *) ov->map +
+					ch->level_offset[l]);
+		}
+
+		if (c->block_count != (c->count + OVERVIEW_BLOCK - 1) /
+				OVERVIEW_BLOCK ||
+		    !overview__blocks_valid(ov, c)) {
+			goto stale;
+		}
+	}
+
+	return true;
+
+stale:
+	munmap(ov->map, ov->map_len);
+	ov->map = NULL;
+	ov->frequency = 0;
+	memset(ov->channel, 0, sizeof(ov->channel));
+	return false;
+}
+
+/* Exported interface, documented in overview.h */
+struct overview *overview_open(const char *path)
+{
+	struct timespec start, end;
+	struct overview *ov;
+	char *sidecar;
+	struct stat st;
+	int fd;
+
+	ov = calloc(1, sizeof(*ov));
+	if (ov == NULL) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Error: Overview: Failed to open '%s': %s\n",
+				path, strerror(errno));
+		free(ov);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		fprintf(stderr, "Error: Overview: '%s' is empty\n", path);
+		close(fd);
+		free(ov);
+		return NULL;
+	}
+
+	ov->rec_len = st.st_size;
+	ov->rec = mmap(NULL, ov->rec_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ov->rec == MAP_FAILED) {
+		fprintf(stderr, "Error: Overview: Failed to map '%s': %s\n",
+				path, strerror(errno));
+		free(ov);
+		return NULL;
+	}
+
+	sidecar = overview__sidecar_path(path);
+	if (sidecar == NULL) {
+		goto error;
+	}
+
+	if (overview__load(ov, &st, sidecar)) {
+		free(sidecar);
+		return ov;
+	}
+
+	fprintf(stderr, "Overview: Building '%s'\n", sidecar);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!overview__build(ov)) {
+		free(sidecar);
+		goto error;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "Overview: Built in %.1f s\n",
+			(end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9);
+
+	if (!overview__write(ov, &st, sidecar)) {
+		fprintf(stderr, "Warning: Overview: Failed to write '%s'; "
+				"it will be rebuilt next time\n", sidecar);
+	}
+
+	free(sidecar);
+	return ov;
+
+error:
+	overview_close(ov);
+	return NULL;
+}
+
+/* Exported interface, documented in overview.h */
+void overview_close(struct overview *ov)
+{
+	if (ov == NULL) {
+		return;
+	}
+
+	if (ov->build != NULL) {
+		for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+			struct overview_build *b = &ov->build[i];
+
+			for (unsigned l = 0; l < OVERVIEW_LEVELS; l++) {
+				free(b->level[l]);
+			}
+			free(b->block);
+		}
+		free(ov->build);
+	}
+
+	if (ov->map != NULL) {
+		munmap(ov->map, ov->map_len);
+	}
+
+	munmap((void *) ov->rec, ov->rec_len);
+	free(ov);
+}
+
+/* Exported interface, documented in overview.h */
+unsigned overview_frequency(const struct overview *ov)
+{
+	return ov->frequency;
+}
+
+/* Exported interface, documented in overview.h */
+uint64_t overview_sample_count(
+		const struct overview *ov,
+		unsigned channel)
+{
+	if (channel >= BL_CHANNEL_MAX) {
+		return 0;
+	}
+
+	return ov->channel[channel].count;
+}
+
+/* Exported interface, documented in overview.h */
+bool overview_range(
+		const struct overview *ov,
+		unsigned channel,
+		uint64_t start,
+		uint64_t end,
+		uint32_t *min,
+		uint32_t *max)
+{
+	const struct overview_channel *c;
+	uint64_t size = OVERVIEW_FANOUT;
+	unsigned level = 0;
+	uint64_t first;
+	uint64_t last;
+
+	if (channel >= BL_CHANNEL_MAX) {
+		return false;
+	}
+
+	c = &ov->channel[channel];
+	if (end > c->count) {
+		end = c->count;
+	}
+	if (start >= end) {
+		return false;
+	}
+
+	while (level + 1 < OVERVIEW_LEVELS &&
+	       size * OVERVIEW_FANOUT <= end - start) {
+		size *= OVERVIEW_FANOUT;
+		level++;
+	}
+
+	first = start / size;
+	last = (end + size - 1) / size;
+	if (last > c->level_count[level]) {
+		last = c->level_count[level];
+	}
+
+	*min = c->level[level][first].min;
+	*max = c->level[level][first].max;
+	for (uint64_t i = first + 1; i < last; i++) {
+		if (c->level[level][i].min < *min) {
+			*min = c->level[level][i].min;
+		}
+		if (c->level[level][i].max > *max) {
+			*max = c->level[level][i].max;
+		}
+	}
+
+	return true;
+}
+
+/* Exported interface, documented in overview.h */
+unsigned overview_samples(
+		const struct overview *ov,
+		unsigned channel,
+		uint64_t start,
+		unsigned count,
+		uint32_t *out)
+{
+	const struct overview_channel *c;
+	struct overview_cursor cur;
+	bool check_channel = false;
+	bool in_channel = true;
+	unsigned skip;
+	unsigned n = 0;
+
+	if (channel >= BL_CHANNEL_MAX) {
+		return 0;
+	}
+
+	c = &ov->channel[channel];
+	if (start >= c->count) {
+		return 0;
+	}
+
+	/* Start at the block's first sample, and skip to the one wanted. */
+	cur.next = ov->rec + c->block[start / OVERVIEW_BLOCK];
+	cur.end = ov->rec + ov->rec_len;
+	skip = start % OVERVIEW_BLOCK;
+
+	while (n < count && overview__next_line(&cur)) {
+		uint32_t value;
+
+		if (overview__is_message(&cur)) {
+			check_channel = overview__prefix(&cur,
+					"- Sample Data");
+			in_channel = false;
+			continue;
+		}
+
+		if (check_channel) {
+			check_channel = false;
+			in_channel = overview__value(&cur, "    Channel: ",
+					&value) && value == channel;
+			continue;
+		}
+
+		if (!in_channel || !overview__value(&cur, "    - ", &value)) {
+			continue;
+		}
+
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+
+		out[n++] = value;
+	}
+
+	return n;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the recording overview module.
+ *
+ * This gives fast access to a recording's samples at any scale, for
+ * browsing recordings that are too long to parse every time they are
+ * looked at.
+ *
+ * An overview is a pyramid of minimum and maximum sample values for each
+ * channel.  Each level summarises blocks of \ref OVERVIEW_FANOUT buckets
+ * of the level below, with the first level summarising that many samples.
+ * The overview also stores where in the recording every
+ * \ref OVERVIEW_BLOCK th sample of each channel is, so individual samples
+ * can be read straight from the recording.
+ *
+ * The overview is built in one pass over the recording the first time it
+ * is opened, and saved in a sidecar file next to the recording, with an
+ * ".overview" extension instead of ".yaml".  The sidecar is used again as
+ * long as the recording's size and modification time are unchanged.  Both
+ * the recording and the sidecar are memory-mapped, rather than read in.
+ */
+
+#ifndef BV_OVERVIEW_H
+#define BV_OVERVIEW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Number of buckets or samples each overview bucket summarises. */
+#define OVERVIEW_FANOUT 8
+
+/** Number of samples between stored recording positions. */
+#define OVERVIEW_BLOCK 256
+
+/** Overview object. */
+struct overview;
+
+/**
+ * Open a recording's overview, building it if needed.
+ *
+ * \param[in]  path  Path to the recording.
+ * \return the overview, or NULL on error.
+ */
+struct overview *overview_open(const char *path);
+
+/**
+ * Close an overview.
+ *
+ * \param[in]  ov  The overview to close, or NULL.
+ */
+void overview_close(struct overview *ov);
+
+/**
+ * Get the sampling rate of an overview's recording.
+ *
+ * \param[in]  ov  The overview.
+ * \return the sampling rate in Hz.
+ */
+unsigned overview_frequency(const struct overview *ov);
+
+/**
+ * Get the number of samples a recording has for a channel.
+ *
+ * \param[in]  ov       The overview.
+ * \param[in]  channel  The acquisition channel.
+ * \return the number of samples, or zero if the channel wasn't recorded.
+ */
+uint64_t overview_sample_count(
+		const struct overview *ov,
+		unsigned channel);
+
+/**
+ * Get the range of a channel's sample values over a span of samples.
+ *
+ * The coarsest level whose buckets are no wider than the span is used, so
+ * the result may include samples up to one bucket outside the span.
+ *
+ * \param[in]  ov       The overview.
+ * \param[in]  channel  The acquisition channel.
+ * \param[in]  start    The first sample in the span.
+ * \param[in]  end      The sample after the last sample in the span.
+ * \param[out] min      Returns the minimum sample value.
+ * \param[out] max      Returns the maximum sample value.
+ * \return true on success, or false if the span has no samples.
+ */
+bool overview_range(
+		const struct overview *ov,
+		unsigned channel,
+		uint64_t start,
+		uint64_t end,
+		uint32_t *min,
+		uint32_t *max);
+
+/**
+ * Read a channel's samples from the recording.
+ *
+ * \param[in]  ov       The overview.
+ * \param[in]  channel  The acquisition channel.
+ * \param[in]  start    The first sample to read.
+ * \param[in]  count    The number of samples to read.
+ * \param[out] out      Array of at least count entries.
+ * \return the number of samples read.
+ */
+unsigned overview_samples(
+		const struct overview *ov,
+		unsigned channel,
+		uint64_t start,
+		unsigned count,
+		uint32_t *out);
+
+#endif /* BV_OVERVIEW_H */
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the signal quality module.
+ *
+ * Samples are averaged down to a low rate, scaled to full scale, and have
+ * their slowly varying baseline removed, which also removes most of the
+ * respiratory variation.  They're kept in a ring buffer holding a few
+ * seconds per channel.  Once a second, the window has its linear trend
+ * removed, and is correlated with itself delayed by each lag in the range
+ * of plausible pulse periods.  A clean pulse wave matches itself one period
+ * later, so the first strong peak gives both the correlation and the pulse
+ * rate.  Motion artefacts and noise aren't periodic, so they lower the
+ * correlation.
+ *
+ * Calibration sets the channel offsets, so the signal's DC level doesn't
+ * say anything about perfusion.  Instead, the pulse amplitude relative to
+ * full scale is used; a signal too small to resolve is poor however
+ * periodic it looks.  Full scale is the largest sample the channel's
+ * source and channel configuration can produce.
+ *
+ * Estimation runs on the device thread.  The results are published to
+ * other threads under a lock.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "host/common/sample.h"
+
+#include "util.h"
+#include "device.h"
+#include "quality.h"
+#include "main-menu.h"
+
+/** Rate to average samples down to, in Hz. */
+#define QUALITY_RATE 50
+
+/** Cut-off frequency of the baseline removal filter, in Hz. */
+#define QUALITY_BASELINE_CUTOFF 0.5
+
+/** Length of the analysis window, in seconds. */
+#define QUALITY_WINDOW 4
+
+/** Largest window, in samples, at up to twice \ref QUALITY_RATE. */
+#define QUALITY_WINDOW_MAX (2 * QUALITY_RATE * QUALITY_WINDOW)
+
+/** Lowest plausible pulse rate, in beats per minute. */
+#define QUALITY_BPM_MIN 40
+
+/** Highest plausible pulse rate, in beats per minute. */
+#define QUALITY_BPM_MAX 180
+
+/**
+ * Fraction of the strongest correlation peak a shorter lag's peak must
+ * reach to be taken as the pulse period, rather than a multiple of it.
+ */
+#define QUALITY_PEAK_FRACTION 0.9
+
+/** Pulse amplitude, in percent of full scale, below which quality falls. */
+#define QUALITY_AMPLITUDE_MIN 0.1
+
+/** Quality lost per percent of samples clipped, as a fraction. */
+#define QUALITY_CLIP_WEIGHT 0.2
+
+/** Per-channel estimator state. */
+struct quality_channel {
+	uint32_t full16;    /**< Full scale of 16-bit samples. */
+	uint32_t full32;    /**< Full scale of 32-bit samples. */
+
+	double   acc;       /**< Sum of samples being averaged. */
+	unsigned acc_count; /**< Number of samples in acc. */
+	double   baseline;  /**< Baseline level, tracked by a low-pass filter. */
+
+	float    ring[QUALITY_WINDOW_MAX]; /**< Averaged samples. */
+	unsigned pos;    /**< Next position to write in ring. */
+	unsigned filled; /**< Number of valid entries in ring. */
+	unsigned block;  /**< Averaged samples since the last estimate. */
+
+	uint32_t clipped; /**< Clipped samples since the last estimate. */
+	uint32_t count;   /**< Samples since the last estimate. */
+
+	double   sum;     /**< Sum of the quality estimates. */
+	double   quality; /**< Latest quality estimate. */
+	uint32_t estimates; /**< Number of estimates made. */
+
+	/** Estimate published to other threads, under lock. */
+	struct quality_stats stats;
+};
+
+/** Signal quality module global data. */
+static struct {
+	/** Whether estimation is running. */
+	bool enabled;
+
+	/** Whether the signal quality is acceptable. */
+	bool ok;
+
+	unsigned factor; /**< Number of samples averaged together. */
+	unsigned window; /**< Window length, in averaged samples. */
+	unsigned block;  /**< Averaged samples between estimates. */
+	unsigned lag_min; /**< Shortest pulse period, in averaged samples. */
+	unsigned lag_max; /**< Longest pulse period, in averaged samples. */
+	double   rate;   /**< Averaged sample rate, in Hz. */
+	double   alpha;  /**< Baseline filter coefficient. */
+
+	unsigned threshold; /**< Configured quality threshold. */
+	bool     pause;     /**< Whether to pause recording on poor quality. */
+
+	/** Per-channel estimators, indexed by acquisition channel. */
+	struct quality_channel channel[sizeof(unsigned) * CHAR_BIT];
+
+	/** Channels which are being estimated. */
+	unsigned channel_mask;
+
+	/** Channels with a published estimate, under lock. */
+	unsigned valid_mask;
+
+	/** Lock for published estimates. */
+	pthread_mutex_t lock;
+} quality_g = {
+	.ok = true,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Exported interface, documented in quality.h */
+void quality_start(unsigned frequency, unsigned channel_mask)
+{
+	unsigned factor = frequency / QUALITY_RATE;
+
+	quality_g.enabled = false;
+	quality_g.ok = true;
+	quality_g.channel_mask = 0;
+	quality_g.threshold = main_menu_config_get_quality_threshold();
+	quality_g.pause = main_menu_config_get_quality_pause();
+
+	pthread_mutex_lock(&quality_g.lock);
+	memset(quality_g.channel, 0, sizeof(quality_g.channel));
+	quality_g.valid_mask = 0;
+	pthread_mutex_unlock(&quality_g.lock);
+
+	if (channel_mask == 0) {
+		return;
+	}
+
+	if (factor == 0) {
+		factor = 1;
+	}
+
+	quality_g.factor = factor;
+	quality_g.rate = (double)frequency / factor;
+	quality_g.window = quality_g.rate * QUALITY_WINDOW + 0.5;
+	quality_g.block = quality_g.rate + 0.5;
+	quality_g.alpha = 1 - exp(-2 * M_PI * QUALITY_BASELINE_CUTOFF /
+			quality_g.rate);
+	quality_g.lag_min = quality_g.rate * 60 / QUALITY_BPM_MAX;
+	quality_g.lag_max = ceil(quality_g.rate * 60 / QUALITY_BPM_MIN);
+
+	if (quality_g.lag_min < 2 ||
+	    quality_g.lag_max + 1 >= quality_g.window / 2) {
+		fprintf(stderr, "Warning: Sampling rate too low for "
+				"signal quality estimation.\n");
+		return;
+	}
+
+	for (unsigned i = 0; i < BV_ARRAY_LEN(quality_g.channel); i++) {
+		if (channel_mask & (1u << i)) {
+			quality_g.channel[i].full16 =
+					device_get_channel_full_scale(i, false);
+			quality_g.channel[i].full32 =
+					device_get_channel_full_scale(i, true);
+		}
+	}
+
+	quality_g.channel_mask = channel_mask;
+	quality_g.enabled = true;
+}
+
+/* Exported interface, documented in quality.h */
+void quality_finish(void)
+{
+	quality_g.enabled = false;
+	quality_g.ok = true;
+}
+
+/**
+ * Get the correlation of a window with itself delayed.
+ *
+ * \param[in]  x    The window.
+ * \param[in]  n    Number of samples in the window.
+ * \param[in]  lag  The delay, in samples.
+ * \return the normalised correlation, from -1 to 1.
+ */
+static double quality__correlate(
+		const double *x,
+		unsigned n,
+		unsigned lag)
+{
+	double xy = 0;
+	double xx = 0;
+	double yy = 0;
+
+	for (unsigned i = 0; i + lag < n; i++) {
+		xy += x[i] * x[i + lag];
+		xx += x[i] * x[i];
+		yy += x[i + lag] * x[i + lag];
+	}
+
+	if (xx <= 0 || yy <= 0) {
+		return 0;
+	}
+
+	return xy / sqrt(xx * yy);
+}
+
+/**
+ * Find the pulse period in a window.
+ *
+ * The pulse period is taken as the shortest lag with a local maximum of
+ * correlation close to the strongest.  Longer lags that are multiples of
+ * the period correlate almost as well, so the strongest alone isn't used.
+ *
+ * \param[in]  x            The window, with its trend removed.
+ * \param[out] correlation  Returns the correlation at the pulse period.
+ * \return the pulse period in averaged samples, or 0 if none was found.
+ */
+static double quality__period(
+		const double *x,
+		double *correlation)
+{
+	double r[QUALITY_WINDOW_MAX / 2];
+	unsigned lag_min = quality_g.lag_min;
+	unsigned lag_max = quality_g.lag_max;
+	double best = 0;
+	double offset;
+	double a, b, c;
+	unsigned lag;
+
+	for (lag = lag_min - 1; lag <= lag_max + 1; lag++) {
+		r[lag] = quality__correlate(x, quality_g.window, lag);
+	}
+
+	for (lag = lag_min; lag <= lag_max; lag++) {
+		if (r[lag] >= r[lag - 1] && r[lag] >= r[lag + 1] &&
+		    r[lag] > best) {
+			best = r[lag];
+		}
+	}
+
+	*correlation = 0;
+	if (best <= 0) {
+		return 0;
+	}
+
+	for (lag = lag_min; lag <= lag_max; lag++) {
+		if (r[lag] >= r[lag - 1] && r[lag] >= r[lag + 1] &&
+		    r[lag] >= best * QUALITY_PEAK_FRACTION) {
+			break;
+		}
+	}
+
+	/* Refine the period by fitting a parabola through the peak. */
+	a = r[lag - 1];
+	b = r[lag];
+	c = r[lag + 1];
+	offset = (a - 2 * b + c < 0) ? 0.5 * (a - c) / (a - 2 * b + c) : 0;
+
+	*correlation = b;
+	return lag + offset;
+}
+
+/**
+ * Update whether the signal quality is acceptable.
+ */
+static void quality__update_ok(void)
+{
+	bool estimated = false;
+	bool ok = false;
+
+	for (unsigned i = 0; i < BV_ARRAY_LEN(quality_g.channel); i++) {
+		const struct quality_channel *ch = &quality_g.channel[i];
+
+		if (ch->estimates == 0) {
+			continue;
+		}
+
+		estimated = true;
+		if (ch->quality >= quality_g.threshold) {
+			ok = true;
+		}
+	}
+
+	quality_g.ok = ok || !estimated;
+}
+
+/**
+ * Estimate a channel's signal quality from its window.
+ *
+ * \param[in]  acq_channel  Acquisition channel to estimate.
+ */
+static void quality__estimate(unsigned acq_channel)
+{
+	struct quality_channel *ch = &quality_g.channel[acq_channel];
+	struct quality_stats stats = { 0 };
+	unsigned n = quality_g.window;
+	double x[QUALITY_WINDOW_MAX];
+	double mean = 0;
+	double slope = 0;
+	double var = 0;
+	double period;
+
+	for (unsigned i = 0; i < n; i++) {
+		x[i] = ch->ring[(ch->pos + i) % n];
+		mean += x[i];
+	}
+	mean /= n;
+
+	/* Remove the linear trend, so slow baseline drift isn't mistaken
+	 * for the signal. */
+	for (unsigned i = 0; i < n; i++) {
+		double t = i - (n - 1) / 2.0;
+
+		slope += t * (x[i] - mean);
+		var += t * t;
+	}
+	slope /= var;
+
+	var = 0;
+	for (unsigned i = 0; i < n; i++) {
+		x[i] -= mean + slope * (i - (n - 1) / 2.0);
+		var += x[i] * x[i];
+	}
+
+	/* Peak to peak amplitude of a sine wave with the same power. */
+	stats.amplitude = 100 * 2 * M_SQRT2 * sqrt(var / n);
+	stats.clipped = (ch->count == 0) ? 0 :
+			100.0 * ch->clipped / ch->count;
+
+	period = quality__period(x, &stats.correlation);
+	if (period > 0) {
+		stats.rate = 60 * quality_g.rate / period;
+	}
+
+	stats.quality = 100 * fmax(0, stats.correlation);
+	stats.quality *= fmin(1, stats.amplitude / QUALITY_AMPLITUDE_MIN);
+	stats.quality *= fmax(0, 1 - stats.clipped * QUALITY_CLIP_WEIGHT);
+
+	ch->quality = stats.quality;
+	ch->sum += stats.quality;
+	ch->estimates++;
+	ch->clipped = 0;
+	ch->count = 0;
+	ch->block = 0;
+
+	stats.mean = ch->sum / ch->estimates;
+	stats.estimates = ch->estimates;
+
+	pthread_mutex_lock(&quality_g.lock);
+	ch->stats = stats;
+	quality_g.valid_mask |= 1u << acq_channel;
+	pthread_mutex_unlock(&quality_g.lock);
+
+	quality__update_ok();
+}
+
+/* Exported interface, documented in quality.h */
+void quality_samples(
+		unsigned acq_channel,
+		bool sample32,
+		const uint32_t *samples,
+		unsigned count)
+{
+	struct quality_channel *ch = &quality_g.channel[acq_channel];
+	uint32_t full = sample32 ? ch->full32 : ch->full16;
+	unsigned high, low;
+	double value;
+
+	if (!quality_g.enabled ||
+	    !(quality_g.channel_mask & (1u << acq_channel))) {
+		return;
+	}
+
+	bl_sample_clip_count(samples, count, full, &high, &low);
+	ch->clipped += high + low;
+	ch->count += count;
+
+	for (unsigned i = 0; i < count; i++) {
+		ch->acc += samples[i];
+		if (++ch->acc_count < quality_g.factor) {
+			continue;
+		}
+
+		value = ch->acc / ch->acc_count / full;
+		if (ch->filled == 0) {
+			ch->baseline = value;
+		}
+		ch->baseline += quality_g.alpha * (value - ch->baseline);
+
+		ch->ring[ch->pos] = value - ch->baseline;
+		ch->pos = (ch->pos + 1) % quality_g.window;
+		if (ch->filled < quality_g.window) {
+			ch->filled++;
+		}
+		ch->acc = 0;
+		ch->acc_count = 0;
+
+		if (++ch->block >= quality_g.block &&
+		    ch->filled == quality_g.window) {
+			quality__estimate(acq_channel);
+		}
+	}
+}
+
+/* Exported interface, documented in quality.h */
+bool quality_get(
+		unsigned acq_channel,
+		struct quality_stats *stats)
+{
+	bool ret = false;
+
+	if (acq_channel >= BV_ARRAY_LEN(quality_g.channel)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&quality_g.lock);
+	if (quality_g.valid_mask & (1u << acq_channel)) {
+		*stats = quality_g.channel[acq_channel].stats;
+		ret = true;
+	}
+	pthread_mutex_unlock(&quality_g.lock);
+
+	return ret;
+}
+
+/* Exported interface, documented in quality.h */
+bool quality_ok(void)
+{
+	return quality_g.ok;
+}
+
+/* Exported interface, documented in quality.h */
+unsigned quality_threshold(void)
+{
+	return quality_g.threshold;
+}
+
+/* Exported interface, documented in quality.h */
+bool quality_pause(void)
+{
+	return quality_g.pause;
+}
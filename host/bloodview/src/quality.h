@@ -0,0 +1,121 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the signal quality module.
+ *
+ * This estimates how usable each channel's signal is while an acquisition
+ * is running.  Once a second, each channel's last few seconds of samples
+ * are checked for periodicity at a plausible pulse rate, for pulse
+ * amplitude, and for clipping, and these are combined into a quality
+ * index from 0 to 100.
+ *
+ * The estimates are shown live, and can be used to annotate or pause the
+ * recording while the signal is poor.
+ */
+
+#ifndef BV_QUALITY_H
+#define BV_QUALITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Signal quality estimate for a channel. */
+struct quality_stats {
+	double quality;     /**< Quality index, from 0 to 100. */
+	double correlation; /**< Correlation over one pulse period. */
+	double amplitude;   /**< Pulse amplitude, in percent of full scale. */
+	double clipped;     /**< Clipped samples, in percent. */
+	double rate;        /**< Pulse rate in beats per minute. */
+
+	double mean;        /**< Mean quality index over the acquisition. */
+	uint32_t estimates; /**< Number of estimates made this acquisition. */
+};
+
+/**
+ * Start signal quality estimation for an acquisition.
+ *
+ * \param[in]  frequency     The acquisition's sampling rate in Hz.
+ * \param[in]  channel_mask  Mask of acquisition channels to estimate, or
+ *                          zero to estimate none, for calibration.
+ */
+void quality_start(unsigned frequency, unsigned channel_mask);
+
+/**
+ * Stop signal quality estimation.
+ *
+ * The estimates are kept until the next acquisition starts.
+ */
+void quality_finish(void);
+
+/**
+ * Add a channel's raw samples to the quality estimator.
+ *
+ * Must be called from the device thread.
+ *
+ * \param[in]  acq_channel  Acquisition channel the samples are for.
+ * \param[in]  sample32     Whether the samples are 32-bit.
+ * \param[in]  samples      The unpacked samples.
+ * \param[in]  count        Number of samples.
+ */
+void quality_samples(
+		unsigned acq_channel,
+		bool sample32,
+		const uint32_t *samples,
+		unsigned count);
+
+/**
+ * Get a channel's latest signal quality estimate.
+ *
+ * May be called from any thread.
+ *
+ * \param[in]  acq_channel  Acquisition channel to get the estimate for.
+ * \param[out] stats        Returns the estimate on success.
+ * \return true if the channel has an estimate, false otherwise.
+ */
+bool quality_get(
+		unsigned acq_channel,
+		struct quality_stats *stats);
+
+/**
+ * Get whether the signal quality is acceptable.
+ *
+ * The signal is acceptable while any channel's quality index is at least
+ * the configured threshold.  Until there are estimates, and when not
+ * estimating, the signal is acceptable.
+ *
+ * Must be called from the device thread.
+ *
+ * \return true if the signal quality is acceptable, false otherwise.
+ */
+bool quality_ok(void);
+
+/**
+ * Get the quality threshold for the current or last acquisition.
+ *
+ * \return the threshold quality index.
+ */
+unsigned quality_threshold(void);
+
+/**
+ * Get whether recording should pause while the signal quality is poor.
+ *
+ * \return true to pause recording, false to record everything.
+ */
+bool quality_pause(void);
+
+#endif /* BV_QUALITY_H */
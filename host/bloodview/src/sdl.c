@@ -22,12 +22,20 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include <SDL2/SDL.h>
 
+#include "common/msg.h"
+
 #include "sdl-tk/widget.h"
 
+#include "data.h"
 #include "graph.h"
+#include "browse.h"
+#include "quality.h"
 #include "main-menu.h"
 
 /** Mask of SDL subsystems we use. */
@@ -53,12 +61,24 @@ static struct sdl_ctx
 	bool ctrl;  /**< Whether ctrl is pressed. */
 
 	SDL_Rect graph_rect; /**< Rectangle containing graphs. */
+
+	struct sdl_tk_text *clip_text; /**< Clipping indicator text. */
+	char clip_string[256];         /**< String shown by clip_text. */
+
+	struct sdl_tk_text *quality_text; /**< Signal quality indicator text. */
+	char quality_string[256];         /**< String shown by quality_text. */
+	bool quality_ok;                  /**< Whether quality_text shows ok. */
 } ctx; /**< SDL module context global object. */
 
 /* Exported interface, documented in sdl.h */
 void sdl_fini(void)
 {
+	browse_close();
 	main_menu_destroy(ctx.main_menu);
+	sdl_tk_text_destroy(ctx.clip_text);
+	ctx.clip_text = NULL;
+	sdl_tk_text_destroy(ctx.quality_text);
+	ctx.quality_text = NULL;
 	sdl_tk_text_fini();
 	sdl_tk_colour_fini();
 
@@ -79,8 +99,22 @@ void sdl_fini(void)
 bool sdl_init(const char *resources_dir_path,
 		const char *config_dir_path,
 		const char *config_file,
-		const char *font_path)
+		const char *font_path,
+		bool headless)
 {
+	Uint32 win_flags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE;
+	Uint32 ren_flags = SDL_RENDERER_ACCELERATED |
+			SDL_RENDERER_PRESENTVSYNC;
+
+	if (headless) {
+		/* The environment takes precedence over these.  Signals
+		 * are left for the caller to handle. */
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+		SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
+		win_flags = SDL_WINDOW_HIDDEN;
+		ren_flags = SDL_RENDERER_SOFTWARE;
+	}
+
 	if (SDL_Init(BL_SDL_INIT_MASK) != 0) {
 		fprintf(stderr, "SDL_Init Error: %s\n",
 				SDL_GetError());
@@ -93,17 +127,14 @@ bool sdl_init(const char *resources_dir_path,
 	ctx.win = SDL_CreateWindow("Bloodlight",
 			SDL_WINDOWPOS_CENTERED,
 			SDL_WINDOWPOS_CENTERED,
-			ctx.w, ctx.h,
-			SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+			ctx.w, ctx.h, win_flags);
 	if (ctx.win == NULL) {
 		fprintf(stderr, "SDL_CreateWindow Error: %s\n",
 				SDL_GetError());
 		goto error;
 	}
 
-	ctx.ren = SDL_CreateRenderer(ctx.win, -1,
-			SDL_RENDERER_ACCELERATED |
-			SDL_RENDERER_PRESENTVSYNC);
+	ctx.ren = SDL_CreateRenderer(ctx.win, -1, ren_flags);
 	if (ctx.ren == NULL) {
 		fprintf(stderr, "SDL_CreateRenderer Error: %s\n",
 				SDL_GetError());
@@ -218,7 +249,13 @@ static void sdl__handle_input(SDL_Event *event)
 			break;
 		}
 
-		graph_handle_input(event, &ctx.graph_rect, ctx.shift, ctx.ctrl);
+		if (browse_active()) {
+			browse_handle_input(event, &ctx.graph_rect,
+					ctx.shift, ctx.ctrl);
+		} else {
+			graph_handle_input(event, &ctx.graph_rect,
+					ctx.shift, ctx.ctrl);
+		}
 	}
 }
 
@@ -261,6 +298,137 @@ bool sdl_handle_input(void)
 	return true;
 }
 
+/**
+ * Render the clipping indicator.
+ *
+ * This lists any channels which clipped in the last second of samples.
+ */
+static void sdl__render_clipping(void)
+{
+	static const SDL_Color colour = { .r = 255, .g = 64, .b = 64 };
+	char string[sizeof(ctx.clip_string)];
+	size_t len = 0;
+
+	for (unsigned i = 0; i < sizeof(unsigned) * CHAR_BIT; i++) {
+		struct data_clip_stats stats;
+		int written;
+
+		if (!data_get_clip_stats(i, &stats) ||
+		    (stats.second_high == 0 && stats.second_low == 0)) {
+			continue;
+		}
+
+		written = snprintf(string + len, sizeof(string) - len,
+				"%s%u: %"PRIu32" high, %"PRIu32" low",
+				(len == 0) ? "Clipping: Channel " : "; ",
+				i, stats.second_high, stats.second_low);
+		if (written < 0 || (size_t)written >= sizeof(string) - len) {
+			break;
+		}
+		len += written;
+	}
+	string[len] = '\0';
+
+	if (strcmp(string, ctx.clip_string) != 0) {
+		sdl_tk_text_destroy(ctx.clip_text);
+		ctx.clip_text = NULL;
+		memcpy(ctx.clip_string, string, sizeof(string));
+		if (len != 0) {
+			ctx.clip_text = sdl_tk_text_create(string, colour,
+					SDL_TK_TEXT_SIZE_NORMAL);
+		}
+	}
+
+	if (ctx.clip_text != NULL) {
+		SDL_Rect rect = {
+			.x = ctx.graph_rect.x + ctx.graph_rect.w -
+					ctx.clip_text->w - 2,
+			.y = ctx.graph_rect.y + 2,
+			.w = ctx.clip_text->w,
+			.h = ctx.clip_text->h,
+		};
+
+		SDL_RenderCopy(ctx.ren, ctx.clip_text->t, NULL, &rect);
+	}
+}
+
+/**
+ * Render the signal quality indicator.
+ *
+ * This lists each channel's latest quality index and pulse rate, below
+ * the clipping indicator.  It's drawn in red while every channel is below
+ * the quality threshold.
+ */
+static void sdl__render_quality(void)
+{
+	static const SDL_Color colour_ok = { .r = 64, .g = 192, .b = 64 };
+	static const SDL_Color colour_poor = { .r = 255, .g = 64, .b = 64 };
+	char string[sizeof(ctx.quality_string)];
+	unsigned threshold = quality_threshold();
+	size_t len = 0;
+	bool ok = false;
+
+	if (!main_menu_config_get_quality_shown()) {
+		return;
+	}
+
+	for (unsigned i = 0; i < sizeof(unsigned) * CHAR_BIT; i++) {
+		struct quality_stats stats;
+		char rate[32] = "";
+		int written;
+
+		if (!quality_get(i, &stats)) {
+			continue;
+		}
+
+		if (stats.quality >= threshold) {
+			ok = true;
+		}
+
+		if (stats.rate > 0) {
+			snprintf(rate, sizeof(rate), " %.0f bpm", stats.rate);
+		}
+
+		written = snprintf(string + len, sizeof(string) - len,
+				"%s%u: %.0f%%%s",
+				(len == 0) ? "Quality: Channel " : "; ",
+				i, stats.quality, rate);
+		if (written < 0 || (size_t)written >= sizeof(string) - len) {
+			break;
+		}
+		len += written;
+	}
+	string[len] = '\0';
+
+	if (strcmp(string, ctx.quality_string) != 0 || ok != ctx.quality_ok) {
+		sdl_tk_text_destroy(ctx.quality_text);
+		ctx.quality_text = NULL;
+		memcpy(ctx.quality_string, string, sizeof(string));
+		ctx.quality_ok = ok;
+		if (len != 0) {
+			ctx.quality_text = sdl_tk_text_create(string,
+					ok ? colour_ok : colour_poor,
+					SDL_TK_TEXT_SIZE_NORMAL);
+		}
+	}
+
+	if (ctx.quality_text != NULL) {
+		SDL_Rect rect = {
+			.x = ctx.graph_rect.x + ctx.graph_rect.w -
+					ctx.quality_text->w - 2,
+			.y = ctx.graph_rect.y + 2,
+			.w = ctx.quality_text->w,
+			.h = ctx.quality_text->h,
+		};
+
+		if (ctx.clip_text != NULL) {
+			rect.y += ctx.clip_text->h + 2;
+		}
+
+		SDL_RenderCopy(ctx.ren, ctx.quality_text->t, NULL, &rect);
+	}
+}
+
 /* Exported interface, documented in sdl.h */
 void sdl_present(void)
 {
@@ -269,7 +437,13 @@ void sdl_present(void)
 	SDL_SetRenderDrawColor(ctx.ren, bg.r, bg.g, bg.b, 255);
 	SDL_RenderClear(ctx.ren);
 
-	graph_render(ctx.ren, &ctx.graph_rect);
+	if (browse_active()) {
+		browse_render(ctx.ren, &ctx.graph_rect);
+	} else {
+		graph_render(ctx.ren, &ctx.graph_rect);
+		sdl__render_clipping();
+		sdl__render_quality();
+	}
 
 	main_menu_update();
 	sdl_tk_widget_render(ctx.main_menu, &ctx.graph_rect,
@@ -34,16 +34,22 @@ void sdl_fini(void);
 /**
  * Initialise the SDL module.
  *
+ * When headless, no window is shown and nothing is rendered.  The main
+ * menu is still created, since it holds the configuration.  SDL's dummy
+ * video driver is used, unless another is chosen in the environment.
+ *
  * \param[in]  resources_dir_path  Path to resources directory.
  * \param[in]  config_dir_path     Path to config directory.
  * \param[in]  config_file         Config filename in config_dir_path or NULL.
  * \param[in]  font_path           Font path to use for the interface, or NULL.
+ * \param[in]  headless            Whether to run without a display.
  * \return true on success or false on failure.
  */
 bool sdl_init(const char *resources_dir_path,
 		const char *config_dir_path,
 		const char *config_file,
-		const char *font_path);
+		const char *font_path,
+		bool headless);
 
 /**
  * Handle any SDL events.
@@ -0,0 +1,1003 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the recording catalogue module.
+ *
+ * The catalogue file starts with a \ref bl_catalogue_header.  Each entry
+ * is a uint32_t path length, a \ref bl_catalogue_info, and the path,
+ * without a terminator.  Everything is in host byte order.
+ *
+ * Writers hold an exclusive lock on the file, and readers a shared one.
+ * Saving replaces the file, so a writer which gets the lock checks that
+ * the file it locked is still the one at the catalogue path.
+ *
+ * In memory, entries are kept sorted by path.
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "common/msg.h"
+#include "common/error.h"
+
+#include "host/common/msg.h"
+#include "host/common/sample.h"
+
+#include "catalogue.h"
+
+/** Catalogue file magic. */
+static const char bl_catalogue_magic[8] = "BLCATL01";
+
+/** Catalogue file header. */
+struct bl_catalogue_header {
+	char     magic[8];  /**< Must be \ref bl_catalogue_magic. */
+	uint32_t info_size; /**< Size of \ref bl_catalogue_info. */
+	uint32_t reserved;  /**< Zero. */
+};
+
+/**
+ * End the current acquisition, if any, and add up its statistics.
+ *
+ * \param[in]  scan  The scanner.
+ */
+static void bl_catalogue__scan_end_acq(
+		struct bl_catalogue_scan *scan)
+{
+	uint64_t longest = 0;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		if (scan->acq_samples[i] > longest) {
+			longest = scan->acq_samples[i];
+		}
+	}
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		if (scan->acq_samples[i] != 0) {
+			scan->info.channel[i].missing +=
+					longest - scan->acq_samples[i];
+		}
+		scan->acq_samples[i] = 0;
+	}
+
+	if (scan->frequency != 0) {
+		scan->info.duration += (double) longest / scan->frequency;
+	}
+}
+
+/**
+ * Add a sample data message to a recording scanner.
+ *
+ * Samples are counted as clipped in the same way as Bloodview's live
+ * clipping detection: at 0, or at the channel's full scale, as set by the
+ * most recent source and channel configuration.
+ *
+ * \param[in]  scan  The scanner.
+ * \param[in]  msg   The sample data message.
+ */
+static void bl_catalogue__scan_samples(
+		struct bl_catalogue_scan *scan,
+		const union bl_msg_data *msg)
+{
+	const bl_msg_sample_data_t *data = &msg->sample_data;
+	const bl_msg_source_conf_t *source = NULL;
+	const bl_msg_channel_conf_t *conf;
+	struct bl_catalogue_channel *channel;
+	uint32_t samples[BL_SAMPLE_MAX];
+	unsigned count;
+	unsigned high;
+	unsigned low;
+	uint32_t full;
+
+	if (data->channel >= BL_CHANNEL_MAX) {
+		return;
+	}
+	channel = &scan->info.channel[data->channel];
+	conf = &scan->channel[data->channel];
+
+	if ((scan->channel_mask & (1u << data->channel)) != 0 &&
+	    conf->source < BL_ACQ_SOURCE_MAX &&
+	    (scan->source_mask & (1u << conf->source)) != 0) {
+		source = &scan->source[conf->source];
+	}
+
+	count = bl_sample_unpack(data, samples);
+	full = bl_sample_full_scale(source, conf->offset, conf->shift,
+			msg->type);
+	bl_sample_clip_count(samples, count, full, &high, &low);
+
+	scan->info.channel_mask |= 1u << data->channel;
+	scan->acq_samples[data->channel] += count;
+	channel->samples += count;
+	channel->high += high;
+	channel->low += low;
+}
+
+/* Exported function, documented in catalogue.h */
+void bl_catalogue_scan_init(
+		struct bl_catalogue_scan *scan,
+		bool calibration)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->info.calibration = calibration;
+}
+
+/* Exported function, documented in catalogue.h */
+void bl_catalogue_scan_msg(
+		struct bl_catalogue_scan *scan,
+		const union bl_msg_data *msg)
+{
+	struct bl_catalogue_info *info = &scan->info;
+
+	switch (msg->type) {
+	case BL_MSG_SOURCE_CONF:
+		if (msg->source_conf.source < BL_ACQ_SOURCE_MAX) {
+			scan->source[msg->source_conf.source] =
+					msg->source_conf;
+			scan->source_mask |= 1u << msg->source_conf.source;
+		}
+		if (info->acquisitions == 0 &&
+		    msg->source_conf.source < BL_ACQ_SOURCE_MAX) {
+			info->source[msg->source_conf.source] =
+					msg->source_conf;
+			info->source_mask |= 1u << msg->source_conf.source;
+		}
+		break;
+
+	case BL_MSG_CHANNEL_CONF:
+		if (msg->channel_conf.channel < BL_CHANNEL_MAX) {
+			scan->channel[msg->channel_conf.channel] =
+					msg->channel_conf;
+			scan->channel_mask |= 1u << msg->channel_conf.channel;
+		}
+		if (info->acquisitions == 0 &&
+		    msg->channel_conf.channel < BL_CHANNEL_MAX) {
+			info->channel[msg->channel_conf.channel].conf =
+					msg->channel_conf;
+			info->channel_mask |= 1u << msg->channel_conf.channel;
+		}
+		break;
+
+	case BL_MSG_START:
+		bl_catalogue__scan_end_acq(scan);
+		if (info->acquisitions == 0) {
+			info->acq = msg->start;
+		}
+		info->acquisitions++;
+		info->complete = false;
+		scan->frequency = msg->start.frequency;
+		break;
+
+	case BL_MSG_RESPONSE:
+		if (msg->response.error_code != BL_ERROR_NONE) {
+			info->errors++;
+		} else if (msg->response.response_to == BL_MSG_ABORT) {
+			info->complete = true;
+		}
+		break;
+
+	case BL_MSG_SAMPLE_DATA16: /* Fall through. */
+	case BL_MSG_SAMPLE_DATA32:
+		bl_catalogue__scan_samples(scan, msg);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * Get a recording's start time from its file name.
+ *
+ * Bloodview names recordings after their local start time, as
+ * "YYYY-MM-DD.HH:MM:SS-acq.yaml".
+ *
+ * \param[in]  path   Path to the recording.
+ * \param[out] start  Returns the start time, in seconds since the epoch.
+ * \return true on success, or false if the name isn't a Bloodview one.
+ */
+static bool bl_catalogue__name_time(
+		const char *path,
+		double *start)
+{
+	const char *name = strrchr(path, '/');
+	struct tm tm = { .tm_isdst = -1 };
+	time_t t;
+
+	name = (name != NULL) ? name + 1 : path;
+
+	if (sscanf(name, "%4d-%2d-%2d.%2d:%2d:%2d-",
+			&tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+		return false;
+	}
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+
+	t = mktime(&tm);
+	if (t == (time_t) -1) {
+		return false;
+	}
+
+	*start = t;
+	return true;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_scan_finish(
+		struct bl_catalogue_scan *scan,
+		const char *path,
+		const struct bl_clock_map *map,
+		struct bl_catalogue_entry *entry)
+{
+	struct bl_catalogue_info *info = &scan->info;
+	struct stat st;
+
+	bl_catalogue__scan_end_acq(scan);
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "Failed to stat '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	info->size = st.st_size;
+	info->mtime_sec = st.st_mtim.tv_sec;
+	info->mtime_nsec = st.st_mtim.tv_nsec;
+
+	if (map != NULL && map->realtime != 0) {
+		info->start = map->offset + map->realtime;
+	} else if (!bl_catalogue__name_time(path, &info->start)) {
+		info->start = st.st_mtim.tv_sec - info->duration;
+	}
+
+	entry->path = realpath(path, NULL);
+	if (entry->path == NULL) {
+		fprintf(stderr, "Failed to resolve '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	entry->info = *info;
+	return true;
+}
+
+/**
+ * Check whether a path names a calibration recording.
+ *
+ * \param[in]  path  Path to the recording.
+ * \return true if the path ends in "-cal.yaml".
+ */
+static bool bl_catalogue__is_calibration(const char *path)
+{
+	static const char suffix[] = "-cal.yaml";
+	size_t len = strlen(path);
+
+	return len >= sizeof(suffix) - 1 &&
+			strcmp(path + len - (sizeof(suffix) - 1), suffix) == 0;
+}
+
+/**
+ * Read the clock mapping from a recording's metadata file, if it has one.
+ *
+ * \param[in]  path  Path to the recording.
+ * \param[out] map   Returns the mapping on success.
+ * \return true if a mapping was read, false otherwise.
+ */
+static bool bl_catalogue__read_meta(
+		const char *path,
+		struct bl_clock_map *map)
+{
+	size_t len = strlen(path);
+	char *meta;
+	bool ok;
+
+	if (len < 5 || strcmp(path + len - 5, ".yaml") != 0) {
+		return false;
+	}
+
+	meta = malloc(len + sizeof(".meta.yaml"));
+	if (meta == NULL) {
+		return false;
+	}
+
+	memcpy(meta, path, len - 5);
+	memcpy(meta + len - 5, ".meta.yaml", sizeof(".meta.yaml"));
+
+	ok = (access(meta, R_OK) == 0) && bl_clock_map_read(meta, map);
+
+	free(meta);
+	return ok;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_scan_file(
+		const char *path,
+		struct bl_catalogue_entry *entry)
+{
+	struct bl_catalogue_scan scan;
+	struct bl_clock_map map;
+	union bl_msg_data msg;
+	unsigned count = 0;
+	FILE *file;
+	bool ok;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	bl_catalogue_scan_init(&scan, bl_catalogue__is_calibration(path));
+
+	while (bl_msg_yaml_parse(file, &msg)) {
+		bl_catalogue_scan_msg(&scan, &msg);
+		count++;
+	}
+
+	if (ferror(file)) {
+		fprintf(stderr, "Failed to read '%s'\n", path);
+		fclose(file);
+		return false;
+	}
+
+	/* A recording that was cut short may end with part of a message,
+	 * so only complain if nothing at all could be parsed. */
+	if (count == 0) {
+		fprintf(stderr, "No messages in '%s'\n", path);
+		fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	ok = bl_catalogue__read_meta(path, &map);
+
+	return bl_catalogue_scan_finish(&scan, path, ok ? &map : NULL, entry);
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_entry_current(
+		const struct bl_catalogue_entry *entry)
+{
+	struct stat st;
+
+	if (stat(entry->path, &st) != 0) {
+		return false;
+	}
+
+	return entry->info.size == (uint64_t) st.st_size &&
+	       entry->info.mtime_sec == st.st_mtim.tv_sec &&
+	       entry->info.mtime_nsec == st.st_mtim.tv_nsec;
+}
+
+/**
+ * Open and lock a catalogue file.
+ *
+ * If the file is replaced while waiting for the lock, the new file is
+ * opened and locked instead.
+ *
+ * \param[in]  path   Path to the catalogue file.
+ * \param[in]  flags  Flags for open(2).
+ * \param[in]  lock   Lock operation for flock(2).
+ * \return the file descriptor, or -1 on error, with errno set.
+ */
+static int bl_catalogue__open_locked(
+		const char *path,
+		int flags,
+		int lock)
+{
+	while (true) {
+		struct stat fd_st;
+		struct stat path_st;
+		int fd;
+
+		fd = open(path, flags | O_CLOEXEC, 0644);
+		if (fd == -1) {
+			return -1;
+		}
+
+		if (flock(fd, lock) != 0 || fstat(fd, &fd_st) != 0) {
+			int err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+
+		if (stat(path, &path_st) == 0 &&
+		    path_st.st_dev == fd_st.st_dev &&
+		    path_st.st_ino == fd_st.st_ino) {
+			return fd;
+		}
+
+		close(fd);
+	}
+}
+
+/**
+ * Check a catalogue file header.
+ *
+ * \param[in]  header  The header to check.
+ * \param[in]  path    Path to the catalogue file, for error messages.
+ * \return true if the header is valid, false otherwise.
+ */
+static bool bl_catalogue__header_ok(
+		const struct bl_catalogue_header *header,
+		const char *path)
+{
+	if (memcmp(header->magic, bl_catalogue_magic,
+			sizeof(header->magic)) != 0) {
+		fprintf(stderr, "'%s' is not a recording catalogue\n", path);
+		return false;
+	}
+
+	if (header->info_size != sizeof(struct bl_catalogue_info)) {
+		fprintf(stderr, "'%s' is from a different version; "
+				"recreate it with \"catalogue rebuild "
+				"-c %s\" and the recordings to keep\n",
+				path, path);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Write all of a buffer to a file descriptor.
+ *
+ * \param[in]  fd    The file descriptor.
+ * \param[in]  buf   The data to write.
+ * \param[in]  len   Length of the data in bytes.
+ * \return true on success, false otherwise.
+ */
+static bool bl_catalogue__write_all(
+		int fd,
+		const void *buf,
+		size_t len)
+{
+	const char *pos = buf;
+
+	while (len > 0) {
+		ssize_t written = write(fd, pos, len);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		pos += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+/**
+ * Encode an entry in the catalogue file format.
+ *
+ * \param[in]  entry  The entry to encode.
+ * \param[out] len    Returns the length of the encoded entry.
+ * \return the encoded entry, which the caller must free, or NULL on error.
+ */
+static char *bl_catalogue__encode(
+		const struct bl_catalogue_entry *entry,
+		size_t *len)
+{
+	uint32_t path_len = strlen(entry->path);
+	char *buf;
+
+	*len = sizeof(path_len) + sizeof(entry->info) + path_len;
+
+	buf = malloc(*len);
+	if (buf == NULL) {
+		return NULL;
+	}
+
+	memcpy(buf, &path_len, sizeof(path_len));
+	memcpy(buf + sizeof(path_len), &entry->info, sizeof(entry->info));
+	memcpy(buf + sizeof(path_len) + sizeof(entry->info),
+			entry->path, path_len);
+
+	return buf;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_append(
+		const char *path,
+		const struct bl_catalogue_entry *entry)
+{
+	struct bl_catalogue_header header = { 0 };
+	bool ok = false;
+	struct stat st;
+	size_t len;
+	char *buf;
+	int fd;
+
+	buf = bl_catalogue__encode(entry, &len);
+	if (buf == NULL) {
+		return false;
+	}
+
+	fd = bl_catalogue__open_locked(path,
+			O_RDWR | O_CREAT | O_APPEND, LOCK_EX);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		free(buf);
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		goto cleanup;
+	}
+
+	if (st.st_size == 0) {
+		memcpy(header.magic, bl_catalogue_magic, sizeof(header.magic));
+		header.info_size = sizeof(struct bl_catalogue_info);
+		if (!bl_catalogue__write_all(fd, &header, sizeof(header))) {
+			goto cleanup;
+		}
+	} else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	           !bl_catalogue__header_ok(&header, path)) {
+		goto cleanup;
+	}
+
+	ok = bl_catalogue__write_all(fd, buf, len);
+
+cleanup:
+	if (!ok) {
+		fprintf(stderr, "Failed to append to '%s'\n", path);
+	}
+	close(fd);
+	free(buf);
+	return ok;
+}
+
+/**
+ * Find where a path is, or would go, in a catalogue.
+ *
+ * \param[in]  cat    The catalogue.
+ * \param[in]  path   The recording path.
+ * \param[out] found  Returns whether the path is in the catalogue.
+ * \return the index of the path's entry, or where it would be inserted.
+ */
+static unsigned bl_catalogue__search(
+		const struct bl_catalogue *cat,
+		const char *path,
+		bool *found)
+{
+	unsigned lo = 0;
+	unsigned hi = cat->count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(path, cat->entry[mid].path);
+
+		if (cmp == 0) {
+			*found = true;
+			return mid;
+		} else if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	*found = false;
+	return lo;
+}
+
+/* Exported function, documented in catalogue.h */
+struct bl_catalogue_entry *bl_catalogue_find(
+		const struct bl_catalogue *cat,
+		const char *path)
+{
+	bool found;
+	unsigned i = bl_catalogue__search(cat, path, &found);
+
+	return found ? &cat->entry[i] : NULL;
+}
+
+/**
+ * Make room for more entries in a catalogue.
+ *
+ * \param[in]  cat    The catalogue.
+ * \param[in]  count  Number of entries needed.
+ * \return true on success, false on allocation failure.
+ */
+static bool bl_catalogue__reserve(
+		struct bl_catalogue *cat,
+		unsigned count)
+{
+	struct bl_catalogue_entry *entry;
+	unsigned alloc = (cat->alloc > 0) ? cat->alloc : 64;
+
+	if (count <= cat->alloc) {
+		return true;
+	}
+
+	while (alloc < count) {
+		alloc *= 2;
+	}
+
+	entry = realloc(cat->entry, alloc * sizeof(*entry));
+	if (entry == NULL) {
+		return false;
+	}
+
+	cat->entry = entry;
+	cat->alloc = alloc;
+	return true;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_add(
+		struct bl_catalogue *cat,
+		struct bl_catalogue_entry *entry)
+{
+	bool found;
+	unsigned i = bl_catalogue__search(cat, entry->path, &found);
+
+	if (found) {
+		free(cat->entry[i].path);
+		cat->entry[i] = *entry;
+		return true;
+	}
+
+	if (!bl_catalogue__reserve(cat, cat->count + 1)) {
+		return false;
+	}
+
+	memmove(&cat->entry[i + 1], &cat->entry[i],
+			(cat->count - i) * sizeof(*cat->entry));
+	cat->entry[i] = *entry;
+	cat->count++;
+	return true;
+}
+
+/**
+ * Decode the entries in a catalogue file's contents.
+ *
+ * \param[in]  cat   The catalogue to add the entries to.
+ * \param[in]  data  The entries from the catalogue file.
+ * \param[in]  len   Length of the data in bytes.
+ * \param[in]  path  Path to the catalogue file, for error messages.
+ * \return true on success, false otherwise.
+ */
+static bool bl_catalogue__decode(
+		struct bl_catalogue *cat,
+		const char *data,
+		size_t len,
+		const char *path)
+{
+	const size_t fixed = sizeof(uint32_t) + sizeof(struct bl_catalogue_info);
+
+	while (len > 0) {
+		struct bl_catalogue_entry entry;
+		uint32_t path_len;
+
+		if (len < fixed) {
+			goto truncated;
+		}
+
+		memcpy(&path_len, data, sizeof(path_len));
+		if (path_len == 0 || len - fixed < path_len) {
+			goto truncated;
+		}
+
+		memcpy(&entry.info, data + sizeof(path_len), sizeof(entry.info));
+		entry.path = strndup(data + fixed, path_len);
+		if (entry.path == NULL) {
+			return false;
+		}
+
+		/* Later entries replace earlier ones for the same path. */
+		if (!bl_catalogue_add(cat, &entry)) {
+			free(entry.path);
+			return false;
+		}
+
+		data += fixed + path_len;
+		len -= fixed + path_len;
+	}
+
+	return true;
+
+truncated:
+	fprintf(stderr, "Warning: '%s' ends with a partial entry\n", path);
+	return true;
+}
+
+/**
+ * Read a whole file from a file descriptor.
+ *
+ * \param[in]  fd   The file descriptor.
+ * \param[out] len  Returns the length of the file.
+ * \return the file's contents, which the caller must free, or NULL on error.
+ */
+static char *bl_catalogue__read_all(int fd, size_t *len)
+{
+	size_t alloc = 0;
+	char *data = NULL;
+
+	*len = 0;
+	while (true) {
+		ssize_t got;
+
+		if (*len == alloc) {
+			char *tmp;
+
+			alloc = (alloc > 0) ? alloc * 2 : 1 << 16;
+			tmp = realloc(data, alloc);
+			if (tmp == NULL) {
+				free(data);
+				return NULL;
+			}
+			data = tmp;
+		}
+
+		got = read(fd, data + *len, alloc - *len);
+		if (got < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(data);
+			return NULL;
+		} else if (got == 0) {
+			return data;
+		}
+
+		*len += got;
+	}
+}
+
+/**
+ * Read entries from a catalogue file into a catalogue.
+ *
+ * \param[in]  cat   The catalogue to add the entries to.
+ * \param[in]  fd    The locked catalogue file.
+ * \param[in]  from  File offset to read entries from, or zero to read
+ *                   the whole file, including the header.
+ * \param[in]  path  Path to the catalogue file, for error messages.
+ * \return true on success, false otherwise.
+ */
+static bool bl_catalogue__read(
+		struct bl_catalogue *cat,
+		int fd,
+		off_t from,
+		const char *path)
+{
+	struct bl_catalogue_header header;
+	const char *entries;
+	struct stat st;
+	bool ok = false;
+	size_t len;
+	char *data;
+
+	if (fstat(fd, &st) != 0 || lseek(fd, from, SEEK_SET) != from) {
+		fprintf(stderr, "Failed to read '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	data = bl_catalogue__read_all(fd, &len);
+	if (data == NULL) {
+		fprintf(stderr, "Failed to read '%s'\n", path);
+		return false;
+	}
+
+	entries = data;
+	if (from == 0 && len > 0) {
+		if (len < sizeof(header)) {
+			fprintf(stderr, "'%s' is not a recording catalogue\n",
+					path);
+			goto cleanup;
+		}
+
+		memcpy(&header, data, sizeof(header));
+		if (!bl_catalogue__header_ok(&header, path)) {
+			goto cleanup;
+		}
+
+		entries += sizeof(header);
+		len -= sizeof(header);
+	}
+
+	ok = bl_catalogue__decode(cat, entries, len, path);
+
+	cat->dev = st.st_dev;
+	cat->ino = st.st_ino;
+	cat->size = from + (entries - data) + len;
+
+cleanup:
+	free(data);
+	return ok;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_load(
+		const char *path,
+		struct bl_catalogue *cat)
+{
+	bool ok;
+	int fd;
+
+	memset(cat, 0, sizeof(*cat));
+
+	fd = bl_catalogue__open_locked(path, O_RDONLY, LOCK_SH);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			return true;
+		}
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	ok = bl_catalogue__read(cat, fd, 0, path);
+	close(fd);
+
+	if (!ok) {
+		bl_catalogue_fini(cat);
+	}
+	return ok;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_replace(
+		const char *path,
+		struct bl_catalogue *cat)
+{
+	struct bl_catalogue_header header;
+	bool ok = false;
+	struct stat st;
+	int fd;
+
+	memset(cat, 0, sizeof(*cat));
+
+	fd = bl_catalogue__open_locked(path, O_RDONLY, LOCK_SH);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			return true;
+		}
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "Failed to read '%s': %s\n",
+				path, strerror(errno));
+		goto cleanup;
+	}
+
+	/* Anything that was appended to an older version's file could not
+	 * be read, so only the magic is checked. */
+	if (st.st_size > 0 &&
+	    (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	     memcmp(header.magic, bl_catalogue_magic,
+			sizeof(header.magic)) != 0)) {
+		fprintf(stderr, "'%s' is not a recording catalogue\n", path);
+		goto cleanup;
+	}
+
+	cat->dev = st.st_dev;
+	cat->ino = st.st_ino;
+	cat->size = st.st_size;
+	ok = true;
+
+cleanup:
+	close(fd);
+	return ok;
+}
+
+/* Exported function, documented in catalogue.h */
+bool bl_catalogue_save(
+		const char *path,
+		struct bl_catalogue *cat)
+{
+	struct bl_catalogue_header header = { 0 };
+	size_t tmp_len = strlen(path) + 32;
+	bool ok = false;
+	struct stat st;
+	off_t from = 0;
+	int lock_fd;
+	char *tmp;
+	int fd;
+
+	tmp = malloc(tmp_len);
+	if (tmp == NULL) {
+		return false;
+	}
+
+	/* Hold the lock on the old file until the new one replaces it, so
+	 * nothing is appended to the old file in between. */
+	lock_fd = bl_catalogue__open_locked(path, O_RDWR | O_CREAT, LOCK_EX);
+	if (lock_fd == -1) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		free(tmp);
+		return false;
+	}
+
+	/* Pick up anything appended since the catalogue was loaded. */
+	if (fstat(lock_fd, &st) != 0) {
+		goto cleanup;
+	}
+	if (st.st_dev == cat->dev && st.st_ino == cat->ino) {
+		from = cat->size;
+	}
+	if (st.st_size > from &&
+	    !bl_catalogue__read(cat, lock_fd, from, path)) {
+		goto cleanup;
+	}
+
+	snprintf(tmp, tmp_len, "%s.%ld", path, (long) getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		goto cleanup;
+	}
+
+	memcpy(header.magic, bl_catalogue_magic, sizeof(header.magic));
+	header.info_size = sizeof(struct bl_catalogue_info);
+	ok = bl_catalogue__write_all(fd, &header, sizeof(header));
+
+	for (unsigned i = 0; ok && i < cat->count; i++) {
+		size_t len;
+		char *buf = bl_catalogue__encode(&cat->entry[i], &len);
+
+		ok = (buf != NULL) && bl_catalogue__write_all(fd, buf, len);
+		free(buf);
+	}
+
+	ok &= (close(fd) == 0);
+	ok = ok && (rename(tmp, path) == 0);
+	if (!ok) {
+		unlink(tmp);
+	}
+
+cleanup:
+	if (!ok) {
+		fprintf(stderr, "Failed to write '%s'\n", path);
+	}
+	close(lock_fd);
+	free(tmp);
+	return ok;
+}
+
+/* Exported function, documented in catalogue.h */
+void bl_catalogue_fini(
+		struct bl_catalogue *cat)
+{
+	for (unsigned i = 0; i < cat->count; i++) {
+		free(cat->entry[i].path);
+	}
+	free(cat->entry);
+	memset(cat, 0, sizeof(*cat));
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the recording catalogue module.
+ *
+ * A catalogue is a small file describing many recordings, so recordings
+ * can be searched without reading them.  Each entry holds a recording's
+ * configuration messages, start time, duration, and per-channel sample,
+ * clipping and drop counts.
+ *
+ * Entries are made by feeding a recording's messages to a scanner, either
+ * as they are recorded, or by parsing an existing recording.
+ *
+ * The file is a header followed by entries.  Entries can be appended, and
+ * a later entry for a recording replaces any earlier one when the
+ * catalogue is loaded.  Saving a catalogue writes each entry only once.
+ */
+
+#ifndef BL_HOST_COMMON_CATALOGUE_H
+#define BL_HOST_COMMON_CATALOGUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#include "common/acq.h"
+#include "common/msg.h"
+#include "common/channel.h"
+
+#include "host/common/clock.h"
+
+/** Default catalogue path, relative to where recordings are made. */
+#define BL_CATALOGUE_DEFAULT_PATH "recordings.catalogue"
+
+/** Catalogue information about one channel of a recording. */
+struct bl_catalogue_channel {
+	bl_msg_channel_conf_t conf; /**< Channel configuration. */
+
+	uint64_t samples; /**< Number of samples recorded. */
+	uint64_t high;    /**< Number of samples clipped high. */
+	uint64_t low;     /**< Number of samples clipped low. */
+
+	/**
+	 * Number of samples fewer than the longest channel had, summed over
+	 * the acquisitions.  All enabled channels are sampled together, so
+	 * these samples were dropped.
+	 */
+	uint64_t missing;
+};
+
+/** Catalogue information about a recording. */
+struct bl_catalogue_info {
+	uint64_t size;       /**< Recording size in bytes. */
+	int64_t  mtime_sec;  /**< Recording modification time, seconds. */
+	int64_t  mtime_nsec; /**< Recording modification time, nanoseconds. */
+
+	double start;    /**< Start time, in seconds since the epoch. */
+	double duration; /**< Total acquisition time, in seconds. */
+
+	/** Start message of the first acquisition. */
+	bl_msg_start_t acq;
+
+	/** Configuration of each source, for the first acquisition. */
+	bl_msg_source_conf_t source[BL_ACQ_SOURCE_MAX];
+
+	/** Per-channel information. */
+	struct bl_catalogue_channel channel[BL_CHANNEL_MAX];
+
+	uint32_t source_mask;  /**< Sources with a configuration message. */
+	uint32_t channel_mask; /**< Channels with configuration or samples. */
+
+	uint32_t acquisitions; /**< Number of Start messages. */
+	uint32_t errors;       /**< Number of error responses. */
+	bool     calibration;  /**< Whether the recording is a calibration. */
+	bool     complete;     /**< Whether the last acquisition was stopped. */
+};
+
+/** A catalogue entry. */
+struct bl_catalogue_entry {
+	char *path; /**< Absolute path of the recording. */
+	struct bl_catalogue_info info; /**< Information about the recording. */
+};
+
+/** A catalogue. */
+struct bl_catalogue {
+	struct bl_catalogue_entry *entry; /**< Array of entries, by path. */
+	unsigned count;                   /**< Number of entries. */
+	unsigned alloc;                   /**< Allocated number of entries. */
+
+	dev_t dev;  /**< Device of the file the catalogue was loaded from. */
+	ino_t ino;  /**< Inode of the file the catalogue was loaded from. */
+	off_t size; /**< Length of the file when it was loaded. */
+};
+
+/** Recording scanner state. */
+struct bl_catalogue_scan {
+	struct bl_catalogue_info info; /**< Information gathered so far. */
+
+	/** Number of samples each channel has in the current acquisition. */
+	uint64_t acq_samples[BL_CHANNEL_MAX];
+
+	unsigned frequency; /**< Current acquisition's sampling rate. */
+
+	/** Most recent source configurations, for clip detection. */
+	bl_msg_source_conf_t source[BL_ACQ_SOURCE_MAX];
+	uint32_t source_mask; /**< Sources with a configuration. */
+
+	/** Most recent channel configurations, for clip detection. */
+	bl_msg_channel_conf_t channel[BL_CHANNEL_MAX];
+	uint32_t channel_mask; /**< Channels with a configuration. */
+};
+
+/**
+ * Initialise a recording scanner.
+ *
+ * \param[in]  scan         The scanner to initialise.
+ * \param[in]  calibration  Whether the recording is a calibration.
+ */
+void bl_catalogue_scan_init(
+		struct bl_catalogue_scan *scan,
+		bool calibration);
+
+/**
+ * Add a recorded message to a recording scanner.
+ *
+ * \param[in]  scan  The scanner.
+ * \param[in]  msg   The message, in recording order.
+ */
+void bl_catalogue_scan_msg(
+		struct bl_catalogue_scan *scan,
+		const union bl_msg_data *msg);
+
+/**
+ * Make a catalogue entry from a recording scanner.
+ *
+ * The recording file must be complete and closed.  Its start time is
+ * taken from the clock mapping if there is one, then from its file name,
+ * and finally from its modification time.
+ *
+ * \param[in]  scan   The scanner, which has seen all of the recording.
+ * \param[in]  path   Path to the recording.
+ * \param[in]  map    Clock mapping for the recording, or NULL.
+ * \param[out] entry  Returns the entry on success.  Free its path member.
+ * \return true on success, false otherwise.
+ */
+bool bl_catalogue_scan_finish(
+		struct bl_catalogue_scan *scan,
+		const char *path,
+		const struct bl_clock_map *map,
+		struct bl_catalogue_entry *entry);
+
+/**
+ * Make a catalogue entry by parsing a recording.
+ *
+ * If there is a Bloodview metadata file next to the recording, its clock
+ * mapping is used for the start time.
+ *
+ * \param[in]  path   Path to the recording.
+ * \param[out] entry  Returns the entry on success.  Free its path member.
+ * \return true on success, false otherwise.
+ */
+bool bl_catalogue_scan_file(
+		const char *path,
+		struct bl_catalogue_entry *entry);
+
+/**
+ * Check whether a catalogue entry still describes its recording.
+ *
+ * \param[in]  entry  The entry to check.
+ * \return true if the recording's size and modification time are as they
+ *         were when the entry was made.
+ */
+bool bl_catalogue_entry_current(
+		const struct bl_catalogue_entry *entry);
+
+/**
+ * Append an entry to a catalogue file, creating it if necessary.
+ *
+ * This is safe to use while other processes append to the same file.
+ *
+ * \param[in]  path   Path to the catalogue file.
+ * \param[in]  entry  The entry to append.
+ * \return true on success, false otherwise.
+ */
+bool bl_catalogue_append(
+		const char *path,
+		const struct bl_catalogue_entry *entry);
+
+/**
+ * Load a catalogue file.
+ *
+ * A missing catalogue file loads as an empty catalogue.
+ *
+ * \param[in]  path  Path to the catalogue file.
+ * \param[out] cat   Returns the catalogue on success.
+ * \return true on success, false otherwise.
+ */
+bool bl_catalogue_load(
+		const char *path,
+		struct bl_catalogue *cat);
+
+/**
+ * Start an empty catalogue to replace a catalogue file.
+ *
+ * Unlike \ref bl_catalogue_load, no entries are read from the file, so
+ * this works for a catalogue file from a different version.  Only files
+ * which aren't catalogues at all are refused.  When the catalogue is
+ * saved, only entries appended to the file after this call are added.
+ *
+ * \param[in]  path  Path to the catalogue file.
+ * \param[out] cat   Returns the empty catalogue on success.
+ * \return true on success, false otherwise.
+ */
+bool bl_catalogue_replace(
+		const char *path,
+		struct bl_catalogue *cat);
+
+/**
+ * Save a catalogue file, replacing any existing one.
+ *
+ * Entries appended to the file since the catalogue was loaded from it are
+ * added to the catalogue first, so they aren't lost.
+ *
+ * \param[in]  path  Path to the catalogue file.
+ * \param[in]  cat   The catalogue to save.
+ * \return true on success, false otherwise.
+ */
+bool bl_catalogue_save(
+		const char *path,
+		struct bl_catalogue *cat);
+
+/**
+ * Find a recording's entry in a catalogue.
+ *
+ * \param[in]  cat   The catalogue to search.
+ * \param[in]  path  Absolute path of the recording.
+ * \return the entry, or NULL if the recording isn't in the catalogue.
+ */
+struct bl_catalogue_entry *bl_catalogue_find(
+		const struct bl_catalogue *cat,
+		const char *path);
+
+/**
+ * Add an entry to a catalogue, replacing any entry for the same recording.
+ *
+ * The catalogue takes ownership of the entry's path.
+ *
+ * \param[in]  cat    The catalogue to add to.
+ * \param[in]  entry  The entry to add.
+ * \return true on success, false on allocation failure.
+ */
+bool bl_catalogue_add(
+		struct bl_catalogue *cat,
+		struct bl_catalogue_entry *entry);
+
+/**
+ * Free a catalogue's resources.
+ *
+ * \param[in]  cat  The catalogue to free.
+ */
+void bl_catalogue_fini(
+		struct bl_catalogue *cat);
+
+#endif /* BL_HOST_COMMON_CATALOGUE_H */
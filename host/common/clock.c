@@ -0,0 +1,218 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the device clock estimator module.
+ *
+ * The fit is a weighted least squares line through (x, y) points, where x
+ * is the nominal time of a sample and y is the host arrival time minus x.
+ * The slope is then the drift itself, rather than one plus a tiny drift,
+ * which keeps precision.  The weighted means and co-moments are updated
+ * incrementally, which is numerically stable over long acquisitions.
+ *
+ * Each point's weight comes from its residual against the fit so far, with
+ * a Huber weighting: points within a few times the running jitter get full
+ * weight, and points beyond that get weight inversely proportional to their
+ * residual.
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "clock.h"
+
+/** Number of arrivals fitted with full weight, before residuals are used. */
+#define BL_CLOCK_WARMUP 8
+
+/** Residual beyond which arrivals are down-weighted, in jitters. */
+#define BL_CLOCK_HUBER 3.0
+
+/** Smallest jitter, in seconds, so that a perfect fit can still adapt. */
+#define BL_CLOCK_JITTER_MIN 0.000001
+
+/** Rate at which the running jitter follows the residuals. */
+#define BL_CLOCK_JITTER_RATE 0.01
+
+/**
+ * Get a clock time in seconds.
+ *
+ * \param[in]  id  The clock to read.
+ * \return the time in seconds, or zero on error.
+ */
+static double bl_clock__read(clockid_t id)
+{
+	struct timespec ts;
+
+	if (clock_gettime(id, &ts) == -1) {
+		return 0;
+	}
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Exported function, documented in clock.h */
+double bl_clock_monotonic(void)
+{
+	return bl_clock__read(CLOCK_MONOTONIC);
+}
+
+/* Exported function, documented in clock.h */
+void bl_clock_init(
+		struct bl_clock *clock,
+		unsigned frequency)
+{
+	memset(clock, 0, sizeof(*clock));
+
+	clock->frequency = frequency;
+	clock->realtime = bl_clock__read(CLOCK_REALTIME) -
+			bl_clock__read(CLOCK_MONOTONIC);
+}
+
+/* Exported function, documented in clock.h */
+void bl_clock_add(
+		struct bl_clock *clock,
+		uint64_t sample,
+		double host)
+{
+	double x, y, dx, dy;
+	double w = 1;
+
+	if (clock->frequency == 0) {
+		return;
+	}
+
+	x = (double) sample / clock->frequency;
+	y = host - x;
+
+	if (clock->points >= 2 && clock->cxx > 0) {
+		double limit = clock->jitter;
+		double residual;
+
+		if (limit < BL_CLOCK_JITTER_MIN) {
+			limit = BL_CLOCK_JITTER_MIN;
+		}
+		limit *= BL_CLOCK_HUBER;
+
+		residual = y - clock->mean_y -
+				clock->cxy / clock->cxx * (x - clock->mean_x);
+		if (residual < 0) {
+			residual = -residual;
+		}
+		if (clock->points >= BL_CLOCK_WARMUP && residual > limit) {
+			w = limit / residual;
+			residual = limit;
+		}
+
+		clock->jitter += (residual - clock->jitter) *
+				BL_CLOCK_JITTER_RATE;
+	}
+
+	clock->weight += w;
+	dx = x - clock->mean_x;
+	dy = y - clock->mean_y;
+	clock->mean_x += w * dx / clock->weight;
+	clock->mean_y += w * dy / clock->weight;
+	clock->cxx += w * dx * (x - clock->mean_x);
+	clock->cxy += w * dx * (y - clock->mean_y);
+	clock->points++;
+}
+
+/* Exported function, documented in clock.h */
+bool bl_clock_get(
+		const struct bl_clock *clock,
+		struct bl_clock_map *map)
+{
+	if (clock->points < 2 || !(clock->cxx > 0)) {
+		return false;
+	}
+
+	map->frequency = clock->frequency;
+	map->drift = clock->cxy / clock->cxx;
+	map->offset = clock->mean_y - map->drift * clock->mean_x;
+	map->jitter = clock->jitter;
+	map->realtime = clock->realtime;
+	map->points = clock->points;
+
+	return true;
+}
+
+/* Exported function, documented in clock.h */
+void bl_clock_map_write(
+		FILE *file,
+		const struct bl_clock_map *map)
+{
+	fprintf(file, "clock:\n");
+	fprintf(file, "  frequency: %u\n", map->frequency);
+	fprintf(file, "  offset: %.9f\n", map->offset);
+	fprintf(file, "  drift_ppm: %.6f\n", map->drift * 1000000);
+	fprintf(file, "  jitter: %.9f\n", map->jitter);
+	fprintf(file, "  realtime: %.6f\n", map->realtime);
+	fprintf(file, "  points: %"PRIu64"\n", map->points);
+}
+
+/* Exported function, documented in clock.h */
+bool bl_clock_map_read(
+		const char *path,
+		struct bl_clock_map *map)
+{
+	bool in_clock = false;
+	bool have_offset = false;
+	double drift_ppm = 0;
+	char line[128];
+	FILE *file;
+
+	memset(map, 0, sizeof(*map));
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (line[0] != ' ') {
+			in_clock = (strcmp(line, "clock:\n") == 0);
+			continue;
+		}
+		if (!in_clock) {
+			continue;
+		}
+
+		sscanf(line, "  frequency: %u", &map->frequency);
+		sscanf(line, "  drift_ppm: %lf", &drift_ppm);
+		sscanf(line, "  jitter: %lf", &map->jitter);
+		sscanf(line, "  realtime: %lf", &map->realtime);
+		sscanf(line, "  points: %"SCNu64, &map->points);
+		if (sscanf(line, "  offset: %lf", &map->offset) == 1) {
+			have_offset = true;
+		}
+	}
+
+	fclose(file);
+
+	if (map->frequency == 0 || !have_offset) {
+		fprintf(stderr, "No clock mapping in '%s'\n", path);
+		return false;
+	}
+
+	map->drift = drift_ppm / 1000000;
+	return true;
+}
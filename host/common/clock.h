@@ -0,0 +1,146 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the device clock estimator module.
+ *
+ * The device's sample clock runs at a nominal frequency, but its crystal
+ * differs from the host's, so over a long acquisition sample times worked
+ * out from the sample count drift against host time.
+ *
+ * This fits a line mapping sample number to host CLOCK_MONOTONIC time,
+ * from the arrival times of sample data messages.  The fit is an offset,
+ * the host time of sample zero, and a drift, the fractional difference
+ * between the real and nominal sample rate.
+ *
+ * Message arrival is delayed by a varying transfer latency, with
+ * occasional long delays when the host is busy.  Arrivals far from the
+ * current fit are down-weighted, so these don't skew it.  The typical
+ * latency can't be told apart from the offset, so it is included in it.
+ * Each update is O(1).
+ */
+
+#ifndef BL_HOST_COMMON_CLOCK_H
+#define BL_HOST_COMMON_CLOCK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** A mapping from sample number to host time. */
+struct bl_clock_map {
+	unsigned frequency; /**< Nominal sampling rate in Hz. */
+	double   offset;    /**< Host time of sample zero, in seconds. */
+	double   drift;     /**< Fractional sample rate error. */
+	double   jitter;    /**< Typical arrival time error, in seconds. */
+	double   realtime;  /**< CLOCK_REALTIME minus CLOCK_MONOTONIC. */
+	uint64_t points;    /**< Number of arrivals fitted. */
+};
+
+/** Clock estimator state. */
+struct bl_clock {
+	unsigned frequency; /**< Nominal sampling rate in Hz. */
+	double   realtime;  /**< CLOCK_REALTIME minus CLOCK_MONOTONIC. */
+
+	double   weight; /**< Total weight of fitted arrivals. */
+	double   mean_x; /**< Weighted mean nominal sample time. */
+	double   mean_y; /**< Weighted mean host minus nominal time. */
+	double   cxx;    /**< Weighted sum of squared x deviations. */
+	double   cxy;    /**< Weighted sum of x and y deviation products. */
+	double   jitter; /**< Running mean absolute residual. */
+	uint64_t points; /**< Number of arrivals fitted. */
+};
+
+/**
+ * Get the current CLOCK_MONOTONIC time.
+ *
+ * \return the time in seconds.
+ */
+double bl_clock_monotonic(void);
+
+/**
+ * Initialise a clock estimator, for the start of an acquisition.
+ *
+ * \param[in]  clock      The clock estimator to initialise.
+ * \param[in]  frequency  The acquisition's nominal sampling rate.
+ */
+void bl_clock_init(
+		struct bl_clock *clock,
+		unsigned frequency);
+
+/**
+ * Add a sample data message arrival to a clock estimator.
+ *
+ * \param[in]  clock   The clock estimator.
+ * \param[in]  sample  Sample number of the message's last sample, counting
+ *                     the channel's samples from zero.
+ * \param[in]  host    CLOCK_MONOTONIC time the message arrived, in seconds.
+ */
+void bl_clock_add(
+		struct bl_clock *clock,
+		uint64_t sample,
+		double host);
+
+/**
+ * Get a clock estimator's current mapping.
+ *
+ * \param[in]  clock  The clock estimator.
+ * \param[out] map    Returns the mapping on success.
+ * \return true on success, or false if there are too few arrivals to fit.
+ */
+bool bl_clock_get(
+		const struct bl_clock *clock,
+		struct bl_clock_map *map);
+
+/**
+ * Write a mapping as a YAML mapping, under the key "clock".
+ *
+ * \param[in]  file  The file to write to.
+ * \param[in]  map   The mapping to write.
+ */
+void bl_clock_map_write(
+		FILE *file,
+		const struct bl_clock_map *map);
+
+/**
+ * Read a mapping from a recording metadata file.
+ *
+ * \param[in]  path  Path to metadata file.
+ * \param[out] map   Returns the mapping on success.
+ * \return true on success, false otherwise.
+ */
+bool bl_clock_map_read(
+		const char *path,
+		struct bl_clock_map *map);
+
+/**
+ * Get the host time of a sample.
+ *
+ * \param[in]  map     The mapping to use.
+ * \param[in]  sample  Sample number.
+ * \return the CLOCK_MONOTONIC time of the sample, in seconds.
+ */
+static inline double bl_clock_map_time(
+		const struct bl_clock_map *map,
+		double sample)
+{
+	double nominal = sample / map->frequency;
+
+	return map->offset + nominal * (1 + map->drift);
+}
+
+#endif /* BL_HOST_COMMON_CLOCK_H */
@@ -55,7 +55,7 @@ static inline uint16_t fifo__pos_seek(
 		int32_t pos,
 		int32_t n)
 {
-	assert(abs(n) < fifo->used);
+	assert(abs(n) <= fifo->used);
 
 	pos += n;
 	if (pos >= fifo->capacity) {
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the recording index module.
+ *
+ * The recording is scanned line by line.  Only the lines that start a
+ * message, and the few header lines of Start and sample data messages,
+ * are looked at; sample values are skipped without being converted.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "index.h"
+
+/** Chunk array allocation granularity. */
+#define BL_INDEX_ALLOC 64
+
+/** Index builder state. */
+struct bl_index_ctx {
+	FILE *file;     /**< Recording file. */
+	char *line;     /**< Current line. */
+	size_t line_sz; /**< Allocated size of line. */
+	ssize_t len;    /**< Length of current line, or -1 at end of file. */
+	long offset;    /**< File offset of the current line. */
+	long next;      /**< File offset of the next line. */
+};
+
+/**
+ * Read the next line of the recording.
+ *
+ * \param[in]  ctx  Index builder state.
+ * \return true if a line was read, false at end of file.
+ */
+static bool bl_index__next_line(struct bl_index_ctx *ctx)
+{
+	ctx->offset = ctx->next;
+	ctx->len = getline(&ctx->line, &ctx->line_sz, ctx->file);
+	if (ctx->len < 0) {
+		return false;
+	}
+
+	ctx->next += ctx->len;
+	return true;
+}
+
+/**
+ * Check whether the current line starts a message.
+ *
+ * \param[in]  ctx  Index builder state.
+ * \return true if the current line starts a message.
+ */
+static inline bool bl_index__is_message(const struct bl_index_ctx *ctx)
+{
+	return ctx->len >= 2 && ctx->line[0] == '-' && ctx->line[1] == ' ';
+}
+
+/**
+ * Add a chunk to the index, starting at the current line.
+ *
+ * \param[in]  ctx    Index builder state.
+ * \param[in]  index  The index being built.
+ * \return true on success, false on allocation failure.
+ */
+static bool bl_index__add_chunk(
+		const struct bl_index_ctx *ctx,
+		struct bl_index *index)
+{
+	struct bl_index_chunk *chunk;
+
+	if (index->count % BL_INDEX_ALLOC == 0) {
+		chunk = realloc(index->chunk, (index->count + BL_INDEX_ALLOC) *
+				sizeof(*index->chunk));
+		if (chunk == NULL) {
+			return false;
+		}
+		index->chunk = chunk;
+	}
+
+	if (index->count > 0) {
+		index->chunk[index->count - 1].end = ctx->offset;
+	}
+
+	chunk = &index->chunk[index->count++];
+	chunk->offset = ctx->offset;
+	chunk->end = ctx->offset;
+	memcpy(chunk->sample, index->samples, sizeof(chunk->sample));
+
+	return true;
+}
+
+/**
+ * Read the header of a Start message.
+ *
+ * \param[in]  ctx    Index builder state, at the message's first line.
+ * \param[in]  index  The index being built.
+ * \return true on success, false on error.
+ */
+static bool bl_index__start(
+		struct bl_index_ctx *ctx,
+		struct bl_index *index)
+{
+	unsigned frequency = 0;
+	unsigned src_mask = 0;
+
+	while (bl_index__next_line(ctx) && !bl_index__is_message(ctx)) {
+		sscanf(ctx->line, "    Frequency: %u", &frequency);
+		sscanf(ctx->line, "    Source Mask: 0x%x", &src_mask);
+	}
+
+	if (frequency == 0 || frequency > UINT16_MAX) {
+		fprintf(stderr, "Bad frequency in Start message\n");
+		return false;
+	}
+
+	if (index->frequency != 0 && index->frequency != frequency) {
+		fprintf(stderr, "Sampling rate changed from %u to %u Hz\n",
+				index->frequency, frequency);
+		return false;
+	}
+
+	index->frequency = frequency;
+	index->src_mask |= src_mask;
+	return true;
+}
+
+/**
+ * Read the header of a sample data message, and skip its samples.
+ *
+ * \param[in]  ctx    Index builder state, at the message's first line.
+ * \param[in]  index  The index being built.
+ * \param[out] count  Returns the number of samples in the message.
+ * \return true on success, false on error.
+ */
+static bool bl_index__sample_data(
+		struct bl_index_ctx *ctx,
+		struct bl_index *index,
+		unsigned *count)
+{
+	unsigned channel;
+
+	if (!bl_index__next_line(ctx) ||
+	    sscanf(ctx->line, "    Channel: %u", &channel) != 1 ||
+	    !bl_index__next_line(ctx) ||
+	    sscanf(ctx->line, "    Count: %u", count) != 1 ||
+	    channel >= BL_CHANNEL_MAX) {
+		fprintf(stderr, "Bad sample data message at offset %ld\n",
+				ctx->offset);
+		return false;
+	}
+
+	index->samples[channel] += *count;
+
+	while (bl_index__next_line(ctx) && !bl_index__is_message(ctx)) {
+	}
+
+	return true;
+}
+
+/* Exported function, documented in index.h */
+bool bl_index_build(
+		const char *path,
+		unsigned chunk_seconds,
+		struct bl_index *index)
+{
+	struct bl_index_ctx ctx = { 0 };
+	uint64_t chunk_samples = 0;
+	bool ok = true;
+
+	memset(index, 0, sizeof(*index));
+
+	ctx.file = fopen(path, "r");
+	if (ctx.file == NULL) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	ok = bl_index__add_chunk(&ctx, index);
+	bl_index__next_line(&ctx);
+
+	while (ok && ctx.len >= 0) {
+		unsigned count;
+
+		if (!bl_index__is_message(&ctx)) {
+			bl_index__next_line(&ctx);
+			continue;
+		}
+
+		if (strncmp(ctx.line, "- Start:", 8) == 0) {
+			ok = bl_index__start(&ctx, index);
+
+		} else if (strncmp(ctx.line, "- Sample Data", 13) == 0) {
+			uint64_t limit = (uint64_t)chunk_seconds *
+					index->frequency;
+
+			/* Sample data is counted per channel, so scale the
+			 * chunk size by the number of channels. */
+			limit *= (index->src_mask != 0) ?
+					__builtin_popcount(index->src_mask) : 1;
+
+			if (index->frequency != 0 && chunk_samples >= limit) {
+				ok = bl_index__add_chunk(&ctx, index);
+				chunk_samples = 0;
+			}
+
+			if (ok) {
+				ok = bl_index__sample_data(&ctx, index, &count);
+				chunk_samples += count;
+			}
+		} else {
+			bl_index__next_line(&ctx);
+		}
+	}
+
+	if (ok && ferror(ctx.file)) {
+		fprintf(stderr, "Failed to read '%s'\n", path);
+		ok = false;
+	}
+
+	if (ok) {
+		index->chunk[index->count - 1].end = ctx.next;
+	}
+
+	free(ctx.line);
+	fclose(ctx.file);
+
+	if (!ok) {
+		bl_index_fini(index);
+	}
+	return ok;
+}
+
+/* Exported function, documented in index.h */
+void bl_index_fini(
+		struct bl_index *index)
+{
+	free(index->chunk);
+	memset(index, 0, sizeof(*index));
+}
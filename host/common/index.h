@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the recording index module.
+ *
+ * This splits a recording file into chunks which start on message
+ * boundaries, so that the chunks can be seeked to and parsed with
+ * \ref bl_msg_yaml_parse independently, for example by several threads.
+ *
+ * Building the index only looks at message headers, so it is much faster
+ * than parsing the recording.  Each chunk records how many samples every
+ * channel had before it, so that sample times can be worked out without
+ * parsing the preceding chunks.
+ */
+
+#ifndef BL_HOST_COMMON_INDEX_H
+#define BL_HOST_COMMON_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common/channel.h"
+
+/** A chunk of a recording file. */
+struct bl_index_chunk {
+	long offset; /**< File offset of the chunk's first message. */
+	long end;    /**< File offset just past the chunk's last message. */
+
+	/** Number of samples each channel had before the chunk. */
+	uint64_t sample[BL_CHANNEL_MAX];
+};
+
+/** A recording index. */
+struct bl_index {
+	uint16_t frequency; /**< Sampling rate in Hz, from the Start message. */
+	uint16_t src_mask;  /**< Acquisition channel mask. */
+
+	/** Total number of samples for each channel. */
+	uint64_t samples[BL_CHANNEL_MAX];
+
+	struct bl_index_chunk *chunk; /**< Array of chunks, in file order. */
+	unsigned count;               /**< Number of chunks. */
+};
+
+/**
+ * Build an index for a recording file.
+ *
+ * Chunks are ended at the first message boundary after they reach the
+ * given duration.  Any messages before the first sample data message are
+ * part of the first chunk.  Recordings with more than one acquisition are
+ * treated as one continuous acquisition, as long as the sampling rate is
+ * the same.
+ *
+ * \param[in]  path           Path to recording file.
+ * \param[in]  chunk_seconds  Duration of each chunk, in seconds.
+ * \param[out] index          Returns the index on success.
+ * \return true on success, false otherwise.
+ */
+bool bl_index_build(
+		const char *path,
+		unsigned chunk_seconds,
+		struct bl_index *index);
+
+/**
+ * Free an index's resources.
+ *
+ * \param[in]  index  The index to finalise.
+ */
+void bl_index_fini(
+		struct bl_index *index);
+
+#endif /* BL_HOST_COMMON_INDEX_H */
@@ -36,7 +36,8 @@
 #define BUFFER_LEN 64
 #define BUFFER_LEN_STR "64"
 
-static char buffer[BUFFER_LEN + 1];
+/** Parse buffer, per thread so streams can be parsed concurrently. */
+static _Thread_local char buffer[BUFFER_LEN + 1];
 
 /** Message type to string mapping, */
 static const char *msg_types[]  = {
@@ -162,7 +163,7 @@ static uint8_t bl_msg__yaml_read_response_to(FILE *file, bool *success)
 	return bl_msg_str_to_type("Unknown");
 }
 
-static uint16_t bl_msg__yaml_read_unsigned(FILE *file, const char *field, bool *success)
+static uint32_t bl_msg__yaml_read_unsigned(FILE *file, const char *field, bool *success)
 {
 	unsigned value;
 	int ret;
@@ -179,7 +180,7 @@ static uint16_t bl_msg__yaml_read_unsigned(FILE *file, const char *field, bool *
 	return 0;
 }
 
-static uint16_t bl_msg__yaml_read_hex(FILE *file, const char *field, bool *success)
+static uint32_t bl_msg__yaml_read_hex(FILE *file, const char *field, bool *success)
 {
 	unsigned value;
 	int ret;
@@ -534,6 +535,24 @@ static ssize_t bl_msg__read(int fd, void *data, size_t size, int timeout_ms)
 	return total_read;
 }
 
+enum bl_msg_type bl_msg_reply_to(
+		const union bl_msg_data *msg)
+{
+	switch (msg->type) {
+	case BL_MSG_RESPONSE:
+		return msg->response.response_to;
+
+	case BL_MSG_SOURCE_CAP:
+		return BL_MSG_SOURCE_CAP_REQ;
+
+	case BL_MSG_VERSION:
+		return BL_MSG_VERSION_REQ;
+
+	default:
+		return BL_MSG__COUNT;
+	}
+}
+
 bool bl_msg_read(
 		int fd,
 		int timeout,
@@ -40,6 +40,16 @@ void bl_msg_yaml_print(
 		FILE *file,
 		const union bl_msg_data *msg);
 
+/**
+ * Get the type of command a message from the device is the reply to.
+ *
+ * \param[in] msg  Message received from the device.
+ * \return the type of command replied to, or \ref BL_MSG__COUNT if the
+ *         message is not a reply to a command.
+ */
+enum bl_msg_type bl_msg_reply_to(
+		const union bl_msg_data *msg);
+
 /**
  * Read raw msg from given file descriptor into given message data structure.
  *
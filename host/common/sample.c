@@ -0,0 +1,169 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Implementation of the sample codec module.
+ *
+ * The conversions are kept as simple loops over contiguous arrays with no
+ * aliasing, so the compiler can vectorise them for the host.
+ */
+
+#include <stdint.h>
+
+#include "sample.h"
+
+/**
+ * Get the number of samples in a sample data message.
+ *
+ * The count is clamped to what the message type can hold, so a corrupt
+ * count can not cause reads beyond the message.
+ *
+ * \param[in]  msg  The sample data message.
+ * \return the number of samples in the message.
+ */
+static unsigned bl_sample__count(const bl_msg_sample_data_t *msg)
+{
+	unsigned max;
+
+	switch (msg->type) {
+	case BL_MSG_SAMPLE_DATA16: max = MSG_SAMPLE_DATA16_MAX; break;
+	case BL_MSG_SAMPLE_DATA32: max = MSG_SAMPLE_DATA32_MAX; break;
+	default: return 0;
+	}
+
+	return (msg->count > max) ? max : msg->count;
+}
+
+unsigned bl_sample_unpack(
+		const bl_msg_sample_data_t *msg,
+		uint32_t *restrict out)
+{
+	const uint16_t *restrict in16 = msg->data16;
+	const uint32_t *restrict in32 = msg->data32;
+	unsigned count = bl_sample__count(msg);
+
+	if (msg->type == BL_MSG_SAMPLE_DATA16) {
+		for (unsigned i = 0; i < count; i++) {
+			out[i] = in16[i];
+		}
+	} else {
+		for (unsigned i = 0; i < count; i++) {
+			out[i] = in32[i];
+		}
+	}
+
+	return count;
+}
+
+unsigned bl_sample_unpack_scaled(
+		const bl_msg_sample_data_t *msg,
+		uint32_t *restrict out)
+{
+	const uint16_t *restrict in16 = msg->data16;
+	unsigned count;
+
+	if (msg->type != BL_MSG_SAMPLE_DATA16) {
+		return bl_sample_unpack(msg, out);
+	}
+
+	count = bl_sample__count(msg);
+	for (unsigned i = 0; i < count; i++) {
+		out[i] = ((uint32_t)in16[i] << 16) | in16[i];
+	}
+
+	return count;
+}
+
+unsigned bl_sample_unpack_double(
+		const bl_msg_sample_data_t *msg,
+		double *restrict out)
+{
+	const uint16_t *restrict in16 = msg->data16;
+	const uint32_t *restrict in32 = msg->data32;
+	unsigned count = bl_sample__count(msg);
+
+	if (msg->type == BL_MSG_SAMPLE_DATA16) {
+		for (unsigned i = 0; i < count; i++) {
+			out[i] = in16[i];
+		}
+	} else {
+		for (unsigned i = 0; i < count; i++) {
+			out[i] = in32[i];
+		}
+	}
+
+	return count;
+}
+
+uint32_t bl_sample_full_scale(
+		const bl_msg_source_conf_t *source,
+		uint32_t offset,
+		uint8_t shift,
+		enum bl_msg_type type)
+{
+	uint64_t full = UINT32_MAX;
+
+	if (source != NULL) {
+		full = ((uint64_t)BL_SAMPLE_ADC_MAX <<
+				(source->hw_oversample & 15)) >>
+				(source->hw_shift & 15);
+		full *= (source->sw_oversample > 0) ?
+				source->sw_oversample : 1;
+		if (full > UINT32_MAX) {
+			full = UINT32_MAX;
+		}
+	}
+
+	if (type == BL_MSG_SAMPLE_DATA16) {
+		full = (full > offset) ? (full - offset) >> (shift & 31) : 0;
+		if (full > UINT16_MAX) {
+			full = UINT16_MAX;
+		}
+	}
+
+	return (full > 0) ? full : 1;
+}
+
+void bl_sample_clip_count(
+		const uint32_t *restrict samples,
+		unsigned count,
+		uint32_t full,
+		unsigned *high,
+		unsigned *low)
+{
+	unsigned h = 0;
+	unsigned l = 0;
+
+	/* Branch free, so the compiler can vectorise it. */
+	for (unsigned i = 0; i < count; i++) {
+		h += (samples[i] >= full);
+		l += (samples[i] == 0);
+	}
+
+	*high = h;
+	*low = l;
+}
+
+void bl_sample_to_signed(
+		const uint32_t *in,
+		int32_t *out,
+		unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		out[i] = (int32_t)(in[i] - INT32_MIN);
+	}
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ * \brief Interface to the sample codec module.
+ *
+ * This converts the sample payloads of \ref BL_MSG_SAMPLE_DATA16 and
+ * \ref BL_MSG_SAMPLE_DATA32 messages into the forms the host tools and
+ * Bloodview work with, so that each payload format is handled in one place.
+ */
+
+#ifndef BL_HOST_COMMON_SAMPLE_H
+#define BL_HOST_COMMON_SAMPLE_H
+
+#include <stdint.h>
+
+#include "common/msg.h"
+
+/** Largest number of samples a sample data message can contain. */
+#define BL_SAMPLE_MAX MSG_SAMPLE_DATA16_MAX
+
+/** Largest 12-bit ADC conversion result. */
+#define BL_SAMPLE_ADC_MAX 4095
+
+/**
+ * Get the samples from a sample data message.
+ *
+ * 16-bit samples are zero extended.
+ *
+ * \param[in]  msg  The sample data message.
+ * \param[out] out  Array of at least \ref BL_SAMPLE_MAX entries.
+ * \return the number of samples written to out.
+ */
+unsigned bl_sample_unpack(
+		const bl_msg_sample_data_t *msg,
+		uint32_t *out);
+
+/**
+ * Get the samples from a sample data message, scaled to 32 bits.
+ *
+ * 16-bit samples are scaled to cover the full 32-bit range, so samples
+ * from either message type can be treated the same way.
+ *
+ * \param[in]  msg  The sample data message.
+ * \param[out] out  Array of at least \ref BL_SAMPLE_MAX entries.
+ * \return the number of samples written to out.
+ */
+unsigned bl_sample_unpack_scaled(
+		const bl_msg_sample_data_t *msg,
+		uint32_t *out);
+
+/**
+ * Get the samples from a sample data message as doubles.
+ *
+ * \param[in]  msg  The sample data message.
+ * \param[out] out  Array of at least \ref BL_SAMPLE_MAX entries.
+ * \return the number of samples written to out.
+ */
+unsigned bl_sample_unpack_double(
+		const bl_msg_sample_data_t *msg,
+		double *out);
+
+/**
+ * Get the largest sample value a channel can produce.
+ *
+ * 32-bit samples are the source's accumulated ADC readings, so they top
+ * out at the ADC maximum, scaled by the hardware oversample and shift, and
+ * summed over the software oversample.  16-bit samples have the channel's
+ * offset subtracted and are shifted down, and are clamped to 16 bits.
+ *
+ * \param[in]  source  The channel's source configuration, or NULL if it
+ *                     is unknown, in which case any 32-bit value is taken
+ *                     as possible.
+ * \param[in]  offset  The channel's offset.
+ * \param[in]  shift   The channel's shift.
+ * \param[in]  type    Type of the sample data messages the samples are in.
+ * \return the channel's full scale sample value, which is at least 1.
+ */
+uint32_t bl_sample_full_scale(
+		const bl_msg_source_conf_t *source,
+		uint32_t offset,
+		uint8_t shift,
+		enum bl_msg_type type);
+
+/**
+ * Count clipped samples.
+ *
+ * Samples at or above full scale are clipped high, and samples at zero are
+ * clipped low.
+ *
+ * \param[in]  samples  Unpacked samples.
+ * \param[in]  count    Number of samples.
+ * \param[in]  full     Full scale, from \ref bl_sample_full_scale.
+ * \param[out] high     Returns the number of samples clipped high.
+ * \param[out] low      Returns the number of samples clipped low.
+ */
+void bl_sample_clip_count(
+		const uint32_t *samples,
+		unsigned count,
+		uint32_t full,
+		unsigned *high,
+		unsigned *low);
+
+/**
+ * Convert unsigned samples to signed, centred on zero.
+ *
+ * This may be done in place.
+ *
+ * \param[in]  in     Unsigned 32-bit samples.
+ * \param[out] out    Returns signed 32-bit samples.
+ * \param[in]  count  Number of samples to convert.
+ */
+void bl_sample_to_signed(
+		const uint32_t *in,
+		int32_t *out,
+		unsigned count);
+
+#endif /* BL_HOST_COMMON_SAMPLE_H */
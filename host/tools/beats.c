@@ -0,0 +1,907 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "common/msg.h"
+#include "common/channel.h"
+#include "common/util.h"
+
+#include "host/common/msg.h"
+#include "host/common/sig.h"
+#include "host/common/index.h"
+#include "host/common/sample.h"
+
+#include "util.h"
+
+uint32_t DEFAULT_CHUNK_LENGTH = 30; // measured in seconds
+uint32_t MIN_CHUNK_LENGTH = 10; // must cover a beat's context
+double DEFAULT_LEVEL = 0.5; // fraction of the local maximum for a peak
+double DEFAULT_REFRACTORY = 0.3; // minimum beat interval in seconds
+
+// Smoothing and detrending window lengths, in seconds
+#define SMOOTH_WINDOW 0.05
+#define BASELINE_WINDOW 1.5
+#define ENVELOPE_WINDOW 4.0
+
+// Longest beat interval whose neighbouring beats are always found at chunk
+// edges, in seconds
+#define INTERVAL_MAX 2.0
+
+/*
+ * Binary table output format.
+ *
+ * The file starts with the 8 byte magic "BLBEAT01", a uint32_t column count
+ * and a uint64_t row count.  Then for each column there is a 16 byte NUL
+ * padded name and a uint32_t column type.  Then for each column in turn
+ * there are row count values of the column's type.  All values are in host
+ * byte order.
+ */
+static const char TABLE_MAGIC[8] = "BLBEAT01";
+
+enum column_type {
+	COLUMN_U8,
+	COLUMN_F32,
+	COLUMN_F64,
+};
+
+enum feature {
+	FEATURE_TIME,
+	FEATURE_INTERVAL,
+	FEATURE_AMPLITUDE,
+	FEATURE_RISE,
+	FEATURE_NOTCH,
+	FEATURE_AREA,
+	FEATURE_WIDTH,
+
+	FEATURE__COUNT,
+};
+
+static const struct feature_info {
+	const char *name;
+	const char *description;
+	enum column_type type;
+} features[FEATURE__COUNT] = {
+	[FEATURE_TIME] = { .name = "time", .type = COLUMN_F64,
+		.description = "Time of the systolic peak, in seconds" },
+	[FEATURE_INTERVAL] = { .name = "interval", .type = COLUMN_F32,
+		.description = "Time since the previous peak, in seconds" },
+	[FEATURE_AMPLITUDE] = { .name = "amplitude", .type = COLUMN_F32,
+		.description = "Peak height above the foot, in sample units" },
+	[FEATURE_RISE] = { .name = "rise", .type = COLUMN_F32,
+		.description = "Time from the foot to the peak, in seconds" },
+	[FEATURE_NOTCH] = { .name = "notch", .type = COLUMN_F32,
+		.description = "Time from the peak to the dicrotic notch, "
+				"in seconds" },
+	[FEATURE_AREA] = { .name = "area", .type = COLUMN_F32,
+		.description = "Area above the foot to foot line, in sample "
+				"unit seconds" },
+	[FEATURE_WIDTH] = { .name = "width", .type = COLUMN_F32,
+		.description = "Pulse width at half amplitude, in seconds" },
+};
+
+struct options {
+	enum feature feature[FEATURE__COUNT]; // Selected features, in order
+	unsigned feature_count; // Number of selected features
+	const char *output;     // Binary table output path, or NULL for CSV
+	uint32_t chunk_length;  // Chunk length in seconds
+	uint32_t jobs;          // Number of worker threads
+	double level;           // Peak level, fraction of the local maximum
+	double refractory;      // Minimum beat interval in seconds
+	bool invert;            // Whether to look for troughs instead of peaks
+};
+
+struct beat {
+	double value[FEATURE__COUNT];
+};
+
+struct beat_list {
+	struct beat *beat;
+	size_t count;
+	size_t alloc;
+};
+
+/*
+ * Work shared by the worker threads.
+ *
+ * The recording is indexed in steps just longer than the context a beat
+ * needs either side of it, and each task is a run of steps making up a
+ * chunk.  A task parses its chunk and one step either side of it, so beats
+ * near the chunk edges have all the context they need and come out the
+ * same as if the whole recording was processed at once.  Beats are only
+ * reported by the task whose chunk contains their peak.
+ */
+struct work {
+	const char *path;
+	const struct bl_index *index;
+	const struct options *options;
+
+	unsigned steps;  // Index steps per task
+	unsigned tasks;  // Number of tasks
+
+	struct beat_list *result; // Per task, per channel beat lists
+	unsigned next;            // Next task to process
+	bool failed;              // Whether any task has failed
+	pthread_mutex_t lock;
+};
+
+static bool beat_list_add(struct beat_list *list, const struct beat *beat)
+{
+	if (list->count == list->alloc) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 64;
+		struct beat *temp = realloc(list->beat, alloc * sizeof(*temp));
+		if (temp == NULL) {
+			return false;
+		}
+		list->beat = temp;
+		list->alloc = alloc;
+	}
+
+	list->beat[list->count++] = *beat;
+	return true;
+}
+
+// Centred moving average, over the available samples at the ends
+static void moving_average(const double *in, double *out,
+		double *sum, size_t n, size_t half)
+{
+	// Prefix sums relative to the first sample, to keep precision
+	sum[0] = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum[i + 1] = sum[i] + (in[i] - in[0]);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		size_t lo = (i > half) ? i - half : 0;
+		size_t hi = (i + half + 1 < n) ? i + half + 1 : n;
+		out[i] = in[0] + (sum[hi] - sum[lo]) / (hi - lo);
+	}
+}
+
+// Centred moving maximum, using a monotonic queue of sample indexes
+static void moving_max(const double *in, double *out,
+		size_t *queue, size_t n, size_t half)
+{
+	size_t head = 0;
+	size_t tail = 0;
+
+	for (size_t j = 0; j < n + half; j++) {
+		if (j < n) {
+			while (tail > head && in[queue[tail - 1]] <= in[j]) {
+				tail--;
+			}
+			queue[tail++] = j;
+		}
+
+		if (j >= half) {
+			size_t i = j - half;
+			while (queue[head] + half < i) {
+				head++;
+			}
+			out[i] = in[queue[head]];
+		}
+	}
+}
+
+static double half_width(const double *d, size_t foot, size_t peak,
+		size_t next_foot, double half)
+{
+	double start = NAN;
+	double end = NAN;
+
+	for (size_t i = peak; i > foot; i--) {
+		if (d[i - 1] < half) {
+			start = (i - 1) + (half - d[i - 1]) / (d[i] - d[i - 1]);
+			break;
+		}
+	}
+
+	for (size_t i = peak + 1; i <= next_foot; i++) {
+		if (d[i] < half) {
+			end = (i - 1) + (d[i - 1] - half) / (d[i - 1] - d[i]);
+			break;
+		}
+	}
+
+	return end - start;
+}
+
+static double notch_offset(const double *d, size_t peak, size_t next_foot)
+{
+	for (size_t i = peak + 1; i + 1 < next_foot; i++) {
+		if (d[i] < d[i - 1] && d[i] <= d[i + 1]) {
+			return i - peak;
+		}
+	}
+
+	return NAN;
+}
+
+static double pulse_area(const double *d, size_t foot, size_t next_foot)
+{
+	double slope = (d[next_foot] - d[foot]) / (next_foot - foot);
+	double area = 0;
+
+	for (size_t i = foot; i < next_foot; i++) {
+		area += d[i] - (d[foot] + slope * (i - foot));
+	}
+
+	return area;
+}
+
+/*
+ * Find the beats in a channel's samples.
+ *
+ * The signal is smoothed and has its baseline removed.  Peaks are samples
+ * which are the highest within the refractory period either side, and are
+ * above a fraction of the highest value within a few seconds.  A beat's
+ * foot is the lowest point between its peak and the previous one, and it
+ * ends at the following beat's foot.
+ *
+ * Only beats with peaks in [own_start, own_end) are added to the list.
+ */
+static bool segment_channel(const struct options *options,
+		double frequency, uint64_t base, const double *x, size_t n,
+		size_t own_start, size_t own_end, struct beat_list *list)
+{
+	size_t refractory = options->refractory * frequency;
+	size_t *peak = NULL;
+	size_t *foot = NULL;
+	size_t *queue = NULL;
+	double *s = NULL, *d = NULL, *env = NULL, *tmp = NULL;
+	size_t peaks = 0;
+	bool ok = false;
+
+	if (n < 3) {
+		return true;
+	}
+
+	s = malloc(n * sizeof(*s));
+	d = malloc(n * sizeof(*d));
+	env = malloc(n * sizeof(*env));
+	tmp = malloc((n + 1) * sizeof(*tmp));
+	peak = malloc(n * sizeof(*peak));
+	foot = malloc(n * sizeof(*foot));
+	queue = malloc(n * sizeof(*queue));
+	if (s == NULL || d == NULL || env == NULL || tmp == NULL ||
+	    peak == NULL || foot == NULL || queue == NULL) {
+		fprintf(stderr, "Failed to allocate segmentation buffers\n");
+		goto cleanup;
+	}
+
+	moving_average(x, s, tmp, n, SMOOTH_WINDOW * frequency / 2);
+	moving_average(s, d, tmp, n, BASELINE_WINDOW * frequency / 2);
+	for (size_t i = 0; i < n; i++) {
+		d[i] = s[i] - d[i];
+		if (options->invert) {
+			d[i] = -d[i];
+		}
+	}
+
+	moving_max(d, env, queue, n, ENVELOPE_WINDOW * frequency / 2);
+	moving_max(d, s, queue, n, refractory);
+
+	for (size_t i = 0; i < n; i++) {
+		if (d[i] > 0 && d[i] == s[i] &&
+		    d[i] >= options->level * env[i] &&
+		    (peaks == 0 || i - peak[peaks - 1] > refractory)) {
+			peak[peaks++] = i;
+		}
+	}
+
+	for (size_t j = 1; j < peaks; j++) {
+		foot[j] = peak[j - 1] + 1;
+		for (size_t i = foot[j]; i < peak[j]; i++) {
+			if (d[i] < d[foot[j]]) {
+				foot[j] = i;
+			}
+		}
+	}
+
+	for (size_t j = 1; j + 1 < peaks; j++) {
+		size_t p = peak[j];
+		size_t f = foot[j];
+		size_t next = foot[j + 1];
+		double amplitude = d[p] - d[f];
+		struct beat beat;
+
+		if (p < own_start || p >= own_end) {
+			continue;
+		}
+
+		beat.value[FEATURE_TIME] = (base + p) / frequency;
+		beat.value[FEATURE_INTERVAL] = (p - peak[j - 1]) / frequency;
+		beat.value[FEATURE_AMPLITUDE] = amplitude;
+		beat.value[FEATURE_RISE] = (p - f) / frequency;
+		beat.value[FEATURE_NOTCH] = notch_offset(d, p, next) /
+				frequency;
+		beat.value[FEATURE_AREA] = pulse_area(d, f, next) / frequency;
+		beat.value[FEATURE_WIDTH] = half_width(d, f, p, next,
+				d[f] + amplitude / 2) / frequency;
+
+		if (!beat_list_add(list, &beat)) {
+			fprintf(stderr, "Failed to allocate beat list\n");
+			goto cleanup;
+		}
+	}
+
+	ok = true;
+
+cleanup:
+	free(queue);
+	free(foot);
+	free(peak);
+	free(tmp);
+	free(env);
+	free(d);
+	free(s);
+	return ok;
+}
+
+// Skip to the start of the next message, so ftell can be compared to the
+// chunk end.
+static void skip_space(FILE *file)
+{
+	int c;
+
+	while ((c = fgetc(file)) != EOF && isspace(c)) {
+	}
+	if (c != EOF) {
+		ungetc(c, file);
+	}
+}
+
+/*
+ * Get the context a beat needs either side of it, in seconds.
+ *
+ * This covers the previous or next beat, the smoothing, baseline and
+ * envelope windows around that beat's peak, and the refractory period its
+ * peak is checked over.
+ */
+static double context_seconds(const struct options *options)
+{
+	return INTERVAL_MAX + SMOOTH_WINDOW / 2 + BASELINE_WINDOW / 2 +
+			ENVELOPE_WINDOW / 2 + options->refractory;
+}
+
+// Get the number of samples a channel has before an index step
+static uint64_t step_sample(const struct bl_index *index,
+		unsigned step, unsigned c)
+{
+	return (step < index->count) ?
+			index->chunk[step].sample[c] : index->samples[c];
+}
+
+static bool process_chunk(struct work *work, unsigned k)
+{
+	const struct bl_index *index = work->index;
+	unsigned first = k * work->steps;
+	unsigned last = (first + work->steps < index->count) ?
+			first + work->steps : index->count;
+	unsigned lo = (first > 0) ? first - 1 : first;
+	unsigned hi = (last < index->count) ? last : last - 1;
+	double *samples[BL_CHANNEL_MAX] = { NULL };
+	uint64_t count[BL_CHANNEL_MAX] = { 0 };
+	uint64_t start[BL_CHANNEL_MAX];
+	uint64_t end[BL_CHANNEL_MAX];
+	union bl_msg_data msg;
+	FILE *file;
+	bool ok = false;
+
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		start[c] = step_sample(index, lo, c);
+		end[c] = step_sample(index, hi + 1, c);
+	}
+
+	file = fopen(work->path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				work->path, strerror(errno));
+		return false;
+	}
+
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		if (end[c] > start[c]) {
+			samples[c] = malloc((end[c] - start[c]) *
+					sizeof(*samples[c]));
+			if (samples[c] == NULL) {
+				fprintf(stderr, "Failed to allocate samples\n");
+				goto cleanup;
+			}
+		}
+	}
+
+	if (fseek(file, index->chunk[lo].offset, SEEK_SET) != 0) {
+		fprintf(stderr, "Failed to seek in '%s'\n", work->path);
+		goto cleanup;
+	}
+
+	while (!bl_sig_killed) {
+		skip_space(file);
+		if (ftell(file) >= index->chunk[hi].end ||
+		    !bl_msg_yaml_parse(file, &msg)) {
+			break;
+		}
+
+		if (msg.type == BL_MSG_SAMPLE_DATA16 ||
+		    msg.type == BL_MSG_SAMPLE_DATA32) {
+			unsigned c = msg.sample_data.channel;
+			double values[BL_SAMPLE_MAX];
+			unsigned n;
+
+			n = bl_sample_unpack_double(&msg.sample_data, values);
+			if (c >= BL_CHANNEL_MAX ||
+			    count[c] + n > end[c] - start[c]) {
+				fprintf(stderr, "Recording changed while "
+						"being processed\n");
+				goto cleanup;
+			}
+			memcpy(samples[c] + count[c], values,
+					n * sizeof(*values));
+			count[c] += n;
+		}
+	}
+
+	for (unsigned c = 0; c < BL_CHANNEL_MAX && !bl_sig_killed; c++) {
+		uint64_t own_start = step_sample(index, first, c);
+		uint64_t own_end = step_sample(index, last, c);
+
+		if (!segment_channel(work->options, index->frequency,
+				start[c], samples[c], count[c],
+				own_start - start[c], own_end - start[c],
+				&work->result[k * BL_CHANNEL_MAX + c])) {
+			goto cleanup;
+		}
+	}
+
+	ok = true;
+
+cleanup:
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		free(samples[c]);
+	}
+	fclose(file);
+	return ok;
+}
+
+static void *worker_main(void *pw)
+{
+	struct work *work = pw;
+
+	while (!bl_sig_killed) {
+		unsigned k;
+
+		pthread_mutex_lock(&work->lock);
+		k = work->next++;
+		if (work->failed) {
+			k = work->tasks;
+		}
+		pthread_mutex_unlock(&work->lock);
+
+		if (k >= work->tasks) {
+			break;
+		}
+
+		if (!process_chunk(work, k)) {
+			pthread_mutex_lock(&work->lock);
+			work->failed = true;
+			pthread_mutex_unlock(&work->lock);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static bool run_workers(struct work *work, unsigned jobs)
+{
+	pthread_t thread[jobs];
+	unsigned started;
+
+	for (started = 0; started < jobs; started++) {
+		if (pthread_create(&thread[started], NULL,
+				worker_main, work) != 0) {
+			fprintf(stderr, "Failed to start worker thread\n");
+			pthread_mutex_lock(&work->lock);
+			work->failed = true;
+			pthread_mutex_unlock(&work->lock);
+			break;
+		}
+	}
+
+	for (unsigned i = 0; i < started; i++) {
+		pthread_join(thread[i], NULL);
+	}
+
+	return !work->failed && !bl_sig_killed;
+}
+
+static void write_csv(const struct work *work)
+{
+	const struct options *options = work->options;
+
+	printf("channel");
+	for (unsigned f = 0; f < options->feature_count; f++) {
+		printf(",%s", features[options->feature[f]].name);
+	}
+	printf("\n");
+
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		for (unsigned k = 0; k < work->tasks; k++) {
+			const struct beat_list *list =
+					&work->result[k * BL_CHANNEL_MAX + c];
+
+			for (size_t b = 0; b < list->count; b++) {
+				printf("%u", c);
+				for (unsigned f = 0; f < options->feature_count; f++) {
+					printf(",%g", list->beat[b].value[
+							options->feature[f]]);
+				}
+				printf("\n");
+			}
+		}
+	}
+}
+
+static bool write_column_value(FILE *file, enum column_type type, double v)
+{
+	uint8_t u8 = v;
+	float f32 = v;
+
+	switch (type) {
+	case COLUMN_U8:
+		return fwrite(&u8, sizeof(u8), 1, file) == 1;
+	case COLUMN_F32:
+		return fwrite(&f32, sizeof(f32), 1, file) == 1;
+	case COLUMN_F64:
+		return fwrite(&v, sizeof(v), 1, file) == 1;
+	}
+
+	return false;
+}
+
+static bool write_column(FILE *file, const struct work *work, int feature)
+{
+	enum column_type type = (feature < 0) ?
+			COLUMN_U8 : features[feature].type;
+
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		for (unsigned k = 0; k < work->tasks; k++) {
+			const struct beat_list *list =
+					&work->result[k * BL_CHANNEL_MAX + c];
+
+			for (size_t b = 0; b < list->count; b++) {
+				double v = (feature < 0) ?
+						c : list->beat[b].value[feature];
+				if (!write_column_value(file, type, v)) {
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool write_column_header(FILE *file, const char *name,
+		enum column_type type)
+{
+	char padded[16] = { 0 };
+	uint32_t t = type;
+
+	strncpy(padded, name, sizeof(padded) - 1);
+
+	return fwrite(padded, sizeof(padded), 1, file) == 1 &&
+	       fwrite(&t, sizeof(t), 1, file) == 1;
+}
+
+static bool write_table(const struct work *work)
+{
+	const struct options *options = work->options;
+	uint32_t columns = options->feature_count + 1;
+	uint64_t rows = 0;
+	bool ok;
+	FILE *file;
+
+	for (unsigned i = 0; i < work->tasks * BL_CHANNEL_MAX; i++) {
+		rows += work->result[i].count;
+	}
+
+	file = fopen(options->output, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				options->output, strerror(errno));
+		return false;
+	}
+
+	ok = fwrite(TABLE_MAGIC, sizeof(TABLE_MAGIC), 1, file) == 1 &&
+	     fwrite(&columns, sizeof(columns), 1, file) == 1 &&
+	     fwrite(&rows, sizeof(rows), 1, file) == 1 &&
+	     write_column_header(file, "channel", COLUMN_U8);
+
+	for (unsigned f = 0; ok && f < options->feature_count; f++) {
+		const struct feature_info *info =
+				&features[options->feature[f]];
+		ok = write_column_header(file, info->name, info->type);
+	}
+
+	ok = ok && write_column(file, work, -1);
+	for (unsigned f = 0; ok && f < options->feature_count; f++) {
+		ok = write_column(file, work, options->feature[f]);
+	}
+
+	if (fclose(file) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		fprintf(stderr, "Failed to write '%s'\n", options->output);
+	}
+	return ok;
+}
+
+static int process_recording(const char *path, const struct options *options)
+{
+	struct work work = {
+		.path = path,
+		.options = options,
+	};
+	struct bl_index index;
+	int ret = EXIT_FAILURE;
+	unsigned step;
+	unsigned jobs;
+
+	// A second's slack, as steps end on message boundaries
+	step = ceil(context_seconds(options)) + 1;
+	if (!bl_index_build(path, step, &index)) {
+		return EXIT_FAILURE;
+	}
+
+	if (index.frequency == 0) {
+		fprintf(stderr, "No Start message in '%s'\n", path);
+		goto cleanup;
+	}
+
+	work.index = &index;
+	work.steps = (options->chunk_length > step) ?
+			options->chunk_length / step : 1;
+	work.tasks = (index.count + work.steps - 1) / work.steps;
+	work.result = calloc(work.tasks * BL_CHANNEL_MAX,
+			sizeof(*work.result));
+	if (work.result == NULL) {
+		fprintf(stderr, "Failed to allocate results\n");
+		goto cleanup;
+	}
+
+	if (pthread_mutex_init(&work.lock, NULL) != 0) {
+		fprintf(stderr, "Failed to create mutex\n");
+		goto cleanup;
+	}
+
+	jobs = (options->jobs < work.tasks) ? options->jobs : work.tasks;
+	if (run_workers(&work, jobs)) {
+		if (options->output != NULL) {
+			ret = write_table(&work) ? EXIT_SUCCESS : EXIT_FAILURE;
+		} else {
+			write_csv(&work);
+			ret = EXIT_SUCCESS;
+		}
+	}
+
+	pthread_mutex_destroy(&work.lock);
+
+cleanup:
+	if (work.result != NULL) {
+		for (unsigned i = 0; i < work.tasks * BL_CHANNEL_MAX; i++) {
+			free(work.result[i].beat);
+		}
+		free(work.result);
+	}
+	bl_index_fini(&index);
+	return ret;
+}
+
+static void usage(FILE* file, char *argv[])
+{
+	fprintf(file, "Finds the beats in a recording and measures features "
+			"of each beat's pulse\n");
+	fprintf(file, "The recording is split into chunks which are processed "
+			"in parallel\n");
+	fprintf(file, "By default it outputs CSV, with a row for each beat, "
+			"ordered by channel and time\n");
+	fprintf(file, "\n");
+	fprintf(file, "Usage: %s [OPTIONS] RECORDING\n", argv[0]);
+	fprintf(file, "  RECORDING: Acquisition recording file to analyse\n");
+	fprintf(file, "\n");
+	fprintf(file, "Options:\n");
+	fprintf(file, "  -f, --features LIST  Comma separated features to "
+			"output (default all)\n");
+	fprintf(file, "  -o, --output PATH    Write a binary columnar table "
+			"instead of CSV\n");
+	fprintf(file, "  -j, --jobs N         Number of worker threads "
+			"(default one per CPU)\n");
+	fprintf(file, "  -c, --chunk SECONDS  Chunk length (default %"PRIu32", "
+			"minimum %"PRIu32")\n",
+			DEFAULT_CHUNK_LENGTH, MIN_CHUNK_LENGTH);
+	fprintf(file, "  -l, --level FRACTION Peak level, relative to the "
+			"largest nearby peak (default %g)\n", DEFAULT_LEVEL);
+	fprintf(file, "  -r, --refractory S   Minimum beat interval in seconds "
+			"(default %g)\n", DEFAULT_REFRACTORY);
+	fprintf(file, "  -i, --invert         Invert the signal before looking "
+			"for peaks\n");
+	fprintf(file, "  -h, --help           Print this help\n");
+	fprintf(file, "\n");
+	fprintf(file, "Features:\n");
+	for (unsigned f = 0; f < FEATURE__COUNT; f++) {
+		fprintf(file, "  %-10s %s\n", features[f].name,
+				features[f].description);
+	}
+}
+
+static bool parse_features(const char *list, struct options *options)
+{
+	char *copy = strdup(list);
+	char *save = NULL;
+	bool ok = true;
+
+	if (copy == NULL) {
+		return false;
+	}
+
+	options->feature_count = 0;
+	for (char *name = strtok_r(copy, ",", &save); name != NULL;
+			name = strtok_r(NULL, ",", &save)) {
+		unsigned f;
+
+		for (f = 0; f < FEATURE__COUNT; f++) {
+			if (strcmp(name, features[f].name) == 0) {
+				break;
+			}
+		}
+		for (unsigned i = 0; i < options->feature_count; i++) {
+			if (options->feature[i] == f) {
+				f = FEATURE__COUNT;
+			}
+		}
+
+		if (f == FEATURE__COUNT) {
+			fprintf(stderr, "Unknown or repeated feature '%s'\n",
+					name);
+			ok = false;
+			break;
+		}
+		options->feature[options->feature_count++] = f;
+	}
+
+	if (ok && options->feature_count == 0) {
+		fprintf(stderr, "No features selected\n");
+		ok = false;
+	}
+
+	free(copy);
+	return ok;
+}
+
+static bool parse_options(int argc, char *argv[],
+		struct options *options)
+{
+	const struct option long_options[] = {
+		{ "features",   required_argument, NULL, 'f' },
+		{ "output",     required_argument, NULL, 'o' },
+		{ "jobs",       required_argument, NULL, 'j' },
+		{ "chunk",      required_argument, NULL, 'c' },
+		{ "level",      required_argument, NULL, 'l' },
+		{ "refractory", required_argument, NULL, 'r' },
+		{ "invert",     no_argument,       NULL, 'i' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ NULL,         0,                 NULL,  0  },
+	};
+	int c;
+
+	while ((c = getopt_long(argc, argv, "f:o:j:c:l:r:ih",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			if (!parse_features(optarg, options)) {
+				return false;
+			}
+			break;
+		case 'o':
+			options->output = optarg;
+			break;
+		case 'j':
+			if (!read_sized_uint(optarg, &options->jobs,
+					sizeof(options->jobs)) ||
+			    options->jobs == 0) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'c':
+			if (!read_sized_uint(optarg, &options->chunk_length,
+					sizeof(options->chunk_length)) ||
+			    options->chunk_length < MIN_CHUNK_LENGTH) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'l':
+			if (!read_double(optarg, &options->level) ||
+			    !(options->level > 0) || !(options->level < 1)) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'r':
+			if (!read_double(optarg, &options->refractory) ||
+			    !(options->refractory > 0) ||
+			    options->refractory > MIN_CHUNK_LENGTH / 2) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'i':
+			options->invert = true;
+			break;
+		case 'h':
+			usage(stdout, argv);
+			exit(EXIT_SUCCESS);
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct options options = {
+		.chunk_length = DEFAULT_CHUNK_LENGTH,
+		.level = DEFAULT_LEVEL,
+		.refractory = DEFAULT_REFRACTORY,
+	};
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (unsigned f = 0; f < FEATURE__COUNT; f++) {
+		options.feature[options.feature_count++] = f;
+	}
+	options.jobs = (cpus > 0) ? cpus : 1;
+
+	if (!parse_options(argc, argv, &options)) {
+		usage(stderr, argv);
+		return EXIT_FAILURE;
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "%d is the wrong number of arguments\n", argc);
+		usage(stderr, argv);
+		return EXIT_FAILURE;
+	}
+
+	if (!bl_sig_init()) {
+		return EXIT_FAILURE;
+	}
+
+	return process_recording(argv[optind], &options);
+}
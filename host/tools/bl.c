@@ -418,6 +418,32 @@ int bl_cmd_receive_and_print_loop(int dev_fd)
 	return ret;
 }
 
+/**
+ * Print incoming messages until the acquisition is aborted.
+ *
+ * If the user interrupts us, the acquisition is aborted before returning.
+ *
+ * \param[in]  dev_fd    Device file descriptor.
+ * \param[in]  dev_path  Device path, (only used for error logging).
+ * \return EXIT_SUCCESS on success, or EXIT_FAILURE on error.
+ */
+static int bl_cmd__stream(int dev_fd, const char *dev_path)
+{
+	int ret = bl_cmd_receive_and_print_loop(dev_fd);
+
+	/* Send abort after ctrl+c */
+	if (bl_sig_killed) {
+		union bl_msg_data abort_msg = {
+			.type = BL_MSG_ABORT,
+		};
+		bl_msg_write(dev_fd, dev_path, &abort_msg);
+		bl_sig_killed = false;
+		bl_cmd_receive_and_print_loop(dev_fd);
+	}
+
+	return ret;
+}
+
 static int bl_cmd_start_stream(
 		int argc,
 		char *argv[])
@@ -499,17 +525,7 @@ static int bl_cmd_start_stream(
 		return EXIT_FAILURE;
 	}
 
-	ret = bl_cmd_receive_and_print_loop(dev_fd);
-
-	/* Send abort after ctrl+c */
-	if (bl_sig_killed) {
-		union bl_msg_data abort_msg = {
-			.type = BL_MSG_ABORT,
-		};
-		bl_msg_write(dev_fd, argv[ARG_DEV_PATH], &abort_msg);
-		bl_sig_killed = false;
-		bl_cmd_receive_and_print_loop(dev_fd);
-	}
+	ret = bl_cmd__stream(dev_fd, argv[ARG_DEV_PATH]);
 
 	bl_device_close(dev_fd);
 	return ret;
@@ -583,6 +599,189 @@ static int bl_cmd_abort(int argc, char *argv[])
 	return bl_cmd__no_params_helper(argc, argv, BL_MSG_ABORT);
 }
 
+/**
+ * Wait for the reply to the oldest outstanding command of a batch.
+ *
+ * Any other messages received in the meantime, such as sample data,
+ * are printed too.
+ *
+ * \param[in]  dev_fd  Device file descriptor.
+ * \return 0 on success, the error code the device replied with, or
+ *         EXIT_FAILURE if no reply was received.
+ */
+static int bl_cmd__batch_reply(int dev_fd)
+{
+	union bl_msg_data msg;
+
+	do {
+		if (!bl_msg_read(dev_fd, 10000, &msg)) {
+			return EXIT_FAILURE;
+		}
+		bl_msg_yaml_print(stdout, &msg);
+	} while (bl_msg_reply_to(&msg) == BL_MSG__COUNT);
+
+	if (msg.type == BL_MSG_RESPONSE &&
+	    msg.response.error_code != BL_ERROR_NONE) {
+		return msg.response.error_code;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the number of commands the device accepts without waiting for replies.
+ *
+ * Older firmware loses commands sent back to back, so commands are only
+ * pipelined if the device reports that it supports it.
+ *
+ * \param[in]  dev_fd    Device file descriptor.
+ * \param[in]  dev_path  Device path, for error messages.
+ * \return the pipeline depth, or zero on failure.
+ */
+static unsigned bl_cmd__batch_depth(int dev_fd, const char *dev_path)
+{
+	union bl_msg_data msg = {
+		.version_req = {
+			.type = BL_MSG_VERSION_REQ,
+		}
+	};
+
+	if (!bl_msg_write(dev_fd, dev_path, &msg)) {
+		return 0;
+	}
+
+	do {
+		if (!bl_msg_read(dev_fd, 10000, &msg)) {
+			return 0;
+		}
+	} while (msg.type != BL_MSG_VERSION);
+
+	if (!(msg.version.capabilities & BL_MSG_CAP_PIPELINE)) {
+		fprintf(stderr, "Device firmware does not support pipelined "
+				"commands; waiting for each reply\n");
+		return 1;
+	}
+
+	return BL_MSG_PIPELINE_MAX;
+}
+
+static int bl_cmd_batch(int argc, char *argv[])
+{
+	union bl_msg_data msg;
+	unsigned outstanding = 0;
+	unsigned depth;
+	bool streaming = false;
+	FILE *file = stdin;
+	int ret = 0;
+	int dev_fd;
+	enum {
+		ARG_PROG,
+		ARG_CMD,
+		ARG_DEV_PATH,
+		ARG_FILE,
+		ARG__COUNT,
+	};
+
+	if (argc < ARG_FILE || argc > ARG__COUNT) {
+		fprintf(stderr, "Usage:\n");
+		fprintf(stderr, "  %s %s \\\n"
+				"  \t<DEVICE_PATH|--auto|-a> \\\n"
+				"  \t[FILE]\n",
+				argv[ARG_PROG],
+				argv[ARG_CMD]);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Send a sequence of messages to the device, "
+				"without waiting for each\n");
+		fprintf(stderr, "reply before sending the next.  Devices with "
+				"older firmware that\n");
+		fprintf(stderr, "can't accept this are sent one message "
+				"at a time.\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Messages are read as YAML, in the format "
+				"printed by the other commands,\n");
+		fprintf(stderr, "from FILE, or from stdin if FILE is "
+				"not provided.\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "If the sequence starts an acquisition, "
+				"samples are printed until it\n");
+		fprintf(stderr, "is aborted.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc > ARG_FILE) {
+		file = fopen(argv[ARG_FILE], "r");
+		if (file == NULL) {
+			fprintf(stderr, "Error: Failed to open '%s': %s\n",
+					argv[ARG_FILE], strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	dev_fd = bl_device_open(argv[ARG_DEV_PATH]);
+	if (dev_fd == -1) {
+		ret = EXIT_FAILURE;
+		goto error;
+	}
+
+	depth = bl_cmd__batch_depth(dev_fd, argv[ARG_DEV_PATH]);
+	if (depth == 0) {
+		fprintf(stderr, "Error: Failed to get device version\n");
+		bl_device_close(dev_fd);
+		ret = EXIT_FAILURE;
+		goto error;
+	}
+
+	while (ret == 0 && bl_msg_yaml_parse(file, &msg)) {
+		if (outstanding == depth) {
+			ret = bl_cmd__batch_reply(dev_fd);
+			outstanding--;
+		}
+		if (ret != 0) {
+			break;
+		}
+
+		bl_msg_yaml_print(stdout, &msg);
+		if (!bl_msg_write(dev_fd, argv[ARG_DEV_PATH], &msg)) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		outstanding++;
+
+		if (msg.type == BL_MSG_START) {
+			streaming = true;
+		} else if (msg.type == BL_MSG_ABORT) {
+			streaming = false;
+		}
+	}
+
+	if (ret == 0 && !feof(file)) {
+		fprintf(stderr, "Error: Failed to parse message\n");
+		ret = EXIT_FAILURE;
+	}
+
+	while (outstanding > 0) {
+		int err = bl_cmd__batch_reply(dev_fd);
+		if (err == EXIT_FAILURE) {
+			ret = err;
+			break;
+		} else if (err != 0 && ret == 0) {
+			ret = err;
+		}
+		outstanding--;
+	}
+
+	if (ret == 0 && streaming) {
+		ret = bl_cmd__stream(dev_fd, argv[ARG_DEV_PATH]);
+	}
+
+	bl_device_close(dev_fd);
+error:
+	if (file != stdin) {
+		fclose(file);
+	}
+	return ret;
+}
+
 static const struct bl_cmd {
 	const char *name;
 	const char *help;
@@ -623,6 +822,11 @@ static const struct bl_cmd {
 		.help = "Abort an acquisition",
 		.fn = bl_cmd_abort,
 	},
+	{
+		.name = "batch",
+		.help = "Send a sequence of messages without waiting for replies",
+		.fn = bl_cmd_batch,
+	},
 };
 
 static void bl_cmd_help(const char *prog)
@@ -26,6 +26,7 @@
 
 #include "host/common/msg.h"
 #include "host/common/sig.h"
+#include "host/common/sample.h"
 
 #include "util.h"
 
@@ -51,15 +52,14 @@ static inline double calculate_bpm(const struct channel_data *channel)
 void channel_process_sample(struct channel_data *channel,
 		uint32_t peak_threshold, const bl_msg_sample_data_t *msg)
 {
-	uint32_t value;
-	for (uint8_t i = 0; i < msg->count; i++) {
-		if (msg->type == BL_MSG_SAMPLE_DATA16) {
-			/* Upscale 16-bit samples to 32-bit. */
-			value = msg->data16[i];
-			value = (value << 16) | value;
-		} else {
-			value = msg->data32[i];
-		}
+	uint32_t values[BL_SAMPLE_MAX];
+	unsigned count;
+
+	/* Upscale 16-bit samples to 32-bit. */
+	count = bl_sample_unpack_scaled(msg, values);
+
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t value = values[i];
 
 		if (value >= peak_threshold) {
 			if (!channel->in_peak) {
@@ -29,6 +29,7 @@
 
 #include "host/common/msg.h"
 #include "host/common/sig.h"
+#include "host/common/sample.h"
 
 struct channel_conf {
 	bool     enabled;
@@ -114,12 +115,16 @@ static void bl__handle_sample_data32(
 		struct channel_conf conf[BL_ACQ_SOURCE_MAX])
 {
 	unsigned channel = msg->sample_data.channel;
+	uint32_t samples[BL_SAMPLE_MAX];
+	unsigned count;
+
 	if (channel >= BL_ACQ_SOURCE_MAX) {
 		return;
 	}
 
-	for (unsigned i = 0; i < msg->sample_data.count; i++) {
-		uint32_t sample = msg->sample_data.data32[i];
+	count = bl_sample_unpack(&msg->sample_data, samples);
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t sample = samples[i];
 		if (sample < conf[channel].sample_min) {
 			conf[channel].sample_min = sample;
 		}
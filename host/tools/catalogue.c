@@ -0,0 +1,902 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "common/acq.h"
+#include "common/msg.h"
+#include "common/util.h"
+#include "common/channel.h"
+
+#include "host/common/msg.h"
+#include "host/common/sig.h"
+#include "host/common/catalogue.h"
+
+#include "util.h"
+
+typedef int (* bl_cmd_fn)(int argc, char *argv[]);
+
+// Options for value filters, which only have long forms
+enum {
+	OPT_MIN_DURATION = 256,
+	OPT_MAX_DURATION,
+	OPT_CLIPPED,
+	OPT_DROPPED,
+};
+
+struct filter {
+	double since;        // Earliest start time, or 0
+	double until;        // Start time limit, or 0
+	double min_duration; // Shortest duration in seconds, or 0
+	double max_duration; // Longest duration in seconds, or 0
+	uint32_t frequency;  // Sampling rate in Hz, or 0
+	int leds;            // Number of LEDs used, or -1
+	int flash_mode;      // Flash mode, or -1
+	int detection_mode;  // Detection mode, or -1
+	int calibration;     // Whether a calibration, or -1
+	int channel;         // Channel that must have samples, or -1
+	bool clipped;        // Only recordings with clipped samples
+	bool dropped;        // Only recordings with missing samples
+};
+
+struct item {
+	char *path;                      // Recording path, as given
+	struct bl_catalogue_entry entry; // Entry made from the recording
+	bool ok;                         // Whether the entry was made
+};
+
+// Recordings to scan, shared by the worker threads
+struct work {
+	struct item *item;
+	unsigned count;
+	unsigned next;
+	pthread_mutex_t lock;
+};
+
+static void *worker_main(void *pw)
+{
+	struct work *work = pw;
+
+	while (!bl_sig_killed) {
+		unsigned k;
+
+		pthread_mutex_lock(&work->lock);
+		k = work->next++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (k >= work->count) {
+			break;
+		}
+
+		work->item[k].ok = bl_catalogue_scan_file(work->item[k].path,
+				&work->item[k].entry);
+	}
+
+	return NULL;
+}
+
+static bool run_workers(struct work *work, unsigned jobs)
+{
+	pthread_t thread[jobs];
+	unsigned started;
+
+	for (started = 0; started < jobs; started++) {
+		if (pthread_create(&thread[started], NULL,
+				worker_main, work) != 0) {
+			fprintf(stderr, "Failed to start worker thread\n");
+			break;
+		}
+	}
+
+	// If no threads could be started, scan on this one
+	if (started == 0) {
+		worker_main(work);
+	}
+
+	for (unsigned i = 0; i < started; i++) {
+		pthread_join(thread[i], NULL);
+	}
+
+	return !bl_sig_killed;
+}
+
+static bool is_recording_name(const char *name)
+{
+	static const char *const suffix[] = { "-acq.yaml", "-cal.yaml" };
+	size_t len = strlen(name);
+
+	for (unsigned i = 0; i < BL_ARRAY_LEN(suffix); i++) {
+		size_t s_len = strlen(suffix[i]);
+
+		if (len > s_len &&
+		    strcmp(name + len - s_len, suffix[i]) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool add_item(struct work *work, const char *path)
+{
+	struct item *item;
+
+	if ((work->count & (work->count - 1)) == 0) {
+		unsigned alloc = (work->count > 0) ? work->count * 2 : 16;
+
+		item = realloc(work->item, alloc * sizeof(*item));
+		if (item == NULL) {
+			return false;
+		}
+		work->item = item;
+	}
+
+	item = &work->item[work->count];
+	memset(item, 0, sizeof(*item));
+
+	item->path = strdup(path);
+	if (item->path == NULL) {
+		return false;
+	}
+
+	work->count++;
+	return true;
+}
+
+// Add the recordings in a directory, or a single recording, to the work
+static bool add_path(struct work *work, const char *path)
+{
+	struct dirent *ent;
+	struct stat st;
+	bool ok = true;
+	DIR *dir;
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "Failed to stat '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		return add_item(work, path);
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				path, strerror(errno));
+		return false;
+	}
+
+	while (ok && (ent = readdir(dir)) != NULL) {
+		size_t len = strlen(path) + strlen(ent->d_name) + 2;
+		char *file;
+
+		if (!is_recording_name(ent->d_name)) {
+			continue;
+		}
+
+		file = malloc(len);
+		if (file == NULL) {
+			ok = false;
+			break;
+		}
+
+		snprintf(file, len, "%s/%s", path, ent->d_name);
+		ok = add_item(work, file);
+		free(file);
+	}
+
+	closedir(dir);
+	return ok;
+}
+
+static void free_work(struct work *work)
+{
+	for (unsigned i = 0; i < work->count; i++) {
+		free(work->item[i].path);
+		free(work->item[i].entry.path);
+	}
+	free(work->item);
+}
+
+static void scan_usage(FILE *file, char *argv[], const char *description)
+{
+	fprintf(file, "%s\n", description);
+	fprintf(file, "\n");
+	fprintf(file, "Usage: %s %s [OPTIONS] PATH...\n", argv[0], argv[1]);
+	fprintf(file, "  PATH: Recording file, or directory of recordings\n");
+	fprintf(file, "\n");
+	fprintf(file, "Options:\n");
+	fprintf(file, "  -c, --catalogue PATH Catalogue file (default %s)\n",
+			BL_CATALOGUE_DEFAULT_PATH);
+	fprintf(file, "  -j, --jobs N         Number of worker threads "
+			"(default one per CPU)\n");
+	fprintf(file, "  -h, --help           Print this help\n");
+}
+
+// Scan recordings into the catalogue, and save it.
+//
+// If rebuild is set, the catalogue only keeps the recordings that are
+// scanned.  Otherwise recordings already in the catalogue are only scanned
+// if they have changed, and all existing entries are kept.
+static int scan_recordings(int argc, char *argv[], bool rebuild,
+		const char *description)
+{
+	const struct option long_options[] = {
+		{ "catalogue", required_argument, NULL, 'c' },
+		{ "jobs",      required_argument, NULL, 'j' },
+		{ "help",      no_argument,       NULL, 'h' },
+		{ NULL,        0,                 NULL,  0  },
+	};
+	const char *path = BL_CATALOGUE_DEFAULT_PATH;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t jobs = (cpus > 0) ? cpus : 1;
+	struct work work = { 0 };
+	struct bl_catalogue cat;
+	unsigned scanned = 0;
+	unsigned failed = 0;
+	int ret = EXIT_FAILURE;
+	int c;
+
+	optind = 2;
+	while ((c = getopt_long(argc, argv, "c:j:h",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			path = optarg;
+			break;
+		case 'j':
+			if (!read_sized_uint(optarg, &jobs, sizeof(jobs)) ||
+			    jobs == 0) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			scan_usage(stdout, argv, description);
+			return EXIT_SUCCESS;
+		default:
+			scan_usage(stderr, argv, description);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind == argc) {
+		scan_usage(stderr, argv, description);
+		return EXIT_FAILURE;
+	}
+
+	// A rebuild doesn't keep any entries, so it doesn't read them, and
+	// can replace a catalogue from a different version
+	if (!(rebuild ? bl_catalogue_replace(path, &cat) :
+			bl_catalogue_load(path, &cat))) {
+		return EXIT_FAILURE;
+	}
+
+	for (int i = optind; i < argc; i++) {
+		if (!add_path(&work, argv[i])) {
+			goto cleanup;
+		}
+	}
+
+	if (!rebuild) {
+		unsigned kept = 0;
+
+		// Drop recordings whose entries are still current
+		for (unsigned i = 0; i < work.count; i++) {
+			char *real = realpath(work.item[i].path, NULL);
+			const struct bl_catalogue_entry *entry = (real == NULL) ?
+					NULL : bl_catalogue_find(&cat, real);
+
+			free(real);
+			if (entry != NULL && bl_catalogue_entry_current(entry)) {
+				free(work.item[i].path);
+				continue;
+			}
+			work.item[kept++] = work.item[i];
+		}
+		work.count = kept;
+	}
+
+	if (pthread_mutex_init(&work.lock, NULL) != 0) {
+		goto cleanup;
+	}
+
+	if (jobs > work.count) {
+		jobs = (work.count > 0) ? work.count : 1;
+	}
+
+	if (!run_workers(&work, jobs)) {
+		pthread_mutex_destroy(&work.lock);
+		goto cleanup;
+	}
+	pthread_mutex_destroy(&work.lock);
+
+	for (unsigned i = 0; i < work.count; i++) {
+		struct item *item = &work.item[i];
+
+		if (!item->ok) {
+			failed++;
+			continue;
+		}
+
+		if (!bl_catalogue_add(&cat, &item->entry)) {
+			goto cleanup;
+		}
+		item->entry.path = NULL;
+		scanned++;
+	}
+
+	if (bl_catalogue_save(path, &cat)) {
+		ret = EXIT_SUCCESS;
+	}
+
+	fprintf(stderr, "Scanned %u recordings, %u failed, "
+			"%u in catalogue\n", scanned, failed, cat.count);
+
+cleanup:
+	free_work(&work);
+	bl_catalogue_fini(&cat);
+	return ret;
+}
+
+static int bl_cmd_update(int argc, char *argv[])
+{
+	return scan_recordings(argc, argv, false,
+			"Adds new or changed recordings to a catalogue");
+}
+
+static int bl_cmd_rebuild(int argc, char *argv[])
+{
+	return scan_recordings(argc, argv, true,
+			"Replaces a catalogue's contents with the given recordings");
+}
+
+// Parse a local time of the form "YYYY-MM-DD[.HH:MM[:SS]]"
+static bool read_time(const char *value, double *out)
+{
+	struct tm tm = { .tm_isdst = -1 };
+	int fields;
+	int end = 0;
+	time_t t;
+
+	fields = sscanf(value, "%4d-%2d-%2d%n.%2d:%2d%n:%2d%n",
+			&tm.tm_year, &tm.tm_mon, &tm.tm_mday, &end,
+			&tm.tm_hour, &tm.tm_min, &end,
+			&tm.tm_sec, &end);
+	if (fields < 3 || fields == 4 || value[end] != '\0') {
+		return false;
+	}
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+
+	t = mktime(&tm);
+	if (t == (time_t) -1) {
+		return false;
+	}
+
+	*out = t;
+	return true;
+}
+
+static bool read_choice(const char *value, const char *const choice[],
+		unsigned count, int *out)
+{
+	for (unsigned i = 0; i < count; i++) {
+		if (strcmp(value, choice[i]) == 0) {
+			*out = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static const char *const flash_modes[] = {
+	[BL_ACQ_CONTINUOUS] = "continuous",
+	[BL_ACQ_FLASH]      = "flash",
+};
+
+static const char *const detection_modes[] = {
+	[BL_ACQ_REFLECTIVE]   = "reflective",
+	[BL_ACQ_TRANSMISSIVE] = "transmissive",
+};
+
+static const char *const recording_types[] = { "acq", "cal" };
+
+static const char *mode_name(const char *const names[], unsigned count,
+		unsigned mode)
+{
+	return (mode < count) ? names[mode] : "unknown";
+}
+
+static uint64_t entry_clipped(const struct bl_catalogue_info *info)
+{
+	uint64_t clipped = 0;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		clipped += info->channel[i].high + info->channel[i].low;
+	}
+
+	return clipped;
+}
+
+static uint64_t entry_missing(const struct bl_catalogue_info *info)
+{
+	uint64_t missing = 0;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		missing += info->channel[i].missing;
+	}
+
+	return missing;
+}
+
+static uint64_t entry_samples(const struct bl_catalogue_info *info)
+{
+	uint64_t samples = 0;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		samples += info->channel[i].samples;
+	}
+
+	return samples;
+}
+
+static unsigned entry_channels(const struct bl_catalogue_info *info)
+{
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		count += (info->channel[i].samples != 0);
+	}
+
+	return count;
+}
+
+static bool filter_match(const struct filter *filter,
+		const struct bl_catalogue_info *info)
+{
+	if (filter->since != 0 && info->start < filter->since) {
+		return false;
+	}
+	if (filter->until != 0 && info->start >= filter->until) {
+		return false;
+	}
+	if (filter->min_duration != 0 &&
+	    info->duration < filter->min_duration) {
+		return false;
+	}
+	if (filter->max_duration != 0 &&
+	    info->duration > filter->max_duration) {
+		return false;
+	}
+	if (filter->frequency != 0 &&
+	    info->acq.frequency != filter->frequency) {
+		return false;
+	}
+	if (filter->leds >= 0 &&
+	    __builtin_popcount(info->acq.led_mask) != filter->leds) {
+		return false;
+	}
+	if (filter->flash_mode >= 0 &&
+	    info->acq.flash_mode != filter->flash_mode) {
+		return false;
+	}
+	if (filter->detection_mode >= 0 &&
+	    info->acq.detection_mode != filter->detection_mode) {
+		return false;
+	}
+	if (filter->calibration >= 0 &&
+	    info->calibration != filter->calibration) {
+		return false;
+	}
+	if (filter->channel >= 0 &&
+	    info->channel[filter->channel].samples == 0) {
+		return false;
+	}
+	if (filter->clipped && entry_clipped(info) == 0) {
+		return false;
+	}
+	if (filter->dropped && entry_missing(info) == 0) {
+		return false;
+	}
+
+	return true;
+}
+
+static void format_time(double t, char *buf, size_t size)
+{
+	time_t secs = t;
+	struct tm tm;
+
+	if (localtime_r(&secs, &tm) == NULL ||
+	    strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm) == 0) {
+		snprintf(buf, size, "%.0f", t);
+	}
+}
+
+static void print_short(const struct bl_catalogue_entry *entry)
+{
+	const struct bl_catalogue_info *info = &entry->info;
+	uint64_t samples = entry_samples(info);
+	char start[32];
+
+	format_time(info->start, start, sizeof(start));
+
+	printf("%s  %s  %5"PRIu16" Hz  %-10s  %2u LEDs  %9.1f s  %2u ch  "
+			"clip %6.2f%%  drop %4"PRIu64"  %s\n",
+			start,
+			recording_types[info->calibration],
+			info->acq.frequency,
+			mode_name(flash_modes, BL_ARRAY_LEN(flash_modes),
+					info->acq.flash_mode),
+			__builtin_popcount(info->acq.led_mask),
+			info->duration,
+			entry_channels(info),
+			(samples > 0) ? entry_clipped(info) * 100.0 / samples : 0,
+			entry_missing(info),
+			entry->path);
+}
+
+static void print_long(const struct bl_catalogue_entry *entry)
+{
+	const struct bl_catalogue_info *info = &entry->info;
+	char start[32];
+
+	format_time(info->start, start, sizeof(start));
+
+	printf("- Path: %s\n", entry->path);
+	printf("  Start: %s\n", start);
+	printf("  Type: %s\n", info->calibration ? "calibration" : "acquisition");
+	printf("  Duration: %.3f\n", info->duration);
+	printf("  Size: %"PRIu64"\n", info->size);
+	printf("  Acquisitions: %"PRIu32"\n", info->acquisitions);
+	printf("  Complete: %s\n", info->complete ? "yes" : "no");
+	printf("  Errors: %"PRIu32"\n", info->errors);
+	printf("  Detection Mode: %s\n", mode_name(detection_modes,
+			BL_ARRAY_LEN(detection_modes),
+			info->acq.detection_mode));
+	printf("  Flash Mode: %s\n", mode_name(flash_modes,
+			BL_ARRAY_LEN(flash_modes), info->acq.flash_mode));
+	printf("  Frequency: %"PRIu16"\n", info->acq.frequency);
+	printf("  Source Mask: 0x%"PRIx16"\n", info->acq.src_mask);
+	printf("  LED Mask: 0x%"PRIx16"\n", info->acq.led_mask);
+
+	if (info->source_mask != 0) {
+		printf("  Sources:\n");
+	}
+	for (unsigned i = 0; i < BL_ACQ_SOURCE_MAX; i++) {
+		const bl_msg_source_conf_t *conf = &info->source[i];
+
+		if (!(info->source_mask & (1u << i))) {
+			continue;
+		}
+
+		printf("  - Source: %u\n", i);
+		printf("    Op-Amp Gain: %"PRIu8"\n", conf->opamp_gain);
+		printf("    Op-Amp Offset: %"PRIu16"\n", conf->opamp_offset);
+		printf("    Software Oversample: %"PRIu16"\n",
+				conf->sw_oversample);
+		printf("    Hardware Oversample: %"PRIu8"\n",
+				conf->hw_oversample);
+		printf("    Hardware Shift: %"PRIu8"\n", conf->hw_shift);
+	}
+
+	if (info->channel_mask != 0) {
+		printf("  Channels:\n");
+	}
+	for (unsigned i = 0; i < BL_CHANNEL_MAX; i++) {
+		const struct bl_catalogue_channel *channel = &info->channel[i];
+
+		if (!(info->channel_mask & (1u << i))) {
+			continue;
+		}
+
+		printf("  - Channel: %u\n", i);
+		printf("    Source: %"PRIu8"\n", channel->conf.source);
+		printf("    Shift: %"PRIu8"\n", channel->conf.shift);
+		printf("    Offset: %"PRIu32"\n", channel->conf.offset);
+		printf("    Sample32: %"PRIu8"\n", channel->conf.sample32);
+		printf("    Samples: %"PRIu64"\n", channel->samples);
+		printf("    Clipped High: %"PRIu64"\n", channel->high);
+		printf("    Clipped Low: %"PRIu64"\n", channel->low);
+		printf("    Missing: %"PRIu64"\n", channel->missing);
+	}
+}
+
+static int cmp_start(const void *a, const void *b)
+{
+	const struct bl_catalogue_entry *ea = *(const struct bl_catalogue_entry **) a;
+	const struct bl_catalogue_entry *eb = *(const struct bl_catalogue_entry **) b;
+
+	if (ea->info.start != eb->info.start) {
+		return (ea->info.start < eb->info.start) ? -1 : 1;
+	}
+	return strcmp(ea->path, eb->path);
+}
+
+static void query_usage(FILE *file, char *argv[])
+{
+	fprintf(file, "Lists the recordings in a catalogue which match all of "
+			"the given filters\n");
+	fprintf(file, "The recordings themselves are not read\n");
+	fprintf(file, "\n");
+	fprintf(file, "Usage: %s %s [OPTIONS]\n", argv[0], argv[1]);
+	fprintf(file, "\n");
+	fprintf(file, "Options:\n");
+	fprintf(file, "  -c, --catalogue PATH Catalogue file (default %s)\n",
+			BL_CATALOGUE_DEFAULT_PATH);
+	fprintf(file, "  -s, --since TIME     Started at or after TIME\n");
+	fprintf(file, "  -u, --until TIME     Started before TIME\n");
+	fprintf(file, "      --min-duration S Lasted at least S seconds\n");
+	fprintf(file, "      --max-duration S Lasted at most S seconds\n");
+	fprintf(file, "  -f, --frequency HZ   Sampled at HZ\n");
+	fprintf(file, "  -n, --leds N         Used N LEDs\n");
+	fprintf(file, "  -m, --mode MODE      Flash mode: continuous or flash\n");
+	fprintf(file, "  -d, --detection MODE Detection mode: reflective or "
+			"transmissive\n");
+	fprintf(file, "  -t, --type TYPE      Recording type: acq or cal\n");
+	fprintf(file, "  -C, --channel N      Has samples for channel N\n");
+	fprintf(file, "      --clipped        Has clipped samples\n");
+	fprintf(file, "      --dropped        Has missing samples\n");
+	fprintf(file, "  -l, --long           Print everything known about "
+			"each recording\n");
+	fprintf(file, "  -h, --help           Print this help\n");
+	fprintf(file, "\n");
+	fprintf(file, "TIME is local time, as YYYY-MM-DD[.HH:MM[:SS]]\n");
+}
+
+static int bl_cmd_query(int argc, char *argv[])
+{
+	const struct option long_options[] = {
+		{ "catalogue",    required_argument, NULL, 'c' },
+		{ "since",        required_argument, NULL, 's' },
+		{ "until",        required_argument, NULL, 'u' },
+		{ "min-duration", required_argument, NULL, OPT_MIN_DURATION },
+		{ "max-duration", required_argument, NULL, OPT_MAX_DURATION },
+		{ "frequency",    required_argument, NULL, 'f' },
+		{ "leds",         required_argument, NULL, 'n' },
+		{ "mode",         required_argument, NULL, 'm' },
+		{ "detection",    required_argument, NULL, 'd' },
+		{ "type",         required_argument, NULL, 't' },
+		{ "channel",      required_argument, NULL, 'C' },
+		{ "clipped",      no_argument,       NULL, OPT_CLIPPED },
+		{ "dropped",      no_argument,       NULL, OPT_DROPPED },
+		{ "long",         no_argument,       NULL, 'l' },
+		{ "help",         no_argument,       NULL, 'h' },
+		{ NULL,           0,                 NULL,  0  },
+	};
+	struct filter filter = {
+		.leds = -1,
+		.flash_mode = -1,
+		.detection_mode = -1,
+		.calibration = -1,
+		.channel = -1,
+	};
+	const char *path = BL_CATALOGUE_DEFAULT_PATH;
+	const struct bl_catalogue_entry **match;
+	struct bl_catalogue cat;
+	unsigned count = 0;
+	bool ok = true;
+	bool full = false;
+	uint32_t value;
+	int c;
+
+	optind = 2;
+	while (ok && (c = getopt_long(argc, argv, "c:s:u:f:n:m:d:t:C:lh",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			path = optarg;
+			break;
+		case 's':
+			ok = read_time(optarg, &filter.since);
+			break;
+		case 'u':
+			ok = read_time(optarg, &filter.until);
+			break;
+		case OPT_MIN_DURATION:
+			ok = read_double(optarg, &filter.min_duration);
+			break;
+		case OPT_MAX_DURATION:
+			ok = read_double(optarg, &filter.max_duration);
+			break;
+		case 'f':
+			ok = read_sized_uint(optarg, &filter.frequency,
+					sizeof(uint16_t));
+			break;
+		case 'n':
+			ok = read_sized_uint(optarg, &value, sizeof(uint8_t)) &&
+					value <= 16;
+			filter.leds = value;
+			break;
+		case 'm':
+			ok = read_choice(optarg, flash_modes,
+					BL_ARRAY_LEN(flash_modes),
+					&filter.flash_mode);
+			break;
+		case 'd':
+			ok = read_choice(optarg, detection_modes,
+					BL_ARRAY_LEN(detection_modes),
+					&filter.detection_mode);
+			break;
+		case 't':
+			ok = read_choice(optarg, recording_types,
+					BL_ARRAY_LEN(recording_types),
+					&filter.calibration);
+			break;
+		case 'C':
+			ok = read_sized_uint(optarg, &value, sizeof(uint8_t)) &&
+					value < BL_CHANNEL_MAX;
+			filter.channel = value;
+			break;
+		case OPT_CLIPPED:
+			filter.clipped = true;
+			break;
+		case OPT_DROPPED:
+			filter.dropped = true;
+			break;
+		case 'l':
+			full = true;
+			break;
+		case 'h':
+			query_usage(stdout, argv);
+			return EXIT_SUCCESS;
+		default:
+			query_usage(stderr, argv);
+			return EXIT_FAILURE;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "Could not parse '%s'\n", optarg);
+		}
+	}
+
+	if (!ok || optind != argc) {
+		query_usage(stderr, argv);
+		return EXIT_FAILURE;
+	}
+
+	if (!bl_catalogue_load(path, &cat)) {
+		return EXIT_FAILURE;
+	}
+
+	match = malloc((cat.count + 1) * sizeof(*match));
+	if (match == NULL) {
+		bl_catalogue_fini(&cat);
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned i = 0; i < cat.count; i++) {
+		if (filter_match(&filter, &cat.entry[i].info)) {
+			match[count++] = &cat.entry[i];
+		}
+	}
+
+	qsort(match, count, sizeof(*match), cmp_start);
+
+	for (unsigned i = 0; i < count; i++) {
+		if (full) {
+			print_long(match[i]);
+		} else {
+			print_short(match[i]);
+		}
+	}
+
+	fprintf(stderr, "%u of %u recordings match\n", count, cat.count);
+
+	free(match);
+	bl_catalogue_fini(&cat);
+	return EXIT_SUCCESS;
+}
+
+static const struct bl_cmd {
+	const char *name;
+	const char *help;
+	const bl_cmd_fn fn;
+} cmds[] = {
+	{
+		.name = "update",
+		.help = "Add new or changed recordings to the catalogue",
+		.fn = bl_cmd_update,
+	},
+	{
+		.name = "rebuild",
+		.help = "Rebuild the catalogue from recordings",
+		.fn = bl_cmd_rebuild,
+	},
+	{
+		.name = "query",
+		.help = "List catalogued recordings matching filters",
+		.fn = bl_cmd_query,
+	},
+};
+
+static void bl_cmd_help(const char *prog)
+{
+	unsigned max_name = 0;
+
+	for (unsigned i = 0; i < BL_ARRAY_LEN(cmds); i++) {
+		unsigned len = strlen(cmds[i].name);
+		if (len > max_name) {
+			max_name = len;
+		}
+	}
+
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "  %s CMD [params]\n", prog);
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "Available CMDs:\n");
+	for (unsigned i = 0; i < BL_ARRAY_LEN(cmds); i++) {
+		fprintf(stderr, "  %-*s   %s\n", max_name,
+				cmds[i].name,
+				cmds[i].help);
+	}
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Use '%s CMD --help' for a command's options.\n", prog);
+}
+
+static bl_cmd_fn bl_cmd_lookup(const char *cmd_name)
+{
+	for (unsigned i = 0; i < BL_ARRAY_LEN(cmds); i++) {
+		if (strcmp(cmds[i].name, cmd_name) == 0) {
+			return cmds[i].fn;
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	bl_cmd_fn cmd_fn;
+	enum {
+		ARG_PROG,
+		ARG_CMD,
+		ARG__COUNT,
+	};
+
+	if (argc < ARG__COUNT) {
+		bl_cmd_help(argv[ARG_PROG]);
+		return EXIT_FAILURE;
+	}
+
+	cmd_fn = bl_cmd_lookup(argv[ARG_CMD]);
+	if (cmd_fn == NULL) {
+		bl_cmd_help(argv[ARG_PROG]);
+		return EXIT_FAILURE;
+	}
+
+	if (!bl_sig_init()) {
+		return EXIT_FAILURE;
+	}
+
+	return cmd_fn(argc, argv);
+}
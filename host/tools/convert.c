@@ -19,11 +19,15 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
+#include <time.h>
 
+#include "common/acq.h"
 #include "common/channel.h"
 #include "common/error.h"
 #include "common/util.h"
@@ -32,6 +36,8 @@
 #include "host/common/msg.h"
 #include "host/common/sig.h"
 #include "host/common/fifo.h"
+#include "host/common/clock.h"
+#include "host/common/sample.h"
 
 #define FIFO_MAX 1024
 
@@ -50,11 +56,6 @@ static uint16_t bl_count_channels(uint16_t src_mask)
 	return bit_count;
 }
 
-static inline int32_t bl_sample_to_signed(uint32_t in)
-{
-	return in - INT32_MIN;
-}
-
 enum bl_format {
 	BL_FORMAT_WAV,
 	BL_FORMAT_RAW,
@@ -164,29 +165,25 @@ static int bl_sample_msg_to_file(
 		unsigned num_channels,
 		enum bl_format format,
 		struct fifo **fifos,
+		const struct bl_clock_map *clock,
 		unsigned *time_index)
 {
 	BL_UNUSED(src_mask);
 
-	unsigned count = msg->sample_data.count;
+	uint32_t values[BL_SAMPLE_MAX];
+	unsigned count;
 
 	size_t written;
 
-	uint32_t value;
-	for (unsigned i = 0; i < count; i++) {
-		if (msg->type == BL_MSG_SAMPLE_DATA16) {
-			/* Upscale 16-bit samples to 32-bit. */
-			value = msg->sample_data.data16[i];
-			value = (value << 16) | value;
-		} else {
-			value = msg->sample_data.data32[i];
-		}
+	/* Upscale 16-bit samples to 32-bit. */
+	count = bl_sample_unpack_scaled(&msg->sample_data, values);
 
-		if (format == BL_FORMAT_WAV) {
-			value = (uint32_t)bl_sample_to_signed(value);
-		}
+	if (format == BL_FORMAT_WAV) {
+		bl_sample_to_signed(values, (int32_t *)values, count);
+	}
 
-		if (!fifo_write(fifos[chan[msg->sample_data.channel]], &value)) {
+	for (unsigned i = 0; i < count; i++) {
+		if (!fifo_write(fifos[chan[msg->sample_data.channel]], &values[i])) {
 			fprintf(stderr, "FIFO overflow\n");
 			return EXIT_FAILURE;
 		}
@@ -201,8 +198,15 @@ static int bl_sample_msg_to_file(
 
 	for (unsigned i = 0; i < ready; i++) {
 		for (unsigned j = 0; j < num_channels; j++) {
+			uint32_t value;
+
 			fifo_read(fifos[j], &value);
-			if (format == BL_FORMAT_CSV) {
+			if (format == BL_FORMAT_CSV && clock != NULL) {
+				float x_ms =  (*time_index) * 1000.0 / frequency;
+				double host = bl_clock_map_time(clock, *time_index);
+				written = fprintf(file, "%d,%f,%"PRIu32",%.6f\n",
+						j, x_ms, value, host);
+			} else if (format == BL_FORMAT_CSV) {
 				float x_ms =  (*time_index) * 1000.0 / frequency;
 				written = fprintf(file, "%d,%f,%"PRIu32"\n", j, x_ms, value);
 			} else {
@@ -231,26 +235,46 @@ static int bl_samples_to_file(int argc, char *argv[], enum bl_format format)
 	FILE *file;
 	int ret;
 	struct fifo *fifos[BL_CHANNEL_MAX];
+	struct bl_clock_map clock;
 	enum {
 		ARG_PROG,
 		ARG_CMD,
 		ARG_PATH,
+		ARG_META,
 		ARG__COUNT,
 	};
+	int max_args = (format == BL_FORMAT_CSV) ? ARG__COUNT : ARG_META;
 
 	// For incrementing the time between subsequent samples
 	unsigned time_index = 0;
 
-	if (argc < ARG_PATH || argc > ARG__COUNT) {
+	if (argc < ARG_PATH || argc > max_args) {
 		fprintf(stderr, "Usage:\n");
-		fprintf(stderr, "  %s %s [PATH]\n",
-				argv[ARG_PROG], argv[ARG_CMD]);
+		if (format == BL_FORMAT_CSV) {
+			fprintf(stderr, "  %s %s [PATH [META]]\n",
+					argv[ARG_PROG], argv[ARG_CMD]);
+		} else {
+			fprintf(stderr, "  %s %s [PATH]\n",
+					argv[ARG_PROG], argv[ARG_CMD]);
+		}
 		fprintf(stderr, "\n");
 		fprintf(stderr, "If no PATH is given, data will be written to stdout.\n");
+		if (format == BL_FORMAT_CSV) {
+			fprintf(stderr, "If a Bloodview recording metadata "
+					"file is given as META, a column\n"
+					"of host CLOCK_MONOTONIC times, "
+					"corrected for clock drift, is added.\n");
+		}
 		return EXIT_FAILURE;
 	}
 
-	if (argc == ARG__COUNT) {
+	if (argc > ARG_META) {
+		if (!bl_clock_map_read(argv[ARG_META], &clock)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc > ARG_PATH) {
 		file = fopen(argv[ARG_PATH], "w");
 		if (file == NULL) {
 			fprintf(stderr, "Failed to open '%s': %s\n",
@@ -286,6 +310,13 @@ static int bl_samples_to_file(int argc, char *argv[], enum bl_format format)
 
 			frequency = msg.start.frequency;
 
+			if (argc > ARG_META && clock.frequency != frequency) {
+				fprintf(stderr, "Metadata is for a %u Hz "
+						"acquisition, not %u Hz\n",
+						clock.frequency, frequency);
+				goto cleanup;
+			}
+
 			if (format == BL_FORMAT_WAV) {
 				ret = bl_cmd_wav_write_format_header(file,
 						msg.start.frequency,
@@ -319,7 +350,8 @@ static int bl_samples_to_file(int argc, char *argv[], enum bl_format format)
 		}
 
 		ret = bl_sample_msg_to_file(file, frequency, &msg, src_mask,
-				num_channels, format, fifos, &time_index);
+				num_channels, format, fifos,
+				(argc > ARG_META) ? &clock : NULL, &time_index);
 		if (ret != EXIT_SUCCESS) {
 			goto cleanup;
 		}
@@ -329,13 +361,882 @@ cleanup:
 		fifo_destroy(fifos[i]);
 	}
 
-	if (argc == ARG__COUNT) {
+	if (argc > ARG_PATH) {
 		fclose(file);
 	}
 
 	return EXIT_SUCCESS;
 }
 
+/** EDF data record duration in seconds. */
+#define EDF_RECORD_SECONDS 1
+
+/** Bytes per data record given to the EDF+ annotations signal. */
+#define EDF_ANNOT_BYTES 256
+
+/** Maximum number of annotations waiting to be written. */
+#define EDF_ANNOT_MAX 64
+
+/** Maximum length of an annotation's text. */
+#define EDF_ANNOT_TEXT 96
+
+/** EDF digital sample range; EDF samples are 16-bit signed. */
+#define EDF_DIGITAL_MIN INT16_MIN
+#define EDF_DIGITAL_MAX INT16_MAX
+
+/** Largest 12-bit ADC conversion result. */
+#define EDF_ADC_MAX 4095
+
+/** Offset of the number of data records field in the EDF header. */
+#define EDF_HEADER_RECORDS_OFFSET 236
+
+/** A channel's sample mapping, from a channel configuration message. */
+struct bl_edf_conf {
+	uint32_t offset;   /**< Offset subtracted by the device. */
+	uint8_t  shift;    /**< Shift applied by the device. */
+	uint8_t  source;   /**< Acquisition source. */
+	bool     sample32; /**< Whether samples are sent unshifted in 32 bits. */
+};
+
+/** An EDF signal, for one acquisition channel. */
+struct bl_edf_signal {
+	uint32_t offset; /**< Accumulated value of the lowest digital value. */
+	uint8_t  shift;  /**< Log2 of accumulated value per digital step. */
+	int16_t  last;   /**< Last sample, for padding the final record. */
+	struct fifo *fifo; /**< Samples waiting for a complete record. */
+};
+
+/** An annotation waiting to be written. */
+struct bl_edf_annot {
+	uint64_t onset; /**< Onset, in samples from the start of the file. */
+	char text[EDF_ANNOT_TEXT]; /**< Annotation text. */
+};
+
+/** EDF+ writer state. */
+struct bl_edf {
+	FILE *file; /**< File being written. */
+
+	bool started; /**< Whether the header has been written. */
+	bool running; /**< Whether an acquisition is in progress. */
+
+	unsigned frequency;    /**< Sampling rate in Hz. */
+	unsigned src_mask;     /**< Mask of acquisition channels. */
+	unsigned num_channels; /**< Number of acquisition channels. */
+	unsigned per_record;   /**< Samples per signal per data record. */
+
+	const struct bl_clock_map *clock; /**< Host clock mapping, or NULL. */
+	unsigned start_micro; /**< First sample's microseconds past the start
+	                       *   time, which is in whole seconds. */
+
+	struct bl_edf_conf conf[BL_CHANNEL_MAX];   /**< Current channel config. */
+	struct bl_edf_signal sig[BL_CHANNEL_MAX];  /**< Per-signal state. */
+	bl_msg_source_conf_t source[BL_ACQ_SOURCE_MAX]; /**< Source config. */
+	unsigned source_mask; /**< Mask of sources with a config message. */
+
+	uint8_t *record;    /**< Data record being assembled. */
+	size_t record_size; /**< Size of a data record in bytes. */
+	uint64_t records;   /**< Number of data records written. */
+	uint64_t clipped;   /**< Samples clipped to the digital range. */
+
+	struct bl_edf_annot annot[EDF_ANNOT_MAX]; /**< Pending annotations. */
+	unsigned annot_count; /**< Number of pending annotations. */
+	unsigned annot_lost;  /**< Annotations dropped for lack of space. */
+};
+
+static const char *bl_edf_source_name(unsigned source)
+{
+	static const char *names[BL_ACQ_SOURCE_MAX] = {
+		[BL_ACQ_PD1] = "PD1",
+		[BL_ACQ_PD2] = "PD2",
+		[BL_ACQ_PD3] = "PD3",
+		[BL_ACQ_PD4] = "PD4",
+		[BL_ACQ_3V3] = "3V3",
+		[BL_ACQ_5V0] = "5V0",
+		[BL_ACQ_TMP] = "TMP",
+		[BL_ACQ_EXT] = "EXT",
+	};
+
+	return (source < BL_ARRAY_LEN(names)) ? names[source] : "???";
+}
+
+/**
+ * Write a space padded EDF header field.
+ *
+ * Values which are too long are truncated.
+ */
+static void bl_edf_field(char *field, size_t len, const char *fmt, ...)
+{
+	char text[128];
+	va_list args;
+	size_t used;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(text, sizeof(text), fmt, args);
+	va_end(args);
+
+	used = (ret < 0) ? 0 : (size_t)ret;
+	if (used > len) {
+		used = len;
+	}
+	if (used > sizeof(text) - 1) {
+		used = sizeof(text) - 1;
+	}
+	memcpy(field, text, used);
+	memset(field + used, ' ', len - used);
+}
+
+/**
+ * Write a number into an 8 character EDF header field.
+ *
+ * As many significant decimal places are used as will fit.
+ */
+static void bl_edf_field_number(char *field, double value)
+{
+	char text[32];
+	int len = 0;
+
+	for (int decimals = 6; decimals >= 0; decimals--) {
+		len = snprintf(text, sizeof(text), "%.*f", decimals, value);
+		if (len <= 8) {
+			break;
+		}
+	}
+
+	if (strchr(text, '.') != NULL) {
+		while (len > 0 && text[len - 1] == '0') {
+			text[--len] = '\0';
+		}
+		if (len > 0 && text[len - 1] == '.') {
+			text[--len] = '\0';
+		}
+	}
+
+	bl_edf_field(field, 8, "%s", text);
+}
+
+/**
+ * Format a time in samples as an EDF+ annotation onset, in seconds.
+ */
+static void bl_edf_onset(
+		const struct bl_edf *edf,
+		uint64_t samples,
+		char *text,
+		size_t len)
+{
+	uint64_t total = samples * 1000000 / edf->frequency + edf->start_micro;
+	uint64_t seconds = total / 1000000;
+	unsigned micro = total % 1000000;
+	int end;
+
+	end = snprintf(text, len, "+%"PRIu64".%06u", seconds, micro);
+
+	/* Trim trailing zeros, and the point if there's no fraction. */
+	while (end > 0 && text[end - 1] == '0') {
+		text[--end] = '\0';
+	}
+	if (end > 0 && text[end - 1] == '.') {
+		text[--end] = '\0';
+	}
+}
+
+/**
+ * Get the current time, in samples from the start of the file.
+ *
+ * This is the time of the sample that the slowest channel will get next.
+ */
+static uint64_t bl_edf_now(const struct bl_edf *edf)
+{
+	unsigned used = UINT_MAX;
+
+	for (unsigned i = 0; i < edf->num_channels; i++) {
+		if (edf->sig[i].fifo->used < used) {
+			used = edf->sig[i].fifo->used;
+		}
+	}
+
+	if (used == UINT_MAX) {
+		used = 0;
+	}
+
+	return edf->records * edf->per_record + used;
+}
+
+static void bl_edf_annotate(struct bl_edf *edf, const char *fmt, ...)
+{
+	struct bl_edf_annot *annot;
+	va_list args;
+
+	if (edf->annot_count == EDF_ANNOT_MAX) {
+		edf->annot_lost++;
+		return;
+	}
+
+	annot = &edf->annot[edf->annot_count++];
+	annot->onset = bl_edf_now(edf);
+
+	va_start(args, fmt);
+	vsnprintf(annot->text, sizeof(annot->text), fmt, args);
+	va_end(args);
+}
+
+static int bl_edf_write_header(struct bl_edf *edf)
+{
+	unsigned ns = edf->num_channels + 1;
+	size_t size = 256 + 256 * ns;
+	char start_date[16] = "X";
+	char date[9] = "01.01.85";
+	char time[9] = "00.00.00";
+	char *header;
+	char *pos;
+
+	header = malloc(size);
+	if (header == NULL) {
+		fprintf(stderr, "Failed to allocate EDF header\n");
+		return EXIT_FAILURE;
+	}
+
+	/* The recording time isn't in the message stream, but it can be
+	 * worked out from a host clock mapping.  Otherwise, the EDF+
+	 * "unknown" conventions are used for the date. */
+	if (edf->clock != NULL) {
+		double start = edf->clock->realtime + edf->clock->offset;
+		time_t whole = start;
+		struct tm tm;
+
+		if (whole > 0 && localtime_r(&whole, &tm) != NULL &&
+		    tm.tm_year >= 85 && tm.tm_year < 185) {
+			strftime(start_date, sizeof(start_date), "%d-%b-%Y", &tm);
+			for (char *c = start_date; *c != '\0'; c++) {
+				*c = toupper((unsigned char) *c);
+			}
+			strftime(date, sizeof(date), "%d.%m.%y", &tm);
+			strftime(time, sizeof(time), "%H.%M.%S", &tm);
+			edf->start_micro = (start - whole) * 1000000;
+		}
+	}
+
+	pos = header;
+	bl_edf_field(pos,  8, "0");                  pos +=  8;
+	bl_edf_field(pos, 80, "X X X X");            pos += 80;
+	bl_edf_field(pos, 80, "Startdate %s X X X", start_date); pos += 80;
+	bl_edf_field(pos,  8, "%s", date);           pos +=  8;
+	bl_edf_field(pos,  8, "%s", time);           pos +=  8;
+	bl_edf_field(pos,  8, "%zu", size);          pos +=  8;
+	bl_edf_field(pos, 44, "EDF+C");              pos += 44;
+	bl_edf_field(pos,  8, "-1");                 pos +=  8;
+	bl_edf_field(pos,  8, "%u", EDF_RECORD_SECONDS); pos += 8;
+	bl_edf_field(pos,  4, "%u", ns);             pos +=  4;
+
+	/* Signal fields are grouped by field, for all signals. */
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		if (edf->src_mask & (1U << c)) {
+			bl_edf_field(pos, 16, "Ch%u %s", c,
+					bl_edf_source_name(edf->conf[c].source));
+			pos += 16;
+		}
+	}
+	bl_edf_field(pos, 16, "EDF Annotations"); pos += 16;
+
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		if (edf->src_mask & (1U << c)) {
+			bl_edf_field(pos, 80, "Bloodlight source %s",
+					bl_edf_source_name(edf->conf[c].source));
+			pos += 80;
+		}
+	}
+	bl_edf_field(pos, 80, ""); pos += 80;
+
+	/* Physical values are the device's accumulated ADC counts, scaled
+	 * to kilo-counts if they wouldn't fit in the header fields. */
+	for (unsigned i = 0; i < edf->num_channels; i++) {
+		double max = edf->sig[i].offset +
+				65535.0 * ((uint64_t)1 << edf->sig[i].shift);
+
+		bl_edf_field(pos, 8, (max < 1e8) ? "count" : "kcount");
+		pos += 8;
+	}
+	bl_edf_field(pos, 8, ""); pos += 8;
+
+	for (unsigned pass = 0; pass < 2; pass++) {
+		for (unsigned i = 0; i < edf->num_channels; i++) {
+			double min = edf->sig[i].offset;
+			double max = min + 65535.0 *
+					((uint64_t)1 << edf->sig[i].shift);
+			double scale = (max < 1e8) ? 1 : 1e-3;
+
+			bl_edf_field_number(pos, (pass == 0 ? min : max) * scale);
+			pos += 8;
+		}
+		bl_edf_field(pos, 8, (pass == 0) ? "-1" : "1"); pos += 8;
+	}
+
+	for (unsigned pass = 0; pass < 2; pass++) {
+		for (unsigned i = 0; i < ns; i++) {
+			bl_edf_field(pos, 8, "%d", (pass == 0) ?
+					EDF_DIGITAL_MIN : EDF_DIGITAL_MAX);
+			pos += 8;
+		}
+	}
+
+	for (unsigned i = 0; i < ns; i++) {
+		bl_edf_field(pos, 80, ""); pos += 80;
+	}
+
+	for (unsigned i = 0; i < edf->num_channels; i++) {
+		bl_edf_field(pos, 8, "%u", edf->per_record); pos += 8;
+	}
+	bl_edf_field(pos, 8, "%u", EDF_ANNOT_BYTES / 2); pos += 8;
+
+	for (unsigned i = 0; i < ns; i++) {
+		bl_edf_field(pos, 32, ""); pos += 32;
+	}
+
+	assert((size_t)(pos - header) == size);
+
+	if (fwrite(header, size, 1, edf->file) != 1) {
+		fprintf(stderr, "Failed to write EDF header\n");
+		free(header);
+		return EXIT_FAILURE;
+	}
+
+	free(header);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Fill in the annotations signal for the data record being assembled.
+ *
+ * Every data record starts with a time-keeping annotation giving its
+ * onset.  Pending annotations follow, as many as fit; any others wait for
+ * the next data record.
+ */
+static void bl_edf_record_annotations(struct bl_edf *edf, uint8_t *out)
+{
+	uint64_t start = edf->records * edf->per_record;
+	uint64_t end = start + edf->per_record;
+	unsigned done = 0;
+	char onset[32];
+	size_t pos;
+
+	memset(out, 0, EDF_ANNOT_BYTES);
+
+	bl_edf_onset(edf, start, onset, sizeof(onset));
+	pos = sprintf((char *)out, "%s\x14\x14", onset) + 1;
+
+	for (; done < edf->annot_count; done++) {
+		const struct bl_edf_annot *annot = &edf->annot[done];
+		size_t len;
+
+		if (annot->onset > end) {
+			break;
+		}
+
+		bl_edf_onset(edf, annot->onset, onset, sizeof(onset));
+		len = strlen(onset) + strlen(annot->text) + 3;
+		if (pos + len > EDF_ANNOT_BYTES) {
+			break;
+		}
+
+		pos += sprintf((char *)out + pos, "%s\x14%s\x14",
+				onset, annot->text) + 1;
+	}
+
+	edf->annot_count -= done;
+	memmove(edf->annot, edf->annot + done,
+			edf->annot_count * sizeof(*edf->annot));
+}
+
+/**
+ * Write out data records while every signal has enough samples.
+ *
+ * Unless flushing, the last complete data record is held back until a
+ * later sample arrives.  An annotation made at the end of a data record,
+ * such as the recording ending, can then still be written in it.
+ */
+static int bl_edf_write_records(struct bl_edf *edf, bool flush)
+{
+	unsigned needed = flush ? edf->per_record : edf->per_record + 1;
+
+	for (;;) {
+		uint8_t *out = edf->record;
+
+		for (unsigned i = 0; i < edf->num_channels; i++) {
+			if (edf->sig[i].fifo->used < needed) {
+				return EXIT_SUCCESS;
+			}
+		}
+
+		for (unsigned i = 0; i < edf->num_channels; i++) {
+			for (unsigned s = 0; s < edf->per_record; s++) {
+				int16_t value;
+				uint16_t bits;
+
+				fifo_read(edf->sig[i].fifo, &value);
+				bits = (uint16_t)value;
+				*out++ = bits & 0xff;
+				*out++ = bits >> 8;
+			}
+		}
+
+		bl_edf_record_annotations(edf, out);
+
+		if (fwrite(edf->record, edf->record_size, 1, edf->file) != 1) {
+			fprintf(stderr, "Failed to write EDF data record\n");
+			return EXIT_FAILURE;
+		}
+		edf->records++;
+	}
+}
+
+/**
+ * Pad every signal to the end of the current data record, and write it.
+ *
+ * EDF+C data records are contiguous and complete, so the end of an
+ * acquisition is filled with each signal's last sample.  The final data
+ * record is held back unless flushing, as for \ref bl_edf_write_records.
+ */
+static int bl_edf_pad(struct bl_edf *edf, bool flush)
+{
+	unsigned target = 0;
+
+	for (unsigned i = 0; i < edf->num_channels; i++) {
+		if (edf->sig[i].fifo->used > target) {
+			target = edf->sig[i].fifo->used;
+		}
+	}
+
+	if (target == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	target = (target + edf->per_record - 1) /
+			edf->per_record * edf->per_record;
+
+	for (unsigned i = 0; i < edf->num_channels; i++) {
+		while (edf->sig[i].fifo->used < target) {
+			fifo_write(edf->sig[i].fifo, &edf->sig[i].last);
+		}
+	}
+
+	return bl_edf_write_records(edf, flush);
+}
+
+/**
+ * Get the largest accumulated value a source can produce.
+ *
+ * This is the ADC's maximum, scaled by the hardware oversample and shift,
+ * and summed over the software oversample.  If the source's configuration
+ * isn't known, any 32-bit value is possible.
+ */
+static uint64_t bl_edf_source_max(const struct bl_edf *edf, unsigned source)
+{
+	const bl_msg_source_conf_t *conf;
+	uint64_t max;
+
+	if (source >= BL_ACQ_SOURCE_MAX ||
+	    !(edf->source_mask & (1U << source))) {
+		return UINT32_MAX;
+	}
+
+	conf = &edf->source[source];
+	max = ((uint64_t)EDF_ADC_MAX << (conf->hw_oversample & 15)) >>
+			(conf->hw_shift & 15);
+	max *= (conf->sw_oversample > 0) ? conf->sw_oversample : 1;
+
+	return (max < UINT32_MAX) ? max : UINT32_MAX;
+}
+
+/**
+ * Choose a signal's mapping from accumulated values to EDF digital values.
+ *
+ * The range covers what the channel can deliver: for 16-bit samples, the
+ * device's offset and shift, and for 32-bit samples, everything the source
+ * can produce.  Low bits are only dropped where that range doesn't fit in
+ * 16 bits, with a warning if that loses precision the samples had.
+ */
+static void bl_edf_signal_map(
+		const struct bl_edf *edf,
+		unsigned channel,
+		struct bl_edf_signal *sig)
+{
+	const struct bl_edf_conf *conf = &edf->conf[channel];
+	uint64_t max = bl_edf_source_max(edf, conf->source);
+	uint64_t span;
+
+	sig->offset = conf->sample32 ? 0 : conf->offset;
+	span = (max > sig->offset) ? max - sig->offset : 0;
+	if (!conf->sample32) {
+		uint64_t range = (uint64_t)UINT16_MAX << (conf->shift & 31);
+
+		if (span > range) {
+			span = range;
+		}
+	}
+
+	sig->shift = 0;
+	while ((span >> sig->shift) > UINT16_MAX) {
+		sig->shift++;
+	}
+
+	if (conf->sample32 && sig->shift > 0) {
+		fprintf(stderr, "Warning: Channel %u's 32-bit samples reach "
+				"%"PRIu64"; dropping %u low bits to fit EDF's "
+				"16-bit samples\n",
+				channel, max, sig->shift);
+	}
+}
+
+static int bl_edf_start(struct bl_edf *edf, const bl_msg_start_t *start)
+{
+	if (edf->started) {
+		if (start->frequency != edf->frequency ||
+		    start->src_mask != edf->src_mask) {
+			fprintf(stderr, "Acquisition frequency or channels "
+					"changed; EDF can't represent this\n");
+			return EXIT_FAILURE;
+		}
+
+		if (bl_edf_pad(edf, false) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+
+		bl_edf_annotate(edf, "Acquisition start after gap of "
+				"unknown duration");
+		edf->running = true;
+		return EXIT_SUCCESS;
+	}
+
+	if (start->frequency == 0 || (start->src_mask &
+			~((1U << BL_CHANNEL_MAX) - 1)) != 0) {
+		fprintf(stderr, "Bad acquisition start message\n");
+		return EXIT_FAILURE;
+	}
+
+	if (edf->clock != NULL && edf->clock->frequency != start->frequency) {
+		fprintf(stderr, "Metadata is for a %u Hz acquisition, "
+				"not %u Hz\n",
+				edf->clock->frequency, start->frequency);
+		return EXIT_FAILURE;
+	}
+
+	edf->frequency = start->frequency;
+	edf->src_mask = start->src_mask;
+	edf->num_channels = bl_count_channels(start->src_mask);
+	edf->per_record = edf->frequency * EDF_RECORD_SECONDS;
+	init_chan_lookup(start->src_mask);
+
+	if (edf->num_channels == 0 ||
+	    edf->per_record + FIFO_MAX > UINT16_MAX) {
+		fprintf(stderr, "Unsupported acquisition for EDF\n");
+		return EXIT_FAILURE;
+	}
+
+	/* The header's sample mapping is fixed by the first acquisition. */
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		struct bl_edf_signal *sig = &edf->sig[chan[c]];
+
+		if (!(edf->src_mask & (1U << c))) {
+			continue;
+		}
+
+		bl_edf_signal_map(edf, c, sig);
+		sig->fifo = fifo_create(edf->per_record + FIFO_MAX,
+				sizeof(int16_t));
+		if (sig->fifo == NULL) {
+			fprintf(stderr, "Failed to create fifo: %s\n",
+					strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	edf->record_size = (size_t)edf->num_channels * edf->per_record *
+			sizeof(int16_t) + EDF_ANNOT_BYTES;
+	edf->record = malloc(edf->record_size);
+	if (edf->record == NULL) {
+		fprintf(stderr, "Failed to allocate EDF data record\n");
+		return EXIT_FAILURE;
+	}
+
+	if (bl_edf_write_header(edf) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "- EDF+ output format:\n");
+	fprintf(stderr, "    Samples: 16-bit signed\n");
+	fprintf(stderr, "    Channels: %u\n", edf->num_channels);
+	fprintf(stderr, "    Frequency: %u Hz\n", edf->frequency);
+	fprintf(stderr, "    Record duration: %u s\n", EDF_RECORD_SECONDS);
+
+	bl_edf_annotate(edf, "Acquisition start");
+	if (edf->clock != NULL) {
+		bl_edf_annotate(edf, "Sample clock drift %+.3f ppm",
+				edf->clock->drift * 1000000);
+	}
+	edf->started = true;
+	edf->running = true;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Note a channel configuration, annotating changes mid-file.
+ */
+static void bl_edf_channel_conf(
+		struct bl_edf *edf,
+		const bl_msg_channel_conf_t *msg)
+{
+	struct bl_edf_conf conf = {
+		.offset = msg->offset,
+		.shift = msg->shift,
+		.source = msg->source,
+		.sample32 = msg->sample32,
+	};
+	struct bl_edf_conf *old;
+
+	if (msg->channel >= BL_CHANNEL_MAX) {
+		return;
+	}
+
+	old = &edf->conf[msg->channel];
+	if (edf->started && (old->offset != conf.offset ||
+			old->shift != conf.shift ||
+			old->source != conf.source ||
+			old->sample32 != conf.sample32)) {
+		bl_edf_annotate(edf, "Channel %u config: source %s, "
+				"offset %"PRIu32", shift %u, %s samples",
+				msg->channel, bl_edf_source_name(conf.source),
+				conf.offset, conf.shift,
+				conf.sample32 ? "32-bit" : "16-bit");
+	}
+
+	*old = conf;
+}
+
+/**
+ * Note a source configuration, annotating changes mid-file.
+ */
+static void bl_edf_source_conf(
+		struct bl_edf *edf,
+		const bl_msg_source_conf_t *msg)
+{
+	bl_msg_source_conf_t *old;
+
+	if (msg->source >= BL_ACQ_SOURCE_MAX) {
+		return;
+	}
+
+	old = &edf->source[msg->source];
+	if (edf->started && (old->opamp_gain != msg->opamp_gain ||
+			old->opamp_offset != msg->opamp_offset ||
+			old->sw_oversample != msg->sw_oversample ||
+			old->hw_oversample != msg->hw_oversample ||
+			old->hw_shift != msg->hw_shift)) {
+		bl_edf_annotate(edf, "Source %s config: gain %u, "
+				"offset %u, oversample %u/%u, shift %u",
+				bl_edf_source_name(msg->source),
+				msg->opamp_gain, msg->opamp_offset,
+				msg->sw_oversample, msg->hw_oversample,
+				msg->hw_shift);
+	}
+
+	*old = *msg;
+	edf->source_mask |= 1U << msg->source;
+}
+
+/**
+ * Add a sample data message's samples to the signal FIFOs.
+ *
+ * Samples are converted to the accumulated values the device measured,
+ * using the channel's current configuration, and then mapped to the
+ * header's digital range.  This keeps physical values correct even if the
+ * channel configuration changed since the header was written.
+ */
+static int bl_edf_samples(struct bl_edf *edf, const bl_msg_sample_data_t *msg)
+{
+	uint32_t values[BL_SAMPLE_MAX];
+	const struct bl_edf_conf *conf;
+	struct bl_edf_signal *sig;
+	unsigned count;
+
+	if (msg->channel >= BL_CHANNEL_MAX ||
+	    !(edf->src_mask & (1U << msg->channel))) {
+		return EXIT_SUCCESS;
+	}
+
+	conf = &edf->conf[msg->channel];
+	sig = &edf->sig[chan[msg->channel]];
+
+	count = bl_sample_unpack(msg, values);
+	for (unsigned i = 0; i < count; i++) {
+		uint64_t acc = values[i];
+		uint64_t digital;
+		int16_t value;
+
+		if (msg->type == BL_MSG_SAMPLE_DATA16) {
+			acc = conf->offset + (acc << (conf->shift & 31));
+		}
+
+		digital = (acc < sig->offset) ? 0 :
+				(acc - sig->offset) >> sig->shift;
+		if (acc < sig->offset || digital > UINT16_MAX) {
+			digital = (acc < sig->offset) ? 0 : UINT16_MAX;
+			edf->clipped++;
+		}
+
+		value = (int16_t)((int32_t)digital + EDF_DIGITAL_MIN);
+		if (!fifo_write(sig->fifo, &value)) {
+			fprintf(stderr, "FIFO overflow\n");
+			return EXIT_FAILURE;
+		}
+		sig->last = value;
+	}
+
+	return bl_edf_write_records(edf, false);
+}
+
+/**
+ * Finish the EDF file.
+ *
+ * The number of data records is filled in if the output is seekable;
+ * otherwise it's left as -1, which EDF readers take as unknown.
+ */
+static int bl_edf_finish(struct bl_edf *edf)
+{
+	char field[8];
+
+	if (!edf->started) {
+		return EXIT_SUCCESS;
+	}
+
+	if (edf->running) {
+		bl_edf_annotate(edf, "Recording end");
+	}
+
+	if (bl_edf_pad(edf, true) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (edf->annot_count > 0 || edf->annot_lost > 0) {
+		fprintf(stderr, "Warning: %u annotations dropped\n",
+				edf->annot_count + edf->annot_lost);
+	}
+	if (edf->clipped > 0) {
+		fprintf(stderr, "Warning: %"PRIu64" samples clipped to "
+				"the EDF range\n", edf->clipped);
+	}
+
+	if (fseek(edf->file, EDF_HEADER_RECORDS_OFFSET, SEEK_SET) == 0) {
+		bl_edf_field(field, sizeof(field), "%"PRIu64, edf->records);
+		if (fwrite(field, sizeof(field), 1, edf->file) != 1) {
+			fprintf(stderr, "Failed to write EDF record count\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int bl_cmd_edf(int argc, char *argv[])
+{
+	union bl_msg_data msg;
+	struct bl_edf edf = { 0 };
+	struct bl_clock_map clock;
+	int ret = EXIT_SUCCESS;
+	enum {
+		ARG_PROG,
+		ARG_CMD,
+		ARG_PATH,
+		ARG_META,
+		ARG__COUNT,
+	};
+
+	if (argc < ARG_PATH || argc > ARG__COUNT) {
+		fprintf(stderr, "Usage:\n");
+		fprintf(stderr, "  %s %s [PATH [META]]\n",
+				argv[ARG_PROG], argv[ARG_CMD]);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "If no PATH is given, data will be written to stdout.\n");
+		fprintf(stderr, "If a Bloodview recording metadata file is given "
+				"as META, the start time\n"
+				"is set from its host clock mapping.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc > ARG_META) {
+		if (!bl_clock_map_read(argv[ARG_META], &clock)) {
+			return EXIT_FAILURE;
+		}
+		edf.clock = &clock;
+	}
+
+	if (argc > ARG_PATH) {
+		edf.file = fopen(argv[ARG_PATH], "wb");
+		if (edf.file == NULL) {
+			fprintf(stderr, "Failed to open '%s': %s\n",
+					argv[ARG_PATH], strerror(errno));
+			return EXIT_FAILURE;
+		}
+	} else {
+		edf.file = stdout;
+	}
+
+	while (ret == EXIT_SUCCESS &&
+	       !bl_sig_killed && bl_msg_yaml_parse(stdin, &msg)) {
+		switch (msg.type) {
+		case BL_MSG_SOURCE_CONF:
+			bl_edf_source_conf(&edf, &msg.source_conf);
+			break;
+
+		case BL_MSG_CHANNEL_CONF:
+			bl_edf_channel_conf(&edf, &msg.channel_conf);
+			break;
+
+		case BL_MSG_START:
+			ret = bl_edf_start(&edf, &msg.start);
+			break;
+
+		case BL_MSG_ABORT:
+			if (edf.running) {
+				bl_edf_annotate(&edf, "Acquisition end");
+				edf.running = false;
+			}
+			break;
+
+		case BL_MSG_SAMPLE_DATA16: /* Fall through. */
+		case BL_MSG_SAMPLE_DATA32:
+			if (!edf.started) {
+				fprintf(stderr, "No acq_setup message found\n");
+				ret = EXIT_FAILURE;
+			} else {
+				ret = bl_edf_samples(&edf, &msg.sample_data);
+			}
+			continue;
+
+		default:
+			break;
+		}
+
+		/* If the message isn't sample data, print to stderr, so
+		 * the user can see what's going on. */
+		bl_msg_yaml_print(stderr, &msg);
+	}
+
+	if (ret == EXIT_SUCCESS) {
+		ret = bl_edf_finish(&edf);
+	}
+
+	for (unsigned i = 0; i < edf.num_channels; i++) {
+		fifo_destroy(edf.sig[i].fifo);
+	}
+	free(edf.record);
+
+	if (argc > ARG_PATH) {
+		fclose(edf.file);
+	}
+
+	return ret;
+}
+
 static int bl_cmd_wav(int argc, char *argv[])
 {
 	return bl_samples_to_file(argc, argv, BL_FORMAT_WAV);
@@ -394,6 +1295,11 @@ static const struct bl_cmd {
 		.help = "Convert to CSV",
 		.fn = bl_cmd_csv,
 	},
+	{
+		.name = "edf",
+		.help = "Convert to EDF+",
+		.fn = bl_cmd_edf,
+	},
 	{
 		.name = "relay",
 		.help = "Relay stdin to stdout",
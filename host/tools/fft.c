@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 #include <inttypes.h>
+#include <pthread.h>
 #include <fftw3.h>
+#include <getopt.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +30,7 @@
 #include "host/common/msg.h"
 #include "host/common/sig.h"
 #include "host/common/fifo.h"
+#include "host/common/sample.h"
 
 #include "util.h"
 
@@ -35,13 +38,55 @@ uint32_t DEFAULT_WINDOW_LENGTH = 1000; // measured in milliseconds
 // Decided to have a fixed window interval of half the sample window.
 uint16_t DEFAULT_WINDOW_COUNT = 3; // number of windows to average together
 
+// Sample data messages each worker can have queued
+#define WORKER_QUEUE_MAX 256
+
+/*
+ * Binary spectrogram output format.
+ *
+ * The stream starts with the 8 byte magic "BLSPEC01".  It is followed by
+ * records, each starting with a uint32_t record type and uint32_t channel.
+ * All values are in host byte order.
+ *
+ * SPEC_RECORD_BINS: uint32_t bin_count, then bin_count float centre
+ *                   frequencies in Hz.  Sent once per channel, before any
+ *                   of the channel's frames.
+ * SPEC_RECORD_FRAME: uint64_t transform index, then bin_count float power
+ *                    values, one per bin.
+ */
+static const char SPEC_MAGIC[8] = "BLSPEC01";
+
+enum spec_record {
+	SPEC_RECORD_BINS,
+	SPEC_RECORD_FRAME,
+};
+
+struct output_options {
+	bool binary;       // Write binary spectrogram records instead of CSV
+	double freq_min;   // Lowest frequency of interest in Hz
+	double freq_max;   // Highest frequency of interest in Hz, or 0 for all
+	uint32_t log_bins; // Number of log-spaced bins to aggregate to, or 0
+	uint32_t band_bins; // Number of Goertzel bins for band analysis, or 0
+	bool single;       // Transform in single precision
+	uint32_t jobs;     // Number of worker threads, or 0 for none
+};
+
+/*
+ * A window of samples.
+ *
+ * Only one of the double and single precision buffer pairs is allocated.
+ * All buffers come from fftw_malloc, so they have the same alignment as
+ * the buffers the channel's plan was made with, and the plan can be
+ * executed on them with SIMD.
+ */
 struct sample_window {
 	double *in_buffer;
 	fftw_complex *out_buffer;
+	float *in_single;
+	fftwf_complex *out_single;
 	uint32_t buffer_capacity;
 	uint32_t out_capacity;
 	uint32_t sample_count;
-	fftw_plan plan;
 	bool transformed;
 };
 
@@ -51,22 +96,55 @@ struct channel_data {
 	uint32_t welch_window_count;
 	uint32_t windows_capacity;
 	uint32_t window_length;
+	uint32_t out_length; // Number of values produced per transform
 	uint32_t new_window_interval; // Samples before opening a window
 	uint32_t sample_index; // Samples since last opening a window
 	double *welch_output;
 	uint64_t output_index; // Distinguishes subsequent fourier transforms
+	uint32_t bin_count; // Number of output bins
+	uint32_t *bin_edge; // bin_count + 1 edges, as indices into welch_output
+	float *frame; // Binary output frame
+	uint32_t decimate; // Input samples averaged into each analysed sample
+	uint32_t decimate_count; // Input samples in decimate_sum
+	double decimate_sum;
+	double *band_freq; // Band analysis bin frequencies in Hz, or NULL
+	double *band_cos; // Band analysis per-bin cosine of angular frequency
+	double *band_sin; // Band analysis per-bin sine of angular frequency
+	bool single; // Whether windows use the single precision plan
+	fftw_plan plan; // Shared by all the channel's windows, or NULL
+	fftwf_plan plan_single; // Single precision version of plan, or NULL
 };
 
+/*
+ * A worker thread, which does the analysis for a subset of the channels.
+ *
+ * The main thread parses the input and queues each sample data message
+ * for the worker that owns its channel, so that channels are transformed
+ * in parallel.  Workers only execute FFTW plans, which is thread safe;
+ * planning is done by the main thread while the workers are stopped.
+ */
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // Signalled when the queue or stop changes
+	bl_msg_sample_data_t queue[WORKER_QUEUE_MAX];
+	unsigned head; // Index of the oldest queued message
+	unsigned used; // Number of queued messages
+	bool stop; // Whether to exit once the queue is empty
+	struct channel_data *channels;
+	const struct output_options *options;
+};
+
+// Serialises output from workers, so records aren't interleaved
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void destroy_sample_window(struct sample_window *window)
 {
 	if (window != NULL) {
-		if (window->plan != NULL) {
-			fftw_destroy_plan(window->plan);
-		}
-		if (window->out_buffer != NULL) {
-			fftw_free(window->out_buffer);
-		}
-		free(window->in_buffer);
+		fftw_free(window->in_buffer);
+		fftw_free(window->out_buffer);
+		fftwf_free(window->in_single);
+		fftwf_free(window->out_single);
 		free(window);
 	}
 }
@@ -79,21 +157,19 @@ static struct sample_window *create_sample_window(
 		return NULL;
 	}
 	window->buffer_capacity = channel->window_length;
-	window->out_capacity = channel->window_length / 2 + 1;
-	window->in_buffer = malloc(window->buffer_capacity *
-			sizeof(*window->in_buffer));
-	if (window->in_buffer == NULL) {
-		goto cleanup;
-	}
-	window->out_buffer = fftw_malloc((window->out_capacity) *
-			sizeof(*window->out_buffer));
-	if (window->out_buffer == NULL) {
-		goto cleanup;
-	}
-	window->plan = fftw_plan_dft_r2c_1d(channel->window_length,
-			window->in_buffer, window->out_buffer, FFTW_MEASURE);
-	if (window->plan == NULL) {
-		goto cleanup;
+	window->out_capacity = channel->out_length;
+	if (channel->single) {
+		window->in_single = fftwf_alloc_real(window->buffer_capacity);
+		window->out_single = fftwf_alloc_complex(window->out_capacity);
+		if (window->in_single == NULL || window->out_single == NULL) {
+			goto cleanup;
+		}
+	} else {
+		window->in_buffer = fftw_alloc_real(window->buffer_capacity);
+		window->out_buffer = fftw_alloc_complex(window->out_capacity);
+		if (window->in_buffer == NULL || window->out_buffer == NULL) {
+			goto cleanup;
+		}
 	}
 	return window;
 
@@ -107,15 +183,67 @@ static inline bool window_is_full(struct sample_window *window)
 	return window->sample_count >= window->buffer_capacity;
 }
 
-static unsigned add_sample_to_window(struct sample_window *window, double sample)
+/*
+ * Run the band analysis Goertzel bank over a full window.
+ *
+ * The window mean is removed first, as the band of interest is usually
+ * close to DC, and leakage from the DC offset would swamp it.
+ */
+static void goertzel_window(const struct channel_data *channel,
+		struct sample_window *window)
+{
+	double mean = 0;
+
+	for (uint32_t i = 0; i < window->buffer_capacity; i++) {
+		mean += window->in_buffer[i];
+	}
+	mean /= window->buffer_capacity;
+
+	for (uint32_t k = 0; k < window->out_capacity; k++) {
+		double coeff = 2 * channel->band_cos[k];
+		double s1 = 0;
+		double s2 = 0;
+
+		for (uint32_t i = 0; i < window->buffer_capacity; i++) {
+			double s = window->in_buffer[i] - mean + coeff * s1 - s2;
+			s2 = s1;
+			s1 = s;
+		}
+
+		window->out_buffer[k][0] = s1 - s2 * channel->band_cos[k];
+		window->out_buffer[k][1] = s2 * channel->band_sin[k];
+	}
+}
+
+static void transform_window(const struct channel_data *channel,
+		struct sample_window *window)
+{
+	if (channel->plan_single != NULL) {
+		fftwf_execute_dft_r2c(channel->plan_single,
+				window->in_single, window->out_single);
+	} else if (channel->plan != NULL) {
+		fftw_execute_dft_r2c(channel->plan,
+				window->in_buffer, window->out_buffer);
+	} else {
+		goertzel_window(channel, window);
+	}
+}
+
+static unsigned add_sample_to_window(const struct channel_data *channel,
+		struct sample_window *window, double sample)
 {
 	if (!window_is_full(window)) {
-		window->in_buffer[window->sample_count] = sample;
+		if (window->in_single != NULL) {
+			window->in_single[window->sample_count] = sample;
+		} else {
+			window->in_buffer[window->sample_count] = sample;
+		}
 		window->sample_count++;
 	}
 	if (window_is_full(window)) {
 		if (!window->transformed) {
-			fftw_execute(window->plan);
+			transform_window(channel, window);
+			window->transformed = true;
 		}
 		return 1;
 	}
@@ -127,8 +255,13 @@ static inline void mod_welch_average(struct channel_data *channel,
 {
 	for (uint32_t i = 0; i < window->out_capacity; i++) {
 		double real, imag, mag, addition;
-		real = window->out_buffer[i][0];
-		imag = window->out_buffer[i][1];
+		if (window->out_single != NULL) {
+			real = window->out_single[i][0];
+			imag = window->out_single[i][1];
+		} else {
+			real = window->out_buffer[i][0];
+			imag = window->out_buffer[i][1];
+		}
 		mag = real * real + imag * imag;
 		// complex magnitude is immediately squared in welch's method
 		addition = mag / window_value / channel->welch_window_count;
@@ -154,7 +287,7 @@ static void welch_method(struct channel_data *channel)
 	// Unless we use a non-square window function, the window value is easy
 	// Otherwise, sum the windowed value squared over the entire window
 	unsigned window_value = channel->window_length;
-	unsigned out_length = channel->window_length / 2 + 1;
+	unsigned out_length = channel->out_length;
 	struct sample_window *window;
 	if (channel->welch_output == NULL) {
 		// Populate from every full window if this is the first run
@@ -179,20 +312,66 @@ static void welch_method(struct channel_data *channel)
 	}
 }
 
-static void print_welch_output(struct channel_data *channel)
+static bool write_spec_record(enum spec_record type, uint16_t channel)
 {
-	unsigned out_length = channel->window_length / 2 + 1;
-	for (unsigned i = 0; i < out_length; i++) {
-		printf("%"PRIu16",%"PRIu64",%f\n", channel->channel,
-				channel->output_index, channel->welch_output[i]);
+	uint32_t header[2] = { type, channel };
+
+	return fwrite(header, sizeof(header), 1, stdout) == 1;
+}
+
+static void print_welch_output(struct channel_data *channel,
+		const struct output_options *options)
+{
+	pthread_mutex_lock(&output_lock);
+	for (unsigned i = 0; i < channel->bin_count; i++) {
+		unsigned start = channel->bin_edge[i];
+		unsigned end = channel->bin_edge[i + 1];
+		double value = 0;
+
+		// Aggregated bins report the mean power of the bins they cover
+		for (unsigned j = start; j < end; j++) {
+			value += channel->welch_output[j];
+		}
+		value /= end - start;
+
+		if (options->binary) {
+			channel->frame[i] = value;
+		} else {
+			printf("%"PRIu16",%"PRIu64",%f\n", channel->channel,
+					channel->output_index, value);
+		}
+	}
+
+	if (options->binary) {
+		if (!write_spec_record(SPEC_RECORD_FRAME, channel->channel) ||
+		    fwrite(&channel->output_index,
+				sizeof(channel->output_index), 1, stdout) != 1 ||
+		    fwrite(channel->frame, sizeof(*channel->frame),
+				channel->bin_count, stdout) != channel->bin_count) {
+			fprintf(stderr, "Failed to write spectrogram frame\n");
+		}
 	}
+	pthread_mutex_unlock(&output_lock);
 	channel->output_index++;
 }
 
-static int add_sample_to_channel(struct channel_data *channel, double sample)
+static int add_sample_to_channel(struct channel_data *channel, double sample,
+		const struct output_options *options)
 {
 	unsigned full_windows = 0;
 	struct sample_window *window;
+
+	if (channel->decimate > 1) {
+		// Block average down to the analysis rate
+		channel->decimate_sum += sample;
+		if (++channel->decimate_count < channel->decimate) {
+			return 0;
+		}
+		sample = channel->decimate_sum / channel->decimate;
+		channel->decimate_sum = 0;
+		channel->decimate_count = 0;
+	}
+
 	if (channel->sample_index > 0
 			&& channel->sample_index % channel->new_window_interval == 0) {
 		struct sample_window *w = create_sample_window(channel);
@@ -207,12 +386,12 @@ static int add_sample_to_channel(struct channel_data *channel, double sample)
 
 	for (unsigned i = 0; fifo_peek_back(channel->windows, i,
 				(void**) &window); i++) {
-		full_windows += add_sample_to_window(window, sample);
+		full_windows += add_sample_to_window(channel, window, sample);
 	}
 
 	if (full_windows == channel->welch_window_count) {
 		welch_method(channel);
-		print_welch_output(channel);
+		print_welch_output(channel, options);
 
 		if (!fifo_read(channel->windows, (void**) &window)) {
 			return -1;
@@ -248,22 +427,232 @@ static int init_channel(struct channel_data *channel,
 	return 0;
 }
 
+/*
+ * Work out which FFT bins to output, and how to aggregate them.
+ *
+ * Bins outside the selected frequency range are dropped.  With log_bins,
+ * the remaining bins are grouped into up to log_bins log-spaced bins, each
+ * covering at least one FFT bin.
+ */
+static int init_channel_bins(struct channel_data *channel,
+		uint16_t frequency, const struct output_options *options)
+{
+	double bin_hz = (double) frequency / channel->window_length;
+	unsigned lo, hi, max_bins;
+
+	lo = 0;
+	hi = channel->out_length - 1;
+	if (channel->band_freq == NULL) {
+		lo = ceil(options->freq_min / bin_hz);
+		if (options->freq_max > 0 && options->freq_max / bin_hz < hi) {
+			hi = floor(options->freq_max / bin_hz);
+		}
+	}
+	if (lo > hi) {
+		fprintf(stderr, "Frequency range %f-%f Hz contains no bins\n",
+				options->freq_min, options->freq_max);
+		return -1;
+	}
+
+	max_bins = hi - lo + 1;
+	if (options->log_bins != 0 && options->log_bins < max_bins) {
+		max_bins = options->log_bins;
+	}
+
+	// Drop any bins from a previous START
+	free(channel->bin_edge);
+	free(channel->frame);
+
+	channel->bin_edge = malloc((max_bins + 1) * sizeof(*channel->bin_edge));
+	channel->frame = malloc(max_bins * sizeof(*channel->frame));
+	if (channel->bin_edge == NULL || channel->frame == NULL) {
+		return -errno;
+	}
+
+	channel->bin_edge[0] = lo;
+	channel->bin_count = 0;
+	if (options->log_bins == 0) {
+		for (unsigned i = lo; i <= hi; i++) {
+			channel->bin_edge[++channel->bin_count] = i + 1;
+		}
+	} else {
+		// Log spacing can't start from DC, so start from bin 1 at least
+		double base = (lo > 0) ? lo : 1;
+		double ratio = (hi + 1) / base;
+
+		while (channel->bin_edge[channel->bin_count] <= hi) {
+			unsigned prev = channel->bin_edge[channel->bin_count];
+			unsigned edge = floor(base * pow(ratio,
+					(double) (channel->bin_count + 1) / max_bins));
+
+			if (edge <= prev) {
+				edge = prev + 1;
+			}
+			if (edge > hi || channel->bin_count + 1 == max_bins) {
+				edge = hi + 1;
+			}
+			channel->bin_edge[++channel->bin_count] = edge;
+		}
+	}
+
+	if (options->binary) {
+		uint32_t count = channel->bin_count;
+
+		for (unsigned i = 0; i < channel->bin_count; i++) {
+			if (channel->band_freq != NULL) {
+				channel->frame[i] = channel->band_freq[i];
+				continue;
+			}
+			channel->frame[i] = bin_hz * (channel->bin_edge[i] +
+					channel->bin_edge[i + 1] - 1) / 2;
+		}
+
+		if (!write_spec_record(SPEC_RECORD_BINS, channel->channel) ||
+		    fwrite(&count, sizeof(count), 1, stdout) != 1 ||
+		    fwrite(channel->frame, sizeof(*channel->frame),
+				count, stdout) != count) {
+			fprintf(stderr, "Failed to write spectrogram bins\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Set up band analysis.
+ *
+ * The input is block averaged down to around four times the top of the
+ * band, since block averaging is a poor anti-aliasing filter.  A Goertzel
+ * bin is then evaluated at each of band_bins evenly spaced frequencies
+ * across the band, rather than computing the full spectrum.
+ */
+static int init_channel_band(struct channel_data *channel,
+		uint16_t frequency, const struct output_options *options)
+{
+	uint32_t bins = options->band_bins;
+	double step = (options->freq_max - options->freq_min) / (bins - 1);
+	double rate;
+
+	if (options->freq_max > frequency / 2.0) {
+		fprintf(stderr, "Band maximum %f Hz is above Nyquist (%f Hz)\n",
+				options->freq_max, frequency / 2.0);
+		return -1;
+	}
+
+	channel->decimate = floor(frequency / (4 * options->freq_max));
+	if (channel->decimate < 1) {
+		channel->decimate = 1;
+	}
+	rate = (double) frequency / channel->decimate;
+
+	// Drop any band from a previous START
+	free(channel->band_freq);
+	free(channel->band_cos);
+	free(channel->band_sin);
+
+	channel->band_freq = malloc(bins * sizeof(*channel->band_freq));
+	channel->band_cos = malloc(bins * sizeof(*channel->band_cos));
+	channel->band_sin = malloc(bins * sizeof(*channel->band_sin));
+	if (channel->band_freq == NULL ||
+	    channel->band_cos == NULL ||
+	    channel->band_sin == NULL) {
+		return -errno;
+	}
+
+	for (uint32_t k = 0; k < bins; k++) {
+		double w;
+
+		channel->band_freq[k] = options->freq_min + k * step;
+		w = 2 * M_PI * channel->band_freq[k] / rate;
+		channel->band_cos[k] = cos(w);
+		channel->band_sin[k] = sin(w);
+	}
+
+	return 0;
+}
+
+/*
+ * Make the FFTW plan shared by all of a channel's windows.
+ *
+ * Planning overwrites the buffers, so it's done with the channel's first
+ * window before any samples are added to it.  Each window is transformed
+ * with the new-array execute functions, which is valid since all windows
+ * have buffers of the same size and alignment.
+ */
+static int init_channel_plan(struct channel_data *channel,
+		struct sample_window *window)
+{
+	if (channel->plan != NULL) {
+		fftw_destroy_plan(channel->plan);
+		channel->plan = NULL;
+	}
+	if (channel->plan_single != NULL) {
+		fftwf_destroy_plan(channel->plan_single);
+		channel->plan_single = NULL;
+	}
+
+	if (channel->single) {
+		channel->plan_single = fftwf_plan_dft_r2c_1d(
+				channel->window_length, window->in_single,
+				window->out_single, FFTW_MEASURE);
+		if (channel->plan_single == NULL) {
+			return -1;
+		}
+	} else {
+		channel->plan = fftw_plan_dft_r2c_1d(channel->window_length,
+				window->in_buffer, window->out_buffer,
+				FFTW_MEASURE);
+		if (channel->plan == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static int init_channel_samples(struct channel_data *channel,
-		uint32_t window_length_samples)
+		uint32_t window_length_samples, uint16_t frequency,
+		const struct output_options *options)
 {
 	struct sample_window *window;
-	channel->window_length = window_length_samples;
-	channel->new_window_interval = window_length_samples / 2;
+	int ret;
 	if (channel->windows == NULL) {
 		fprintf(stderr, "Failed to initialise channel. "
 				"Perhaps a channel config message is missing from the input "
 				"stream\n");
 		return -1;
 	}
+	channel->decimate = 1;
+	if (options->band_bins != 0) {
+		ret = init_channel_band(channel, frequency, options);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	channel->window_length = window_length_samples / channel->decimate;
+	channel->new_window_interval = channel->window_length / 2;
+	channel->out_length = (options->band_bins != 0) ?
+			options->band_bins : channel->window_length / 2 + 1;
+	if (channel->window_length < 2) {
+		fprintf(stderr, "Window is too short to analyse\n");
+		return -1;
+	}
+	ret = init_channel_bins(channel, frequency, options);
+	if (ret < 0) {
+		return ret;
+	}
+	channel->single = options->single;
 	window = create_sample_window(channel);
 	if (window == NULL) {
 		return -errno;
 	}
+	if (options->band_bins == 0) {
+		ret = init_channel_plan(channel, window);
+		if (ret < 0) {
+			destroy_sample_window(window);
+			return ret;
+		}
+	}
 	if (!fifo_write(channel->windows, &window)) {
 		return -1;
 	}
@@ -276,6 +665,17 @@ static void destroy_channel(struct channel_data *channel)
 	if (channel->welch_output != NULL) {
 		free(channel->welch_output);
 	}
+	free(channel->bin_edge);
+	free(channel->frame);
+	free(channel->band_freq);
+	free(channel->band_cos);
+	free(channel->band_sin);
+	if (channel->plan != NULL) {
+		fftw_destroy_plan(channel->plan);
+	}
+	if (channel->plan_single != NULL) {
+		fftwf_destroy_plan(channel->plan_single);
+	}
 	// Destroy all existing windows
 	if (channel->windows != NULL) {
 		while (fifo_read(channel->windows, (void**) &window)) {
@@ -285,14 +685,131 @@ static void destroy_channel(struct channel_data *channel)
 	}
 }
 
-static int read_stream(uint32_t window_length, uint16_t window_count)
+static void process_samples(struct channel_data *channel,
+		const bl_msg_sample_data_t *msg,
+		const struct output_options *options)
+{
+	double values[BL_SAMPLE_MAX];
+	unsigned count;
+
+	count = bl_sample_unpack_double(msg, values);
+	for (unsigned i = 0; i < count; i++) {
+		add_sample_to_channel(channel, values[i], options);
+	}
+}
+
+static void *worker_main(void *pw)
+{
+	struct worker *worker = pw;
+
+	pthread_mutex_lock(&worker->lock);
+	for (;;) {
+		bl_msg_sample_data_t msg;
+
+		while (worker->used == 0 && !worker->stop) {
+			pthread_cond_wait(&worker->cond, &worker->lock);
+		}
+		if (worker->used == 0) {
+			break;
+		}
+
+		msg = worker->queue[worker->head];
+		worker->head = (worker->head + 1) % WORKER_QUEUE_MAX;
+		worker->used--;
+		pthread_cond_broadcast(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+
+		process_samples(worker->channels + msg.channel, &msg,
+				worker->options);
+
+		pthread_mutex_lock(&worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+static void queue_samples(struct worker *worker,
+		const bl_msg_sample_data_t *msg)
+{
+	pthread_mutex_lock(&worker->lock);
+	while (worker->used == WORKER_QUEUE_MAX) {
+		pthread_cond_wait(&worker->cond, &worker->lock);
+	}
+	worker->queue[(worker->head + worker->used) % WORKER_QUEUE_MAX] = *msg;
+	worker->used++;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/*
+ * Stop the running workers, once they have finished their queued samples.
+ */
+static void stop_workers(struct worker *workers, unsigned *running)
+{
+	for (unsigned i = 0; i < *running; i++) {
+		pthread_mutex_lock(&workers[i].lock);
+		workers[i].stop = true;
+		pthread_cond_broadcast(&workers[i].cond);
+		pthread_mutex_unlock(&workers[i].lock);
+	}
+
+	for (unsigned i = 0; i < *running; i++) {
+		pthread_join(workers[i].thread, NULL);
+		pthread_cond_destroy(&workers[i].cond);
+		pthread_mutex_destroy(&workers[i].lock);
+	}
+
+	*running = 0;
+}
+
+static int start_workers(struct worker *workers, unsigned count,
+		struct channel_data *channels, unsigned *running,
+		const struct output_options *options)
+{
+	for (unsigned i = 0; i < count; i++) {
+		struct worker *worker = workers + i;
+
+		worker->head = 0;
+		worker->used = 0;
+		worker->stop = false;
+		worker->channels = channels;
+		worker->options = options;
+
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+		if (pthread_create(&worker->thread, NULL,
+				worker_main, worker) != 0) {
+			pthread_cond_destroy(&worker->cond);
+			pthread_mutex_destroy(&worker->lock);
+			stop_workers(workers, running);
+			fprintf(stderr, "Failed to start worker thread\n");
+			return -1;
+		}
+		(*running)++;
+	}
+	return 0;
+}
+
+static int read_stream(uint32_t window_length, uint16_t window_count,
+		const struct output_options *options)
 {
 	union bl_msg_data msg; // message for reading into
 	struct channel_data channels[BL_CHANNEL_MAX] = {0};
 	struct channel_data *channel;
+	unsigned owner[BL_CHANNEL_MAX] = {0}; // Worker for each channel
+	struct worker *workers = NULL;
+	unsigned running = 0; // Number of running workers
 	int ret;
 	unsigned highest_channel = 0;
 
+	if (options->jobs > 0) {
+		workers = calloc(options->jobs, sizeof(*workers));
+		if (workers == NULL) {
+			return -errno;
+		}
+	}
+
 	while (!bl_sig_killed && bl_msg_yaml_parse(stdin, &msg)) {
 		uint32_t length_samples;
 		switch(msg.type) {
@@ -300,6 +817,9 @@ static int read_stream(uint32_t window_length, uint16_t window_count)
 			assert(msg.channel_conf.channel <
 					BL_ARRAY_LEN(channels));
 
+			// Channel state is only changed while workers are stopped
+			stop_workers(workers, &running);
+
 			if (msg.channel_conf.channel > highest_channel) {
 				highest_channel = msg.channel_conf.channel;
 			}
@@ -315,9 +835,24 @@ static int read_stream(uint32_t window_length, uint16_t window_count)
 			length_samples = window_length *
 				msg.start.frequency	/ 1000; // Magical 1000 from milliseconds.
 
+			stop_workers(workers, &running);
+
 			// Create all the channels' buffers now we know the size
 			for (unsigned i = 0; i <= highest_channel; i++) {
-				ret = init_channel_samples(channels + i, length_samples);
+				ret = init_channel_samples(channels + i, length_samples,
+						msg.start.frequency, options);
+				if (ret < 0) {
+					goto cleanup;
+				}
+				// Share the channels out between the workers
+				if (options->jobs > 0) {
+					owner[i] = i % options->jobs;
+				}
+			}
+
+			if (workers != NULL) {
+				ret = start_workers(workers, options->jobs,
+						channels, &running, options);
 				if (ret < 0) {
 					goto cleanup;
 				}
@@ -329,20 +864,20 @@ static int read_stream(uint32_t window_length, uint16_t window_count)
 					BL_ARRAY_LEN(channels));
 			channel = channels + msg.sample_data.channel;
 
-			for (unsigned i = 0; i < msg.sample_data.count; i++) {
-				if (msg.type == BL_MSG_SAMPLE_DATA16) {
-					add_sample_to_channel(channel,
-							(double) msg.sample_data.data16[i]);
-				} else {
-					add_sample_to_channel(channel,
-							(double) msg.sample_data.data32[i]);
-				}
+			if (running > 0) {
+				queue_samples(workers + owner[msg.sample_data.channel],
+						&msg.sample_data);
+			} else {
+				process_samples(channel, &msg.sample_data,
+						options);
 			}
 			break;
 		}
 	}
 	ret = 0;
 cleanup:
+	stop_workers(workers, &running);
+	free(workers);
 	for (unsigned i = 0; i < BL_ARRAY_LEN(channels); i++) {
 		destroy_channel(channels + i);
 	}
@@ -354,47 +889,161 @@ static void usage(FILE* file, char *argv[])
 	fprintf(file, "Performs fourier transforms on a continuous stream of data\n");
 	fprintf(file, "This is done by taking the fourier transform of a series "
 			"of overlapping windows and averaging them together\n");
-	fprintf(file, "It outputs a series of transforms in the format "
-			"[transform_index],[channel_id],[value]\n");
+	fprintf(file, "By default it outputs a series of transforms in the format "
+			"[channel_id],[transform_index],[value]\n");
 	fprintf(file, "\n");
-	fprintf(file, "Usage: %s [WINDOW_LENGTH] [WINDOW_COUNT]\n", argv[0]);
+	fprintf(file, "Usage: %s [OPTIONS] [WINDOW_LENGTH] [WINDOW_COUNT]\n", argv[0]);
 	fprintf(file, "  SAMPLE_WINDOW: The time (in ms) to perform the fft over\n");
 	fprintf(file, "  WINDOW COUNT: The number of windows to average over\n");
+	fprintf(file, "\n");
+	fprintf(file, "Options:\n");
+	fprintf(file, "  -b, --binary         Write binary float32 spectrogram "
+			"frames instead of CSV\n");
+	fprintf(file, "  -l, --log-bins N     Aggregate to N log-spaced bins\n");
+	fprintf(file, "  -m, --min-freq HZ    Lowest frequency to output\n");
+	fprintf(file, "  -M, --max-freq HZ    Highest frequency to output\n");
+	fprintf(file, "  -g, --band N         Analyse N evenly spaced frequencies "
+			"from --min-freq to\n"
+			"                       --max-freq with a Goertzel bank, "
+			"after decimating\n");
+	fprintf(file, "  -s, --single         Transform in single precision, "
+			"which is faster\n");
+	fprintf(file, "  -j, --jobs N         Transform channels in parallel on "
+			"N worker threads\n");
+	fprintf(file, "  -h, --help           Print this help\n");
+}
+
+static bool parse_options(int argc, char *argv[],
+		struct output_options *options)
+{
+	const struct option long_options[] = {
+		{ "binary",   no_argument,       NULL, 'b' },
+		{ "log-bins", required_argument, NULL, 'l' },
+		{ "min-freq", required_argument, NULL, 'm' },
+		{ "max-freq", required_argument, NULL, 'M' },
+		{ "band",     required_argument, NULL, 'g' },
+		{ "single",   no_argument,       NULL, 's' },
+		{ "jobs",     required_argument, NULL, 'j' },
+		{ "help",     no_argument,       NULL, 'h' },
+		{ NULL,       0,                 NULL,  0  },
+	};
+	int c;
+
+	while ((c = getopt_long(argc, argv, "bl:m:M:g:sj:h",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			options->binary = true;
+			break;
+		case 'l':
+			if (!read_sized_uint(optarg, &options->log_bins,
+					sizeof(options->log_bins))) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'm':
+			if (!read_double(optarg, &options->freq_min) ||
+			    options->freq_min < 0) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'M':
+			if (!read_double(optarg, &options->freq_max) ||
+			    options->freq_max < 0) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'g':
+			if (!read_sized_uint(optarg, &options->band_bins,
+					sizeof(options->band_bins)) ||
+			    options->band_bins < 2) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 's':
+			options->single = true;
+			break;
+		case 'j':
+			if (!read_sized_uint(optarg, &options->jobs,
+					sizeof(options->jobs)) ||
+			    options->jobs > BL_CHANNEL_MAX) {
+				fprintf(stderr, "Could not parse '%s'\n", optarg);
+				return false;
+			}
+			break;
+		case 'h':
+			usage(stdout, argv);
+			exit(EXIT_SUCCESS);
+		default:
+			return false;
+		}
+	}
+
+	if (options->band_bins != 0) {
+		if (options->freq_max <= options->freq_min) {
+			fprintf(stderr, "Band analysis needs --max-freq "
+					"above --min-freq\n");
+			return false;
+		}
+		if (options->log_bins != 0) {
+			fprintf(stderr, "Band analysis can't be combined "
+					"with --log-bins\n");
+			return false;
+		}
+		if (options->single) {
+			fprintf(stderr, "Band analysis doesn't use the FFT, "
+					"so can't be combined with --single\n");
+			return false;
+		}
+	}
+
+	return true;
 }
 
 int main(int argc, char *argv[])
 {
+	struct output_options options = { 0 };
 	uint32_t window_length = DEFAULT_WINDOW_LENGTH;
 	uint32_t window_count = DEFAULT_WINDOW_COUNT;
 	enum {
-		ARG_PROG_NAME,
 		ARG_WINDOW_LENGTH,
 		ARG_WINDOW_COUNT,
 
 		ARG__COUNT,
 	};
-	if (argc > ARG__COUNT) {
+
+	if (!parse_options(argc, argv, &options)) {
+		usage(stderr, argv);
+		return EXIT_FAILURE;
+	}
+	if (argc - optind > ARG__COUNT) {
 		fprintf(stderr, "%d is the wrong number of arguments\n", argc);
 		usage(stderr, argv);
 		return EXIT_FAILURE;
 	}
 
 	// Parse window length
-	if (argc > ARG_WINDOW_LENGTH) {
-		if (read_sized_uint(argv[ARG_WINDOW_LENGTH], &window_length,
+	if (argc - optind > ARG_WINDOW_LENGTH) {
+		if (read_sized_uint(argv[optind + ARG_WINDOW_LENGTH], &window_length,
 					sizeof(window_length))) {
 		} else {
-			fprintf(stderr, "Could not parse '%s'\n", argv[ARG_WINDOW_LENGTH]);
+			fprintf(stderr, "Could not parse '%s'\n",
+					argv[optind + ARG_WINDOW_LENGTH]);
 			usage(stderr, argv);
 			return EXIT_FAILURE;
 		}
 	}
 
-	if (argc > ARG_WINDOW_COUNT) {
-		if (read_sized_uint(argv[ARG_WINDOW_COUNT], &window_count,
+	if (argc - optind > ARG_WINDOW_COUNT) {
+		if (read_sized_uint(argv[optind + ARG_WINDOW_COUNT], &window_count,
 					sizeof(window_count))) {
 		} else {
-			fprintf(stderr, "Could not parse '%s'\n", argv[ARG_WINDOW_COUNT]);
+			fprintf(stderr, "Could not parse '%s'\n",
+					argv[optind + ARG_WINDOW_COUNT]);
 			usage(stderr, argv);
 			return EXIT_FAILURE;
 		}
@@ -404,5 +1053,11 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	return read_stream(window_length, window_count);
+	if (options.binary) {
+		if (fwrite(SPEC_MAGIC, sizeof(SPEC_MAGIC), 1, stdout) != 1) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return read_stream(window_length, window_count, &options);
 }
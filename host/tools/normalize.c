@@ -27,6 +27,7 @@
 #include "host/common/msg.h"
 #include "host/common/sig.h"
 #include "host/common/fifo.h"
+#include "host/common/sample.h"
 
 #include "util.h"
 
@@ -124,6 +125,8 @@ int read_stream(FILE *stream, long average_width)
 	union bl_msg_data msg; // message for reading into
 	struct channel_data channels[BL_CHANNEL_MAX] = {0};
 	struct channel_data *channel;
+	uint32_t values[BL_SAMPLE_MAX];
+	unsigned count;
 	long average_width_samples = 0; // Average width measured in samples
 	while (!bl_sig_killed && bl_msg_yaml_parse(stream, &msg)) {
 		switch(msg.type) {
@@ -160,15 +163,10 @@ int read_stream(FILE *stream, long average_width)
 				return -1;
 			}
 
-			for (unsigned i = 0; i < msg.sample_data.count; i++) {
-				int ret;
-				if (msg.type == BL_MSG_SAMPLE_DATA16) {
-					ret = add_sample(average_width_samples, channel,
-							msg.sample_data.data16[i]);
-				} else {
-					ret = add_sample(average_width_samples, channel,
-							msg.sample_data.data32[i]);
-				}
+			count = bl_sample_unpack(&msg.sample_data, values);
+			for (unsigned i = 0; i < count; i++) {
+				int ret = add_sample(average_width_samples, channel,
+						values[i]);
 				if (ret < 0) {
 					return ret;
 				}
@@ -0,0 +1,478 @@
+/*
+ * Copyright 2020 Codethink Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <inttypes.h>
+
+#include "common/msg.h"
+#include "common/util.h"
+#include "common/channel.h"
+
+#include "host/common/msg.h"
+#include "host/common/sig.h"
+
+#include "util.h"
+
+#define DEFAULT_BPM 72
+#define DEFAULT_REVISION 2
+
+// Time to wait for commands between sample bursts.
+#define POLL_MS 10
+
+// Simulated ADC: 12-bit, with the pulse riding on a mid-scale DC level.
+#define ADC_LEVEL 2048.0
+#define ADC_PULSE 40.0
+#define ADC_NOISE 2.0
+
+struct sim_source {
+	uint16_t sw_oversample;
+	uint8_t hw_oversample;
+	uint8_t hw_shift;
+};
+
+struct sim_channel {
+	uint8_t source;
+	uint8_t shift;
+	uint32_t offset;
+	bool sample32;
+};
+
+struct sim {
+	int fd;
+	const char *path;
+	uint8_t revision;
+	double bpm;
+
+	struct sim_source source[BL_ACQ_SOURCE_MAX];
+	struct sim_channel channel[BL_CHANNEL_MAX];
+
+	bool active;
+	uint16_t frequency;
+	uint32_t channel_mask;
+	uint64_t sample_index;
+	struct timespec start;
+};
+
+static double elapsed_seconds(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double) (now.tv_sec - start->tv_sec) +
+			(double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Photoplethysmogram shape over one beat, for phase in [0, 1).
+static double ppg_shape(double phase)
+{
+	double systolic = exp(-pow((phase - 0.15) / 0.07, 2));
+	double dicrotic = exp(-pow((phase - 0.45) / 0.10, 2));
+
+	return systolic + 0.4 * dicrotic;
+}
+
+static double noise(void)
+{
+	return ((double) rand() / RAND_MAX - 0.5) * 2.0;
+}
+
+// Simulated raw reading, before the channel's offset and shift.
+static double sim_raw(const struct sim *sim, const struct sim_channel *channel,
+		double t)
+{
+	const struct sim_source *source = sim->source + channel->source;
+	double scale = source->sw_oversample *
+			(double) (1u << source->hw_oversample) /
+			(double) (1u << source->hw_shift);
+	double beats = t * sim->bpm / 60.0;
+	double adc = ADC_LEVEL;
+
+	if (channel->source <= BL_ACQ_PD4) {
+		// Light is absorbed as blood arrives, so the pulse dips.
+		double phase = beats + 0.02 * channel->source;
+		adc -= ADC_PULSE * ppg_shape(phase - floor(phase));
+		adc += 10.0 * sin(2 * M_PI * t / 20.0);
+	}
+	adc += ADC_NOISE * noise();
+
+	return adc * scale;
+}
+
+static uint32_t sim_sample(const struct sim *sim, unsigned acq_channel,
+		double t)
+{
+	const struct sim_channel *channel = sim->channel + acq_channel;
+	double max = channel->sample32 ? UINT32_MAX : UINT16_MAX;
+	double value;
+
+	value = (sim_raw(sim, channel, t) - channel->offset) /
+			(double) (1u << channel->shift);
+	if (value < 0) {
+		value = 0;
+	} else if (value > max) {
+		value = max;
+	}
+
+	return (uint32_t) value;
+}
+
+static bool sim_write_samples(struct sim *sim, uint64_t count)
+{
+	for (unsigned c = 0; c < BL_CHANNEL_MAX; c++) {
+		const struct sim_channel *channel = sim->channel + c;
+		uint64_t index = sim->sample_index;
+		uint64_t end = index + count;
+
+		if (!(sim->channel_mask & (1u << c))) {
+			continue;
+		}
+
+		while (index < end) {
+			bl_msg_sample_data_t msg;
+			unsigned max = channel->sample32 ?
+					MSG_SAMPLE_DATA32_MAX :
+					MSG_SAMPLE_DATA16_MAX;
+			size_t len;
+
+			msg.type = channel->sample32 ?
+					BL_MSG_SAMPLE_DATA32 :
+					BL_MSG_SAMPLE_DATA16;
+			msg.channel = c;
+			msg.count = (end - index) < max ? (end - index) : max;
+			msg.reserved = 0;
+
+			for (unsigned i = 0; i < msg.count; i++) {
+				double t = (double) (index + i) / sim->frequency;
+				uint32_t value = sim_sample(sim, c, t);
+
+				if (channel->sample32) {
+					msg.data32[i] = value;
+				} else {
+					msg.data16[i] = value;
+				}
+			}
+
+			// bl_msg_write only writes the header for sample data.
+			len = bl_msg_type_to_len(msg.type) + msg.count *
+					(channel->sample32 ? sizeof(uint32_t) :
+							     sizeof(uint16_t));
+			if (write(sim->fd, &msg, len) != (ssize_t) len) {
+				fprintf(stderr, "Failed to write samples: %s\n",
+						strerror(errno));
+				return false;
+			}
+
+			index += msg.count;
+		}
+	}
+
+	sim->sample_index += count;
+	return true;
+}
+
+static bool sim_stream(struct sim *sim)
+{
+	uint64_t due;
+
+	if (!sim->active) {
+		return true;
+	}
+
+	due = (uint64_t) (elapsed_seconds(&sim->start) * sim->frequency);
+	if (due <= sim->sample_index) {
+		return true;
+	}
+
+	return sim_write_samples(sim, due - sim->sample_index);
+}
+
+static enum bl_error sim_start(struct sim *sim, const bl_msg_start_t *start)
+{
+	if (sim->active) {
+		return BL_ERROR_ACTIVE_ACQUISITION;
+	}
+
+	if (start->frequency == 0) {
+		return BL_ERROR_BAD_FREQUENCY;
+	}
+
+	// Matches the channels the device enables for each mode.
+	if (start->flash_mode == BL_ACQ_FLASH) {
+		sim->channel_mask = start->led_mask |
+				((start->src_mask & 0xF0u) << BL_LED_COUNT);
+	} else {
+		sim->channel_mask = start->src_mask;
+	}
+
+	sim->frequency = start->frequency;
+	sim->sample_index = 0;
+	sim->active = true;
+	clock_gettime(CLOCK_MONOTONIC, &sim->start);
+
+	fprintf(stderr, "Acquisition started: %"PRIu16" Hz, "
+			"channel mask 0x%"PRIx32"\n",
+			sim->frequency, sim->channel_mask);
+	return BL_ERROR_NONE;
+}
+
+static bool sim_handle(struct sim *sim, const union bl_msg_data *msg)
+{
+	union bl_msg_data reply = {
+		.response = {
+			.type = BL_MSG_RESPONSE,
+			.response_to = msg->type,
+			.error_code = BL_ERROR_NONE,
+		},
+	};
+
+	switch (msg->type) {
+	case BL_MSG_LED:
+		break;
+
+	case BL_MSG_SOURCE_CONF:
+		if (msg->source_conf.source >= BL_ACQ_SOURCE_MAX) {
+			reply.response.error_code = BL_ERROR_OUT_OF_RANGE;
+			break;
+		}
+		sim->source[msg->source_conf.source] = (struct sim_source) {
+			.sw_oversample = msg->source_conf.sw_oversample,
+			.hw_oversample = msg->source_conf.hw_oversample,
+			.hw_shift      = msg->source_conf.hw_shift,
+		};
+		break;
+
+	case BL_MSG_CHANNEL_CONF:
+		if (msg->channel_conf.channel >= BL_CHANNEL_MAX ||
+		    msg->channel_conf.source >= BL_ACQ_SOURCE_MAX) {
+			reply.response.error_code = BL_ERROR_OUT_OF_RANGE;
+			break;
+		}
+		sim->channel[msg->channel_conf.channel] = (struct sim_channel) {
+			.source   = msg->channel_conf.source,
+			.shift    = msg->channel_conf.shift,
+			.offset   = msg->channel_conf.offset,
+			.sample32 = msg->channel_conf.sample32,
+		};
+		break;
+
+	case BL_MSG_START:
+		reply.response.error_code = sim_start(sim, &msg->start);
+		break;
+
+	case BL_MSG_ABORT:
+		if (sim->active) {
+			fprintf(stderr, "Acquisition aborted\n");
+		}
+		sim->active = false;
+		break;
+
+	case BL_MSG_SOURCE_CAP_REQ:
+		if (msg->source_cap_req.source >= BL_ACQ_SOURCE_MAX) {
+			reply.response.error_code = BL_ERROR_OUT_OF_RANGE;
+			break;
+		}
+		reply = (union bl_msg_data) {
+			.source_cap = {
+				.type = BL_MSG_SOURCE_CAP,
+				.source = msg->source_cap_req.source,
+				.hw_oversample = (sim->revision != 1),
+			},
+		};
+		break;
+
+	case BL_MSG_VERSION_REQ:
+		reply = (union bl_msg_data) {
+			.version = {
+				.type = BL_MSG_VERSION,
+				.revision = sim->revision,
+				.capabilities = BL_MSG_CAP_PIPELINE,
+			},
+		};
+		break;
+
+	default:
+		reply.response.error_code = BL_ERROR_BAD_MESSAGE_TYPE;
+		break;
+	}
+
+	return bl_msg_write(sim->fd, sim->path, &reply);
+}
+
+static int sim_open(struct sim *sim, int *slave)
+{
+	struct termios t;
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open pseudo-terminal: %s\n",
+				strerror(errno));
+		return -1;
+	}
+
+	if (grantpt(fd) != 0 || unlockpt(fd) != 0) {
+		fprintf(stderr, "Failed to unlock pseudo-terminal: %s\n",
+				strerror(errno));
+		goto error;
+	}
+
+	sim->path = ptsname(fd);
+	if (sim->path == NULL) {
+		fprintf(stderr, "Failed to get pseudo-terminal name: %s\n",
+				strerror(errno));
+		goto error;
+	}
+
+	// Keep the slave end open, so the master doesn't see hangups
+	// between host sessions.
+	*slave = open(sim->path, O_RDWR | O_NOCTTY);
+	if (*slave == -1) {
+		fprintf(stderr, "Failed to open '%s': %s\n",
+				sim->path, strerror(errno));
+		goto error;
+	}
+
+	if (tcgetattr(*slave, &t) == 0) {
+		cfmakeraw(&t);
+		tcsetattr(*slave, TCSANOW, &t);
+	}
+
+	return fd;
+
+error:
+	close(fd);
+	return -1;
+}
+
+static int simulate(struct sim *sim)
+{
+	int ret = EXIT_FAILURE;
+	int slave = -1;
+
+	sim->fd = sim_open(sim, &slave);
+	if (sim->fd == -1) {
+		return EXIT_FAILURE;
+	}
+
+	printf("%s\n", sim->path);
+	fflush(stdout);
+
+	while (!bl_sig_killed) {
+		struct pollfd pfd = {
+			.fd = sim->fd,
+			.events = POLLIN,
+		};
+		union bl_msg_data msg;
+
+		if (poll(&pfd, 1, POLL_MS) > 0 && (pfd.revents & POLLIN)) {
+			if (!bl_msg_read(sim->fd, POLL_MS, &msg)) {
+				continue;
+			}
+			if (!sim_handle(sim, &msg)) {
+				goto cleanup;
+			}
+		}
+
+		if (!sim_stream(sim)) {
+			goto cleanup;
+		}
+	}
+
+	ret = EXIT_SUCCESS;
+
+cleanup:
+	close(slave);
+	close(sim->fd);
+	return ret;
+}
+
+void usage(FILE* file, char *argv[])
+{
+	fprintf(file, "Simulates a Bloodlight device on a pseudo-terminal\n");
+	fprintf(file, "The pseudo-terminal's path is printed on stdout; pass "
+			"it to bl or bloodview as the device path\n");
+	fprintf(file, "\n");
+	fprintf(file, "Usage: %s [BPM [REVISION]]\n", argv[0]);
+	fprintf(file, "  BPM:      simulated pulse rate (default %u)\n",
+			DEFAULT_BPM);
+	fprintf(file, "  REVISION: hardware revision to report (default %u)\n",
+			DEFAULT_REVISION);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sim sim = {
+		.revision = DEFAULT_REVISION,
+		.bpm = DEFAULT_BPM,
+	};
+	enum {
+		ARG_PROG_NAME,
+		ARG_BPM,
+		ARG_REVISION,
+
+		ARG__COUNT,
+	};
+
+	if (argc > ARG__COUNT) {
+		fprintf(stderr, "%d is the wrong number of arguments\n", argc);
+		usage(stderr, argv);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > ARG_BPM) {
+		if (!read_double(argv[ARG_BPM], &sim.bpm) || sim.bpm <= 0) {
+			fprintf(stderr, "Could not parse '%s'\n",
+					argv[ARG_BPM]);
+			usage(stderr, argv);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc > ARG_REVISION) {
+		uint32_t revision;
+
+		if (!read_sized_uint(argv[ARG_REVISION], &revision,
+				sizeof(sim.revision))) {
+			fprintf(stderr, "Could not parse '%s'\n",
+					argv[ARG_REVISION]);
+			usage(stderr, argv);
+			return EXIT_FAILURE;
+		}
+		sim.revision = revision;
+	}
+
+	for (unsigned i = 0; i < BL_ACQ_SOURCE_MAX; i++) {
+		sim.source[i].sw_oversample = 1;
+	}
+
+	if (!bl_sig_init()) {
+		return EXIT_FAILURE;
+	}
+
+	return simulate(&sim);
+}
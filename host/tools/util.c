@@ -54,3 +54,19 @@ bool read_sized_uint(const char *value, uint32_t *out, size_t target_size)
 	*out = (uint32_t)temp;
 	return true;
 }
+
+bool read_double(const char *value, double *out)
+{
+	double temp;
+	char *end = NULL;
+
+	errno = 0;
+	temp = strtod(value, &end);
+
+	if (end == value || *end != '\0' || errno == ERANGE) {
+		return false;
+	}
+
+	*out = temp;
+	return true;
+}
@@ -22,4 +22,6 @@
 
 bool read_sized_uint(const char *value, uint32_t *out, size_t target_size);
 
+bool read_double(const char *value, double *out);
+
 #endif
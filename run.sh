@@ -28,6 +28,36 @@ usage()
 	echo "$0 command"
 }
 
+# Print configuration messages for `bl batch`.
+# msg_led <led mask>
+msg_led()
+{
+	printf -- '- LED:\n    LED Mask: 0x%x\n' "$1"
+}
+
+# msg_srccfg <source> <gain> <offset> <sw oversample> [hw oversample] [hw shift]
+msg_srccfg()
+{
+	printf -- '- Source Config:\n'
+	printf -- '    Source: %u\n' "$1"
+	printf -- '    Op-Amp Gain: %u\n' "$2"
+	printf -- '    Op-Amp Offset: %u\n' "$3"
+	printf -- '    Software Oversample: %u\n' "$4"
+	printf -- '    Hardware Oversample: %u\n' "${5:-0}"
+	printf -- '    Hardware Shift: %u\n' "${6:-0}"
+}
+
+# msg_chancfg <channel> <source> [offset] [shift] [sample32]
+msg_chancfg()
+{
+	printf -- '- Channel Config:\n'
+	printf -- '    Channel: %u\n' "$1"
+	printf -- '    Source: %u\n' "$2"
+	printf -- '    Shift: %u\n' "${4:-0}"
+	printf -- '    Offset: %u\n' "${3:-0}"
+	printf -- '    Sample32: %u\n' "${5:-0}"
+}
+
 # Collect 32-bit samples to be processed for calibrating the device.
 run_cal()
 {
@@ -39,39 +69,42 @@ run_cal()
 	declare frequency="${FREQUENCY:-$DEFAULT_FREQUENCY}"
 	declare oversample="${OVERSAMPLE:-$DEFAULT_OVERSAMPLE}"
 
-	# Shine the lights
-	host/build/bl led     "$device" "$led_mask"
-
-	# srccfg <source> <gain> <offset> <sw oversample> [hw oversample] [hw shift]
-	host/build/bl srccfg "$device" 0  1 0 "$oversample" 0 0 # Photodiode 1
-	host/build/bl srccfg "$device" 1  1 0 "$oversample" 0 0 # Photodiode 2
-	host/build/bl srccfg "$device" 2  1 0 "$oversample" 0 0 # Photodiode 3
-	host/build/bl srccfg "$device" 3  1 0 "$oversample" 0 0 # Photodiode 4
-	host/build/bl srccfg "$device" 4  1 0 "$oversample" 0 0 # 3.3V
-	host/build/bl srccfg "$device" 5  1 0 "$oversample" 0 0 # 5.0V
-	host/build/bl srccfg "$device" 6  1 0 "$oversample" 0 0 # Temperature
-
-	# There are 19 channels including 16 LEDs plus 3.3V, 5.0V and Temperature
-	# chancfg <channel> <source> [offset] [shift] [sample32]
-	host/build/bl chancfg "$device" 0  2  0  0  1 # Photodiode 3
-	host/build/bl chancfg "$device" 1  2  0  0  1 # Photodiode 3
-	host/build/bl chancfg "$device" 2  2  0  0  1 # Photodiode 3
-	host/build/bl chancfg "$device" 3  2  0  0  1 # Photodiode 3
-	host/build/bl chancfg "$device" 4  3  0  0  1 # Photodiode 4
-	host/build/bl chancfg "$device" 5  3  0  0  1 # Photodiode 4
-	host/build/bl chancfg "$device" 6  3  0  0  1 # Photodiode 4
-	host/build/bl chancfg "$device" 7  3  0  0  1 # Photodiode 4
-	host/build/bl chancfg "$device" 8  1  0  0  1 # Photodiode 2
-	host/build/bl chancfg "$device" 9  1  0  0  1 # Photodiode 2
-	host/build/bl chancfg "$device" 10 1  0  0  1 # Photodiode 2
-	host/build/bl chancfg "$device" 11 1  0  0  1 # Photodiode 2
-	host/build/bl chancfg "$device" 12 0  0  0  1 # Photodiode 1
-	host/build/bl chancfg "$device" 13 0  0  0  1 # Photodiode 1
-	host/build/bl chancfg "$device" 14 0  0  0  1 # Photodiode 1
-	host/build/bl chancfg "$device" 15 0  0  0  1 # Photodiode 1
-	host/build/bl chancfg "$device" 16 4  0  0  1 # 3.3V
-	host/build/bl chancfg "$device" 17 5  0  0  1 # 5.0V
-	host/build/bl chancfg "$device" 18 6  0  0  1 # Temperature
+	# Configure the device in one go.
+	{
+		# Shine the lights
+		msg_led "$led_mask"
+
+		# srccfg <source> <gain> <offset> <sw oversample> [hw oversample] [hw shift]
+		msg_srccfg 0  1 0 "$oversample" 0 0 # Photodiode 1
+		msg_srccfg 1  1 0 "$oversample" 0 0 # Photodiode 2
+		msg_srccfg 2  1 0 "$oversample" 0 0 # Photodiode 3
+		msg_srccfg 3  1 0 "$oversample" 0 0 # Photodiode 4
+		msg_srccfg 4  1 0 "$oversample" 0 0 # 3.3V
+		msg_srccfg 5  1 0 "$oversample" 0 0 # 5.0V
+		msg_srccfg 6  1 0 "$oversample" 0 0 # Temperature
+
+		# There are 19 channels including 16 LEDs plus 3.3V, 5.0V and Temperature
+		# chancfg <channel> <source> [offset] [shift] [sample32]
+		msg_chancfg 0  2  0  0  1 # Photodiode 3
+		msg_chancfg 1  2  0  0  1 # Photodiode 3
+		msg_chancfg 2  2  0  0  1 # Photodiode 3
+		msg_chancfg 3  2  0  0  1 # Photodiode 3
+		msg_chancfg 4  3  0  0  1 # Photodiode 4
+		msg_chancfg 5  3  0  0  1 # Photodiode 4
+		msg_chancfg 6  3  0  0  1 # Photodiode 4
+		msg_chancfg 7  3  0  0  1 # Photodiode 4
+		msg_chancfg 8  1  0  0  1 # Photodiode 2
+		msg_chancfg 9  1  0  0  1 # Photodiode 2
+		msg_chancfg 10 1  0  0  1 # Photodiode 2
+		msg_chancfg 11 1  0  0  1 # Photodiode 2
+		msg_chancfg 12 0  0  0  1 # Photodiode 1
+		msg_chancfg 13 0  0  0  1 # Photodiode 1
+		msg_chancfg 14 0  0  0  1 # Photodiode 1
+		msg_chancfg 15 0  0  0  1 # Photodiode 1
+		msg_chancfg 16 4  0  0  1 # 3.3V
+		msg_chancfg 17 5  0  0  1 # 5.0V
+		msg_chancfg 18 6  0  0  1 # Temperature
+	} | host/build/bl batch "$device"
 
 	# Start the calibration acquisition.
 	host/build/bl start   "$device" "$mode" "$detection" "$frequency" "$src_mask" "$led_mask"
@@ -86,29 +119,32 @@ run_acq()
 	declare frequency="${FREQUENCY:-$DEFAULT_FREQUENCY}"
 	declare oversample="${OVERSAMPLE:-$DEFAULT_OVERSAMPLE}"
 
-	# Shine the lights
-	host/build/bl led     "$device" "$led_mask"
-
-	# srccfg <source> <gain> <offset> <sw oversample> [hw oversample] [hw shift]
-	host/build/bl srccfg "$device" 0 16 0 "$oversample" 0 0 # Photodiode 1
-	host/build/bl srccfg "$device" 1  1 0 "$oversample" 0 0 # Photodiode 2
-	host/build/bl srccfg "$device" 2  1 0 "$oversample" 0 0 # Photodiode 3
-	host/build/bl srccfg "$device" 3  1 0 "$oversample" 0 0 # Photodiode 4
-	host/build/bl srccfg "$device" 4  1 0 "$oversample" 0 0 # 3.3V
-	host/build/bl srccfg "$device" 5  1 0 "$oversample" 0 0 # 5.0V
-	host/build/bl srccfg "$device" 6  1 0 "$oversample" 0 0 # Temperature
-
-	# TODO: this chancfg table has to change to be similar to the one
-	# in run_cal, but I've no idea where do those shift values come
-	# from, so leave it for now.
-	# chancfg <channel> <source> [offset] [shift] [sample32]
-	host/build/bl chancfg "$device" 0 0 1264480 0 # Photodiode 1
-	host/build/bl chancfg "$device" 1 1   54879 0 # Photodiode 2
-	host/build/bl chancfg "$device" 2 2  567447 0 # Photodiode 3
-	host/build/bl chancfg "$device" 3 3       0 0 # Photodiode 4
-	host/build/bl chancfg "$device" 4 4 1038856 0 # 3.3V
-	host/build/bl chancfg "$device" 5 5 1031704 0 # 5.0V
-	host/build/bl chancfg "$device" 6 6  860701 0 # Temperature
+	# Configure the device in one go.
+	{
+		# Shine the lights
+		msg_led "$led_mask"
+
+		# srccfg <source> <gain> <offset> <sw oversample> [hw oversample] [hw shift]
+		msg_srccfg 0 16 0 "$oversample" 0 0 # Photodiode 1
+		msg_srccfg 1  1 0 "$oversample" 0 0 # Photodiode 2
+		msg_srccfg 2  1 0 "$oversample" 0 0 # Photodiode 3
+		msg_srccfg 3  1 0 "$oversample" 0 0 # Photodiode 4
+		msg_srccfg 4  1 0 "$oversample" 0 0 # 3.3V
+		msg_srccfg 5  1 0 "$oversample" 0 0 # 5.0V
+		msg_srccfg 6  1 0 "$oversample" 0 0 # Temperature
+
+		# TODO: this chancfg table has to change to be similar to the one
+		# in run_cal, but I've no idea where do those shift values come
+		# from, so leave it for now.
+		# chancfg <channel> <source> [offset] [shift] [sample32]
+		msg_chancfg 0 0 1264480 0 # Photodiode 1
+		msg_chancfg 1 1   54879 0 # Photodiode 2
+		msg_chancfg 2 2  567447 0 # Photodiode 3
+		msg_chancfg 3 3       0 0 # Photodiode 4
+		msg_chancfg 4 4 1038856 0 # 3.3V
+		msg_chancfg 5 5 1031704 0 # 5.0V
+		msg_chancfg 6 6  860701 0 # Temperature
+	} | host/build/bl batch "$device"
 
 	# Start the calibration acquisition.
 	host/build/bl start   "$device" "$frequency" "$src_mask" "$led_mask"